@@ -4,7 +4,8 @@
 		
 static char* useragent = "Mozilla/5.0 (X11; Linux x86_64; rv:28.0) Gecko/20100101";*/
 
-static char* home_page	=	"http://www.google.com/";
+/* Built-in page, see homepage/ */
+static char* home_page	=	"sb://home/";
 
 static char* download_dir = "/home/david/Downloads/";
 
@@ -16,5 +17,112 @@ static gboolean enableinspector = TRUE;
 static gboolean loadimages = TRUE;
 static gboolean enablespellchecking = TRUE;
 static gboolean hidebackground  = FALSE;
+static gboolean enablesmoothscrolling = FALSE;
 static gboolean fullcontentzoom = TRUE;
 static gboolean openinbackground = FALSE;
+
+/* Find bar - delay after typing before searching (ms), max number of matches to highlight, matches highlighted in the first slice (doubled in each next one), and text nodes counted per slice */
+static guint find_delay = 150;
+static guint find_highlight_limit = 1000;
+static guint find_mark_batch = 50;
+static guint find_count_batch = 200;
+
+/* Cookies - database in the sb data directory, seconds between batched writes and between purges of expired cookies, and times a write is retried while another process holds the database, ms apart */
+static char* cookie_file = "cookies.db";
+static guint cookie_flush_interval = 5;
+static guint cookie_purge_interval = 600;
+static guint cookie_busy_retries = 20;
+static guint cookie_busy_delay = 50;
+
+/* Tabs - width of tab labels (characters), and the number of tabs beyond which the tab strip is hidden (use View > Tabs...) */
+static gint tab_label_width = 20;
+static guint tab_strip_limit = 40;
+
+/* Favicons - bytes of decoded icons kept in memory, and the number of pages whose icon is remembered */
+static gsize favicon_cache_size = 1024 * 1024;
+static guint favicon_page_limit = 10000;
+
+/* Prerendering of a likely next page - hover time before a link counts (ms), hidden views at once, resident memory ceiling (kB) and load time allowed (s) */
+static gboolean enableprerender = TRUE;
+static guint prerender_hover_delay = 500;
+static guint prerender_limit = 1;
+static glong prerender_memory_limit = 512 * 1024;
+static guint prerender_timeout = 10;
+
+/* Batch rendering (--render) - page size in pixels, views per worker process, seconds allowed per page */
+static gint render_width = 1280;
+static gint render_height = 1024;
+static guint render_pool_size = 2;
+static gint render_timeout = 30;
+
+/* Large local files - size above which files are paged through sb://file, bytes per page, lines between index entries, files kept open, bytes searched between checks that the page is still wanted, and bytes read at a time to index lines */
+static goffset large_file_size = 16 * 1024 * 1024;
+static gsize text_page_size = 256 * 1024;
+static guint text_line_stride = 1024;
+static guint text_file_limit = 4;
+static gsize text_search_chunk = 16 * 1024 * 1024;
+static gsize text_read_size = 1024 * 1024;
+
+/* Jank monitor (--jank) - shortest main loop stall reported (ms) */
+static gint jank_threshold = 50;
+
+/* Scroll benchmark (--bench-scroll) - ms between scroll steps, pixels per step, window size */
+static guint bench_scroll_interval = 16;
+static guint bench_scroll_step = 40;
+static gint bench_scroll_width = 1024;
+static gint bench_scroll_height = 768;
+
+/* Tab churn soak (--soak) - cycles between memory samples, and the growth (percent) still counted as a plateau */
+static gint soak_sample_interval = 50;
+static gdouble soak_growth_limit = 10;
+
+/* Network replay (--replay) - ms between the parts of a body sent under --bandwidth */
+static guint replay_interval = 10;
+
+/* Renderer processes (--tab-processes) - seconds between pings, without an answer before tabs count as not responding, and bytes left unread by a renderer that count the same */
+static guint renderer_ping_interval = 2;
+static guint renderer_hang_timeout = 6;
+static gsize renderer_queue_limit = 1024 * 1024;
+
+/* Full-text tab search - bytes of text indexed per page, memory for the whole index, bytes fed to it per idle call, and text matches considered */
+static gsize tab_index_page_limit = 512 * 1024;
+static gsize tab_index_memory_limit = 16 * 1024 * 1024;
+static gsize tab_index_chunk = 32 * 1024;
+static guint tab_index_hits = 50;
+
+/* History search (sb://history/) - index directory in the sb data directory, bytes of text indexed per page, pages per segment, segments before the smallest are merged, seconds between writes of a partial segment, and results shown */
+static char* history_index_dir = "history-index";
+static gsize history_index_page_limit = 64 * 1024;
+static guint history_index_flush_pages = 64;
+static guint history_index_merge_segments = 8;
+static guint history_index_flush_interval = 60;
+static guint history_index_results = 50;
+
+/* Site storage - directory in the profile for web databases and local storage, web database quota per origin, and application cache size (bytes) */
+static char* storage_dir = "storage";
+static guint64 storage_database_quota = 50 * 1024 * 1024;
+static guint64 storage_appcache_size = 256 * 1024 * 1024;
+
+/* Kiosk (--kiosk) - default seconds each page is shown and between checks for a new version, seconds between memory checks, resident memory (MB) before views are rebuilt, and seconds at least between rebuilds */
+static guint kiosk_dwell = 30;
+static guint kiosk_refresh = 60;
+static guint kiosk_watchdog_interval = 60;
+static glong kiosk_memory_limit = 1024;
+static guint kiosk_rebuild_cooldown = 600;
+
+/* Flight recorder - events kept (16 bytes each), files in the sb data directory for recordings and crashes, ms between heartbeats, shortest stall noted (ms), and seconds between memory samples */
+static guint flight_events = 64 * 1024;
+static char* flight_file = "flight.sbfr";
+static char* flight_crash_file = "flight-crash.sbfr";
+static guint flight_beat_interval = 100;
+static gint64 flight_stall_threshold = 250;
+static guint flight_memory_interval = 10;
+
+/* Background I/O - ms a file write waits for more writes, so a burst of them goes out as one batch */
+static guint io_write_delay = 500;
+
+/* Lite mode (View > Lite Mode) - stylesheet for pages loaded without scripts, plugins, fonts and other sites' stylesheets */
+static char* lite_stylesheet = "body { max-width: 45em !important; margin: 0 auto !important; padding: 0 1em !important; "
+	"font: 16px/1.5 serif !important; color: #222 !important; background: #fff !important } "
+	"pre, code { font-family: monospace !important; white-space: pre-wrap !important } "
+	"img, video, iframe { max-width: 100% !important; height: auto !important }";
@@ -0,0 +1,177 @@
+/*
+ * sb - simple browser
+ *
+ * Flight recorder - see flight.h. A dump is a FlightHeader followed by the
+ * whole ring; the header's head says which slot is the oldest.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+#define FLIGHT_MAGIC "SBFR"
+#define FLIGHT_VERSION 1
+
+/* type | arg << 8 | tab << 16, written last - 0 while the slot is written */
+typedef struct FlightEvent {
+	gint64 time;
+	guint32 value;
+	guint32 kind;
+} FlightEvent;
+
+typedef struct FlightHeader {
+	gchar magic[4];
+	guint32 version;
+	guint32 size;
+	guint32 head;
+	gint64 clock;	/* wall clock minus monotonic time, in us */
+} FlightHeader;
+
+static FlightEvent* flight_events = NULL;
+static guint flight_mask = 0;
+static guint flight_head = 0;
+
+static const gchar* flight_names[FLIGHT_TYPES] = {
+	"-", "start", "load", "tab open", "tab close", "download", "stall", "memory",
+};
+
+static const gchar* flight_load_names[] = {
+	"provisional", "committed", "finished", "first layout", "failed",
+};
+
+static const gchar* flight_download_names[] = {
+	"started", "finished", "failed", "cancelled",
+};
+
+void
+flight_init (guint size)
+{
+	guint n = 1;
+	
+	while (n < size)
+		n <<= 1;
+	flight_events = g_new0 (FlightEvent, n);
+	flight_mask = n - 1;
+}
+
+void
+flight_record (FlightType type, guint arg, guint tab, guint32 value)
+{
+	FlightEvent* e;
+	
+	if (!flight_events)
+		return;
+	/* Ordering is only needed between a slot's fields - plain stores on x86 */
+	e = &flight_events[__atomic_fetch_add (&flight_head, 1, __ATOMIC_RELAXED) & flight_mask];
+	__atomic_store_n (&e->kind, 0, __ATOMIC_RELAXED);
+	e->time = g_get_monotonic_time ();
+	e->value = value;
+	__atomic_store_n (&e->kind, type | (arg & 0xff) << 8 | (tab & 0xffff) << 16, __ATOMIC_RELEASE);
+}
+
+gboolean
+flight_dump (const gchar* path)
+{
+	FlightHeader header;
+	gsize length = (flight_mask + 1) * sizeof (FlightEvent);
+	gboolean ok;
+	int fd;
+	
+	if (!flight_events || (fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+		return FALSE;
+	
+	memcpy (header.magic, FLIGHT_MAGIC, 4);
+	header.version = FLIGHT_VERSION;
+	header.size = flight_mask + 1;
+	header.head = __atomic_load_n (&flight_head, __ATOMIC_RELAXED);
+	header.clock = g_get_real_time () - g_get_monotonic_time ();
+	
+	ok = write (fd, &header, sizeof header) == sizeof header && write (fd, flight_events, length) == (gssize) length;
+	return close (fd) == 0 && ok;
+}
+
+static void
+flight_print (FILE* out, const FlightEvent* e, gint64 clock, gint64 previous)
+{
+	guint type = e->kind & 0xff, arg = (e->kind >> 8) & 0xff, tab = e->kind >> 16;
+	time_t seconds = (e->time + clock) / G_USEC_PER_SEC;
+	struct tm tm;
+	gchar stamp[32];
+	
+	localtime_r (&seconds, &tm);
+	strftime (stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S", &tm);
+	fprintf (out, "%s.%03d %+10.3f ms  ", stamp, (gint) ((e->time + clock) % G_USEC_PER_SEC / 1000),
+			 previous ? (e->time - previous) / 1000.0 : 0.0);
+	if (tab)
+		fprintf (out, "tab %-5u ", tab);
+	else
+		fprintf (out, "          ");
+	fprintf (out, "%s", type < FLIGHT_TYPES ? flight_names[type] : "unknown");
+	
+	switch (type)
+	{
+		case FLIGHT_START:
+			fprintf (out, " (pid %u)", e->value);
+			break;
+		case FLIGHT_LOAD:
+			fprintf (out, " %s", arg < G_N_ELEMENTS (flight_load_names) ? flight_load_names[arg] : "?");
+			break;
+		case FLIGHT_DOWNLOAD:
+			fprintf (out, " %s, %u kB", arg < G_N_ELEMENTS (flight_download_names) ? flight_download_names[arg] : "?", e->value);
+			break;
+		case FLIGHT_STALL:
+			fprintf (out, " %u ms", e->value);
+			break;
+		case FLIGHT_MEMORY:
+			fprintf (out, " %u kB resident", e->value);
+			break;
+		default:
+			break;
+	}
+	fprintf (out, "\n");
+}
+
+gboolean
+flight_decode (const gchar* path, FILE* out, GError** error)
+{
+	gchar* contents;
+	gsize length;
+	const FlightHeader* header;
+	const FlightEvent* events;
+	guint32 i, count;
+	gint64 previous = 0;
+	
+	if (!g_file_get_contents (path, &contents, &length, error))
+		return FALSE;
+	
+	header = (const FlightHeader*) contents;
+	if (length < sizeof (FlightHeader) || memcmp (header->magic, FLIGHT_MAGIC, 4) != 0 || header->version != FLIGHT_VERSION
+		|| header->size == 0 || (header->size & (header->size - 1))
+		|| length != sizeof (FlightHeader) + (gsize) header->size * sizeof (FlightEvent))
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a flight recording", path);
+		g_free (contents);
+		return FALSE;
+	}
+	
+	/* Slots are taken in order, so the oldest is the one after the newest */
+	events = (const FlightEvent*) (contents + sizeof (FlightHeader));
+	count = MIN (header->head, header->size);
+	for (i = header->head - count; i != header->head; i++)
+	{
+		const FlightEvent* e = &events[i & (header->size - 1)];
+		
+		if ((e->kind & 0xff) == FLIGHT_NONE)
+			continue;
+		flight_print (out, e, header->clock, previous);
+		previous = e->time;
+	}
+	
+	g_free (contents);
+	return TRUE;
+}
@@ -0,0 +1,57 @@
+/*
+ * sb - simple browser
+ *
+ * Flight recorder - a fixed ring of small binary events, always recording,
+ * written out when something went wrong.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <glib.h>
+#include <stdio.h>
+
+typedef enum {
+	FLIGHT_NONE,
+	FLIGHT_START,		/* value: process id */
+	FLIGHT_LOAD,		/* arg: WebKitLoadStatus */
+	FLIGHT_TAB_OPEN,
+	FLIGHT_TAB_CLOSE,
+	FLIGHT_DOWNLOAD,	/* arg: FlightDownload, value: kB so far */
+	FLIGHT_STALL,		/* value: ms the main loop did not run */
+	FLIGHT_MEMORY,		/* value: resident kB */
+	FLIGHT_TYPES
+} FlightType;
+
+typedef enum {
+	FLIGHT_DOWNLOAD_STARTED,
+	FLIGHT_DOWNLOAD_FINISHED,
+	FLIGHT_DOWNLOAD_FAILED,
+	FLIGHT_DOWNLOAD_CANCELLED
+} FlightDownload;
+
+/*
+ * Start recording into a ring of size events (rounded up to a power of two,
+ * 16 bytes each) - until then, events are dropped
+ */
+void flight_init (guint size);
+
+/*
+ * Record an event for tab (0 for none; tab numbers wrap at 65536). Lock-free
+ * and safe from any thread: a slot is taken with one atomic add, and a slot
+ * still being written when the ring is dumped reads as empty.
+ */
+void flight_record (FlightType type, guint arg, guint tab, guint32 value);
+
+/*
+ * Write the ring to path. Only open, write and close are used, so this is
+ * safe in a signal handler.
+ */
+gboolean flight_dump (const gchar* path);
+
+/* Print a dump as a timeline, oldest event first */
+gboolean flight_decode (const gchar* path, FILE* out, GError** error);
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * sb - simple browser
+ *
+ * sb-flight FILE - print a flight recording as a timeline. Recordings are
+ * written on SIGUSR1, on a crash, and from Tools > Save Flight Recording.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <stdio.h>
+
+#include "flight.h"
+
+int
+main (int argc, char* argv[])
+{
+	GError* error = NULL;
+	int i;
+	
+	if (argc < 2)
+	{
+		fprintf (stderr, "usage: %s FILE...\n", argv[0]);
+		return 2;
+	}
+	for (i = 1; i < argc; i++)
+	{
+		if (argc > 2)
+			printf ("%s%s:\n", i > 1 ? "\n" : "", argv[i]);
+		if (!flight_decode (argv[i], stdout, &error))
+		{
+			fprintf (stderr, "sb-flight: %s\n", error->message);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,936 @@
+/*
+ * sb - simple browser
+ *
+ * Full-text history index - see historyindex.h. Pages are split into words
+ * by a writer thread and collected in memory until there are enough of them
+ * for a segment: a file holding, for each word in sorted order, the pages
+ * containing it. Segments are never changed once written. Their numbers
+ * follow the ids of their pages: a new segment takes the next number, and a
+ * merge of neighbouring segments the number of the first. The writer merges
+ * them as they pile up, keeping only the latest visit of each page, and
+ * searches look the words up in the memory maps of all segments.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <glib/gstdio.h>
+
+#include "textindex.h"
+#include "historyindex.h"
+
+#define SEGMENT_MAGIC "SBIX"
+#define SEGMENT_VERSION 1
+
+/* BM25 ranking constants */
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+/*
+ * A segment file: this header, the postings, the strings, the page table and
+ * the word table. Postings are varint (page - previous page, count) pairs,
+ * where pages are indexes into the page table.
+ */
+typedef struct SegmentHeader {
+	gchar magic[4];
+	guint32 version;
+	guint32 pages;
+	guint32 words;
+	guint64 length;			/* words in all pages */
+	guint32 postings, strings, page_table, word_table;
+} SegmentHeader;
+
+typedef struct SegmentPage {
+	guint32 id;
+	guint32 length;
+	gint64 time;
+	guint32 uri, title;		/* offsets into the strings */
+} SegmentPage;
+
+typedef struct SegmentWord {
+	guint32 word;			/* offset into the strings */
+	guint32 postings, size;	/* offset and size of its postings */
+	guint32 pages;
+} SegmentWord;
+
+typedef struct Segment {
+	gint refs;
+	guint number;
+	gchar* path;
+	GMappedFile* file;
+	const SegmentHeader* header;
+	const guint8* postings;
+	const gchar* strings;
+	const SegmentPage* pages;
+	const SegmentWord* words;
+} Segment;
+
+/* Writes a segment file from the front - the tables follow the postings */
+typedef struct SegmentWriter {
+	FILE* file;
+	gchar *path, *temporary;
+	guint64 offset;
+	GString* strings;
+	GArray *pages, *words;
+	guint64 length;
+} SegmentWriter;
+
+/* A visited page, on its way to the writer */
+typedef struct HistoryTask {
+	gchar *uri, *title, *text;
+	gsize length;
+	gint64 time;
+	guint32 words;
+} HistoryTask;
+
+/* The pages containing a word, among those not yet written */
+typedef struct Pending {
+	GByteArray* data;
+	guint32 last, pages;
+} Pending;
+
+struct HistoryIndex {
+	gchar* dir;
+	guint flush_pages, merge_segments;
+	GThreadPool* pool;
+	
+	/* Shared with searches */
+	GMutex lock;
+	GPtrArray* segments;
+	
+	/* Writer thread only */
+	guint next_number;
+	guint32 next_id;
+	GHashTable* pending;
+	GPtrArray* pending_pages;
+};
+
+/* A page matching a search */
+typedef struct Candidate {
+	Segment* segment;
+	guint32 page;
+	gdouble score;
+} Candidate;
+
+static HistoryTask flush_task;
+
+static void
+put_varint (GByteArray* data, guint32 value)
+{
+	guint8 byte;
+	
+	while (value >= 0x80)
+	{
+		byte = (value & 0x7f) | 0x80;
+		g_byte_array_append (data, &byte, 1);
+		value >>= 7;
+	}
+	byte = value;
+	g_byte_array_append (data, &byte, 1);
+}
+
+static guint32
+get_varint (const guint8** p, const guint8* end)
+{
+	guint32 value = 0, shift = 0;
+	
+	while (*p < end)
+	{
+		guint8 byte = *(*p)++;
+		value |= (guint32) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
+		shift += 7;
+	}
+	return value;
+}
+
+static void
+history_task_free (HistoryTask* task)
+{
+	g_free (task->uri);
+	g_free (task->title);
+	g_free (task->text);
+	g_free (task);
+}
+
+static void
+pending_free (Pending* pending)
+{
+	g_byte_array_free (pending->data, TRUE);
+	g_free (pending);
+}
+
+static Segment*
+segment_ref (Segment* segment)
+{
+	g_atomic_int_inc (&segment->refs);
+	return segment;
+}
+
+static void
+segment_unref (Segment* segment)
+{
+	if (!g_atomic_int_dec_and_test (&segment->refs))
+		return;
+	g_mapped_file_unref (segment->file);
+	g_free (segment->path);
+	g_free (segment);
+}
+
+static gchar*
+segment_path (HistoryIndex* index, guint number)
+{
+	gchar* name = g_strdup_printf ("%08x.seg", number);
+	gchar* path = g_build_filename (index->dir, name, NULL);
+	g_free (name);
+	return path;
+}
+
+/*
+ * Map a segment file, checking that its tables lie within it
+ */
+static Segment*
+segment_open (const gchar* path, guint number)
+{
+	GMappedFile* file = g_mapped_file_new (path, FALSE, NULL);
+	const SegmentHeader* header;
+	Segment* segment;
+	gsize size;
+	
+	if (!file)
+		return NULL;
+	
+	size = g_mapped_file_get_length (file);
+	header = (const SegmentHeader*) g_mapped_file_get_contents (file);
+	if (size < sizeof (SegmentHeader) || memcmp (header->magic, SEGMENT_MAGIC, 4) != 0 || header->version != SEGMENT_VERSION
+		|| header->postings > header->strings || header->strings > header->page_table
+		|| header->page_table + (guint64) header->pages * sizeof (SegmentPage) > header->word_table
+		|| header->word_table + (guint64) header->words * sizeof (SegmentWord) > size)
+	{
+		g_mapped_file_unref (file);
+		return NULL;
+	}
+	
+	segment = g_new0 (Segment, 1);
+	segment->refs = 1;
+	segment->number = number;
+	segment->path = g_strdup (path);
+	segment->file = file;
+	segment->header = header;
+	segment->postings = (const guint8*) header + header->postings;
+	segment->strings = (const gchar*) header + header->strings;
+	segment->pages = (const SegmentPage*) ((const gchar*) header + header->page_table);
+	segment->words = (const SegmentWord*) ((const gchar*) header + header->word_table);
+	return segment;
+}
+
+static const gchar*
+segment_word (Segment* segment, guint i)
+{
+	return segment->strings + segment->words[i].word;
+}
+
+/*
+ * The entries of the word table for word - or for every word starting with
+ * it - as the range [*first, *last)
+ */
+static void
+segment_find (Segment* segment, const gchar* word, gboolean prefix, guint* first, guint* last)
+{
+	guint low = 0, high = segment->header->words;
+	gsize length = strlen (word);
+	
+	while (low < high)
+	{
+		guint middle = low + (high - low) / 2;
+		if (strcmp (segment_word (segment, middle), word) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	
+	*first = high = low;
+	while (high < segment->header->words && (prefix ? strncmp (segment_word (segment, high), word, length) == 0
+											 : strcmp (segment_word (segment, high), word) == 0))
+		high++;
+	*last = high;
+}
+
+/* The postings of a word table entry, as [*p, *end) */
+static gboolean
+segment_postings (Segment* segment, guint i, const guint8** p, const guint8** end)
+{
+	const SegmentWord* word = &segment->words[i];
+	
+	if ((guint64) word->postings + word->size > segment->header->strings - segment->header->postings)
+		return FALSE;
+	*p = segment->postings + word->postings;
+	*end = *p + word->size;
+	return TRUE;
+}
+
+static SegmentWriter*
+segment_writer_new (const gchar* path)
+{
+	SegmentWriter* writer = g_new0 (SegmentWriter, 1);
+	SegmentHeader header = {{0}};
+	
+	writer->path = g_strdup (path);
+	writer->temporary = g_strconcat (path, ".tmp", NULL);
+	if (!(writer->file = fopen (writer->temporary, "wb")))
+	{
+		g_free (writer->temporary);
+		g_free (writer->path);
+		g_free (writer);
+		return NULL;
+	}
+	
+	/* Filled in at the end */
+	fwrite (&header, sizeof (header), 1, writer->file);
+	writer->strings = g_string_new (NULL);
+	writer->pages = g_array_new (FALSE, FALSE, sizeof (SegmentPage));
+	writer->words = g_array_new (FALSE, FALSE, sizeof (SegmentWord));
+	return writer;
+}
+
+static void
+segment_writer_page (SegmentWriter* writer, guint32 id, guint32 length, gint64 time, const gchar* uri, const gchar* title)
+{
+	SegmentPage page = {id, length, time, 0, 0};
+	
+	page.uri = writer->strings->len;
+	g_string_append_len (writer->strings, uri, strlen (uri) + 1);
+	page.title = writer->strings->len;
+	g_string_append_len (writer->strings, title ? title : "", title ? strlen (title) + 1 : 1);
+	g_array_append_val (writer->pages, page);
+	writer->length += length;
+}
+
+/* Words must come in sorted order */
+static void
+segment_writer_word (SegmentWriter* writer, const gchar* word, const guint8* postings, gsize size, guint32 pages)
+{
+	SegmentWord entry = {writer->strings->len, writer->offset, size, pages};
+	
+	g_string_append_len (writer->strings, word, strlen (word) + 1);
+	fwrite (postings, 1, size, writer->file);
+	writer->offset += size;
+	g_array_append_val (writer->words, entry);
+}
+
+/*
+ * Write the tables and the header, and move the file into place. The writer
+ * is freed either way.
+ */
+static gboolean
+segment_writer_finish (SegmentWriter* writer)
+{
+	SegmentHeader header;
+	static const gchar padding[8];
+	gboolean ok;
+	
+	memcpy (header.magic, SEGMENT_MAGIC, 4);
+	header.version = SEGMENT_VERSION;
+	header.pages = writer->pages->len;
+	header.words = writer->words->len;
+	header.length = writer->length;
+	header.postings = sizeof (SegmentHeader);
+	header.strings = header.postings + writer->offset;
+	
+	/* The page table holds 64 bit times */
+	guint64 page_table = (header.strings + writer->strings->len + 7) & ~(guint64) 7;
+	guint64 end = page_table + writer->pages->len * sizeof (SegmentPage) + writer->words->len * sizeof (SegmentWord);
+	header.page_table = page_table;
+	header.word_table = page_table + writer->pages->len * sizeof (SegmentPage);
+	
+	fwrite (writer->strings->str, 1, writer->strings->len, writer->file);
+	fwrite (padding, 1, page_table - (header.strings + writer->strings->len), writer->file);
+	fwrite (writer->pages->data, sizeof (SegmentPage), writer->pages->len, writer->file);
+	fwrite (writer->words->data, sizeof (SegmentWord), writer->words->len, writer->file);
+	fseek (writer->file, 0, SEEK_SET);
+	fwrite (&header, sizeof (header), 1, writer->file);
+	
+	ok = end <= G_MAXUINT32 && !ferror (writer->file);
+	ok &= fclose (writer->file) == 0;
+	if (ok)
+		ok = g_rename (writer->temporary, writer->path) == 0;
+	if (!ok)
+	{
+		fprintf (stderr, "Cannot write history index segment %s\n", writer->path);
+		g_unlink (writer->temporary);
+	}
+	
+	g_string_free (writer->strings, TRUE);
+	g_array_free (writer->pages, TRUE);
+	g_array_free (writer->words, TRUE);
+	g_free (writer->temporary);
+	g_free (writer->path);
+	g_free (writer);
+	return ok;
+}
+
+static gint
+segment_number_compare (gconstpointer a, gconstpointer b)
+{
+	const Segment *x = *(Segment**) a, *y = *(Segment**) b;
+	return x->number < y->number ? -1 : x->number > y->number;
+}
+
+/*
+ * Put a segment written by the writer in the place of those it replaces -
+ * or after all others, for a new one - keeping the segments in number order
+ */
+static void
+history_index_replace (HistoryIndex* index, GPtrArray* inputs, const gchar* path, guint number)
+{
+	Segment* segment = segment_open (path, number);
+	guint i, position;
+	
+	g_mutex_lock (&index->lock);
+	position = index->segments->len;
+	for (i = 0; inputs && i < index->segments->len; )
+	{
+		Segment* old = g_ptr_array_index (index->segments, i);
+		guint j;
+		
+		for (j = 0; j < inputs->len && g_ptr_array_index (inputs, j) != old; j++)
+			;
+		if (j == inputs->len)
+			i++;
+		else
+		{
+			position = MIN (position, i);
+			g_ptr_array_remove_index (index->segments, i);
+		}
+	}
+	if (segment)
+		g_ptr_array_insert (index->segments, MIN (position, index->segments->len), segment);
+	g_mutex_unlock (&index->lock);
+	
+	/* Searches still running keep their maps of the old files */
+	for (i = 0; inputs && i < inputs->len; i++)
+		if (strcmp (((Segment*) g_ptr_array_index (inputs, i))->path, path) != 0)
+			g_unlink (((Segment*) g_ptr_array_index (inputs, i))->path);
+}
+
+/*
+ * Write neighbouring segments as one, in the place of the first. Taking them
+ * in number order keeps the postings of each word in page order.
+ */
+static void
+history_index_merge_segments (HistoryIndex* index, GPtrArray* inputs)
+{
+	GHashTable* latest = g_hash_table_new (g_str_hash, g_str_equal);
+	GByteArray* data = g_byte_array_new ();
+	guint number = ((Segment*) g_ptr_array_index (inputs, 0))->number;
+	gchar* path = segment_path (index, number);
+	SegmentWriter* writer = segment_writer_new (path);
+	guint32** map;
+	guint *position, i, j, kept = 0;
+	
+	if (!writer)
+	{
+		g_free (path);
+		return;
+	}
+	
+	/* Only the latest visit of a page - the one with the highest id - is kept */
+	for (i = 0; i < inputs->len; i++)
+	{
+		Segment* segment = g_ptr_array_index (inputs, i);
+		for (j = 0; j < segment->header->pages; j++)
+		{
+			const gchar* uri = segment->strings + segment->pages[j].uri;
+			if (segment->pages[j].id > GPOINTER_TO_UINT (g_hash_table_lookup (latest, uri)))
+				g_hash_table_insert (latest, (gpointer) uri, GUINT_TO_POINTER (segment->pages[j].id));
+		}
+	}
+	map = g_new (guint32*, inputs->len);
+	for (i = 0; i < inputs->len; i++)
+	{
+		Segment* segment = g_ptr_array_index (inputs, i);
+		map[i] = g_new (guint32, segment->header->pages);
+		for (j = 0; j < segment->header->pages; j++)
+		{
+			const SegmentPage* page = &segment->pages[j];
+			const gchar* uri = segment->strings + page->uri;
+			
+			if (GPOINTER_TO_UINT (g_hash_table_lookup (latest, uri)) != page->id)
+			{
+				map[i][j] = G_MAXUINT32;
+				continue;
+			}
+			/* Once - a merge cut short can leave a page in two segments; ids start at 1 */
+			g_hash_table_insert (latest, (gpointer) uri, GUINT_TO_POINTER (0));
+			map[i][j] = kept++;
+			segment_writer_page (writer, page->id, page->length, page->time, uri, segment->strings + page->title);
+		}
+	}
+	
+	/* Merge the sorted word tables */
+	position = g_new0 (guint, inputs->len);
+	for (;;)
+	{
+		const gchar* word = NULL;
+		guint32 last = 0, pages = 0, page;
+		
+		for (i = 0; i < inputs->len; i++)
+		{
+			Segment* segment = g_ptr_array_index (inputs, i);
+			if (position[i] < segment->header->words && (!word || strcmp (segment_word (segment, position[i]), word) < 0))
+				word = segment_word (segment, position[i]);
+		}
+		if (!word)
+			break;
+		
+		g_byte_array_set_size (data, 0);
+		for (i = 0; i < inputs->len; i++)
+		{
+			Segment* segment = g_ptr_array_index (inputs, i);
+			const guint8 *p, *end;
+			
+			if (position[i] >= segment->header->words || strcmp (segment_word (segment, position[i]), word) != 0)
+				continue;
+			page = 0;
+			if (segment_postings (segment, position[i], &p, &end))
+			{
+				while (p < end)
+				{
+					page += get_varint (&p, end);
+					guint32 count = get_varint (&p, end);
+					
+					if (page >= segment->header->pages || map[i][page] == G_MAXUINT32)
+						continue;
+					put_varint (data, map[i][page] - last);
+					put_varint (data, count);
+					last = map[i][page];
+					pages++;
+				}
+			}
+			position[i]++;
+		}
+		if (pages > 0)
+			segment_writer_word (writer, word, data->data, data->len, pages);
+	}
+	
+	if (segment_writer_finish (writer))
+		history_index_replace (index, inputs, path, number);
+	
+	for (i = 0; i < inputs->len; i++)
+		g_free (map[i]);
+	g_free (map);
+	g_free (position);
+	g_free (path);
+	g_byte_array_free (data, TRUE);
+	g_hash_table_destroy (latest);
+}
+
+/*
+ * Once there are more than merge_segments segments, merge the run of
+ * merge_segments neighbours with the fewest pages. Only neighbours are
+ * merged, so each segment keeps holding a range of ids of its own.
+ */
+static void
+history_index_merge (HistoryIndex* index)
+{
+	GPtrArray* inputs = g_ptr_array_new_with_free_func ((GDestroyNotify) segment_unref);
+	guint64 pages = 0, fewest = G_MAXUINT64;
+	guint i, first = 0;
+	
+	g_mutex_lock (&index->lock);
+	if (index->segments->len > index->merge_segments)
+	{
+		for (i = 0; i < index->segments->len; i++)
+		{
+			pages += ((Segment*) g_ptr_array_index (index->segments, i))->header->pages;
+			if (i >= index->merge_segments)
+				pages -= ((Segment*) g_ptr_array_index (index->segments, i - index->merge_segments))->header->pages;
+			if (i + 1 >= index->merge_segments && pages < fewest)
+			{
+				fewest = pages;
+				first = i + 1 - index->merge_segments;
+			}
+		}
+		for (i = first; i < first + index->merge_segments; i++)
+			g_ptr_array_add (inputs, segment_ref (g_ptr_array_index (index->segments, i)));
+	}
+	g_mutex_unlock (&index->lock);
+	
+	if (inputs->len > 0)
+		history_index_merge_segments (index, inputs);
+	g_ptr_array_free (inputs, TRUE);
+}
+
+static gint
+word_compare (gconstpointer a, gconstpointer b)
+{
+	return strcmp (*(const gchar**) a, *(const gchar**) b);
+}
+
+/*
+ * Write the pages collected so far as a new segment
+ */
+static void
+history_index_write_pending (HistoryIndex* index)
+{
+	GPtrArray* words;
+	SegmentWriter* writer;
+	GHashTableIter iter;
+	gpointer key;
+	guint i, number;
+	gchar* path;
+	
+	if (index->pending_pages->len == 0)
+		return;
+	
+	number = index->next_number++;
+	path = segment_path (index, number);
+	if ((writer = segment_writer_new (path)))
+	{
+		for (i = 0; i < index->pending_pages->len; i++)
+		{
+			HistoryTask* task = g_ptr_array_index (index->pending_pages, i);
+			segment_writer_page (writer, index->next_id++, task->words, task->time, task->uri, task->title);
+		}
+		
+		words = g_ptr_array_sized_new (g_hash_table_size (index->pending));
+		g_hash_table_iter_init (&iter, index->pending);
+		while (g_hash_table_iter_next (&iter, &key, NULL))
+			g_ptr_array_add (words, key);
+		g_ptr_array_sort (words, word_compare);
+		for (i = 0; i < words->len; i++)
+		{
+			Pending* pending = g_hash_table_lookup (index->pending, g_ptr_array_index (words, i));
+			segment_writer_word (writer, g_ptr_array_index (words, i), pending->data->data, pending->data->len, pending->pages);
+		}
+		g_ptr_array_free (words, TRUE);
+		
+		if (segment_writer_finish (writer))
+			history_index_replace (index, NULL, path, number);
+	}
+	g_free (path);
+	
+	g_hash_table_remove_all (index->pending);
+	g_ptr_array_set_size (index->pending_pages, 0);
+	
+	history_index_merge (index);
+}
+
+/*
+ * Count the words of a page into the pending postings
+ */
+static void
+history_index_split (HistoryIndex* index, HistoryTask* task)
+{
+	GHashTable* counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	const gchar *text = task->text, *end = text + task->length;
+	guint32 page = index->pending_pages->len;
+	gchar word[TEXT_INDEX_WORD_MAX + 1];
+	GHashTableIter iter;
+	gpointer key, value;
+	gsize length;
+	
+	while (text_index_word (&text, end, word, &length))
+	{
+		guint* count = g_hash_table_lookup (counts, word);
+		
+		if (!count)
+		{
+			count = g_new0 (guint, 1);
+			g_hash_table_insert (counts, g_strndup (word, length), count);
+		}
+		(*count)++;
+		task->words++;
+	}
+	
+	g_hash_table_iter_init (&iter, counts);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+	{
+		Pending* pending = g_hash_table_lookup (index->pending, key);
+		
+		if (!pending)
+		{
+			pending = g_new0 (Pending, 1);
+			pending->data = g_byte_array_new ();
+			g_hash_table_insert (index->pending, g_strdup (key), pending);
+		}
+		put_varint (pending->data, page - pending->last);
+		put_varint (pending->data, *(guint*) value);
+		pending->last = page;
+		pending->pages++;
+	}
+	g_hash_table_destroy (counts);
+	
+	g_free (task->text);
+	task->text = NULL;
+	g_ptr_array_add (index->pending_pages, task);
+}
+
+static void
+history_index_write_cb (gpointer data, gpointer user_data)
+{
+	HistoryIndex* index = user_data;
+	HistoryTask* task = data;
+	
+	if (task == &flush_task)
+	{
+		history_index_write_pending (index);
+		return;
+	}
+	
+	history_index_split (index, task);
+	if (index->pending_pages->len >= index->flush_pages)
+		history_index_write_pending (index);
+}
+
+HistoryIndex*
+history_index_open (const gchar* dir, guint flush_pages, guint merge_segments)
+{
+	HistoryIndex* index = g_new0 (HistoryIndex, 1);
+	const gchar* name;
+	GDir* d;
+	guint i;
+	
+	index->dir = g_strdup (dir);
+	index->flush_pages = MAX (flush_pages, 1);
+	index->merge_segments = MAX (merge_segments, 2);
+	g_mutex_init (&index->lock);
+	index->segments = g_ptr_array_new_with_free_func ((GDestroyNotify) segment_unref);
+	index->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) pending_free);
+	index->pending_pages = g_ptr_array_new_with_free_func ((GDestroyNotify) history_task_free);
+	index->next_id = 1;
+	
+	g_mkdir_with_parents (dir, 0700);
+	if ((d = g_dir_open (dir, 0, NULL)))
+	{
+		while ((name = g_dir_read_name (d)))
+		{
+			gchar* path = g_build_filename (dir, name, NULL);
+			guint number = g_ascii_strtoull (name, NULL, 16);
+			Segment* segment;
+			
+			/* Left by a writer that did not finish */
+			if (g_str_has_suffix (name, ".tmp"))
+				g_unlink (path);
+			else if (g_str_has_suffix (name, ".seg") && (segment = segment_open (path, number)))
+			{
+				g_ptr_array_add (index->segments, segment);
+				index->next_number = MAX (index->next_number, number + 1);
+			}
+			g_free (path);
+		}
+		g_dir_close (d);
+	}
+	
+	/* In the order of their ids, whatever the order of the directory */
+	g_ptr_array_sort (index->segments, segment_number_compare);
+	for (i = 0; i < index->segments->len; i++)
+	{
+		Segment* segment = g_ptr_array_index (index->segments, i);
+		guint32 j;
+		
+		for (j = 0; j < segment->header->pages; j++)
+			index->next_id = MAX (index->next_id, segment->pages[j].id + 1);
+	}
+	
+	index->pool = g_thread_pool_new (history_index_write_cb, index, 1, FALSE, NULL);
+	return index;
+}
+
+void
+history_index_close (HistoryIndex* index)
+{
+	g_thread_pool_push (index->pool, &flush_task, NULL);
+	g_thread_pool_free (index->pool, FALSE, TRUE);
+	
+	g_ptr_array_free (index->segments, TRUE);
+	g_mutex_clear (&index->lock);
+	g_hash_table_destroy (index->pending);
+	g_ptr_array_free (index->pending_pages, TRUE);
+	g_free (index->dir);
+	g_free (index);
+}
+
+void
+history_index_add (HistoryIndex* index, const gchar* uri, const gchar* title, const gchar* text, gsize length)
+{
+	HistoryTask* task = g_new0 (HistoryTask, 1);
+	
+	task->uri = g_strdup (uri);
+	task->title = g_strdup (title);
+	task->text = g_strndup (text, length);
+	task->length = length;
+	task->time = g_get_real_time () / G_USEC_PER_SEC;
+	g_thread_pool_push (index->pool, task, NULL);
+}
+
+void
+history_index_flush (HistoryIndex* index)
+{
+	g_thread_pool_push (index->pool, &flush_task, NULL);
+}
+
+static gint
+candidate_compare (gconstpointer a, gconstpointer b)
+{
+	gdouble d = ((const Candidate*) b)->score - ((const Candidate*) a)->score;
+	return d > 0 ? 1 : d < 0 ? -1 : 0;
+}
+
+/*
+ * Score the pages of one segment that contain every word. A page is only
+ * counted for a word if it contained all the words before it.
+ */
+static void
+history_index_search_segment (Segment* segment, GPtrArray* words, gdouble* idf, gdouble average, GArray* candidates)
+{
+	guint32 pages = segment->header->pages;
+	gdouble* scores = g_new0 (gdouble, pages);
+	guint* matched = g_new0 (guint, pages);
+	guint t, i, first, last;
+	
+	for (t = 0; t < words->len; t++)
+	{
+		segment_find (segment, g_ptr_array_index (words, t), t == words->len - 1, &first, &last);
+		if (first == last)
+			break;
+		
+		for (i = first; i < last; i++)
+		{
+			const guint8 *p, *end;
+			guint32 page = 0;
+			
+			if (!segment_postings (segment, i, &p, &end))
+				continue;
+			while (p < end)
+			{
+				page += get_varint (&p, end);
+				guint32 count = get_varint (&p, end);
+				
+				if (page >= pages || matched[page] < t)
+					continue;
+				scores[page] += idf[t] * count * (BM25_K1 + 1)
+					/ (count + BM25_K1 * (1 - BM25_B + BM25_B * segment->pages[page].length / average));
+				matched[page] = t + 1;
+			}
+		}
+	}
+	
+	for (i = 0; i < pages; i++)
+	{
+		if (matched[i] == words->len)
+		{
+			Candidate candidate = {segment, i, scores[i]};
+			g_array_append_val (candidates, candidate);
+		}
+	}
+	g_free (scores);
+	g_free (matched);
+}
+
+GArray*
+history_index_search (HistoryIndex* index, const gchar* query, guint size)
+{
+	GArray* hits = g_array_new (FALSE, FALSE, sizeof (HistoryHit));
+	GArray* candidates = g_array_new (FALSE, FALSE, sizeof (Candidate));
+	GPtrArray* words = g_ptr_array_new_with_free_func (g_free);
+	GPtrArray* segments = g_ptr_array_new_with_free_func ((GDestroyNotify) segment_unref);
+	GHashTable* seen = g_hash_table_new (g_str_hash, g_str_equal);
+	const gchar* end = query + strlen (query);
+	gchar word[TEXT_INDEX_WORD_MAX + 1];
+	guint64 pages = 0, length = 0;
+	gdouble* idf;
+	guint i, t, first, last;
+	gsize n;
+	
+	while (text_index_word (&query, end, word, &n))
+		g_ptr_array_add (words, g_strndup (word, n));
+	
+	g_mutex_lock (&index->lock);
+	for (i = 0; i < index->segments->len; i++)
+		g_ptr_array_add (segments, segment_ref (g_ptr_array_index (index->segments, i)));
+	g_mutex_unlock (&index->lock);
+	
+	/* Rank with statistics over all segments */
+	idf = g_new0 (gdouble, words->len);
+	for (i = 0; i < segments->len; i++)
+	{
+		Segment* segment = g_ptr_array_index (segments, i);
+		pages += segment->header->pages;
+		length += segment->header->length;
+	}
+	for (t = 0; t < words->len; t++)
+	{
+		guint64 containing = 0;
+		
+		for (i = 0; i < segments->len; i++)
+		{
+			Segment* segment = g_ptr_array_index (segments, i);
+			segment_find (segment, g_ptr_array_index (words, t), t == words->len - 1, &first, &last);
+			for (; first < last; first++)
+				containing += segment->words[first].pages;
+		}
+		containing = MIN (containing, pages);
+		idf[t] = log (1 + (pages - containing + 0.5) / (containing + 0.5));
+	}
+	
+	if (words->len > 0)
+		for (i = 0; i < segments->len; i++)
+			history_index_search_segment (g_ptr_array_index (segments, i), words, idf, MAX ((gdouble) length / MAX (pages, 1), 1), candidates);
+	
+	/* Best first, each uri once */
+	g_array_sort (candidates, candidate_compare);
+	for (i = 0; i < candidates->len && hits->len < size; i++)
+	{
+		Candidate* candidate = &g_array_index (candidates, Candidate, i);
+		const SegmentPage* page = &candidate->segment->pages[candidate->page];
+		const gchar* uri = candidate->segment->strings + page->uri;
+		HistoryHit hit;
+		
+		if (g_hash_table_contains (seen, uri))
+			continue;
+		g_hash_table_add (seen, (gpointer) uri);
+		hit.uri = g_strdup (uri);
+		hit.title = g_strdup (candidate->segment->strings + page->title);
+		hit.time = page->time;
+		hit.score = candidate->score;
+		g_array_append_val (hits, hit);
+	}
+	
+	g_free (idf);
+	g_hash_table_destroy (seen);
+	g_array_free (candidates, TRUE);
+	g_ptr_array_free (segments, TRUE);
+	g_ptr_array_free (words, TRUE);
+	return hits;
+}
+
+void
+history_index_hits_free (GArray* hits)
+{
+	guint i;
+	
+	for (i = 0; i < hits->len; i++)
+	{
+		g_free (g_array_index (hits, HistoryHit, i).uri);
+		g_free (g_array_index (hits, HistoryHit, i).title);
+	}
+	g_array_free (hits, TRUE);
+}
+
+guint
+history_index_pages (HistoryIndex* index, guint* segments)
+{
+	guint pages = 0, i;
+	
+	g_mutex_lock (&index->lock);
+	for (i = 0; i < index->segments->len; i++)
+		pages += ((Segment*) g_ptr_array_index (index->segments, i))->header->pages;
+	if (segments)
+		*segments = index->segments->len;
+	g_mutex_unlock (&index->lock);
+	return pages;
+}
@@ -0,0 +1,55 @@
+/*
+ * sb - simple browser
+ *
+ * Full-text history index - the text of visited pages, kept on disk as
+ * segments that are searched through memory maps.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef HISTORYINDEX_H
+#define HISTORYINDEX_H
+
+#include <glib.h>
+
+typedef struct HistoryIndex HistoryIndex;
+
+typedef struct HistoryHit {
+	gchar* uri;
+	gchar* title;
+	gint64 time;
+	gdouble score;
+} HistoryHit;
+
+/*
+ * Open the index kept in dir, creating it if needed. Pages are written as a
+ * new segment every flush_pages pages; once there are more than
+ * merge_segments segments, the run of merge_segments neighbouring ones with
+ * the fewest pages is merged into one.
+ */
+HistoryIndex* history_index_open (const gchar* dir, guint flush_pages, guint merge_segments);
+
+/* Write the pages not yet on disk, and wait for the writer to finish */
+void history_index_close (HistoryIndex* index);
+
+/*
+ * Index a visited page. Everything is copied, and the text is split into
+ * words by the writer thread, so this returns at once.
+ */
+void history_index_add (HistoryIndex* index, const gchar* uri, const gchar* title, const gchar* text, gsize length);
+
+/* Write the pages added so far as a segment, in the background */
+void history_index_flush (HistoryIndex* index);
+
+/*
+ * Pages containing every word of the query (the last one may be a prefix),
+ * best first, each uri once - an array of at most size HistoryHits, to be
+ * freed with history_index_hits_free
+ */
+GArray* history_index_search (HistoryIndex* index, const gchar* query, guint size);
+void history_index_hits_free (GArray* hits);
+
+/* Pages and segments on disk */
+guint history_index_pages (HistoryIndex* index, guint* segments);
+
+#endif
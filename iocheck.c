@@ -0,0 +1,206 @@
+/*
+ * sb - simple browser
+ *
+ * Main thread I/O check - see iocheck.h. sb-check is linked with -rdynamic, so
+ * these definitions take the place of the C library's for every library in
+ * the process; each one checks the thread and calls the real function. Until
+ * io_check_start is called, that check is a single load.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+/* Wrap the plain and the 64-bit functions separately, whatever the build */
+#undef _FILE_OFFSET_BITS
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "iocheck.h"
+
+#define IO_CHECK_DEPTH 16
+#define IO_CHECK_SEEN 1024
+
+static int io_checking = 0;
+static pthread_t io_check_thread;
+static __thread int io_check_inside = 0;
+static unsigned long io_check_seen[IO_CHECK_SEEN];
+static unsigned io_check_count = 0;
+
+/*
+ * Report a call - unless it comes from a stack already reported, or from
+ * the report itself
+ */
+static void
+io_check (const char* function, const char* path)
+{
+	void* trace[IO_CHECK_DEPTH];
+	unsigned long hash = 5381;
+	int depth, i;
+	
+	if (!io_checking || io_check_inside || !pthread_equal (pthread_self (), io_check_thread))
+		return;
+	io_check_inside = 1;
+	
+	depth = backtrace (trace, IO_CHECK_DEPTH);
+	for (i = 0; i < depth; i++)
+		hash = hash * 33 + (unsigned long) trace[i];
+	hash |= 1;
+	for (i = hash % IO_CHECK_SEEN; io_check_seen[i] && io_check_seen[i] != hash; i = (i + 1) % IO_CHECK_SEEN)
+		;
+	if (!io_check_seen[i] && io_check_count < IO_CHECK_SEEN / 2)
+	{
+		io_check_seen[i] = hash;
+		io_check_count++;
+		fprintf (stderr, "sb: file I/O on the main thread: %s (%s)\n", function, path ? path : "");
+		/* Skip this function and the wrapper */
+		backtrace_symbols_fd (trace + 2, depth - 2, STDERR_FILENO);
+	}
+	io_check_inside = 0;
+}
+
+#define IO_REAL(type, name, args) \
+	static type (*real) args; \
+	if (!real) \
+		real = (type (*) args) dlsym (RTLD_NEXT, name)
+
+int
+open (const char* path, int flags, ...)
+{
+	IO_REAL (int, "open", (const char*, int, ...));
+	mode_t mode = 0;
+	va_list ap;
+	
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start (ap, flags);
+		mode = va_arg (ap, mode_t);
+		va_end (ap);
+	}
+	io_check ("open", path);
+	return real (path, flags, mode);
+}
+
+int
+open64 (const char* path, int flags, ...)
+{
+	IO_REAL (int, "open64", (const char*, int, ...));
+	mode_t mode = 0;
+	va_list ap;
+	
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start (ap, flags);
+		mode = va_arg (ap, mode_t);
+		va_end (ap);
+	}
+	io_check ("open", path);
+	return real (path, flags, mode);
+}
+
+int
+openat (int dir, const char* path, int flags, ...)
+{
+	IO_REAL (int, "openat", (int, const char*, int, ...));
+	mode_t mode = 0;
+	va_list ap;
+	
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start (ap, flags);
+		mode = va_arg (ap, mode_t);
+		va_end (ap);
+	}
+	io_check ("openat", path);
+	return real (dir, path, flags, mode);
+}
+
+FILE*
+fopen (const char* path, const char* how)
+{
+	IO_REAL (FILE*, "fopen", (const char*, const char*));
+	
+	io_check ("fopen", path);
+	return real (path, how);
+}
+
+FILE*
+fopen64 (const char* path, const char* how)
+{
+	IO_REAL (FILE*, "fopen64", (const char*, const char*));
+	
+	io_check ("fopen", path);
+	return real (path, how);
+}
+
+int
+fsync (int fd)
+{
+	IO_REAL (int, "fsync", (int));
+	
+	io_check ("fsync", NULL);
+	return real (fd);
+}
+
+int
+fdatasync (int fd)
+{
+	IO_REAL (int, "fdatasync", (int));
+	
+	io_check ("fdatasync", NULL);
+	return real (fd);
+}
+
+int
+rename (const char* from, const char* to)
+{
+	IO_REAL (int, "rename", (const char*, const char*));
+	
+	io_check ("rename", to);
+	return real (from, to);
+}
+
+int
+unlink (const char* path)
+{
+	IO_REAL (int, "unlink", (const char*));
+	
+	io_check ("unlink", path);
+	return real (path);
+}
+
+int
+mkdir (const char* path, mode_t mode)
+{
+	IO_REAL (int, "mkdir", (const char*, mode_t));
+	
+	io_check ("mkdir", path);
+	return real (path, mode);
+}
+
+void
+io_check_start (void)
+{
+	void* trace[IO_CHECK_DEPTH];
+	
+	/* The first backtrace loads libgcc - not something to report */
+	io_check_inside = 1;
+	backtrace (trace, IO_CHECK_DEPTH);
+	io_check_inside = 0;
+	
+	io_check_thread = pthread_self ();
+	__atomic_store_n (&io_checking, 1, __ATOMIC_RELEASE);
+}
+
+unsigned
+io_check_reports (void)
+{
+	return io_check_count;
+}
@@ -0,0 +1,33 @@
+/*
+ * sb - simple browser
+ *
+ * Main thread I/O check (--check-io) - reports file I/O done on the main
+ * thread, by whatever library, with a backtrace. The interposers are only
+ * built into sb-check (make sb-check, with CHECK_IO defined); elsewhere these
+ * do nothing.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef IOCHECK_H
+#define IOCHECK_H
+
+#ifdef CHECK_IO
+
+/*
+ * Start reporting file opens, fsyncs, renames, unlinks and mkdirs made by
+ * the calling thread - once per distinct call stack
+ */
+void io_check_start (void);
+
+/* Number of distinct call stacks reported */
+unsigned io_check_reports (void);
+
+#else
+
+#define io_check_start() ((void) 0)
+#define io_check_reports() 0u
+
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * sb - simple browser
+ *
+ * Background I/O - see iowork.h. Jobs are queued in order. The thread takes
+ * the whole queue as a batch once its oldest job is due - calls are due at
+ * once, writes after the write delay - and hands the finished jobs back to
+ * the main loop with a single idle callback per batch. A call also makes the
+ * writes queued before it due, and ends coalescing for them, so jobs never
+ * change order.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "iowork.h"
+
+typedef struct IoCallback {
+	IoDoneFunc func;
+	gpointer data;
+} IoCallback;
+
+typedef struct IoJob {
+	gchar* path;		/* a write, or */
+	GBytes* contents;
+	IoJobFunc func;		/* a call */
+	gpointer func_data;
+	GArray* callbacks;
+	gint64 due;
+	GError* error;
+} IoJob;
+
+static GMutex io_lock;
+static GCond io_cond;
+static GQueue io_queue = G_QUEUE_INIT;
+static GHashTable* io_writes = NULL;	/* path -> queued write, since the last call */
+static GQueue io_done = G_QUEUE_INIT;
+static guint io_done_id = 0;
+static gboolean io_flushing = FALSE, io_busy = FALSE;
+static guint io_write_delay = 0;
+
+static void
+io_job_free (IoJob* job)
+{
+	g_free (job->path);
+	if (job->contents)
+		g_bytes_unref (job->contents);
+	g_array_free (job->callbacks, TRUE);
+	g_clear_error (&job->error);
+	g_free (job);
+}
+
+static void
+io_job_run (IoJob* job)
+{
+	if (job->func)
+	{
+		if (!job->func (job->func_data, &job->error) && !job->error)
+			g_set_error (&job->error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Failed");
+		return;
+	}
+	
+	gchar* dir = g_path_get_dirname (job->path);
+	gsize length;
+	const gchar* data = g_bytes_get_data (job->contents, &length);
+	
+	g_mkdir_with_parents (dir, 0700);
+	g_file_set_contents (job->path, data, length, &job->error);
+	g_free (dir);
+}
+
+/*
+ * Main loop: report finished jobs
+ */
+static gboolean
+io_done_cb (gpointer data)
+{
+	GQueue done = G_QUEUE_INIT;
+	IoJob* job;
+	guint i;
+	
+	g_mutex_lock (&io_lock);
+	done = io_done;
+	g_queue_init (&io_done);
+	io_done_id = 0;
+	g_mutex_unlock (&io_lock);
+	
+	while ((job = g_queue_pop_head (&done)))
+	{
+		for (i = 0; i < job->callbacks->len; i++)
+		{
+			IoCallback* callback = &g_array_index (job->callbacks, IoCallback, i);
+			callback->func (job->error, callback->data);
+		}
+		io_job_free (job);
+	}
+	return FALSE;
+}
+
+static gpointer
+io_thread (gpointer data)
+{
+	GQueue batch;
+	GList* l;
+	IoJob* job;
+	
+	g_mutex_lock (&io_lock);
+	while (TRUE)
+	{
+		job = g_queue_peek_head (&io_queue);
+		if (!job)
+		{
+			g_cond_wait (&io_cond, &io_lock);
+			continue;
+		}
+		if (!io_flushing && job->due > g_get_monotonic_time ())
+		{
+			g_cond_wait_until (&io_cond, &io_lock, job->due);
+			continue;
+		}
+		
+		batch = io_queue;
+		g_queue_init (&io_queue);
+		g_hash_table_remove_all (io_writes);
+		io_busy = TRUE;
+		g_mutex_unlock (&io_lock);
+		
+		for (l = batch.head; l; l = l->next)
+			io_job_run (l->data);
+		
+		g_mutex_lock (&io_lock);
+		while ((job = g_queue_pop_head (&batch)))
+			g_queue_push_tail (&io_done, job);
+		if (!io_done_id)
+			io_done_id = g_idle_add (io_done_cb, NULL);
+		io_busy = FALSE;
+		g_cond_broadcast (&io_cond);
+	}
+	return NULL;
+}
+
+void
+io_init (guint write_delay)
+{
+	io_write_delay = write_delay;
+	io_writes = g_hash_table_new (g_str_hash, g_str_equal);
+	g_thread_unref (g_thread_new ("sb-io", io_thread, NULL));
+}
+
+static IoJob*
+io_job_new (IoDoneFunc done, gpointer data)
+{
+	IoJob* job = g_new0 (IoJob, 1);
+	
+	job->callbacks = g_array_new (FALSE, FALSE, sizeof (IoCallback));
+	if (done)
+	{
+		IoCallback callback = {done, data};
+		g_array_append_val (job->callbacks, callback);
+	}
+	return job;
+}
+
+void
+io_write (const gchar* path, GBytes* contents, IoDoneFunc done, gpointer data)
+{
+	IoJob* job;
+	
+	g_mutex_lock (&io_lock);
+	if ((job = g_hash_table_lookup (io_writes, path)))
+	{
+		/* Not started yet - write the newer contents instead */
+		g_bytes_unref (job->contents);
+		job->contents = g_bytes_ref (contents);
+		if (done)
+		{
+			IoCallback callback = {done, data};
+			g_array_append_val (job->callbacks, callback);
+		}
+	}
+	else
+	{
+		job = io_job_new (done, data);
+		job->path = g_strdup (path);
+		job->contents = g_bytes_ref (contents);
+		job->due = g_get_monotonic_time () + io_write_delay * 1000;
+		g_queue_push_tail (&io_queue, job);
+		g_hash_table_insert (io_writes, job->path, job);
+		g_cond_broadcast (&io_cond);
+	}
+	g_mutex_unlock (&io_lock);
+}
+
+void
+io_call (IoJobFunc func, gpointer func_data, IoDoneFunc done, gpointer data)
+{
+	IoJob* job = io_job_new (done, data);
+	GList* l;
+	
+	job->func = func;
+	job->func_data = func_data;
+	
+	g_mutex_lock (&io_lock);
+	for (l = io_queue.head; l; l = l->next)
+		((IoJob*) l->data)->due = 0;
+	g_queue_push_tail (&io_queue, job);
+	g_hash_table_remove_all (io_writes);
+	g_cond_broadcast (&io_cond);
+	g_mutex_unlock (&io_lock);
+}
+
+void
+io_flush (void)
+{
+	if (!io_writes)
+		return;
+	
+	g_mutex_lock (&io_lock);
+	io_flushing = TRUE;
+	g_cond_broadcast (&io_cond);
+	while (io_queue.length > 0 || io_busy)
+		g_cond_wait (&io_cond, &io_lock);
+	io_flushing = FALSE;
+	if (io_done_id)
+		g_source_remove (io_done_id);
+	io_done_id = 0;
+	g_mutex_unlock (&io_lock);
+	
+	io_done_cb (NULL);
+}
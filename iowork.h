@@ -0,0 +1,47 @@
+/*
+ * sb - simple browser
+ *
+ * Background I/O - one thread that does the disk work of the browser, so
+ * the main loop never waits on a slow home directory.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef IOWORK_H
+#define IOWORK_H
+
+#include <glib.h>
+
+/* Runs in the I/O thread - returns FALSE and sets error on failure */
+typedef gboolean (*IoJobFunc) (gpointer data, GError** error);
+
+/* Runs in the main loop once a job is done - error is NULL on success */
+typedef void (*IoDoneFunc) (const GError* error, gpointer data);
+
+/*
+ * Start the I/O thread. Writes wait up to write_delay ms for more writes,
+ * so a burst of them is done as one batch.
+ */
+void io_init (guint write_delay);
+
+/*
+ * Replace the file at path with contents, creating its directory if needed.
+ * A later write to the same path, queued before this one started, replaces
+ * it - the file is written once, and done is called for both. done may be
+ * NULL.
+ */
+void io_write (const gchar* path, GBytes* contents, IoDoneFunc done, gpointer data);
+
+/*
+ * Run job (job_data) in the I/O thread, after everything queued before it,
+ * and then done (data) in the main loop. done may be NULL.
+ */
+void io_call (IoJobFunc job, gpointer job_data, IoDoneFunc done, gpointer data);
+
+/*
+ * Do all queued jobs now and wait for them, then run their done callbacks -
+ * for exit
+ */
+void io_flush (void);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * sb - simple browser
+ *
+ * Metrics - see metrics.h. Memory is read from /proc at each scrape; all
+ * other values are counters the browser adds to as things happen.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+
+typedef struct MetricInfo {
+	const gchar* name;
+	const gchar* type;
+	const gchar* help;
+	gdouble scale;	/* value * scale is exported, to keep units Prometheus-style */
+} MetricInfo;
+
+static const MetricInfo metric_info[METRICS] = {
+	{"sb_tabs", "gauge", "Tabs open, in all windows", 1},
+	{"sb_navigations_total", "counter", "Pages committed to a tab", 1},
+	{"sb_requests_total", "counter", "Resources requested by pages", 1},
+	{"sb_received_bytes_total", "counter", "Bytes of resources received by pages", 1},
+	{"sb_http_responses_total", "counter", "HTTP responses on the network session", 1},
+	{"sb_http_not_modified_total", "counter", "HTTP responses that revalidated a cached copy (304)", 1},
+	{"sb_favicon_cache_hits_total", "counter", "Favicons found decoded in memory", 1},
+	{"sb_favicon_cache_misses_total", "counter", "Favicons that had to be decoded", 1},
+	{"sb_prerenders_total", "counter", "Pages prerendered ahead of a click", 1},
+	{"sb_prerender_hits_total", "counter", "Prerendered pages that were shown", 1},
+	{"sb_main_loop_stalls_total", "counter", "Main loop stalls noted by the flight recorder or --jank", 1},
+	{"sb_main_loop_stall_seconds_total", "counter", "Time the main loop spent stalled", 0.001},
+	{"sb_downloads_total", "counter", "Downloads started", 1},
+	{"sb_downloads_failed_total", "counter", "Downloads that failed or were cancelled", 1},
+	{"sb_download_bytes_total", "counter", "Bytes of downloads that ended", 1},
+};
+
+static gint64 metric_values[METRICS];
+static int metrics_fd = -1;
+
+/* Only the server thread uses these */
+static gchar metrics_request[4096];
+static gchar metrics_body[8192];
+static gchar metrics_head[256];
+static gchar metrics_proc[4096];
+
+void
+metrics_add (Metric metric, gint64 n)
+{
+	__atomic_fetch_add (&metric_values[metric], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Rss and Pss of this process in kB - smaps_rollup is missing before Linux
+ * 4.14, and then only Rss (from statm) is known
+ */
+static void
+metrics_memory (glong* rss, glong* pss)
+{
+	gssize n;
+	gchar* line;
+	int fd;
+	
+	*rss = *pss = -1;
+	if ((fd = open ("/proc/self/smaps_rollup", O_RDONLY)) >= 0)
+	{
+		n = read (fd, metrics_proc, sizeof metrics_proc - 1);
+		close (fd);
+		metrics_proc[MAX (n, 0)] = '\0';
+		if ((line = strstr (metrics_proc, "\nRss:")))
+			*rss = atol (line + 5);
+		if ((line = strstr (metrics_proc, "\nPss:")))
+			*pss = atol (line + 5);
+	}
+	if (*rss < 0 && (fd = open ("/proc/self/statm", O_RDONLY)) >= 0)
+	{
+		n = read (fd, metrics_proc, sizeof metrics_proc - 1);
+		close (fd);
+		metrics_proc[MAX (n, 0)] = '\0';
+		line = strchr (metrics_proc, ' ');
+		if (line)
+			*rss = atol (line + 1) * (sysconf (_SC_PAGESIZE) / 1024);
+	}
+}
+
+/*
+ * Format all metrics into metrics_body, returning the length
+ */
+static gsize
+metrics_format (void)
+{
+	gsize length = 0;
+	glong rss, pss;
+	guint i;
+	
+	for (i = 0; i < METRICS; i++)
+	{
+		const MetricInfo* m = &metric_info[i];
+		gint64 value = __atomic_load_n (&metric_values[i], __ATOMIC_RELAXED);
+		
+		length += snprintf (metrics_body + length, sizeof metrics_body - length, "# HELP %s %s\n# TYPE %s %s\n",
+							m->name, m->help, m->name, m->type);
+		if (m->scale == 1)
+			length += snprintf (metrics_body + length, sizeof metrics_body - length, "%s %" G_GINT64_FORMAT "\n", m->name, value);
+		else
+			length += snprintf (metrics_body + length, sizeof metrics_body - length, "%s %.3f\n", m->name, value * m->scale);
+		if (length >= sizeof metrics_body)
+			return sizeof metrics_body - 1;
+	}
+	
+	metrics_memory (&rss, &pss);
+	if (rss >= 0)
+		length += snprintf (metrics_body + length, sizeof metrics_body - length,
+							"# HELP sb_resident_memory_bytes Resident memory of the browser process\n"
+							"# TYPE sb_resident_memory_bytes gauge\nsb_resident_memory_bytes %ld\n", rss * 1024);
+	if (pss >= 0 && length < sizeof metrics_body)
+		length += snprintf (metrics_body + length, sizeof metrics_body - length,
+							"# HELP sb_proportional_memory_bytes Resident memory with shared pages split between the processes using them\n"
+							"# TYPE sb_proportional_memory_bytes gauge\nsb_proportional_memory_bytes %ld\n", pss * 1024);
+	return MIN (length, sizeof metrics_body - 1);
+}
+
+static void
+metrics_send (int fd, const gchar* data, gsize length)
+{
+	while (length > 0)
+	{
+		gssize n = send (fd, data, length, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		data += n;
+		length -= n;
+	}
+}
+
+/*
+ * Answer one request - the headers are read, and anything but a GET of
+ * /metrics (or /) gets a 404
+ */
+static void
+metrics_answer (int fd)
+{
+	gsize length = 0, body = 0, head;
+	const gchar* status = "404 Not Found";
+	
+	while (length < sizeof metrics_request - 1)
+	{
+		gssize n = recv (fd, metrics_request + length, sizeof metrics_request - 1 - length, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		length += n;
+		metrics_request[length] = '\0';
+		if (strstr (metrics_request, "\r\n\r\n") || strstr (metrics_request, "\n\n"))
+			break;
+	}
+	metrics_request[length] = '\0';
+	
+	if (g_str_has_prefix (metrics_request, "GET /metrics ") || g_str_has_prefix (metrics_request, "GET /metrics?")
+		|| g_str_has_prefix (metrics_request, "GET / "))
+	{
+		status = "200 OK";
+		body = metrics_format ();
+	}
+	head = snprintf (metrics_head, sizeof metrics_head,
+					 "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %" G_GSIZE_FORMAT "\r\nConnection: close\r\n\r\n",
+					 status, body);
+	metrics_send (fd, metrics_head, MIN (head, sizeof metrics_head - 1));
+	metrics_send (fd, metrics_body, body);
+}
+
+static gpointer
+metrics_thread (gpointer data)
+{
+	struct timeval timeout = {2, 0};
+	
+	while (TRUE)
+	{
+		int fd = accept (metrics_fd, NULL, NULL);
+		
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		/* A client that never finishes its request must not block the next one */
+		setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+		setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+		metrics_answer (fd);
+		close (fd);
+	}
+	return NULL;
+}
+
+gboolean
+metrics_serve (const gchar* path, guint port, GError** error)
+{
+	int fd;
+	
+	if (path)
+	{
+		struct sockaddr_un address = {.sun_family = AF_UNIX};
+		struct stat info;
+		
+		if (strlen (path) >= sizeof address.sun_path)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NAMETOOLONG, "%s: socket path too long", path);
+			return FALSE;
+		}
+		strcpy (address.sun_path, path);
+		
+		/* Replace a socket left behind by an earlier run, and nothing else */
+		if (lstat (path, &info) == 0 && !S_ISSOCK (info.st_mode))
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_EXIST, "%s: exists and is not a socket", path);
+			return FALSE;
+		}
+		unlink (path);
+		fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		
+		/* Only this user may read the metrics */
+		if (fd >= 0 && (bind (fd, (struct sockaddr*) &address, sizeof address) < 0 || chmod (path, 0600) < 0))
+		{
+			close (fd);
+			fd = -1;
+		}
+	}
+	else
+	{
+		struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons (port), .sin_addr.s_addr = htonl (INADDR_LOOPBACK)};
+		int on = 1;
+		
+		fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0)
+			setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		if (fd >= 0 && bind (fd, (struct sockaddr*) &address, sizeof address) < 0)
+		{
+			close (fd);
+			fd = -1;
+		}
+	}
+	
+	if (fd < 0 || listen (fd, 8) < 0)
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "cannot listen for metrics: %s", g_strerror (errno));
+		if (fd >= 0)
+			close (fd);
+		return FALSE;
+	}
+	metrics_fd = fd;
+	g_thread_unref (g_thread_new ("sb-metrics", metrics_thread, NULL));
+	return TRUE;
+}
@@ -0,0 +1,45 @@
+/*
+ * sb - simple browser
+ *
+ * Metrics - counters kept with atomic adds, served in the Prometheus text
+ * format over HTTP on a Unix socket or a loopback port.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+typedef enum {
+	METRIC_TABS,
+	METRIC_NAVIGATIONS,
+	METRIC_REQUESTS,
+	METRIC_RECEIVED_BYTES,
+	METRIC_HTTP_RESPONSES,
+	METRIC_HTTP_NOT_MODIFIED,
+	METRIC_FAVICON_HITS,
+	METRIC_FAVICON_MISSES,
+	METRIC_PRERENDERS,
+	METRIC_PRERENDER_HITS,
+	METRIC_STALLS,
+	METRIC_STALL_MS,
+	METRIC_DOWNLOADS,
+	METRIC_DOWNLOADS_FAILED,
+	METRIC_DOWNLOAD_BYTES,
+	METRICS
+} Metric;
+
+/* Add to a counter, or to a gauge (n may be negative) - one atomic add, from any thread */
+void metrics_add (Metric metric, gint64 n);
+
+/*
+ * Serve the metrics at /metrics from a thread of their own, so a stalled
+ * main loop is still seen - on the Unix socket path, or on 127.0.0.1:port
+ * if path is NULL. Only the thread and the socket are allocated; each scrape
+ * is formatted into a fixed buffer.
+ */
+gboolean metrics_serve (const gchar* path, guint port, GError** error);
+
+#endif
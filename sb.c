@@ -6,32 +6,174 @@
  * See LICENSE file for copyright and license details.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <glib/gstdio.h>
+#include <sys/socket.h>
 #include <gtk/gtk.h>
+#include <gdk/gdkkeysyms.h>
 #include <webkit/webkit.h>
+#define LIBSOUP_USE_UNSTABLE_REQUEST_API
+#include <libsoup/soup.h>
+#include <gio/gunixinputstream.h>
+#include <sqlite3.h>
 
 #include "config.h"
+#include "url.h"
+#include "textindex.h"
+#include "historyindex.h"
+#include "flight.h"
+#include "metrics.h"
+#include "iowork.h"
+#include "iocheck.h"
 
-static GtkWidget* main_window;
-static GtkWidget* main_book;
-static GtkWidget* main_menu_bar;
+typedef struct Client Client;
 
-static GtkWidget* main_toolbar;
-static GtkToolItem* back_button;
-static GtkToolItem* forward_button;
-static GtkToolItem* refresh_button;
-static GtkWidget* uri_entry;
-static GtkEntryBuffer* search_buffer;
-static GtkWidget* search_engine_entry;
+/*
+ * Messages waiting for a non-blocking socket to take them - written out as
+ * the peer reads, so a peer that stops reading never blocks the sender
+ */
+typedef struct Outbox {
+	GIOChannel* channel;
+	GString* queue;
+	guint watch_id;
+} Outbox;
+
+/*
+ * A renderer process (--tab-processes) as seen from the browser - the tabs it
+ * hosts, and the socket their commands and events go over
+ */
+typedef struct Renderer {
+	GPid pid;
+	GIOChannel* channel;
+	Outbox out;
+	guint watch_id, ping_id;
+	GPtrArray* clients;
+	guint next_id;
+	gint64 last_answer;
+	gboolean hung;
+} Renderer;
+
+/*
+ * A top-level browser window. Everything that belongs to one window lives here;
+ * the network session, cookies and web settings are shared by all windows.
+ */
+typedef struct Browser {
+	GtkWidget *window, *book, *menubar, *toolbar;
+	GtkToolItem *back_button, *forward_button, *refresh_button;
+	GtkWidget *uri_entry, *search_engine_entry;
+	
+	GtkWidget *find_bar, *find_entry, *find_case_button, *find_highlight_button, *find_status_label;
+	guint find_timeout_id, find_mark_id, find_count_id;
+	gchar* find_last_text;
+	gboolean find_last_case, find_found;
+	guint find_match_count, find_match_current, find_mark_limit;
+	
+	/* Matches are counted in the page's text nodes, a slice at a time */
+	WebKitDOMTreeWalker* find_walker;
+	WebKitDOMNode* find_anchor;
+	glong find_anchor_offset;
+	guint find_counted, find_counted_current;
+	
+	GtkStatusbar* statusbar;
+	guint status_context_id;
+	
+	GPtrArray* clients;
+	Client* current;
+	gboolean fullscreen;
+	
+	GtkWidget *switcher, *switcher_entry, *switcher_view;
+	GtkListStore* switcher_store;
+	GtkTreeModel* switcher_model;
+	
+	GtkWidget* lite_item;
+	
+	Client* prerender;
+	gchar* prerender_uri;
+	GtkWidget *prerender_window, *prerender_tab;
+	guint prerender_timeout_id, prerender_swap_id, prerender_hover_id;
+	gchar* prerender_hover_uri;
+	
+	guint finish_id;
+} Browser;
 
-static GtkStatusbar* main_statusbar;
-static WebKitWebView* web_view;
-static gchar* main_title;
-static gint load_progress;
-static guint status_context_id;
+struct Client {
+	GtkWidget *vbox, *scroll, *pane, *label, *icon;
+	WebKitWebView* view;
+	WebKitWebInspector *inspector;
+	Browser* b;
+	gchar* title;
+	const char *uri;
+	gint progress;
+	gboolean zoomed, isinspecting;
+	gboolean prerender;
+	guint flight_id;
+	
+	/* Jank monitor - events of the view being handled, and the depth before the outermost */
+	guint jank_events;
+	gint jank_event_depth;
+	
+	/* Lite mode - requests made and blocked, bytes received and start of this load, and the last normal load */
+	gboolean lite;
+	guint load_requests, load_blocked;
+	gsize load_bytes;
+	gint64 load_start;
+	gchar* normal_uri;
+	guint normal_requests;
+	gsize normal_bytes;
+	gint64 normal_time;
+	
+	/* The page's text in the tab index, and the part still to be fed to it */
+	guint index_page, index_id;
+	gchar* index_text;
+	gsize index_length, index_offset;
+	
+	/* Tabs shown from a renderer process - view is NULL */
+	gboolean remote;
+	Renderer* renderer;
+	guint remote_id;
+	GtkWidget *socket, *message;
+	gchar* remote_uri;
+	gboolean can_go_back, can_go_forward;
+};
+
+/* A view in a renderer process, shown in the browser through a plug */
+typedef struct RemoteView {
+	guint id;
+	GtkWidget *plug, *scroll;
+	WebKitWebView* view;
+} RemoteView;
 
-static gboolean fullscreen = FALSE;
+static GList* browsers = NULL;
+static WebKitWebSettings* web_settings = NULL;
+static WebKitWebSettings* lite_settings = NULL;
+static gboolean spell_checking_started = FALSE;
+/* Where WebKit keeps site storage - copied here, so sb://storage/ can be served from a thread */
+static gchar* storage_database_path = NULL;
+static gchar* storage_local_path = NULL;
+static gchar* storage_appcache_path = NULL;
+
+/* Full-text index of the pages open in all windows, searched by the tab switcher */
+static TextIndex* tab_index = NULL;
+
+/* Full-text index of visited pages, on disk - searched from sb://history/ */
+static HistoryIndex* history_index = NULL;
+
+/* Flight recorder - tab numbers, and where recordings are written */
+static guint flight_tabs = 0;
+static gchar *flight_path = NULL, *flight_crash_path = NULL;
 
 static int user_agent_current = 0;
 static char* useragents[] = {
@@ -42,16 +184,137 @@ static char* useragents[] = {
 	"Mozilla/5.0 (Linux; U; Android 4.0.3; ko-kr; LG-L160L Build/IML74K) AppleWebkit/534.30 (KHTML, like Gecko) Version/4.0 Mobile Safari/534.30",
 };
 
-typedef struct Client {
-	GtkWidget *vbox, *scroll, *pane;
-	WebKitWebView* view;
-	WebKitWebInspector *inspector;
-	const char *uri;
-	gint progress;
-	gboolean zoomed, isinspecting;
-} Client;
+/*
+ * Rows of the tab switcher - one per tab, whether it matches the query or
+ * not. Rows that don't are filtered out, and the rest are sorted by rank.
+ */
+enum {
+	SWITCHER_COLUMN_TEXT,
+	SWITCHER_COLUMN_CLIENT,
+	SWITCHER_COLUMN_VISIBLE,
+	SWITCHER_COLUMN_SCORE,
+	SWITCHER_COLUMN_RANK,
+	SWITCHER_N_COLUMNS
+};
+
+typedef struct Favicon {
+	gchar* hash;
+	GdkPixbuf* pixbuf;
+	gsize size;
+	gboolean provisional;	/* hashed from WebKit's pixels, until the stored bytes are read */
+	GList* link;
+} Favicon;
+
+typedef struct FaviconPage {
+	gchar *uri, *hash;
+	GList* link;
+} FaviconPage;
+
+typedef struct FaviconRead {
+	Client* c;
+	gchar *page_uri, *hash;
+	GBytes* data;
+} FaviconRead;
+
+static GHashTable* favicons;
+static GHashTable* favicon_pages;
+static GQueue favicon_lru = G_QUEUE_INIT;
+static GQueue favicon_page_lru = G_QUEUE_INIT;
+static gsize favicon_cache_bytes = 0;
+static gchar* favicon_db_path = NULL;
+static sqlite3* favicon_db = NULL;
+
+typedef struct CookieChange {
+	SoupCookie *old_cookie, *new_cookie;
+} CookieChange;
+
+static SoupCookieJar* cookie_jar;
+static sqlite3* cookie_db = NULL;
+static sqlite3_stmt *cookie_delete_stmt, *cookie_insert_stmt, *cookie_purge_stmt;
+static GPtrArray* cookie_changes;
+static guint cookie_flush_id = 0;
+static gboolean cookie_loading = FALSE;
+
+typedef struct ArchiveEntry {
+	gsize offset;
+	gsize length;
+	gsize header_length;
+	guint status;
+	guint msec;
+	gchar* mime;
+	gchar* uri;
+	const gchar* data;
+} ArchiveEntry;
+
+typedef struct Archive {
+	GMappedFile* file;
+	const gchar* data;
+	gsize length;
+	GArray* entries;
+	GHashTable* index;
+} Archive;
 
-static Client* current_client = NULL;
+static GHashTable* archives = NULL;
+static GMutex archives_lock;
+
+typedef struct RecordEntry {
+	guint status;
+	guint msec;
+	GString* headers;
+	gchar* mime;
+	GBytes* body;
+} RecordEntry;
+
+typedef struct ReplayResponse {
+	SoupServer* server;
+	SoupMessage* msg;
+	const gchar* data;
+	gsize length;
+	gsize sent;
+	guint timeout_id;
+} ReplayResponse;
+
+static GHashTable* record_entries = NULL;
+static GPtrArray* record_uris = NULL;
+static Archive* replay_archive = NULL;
+static SoupServer* replay_server = NULL;
+
+typedef struct TextFile {
+	gchar* path;
+	gint fd;
+	gsize length;
+	dev_t device;
+	ino_t inode;
+	time_t mtime;
+	GMutex lock;
+	GArray* lines;
+	gsize indexed;
+	guint64 line_count;
+	gint ref_count;
+	gint closed;
+	GList* link;
+} TextFile;
+
+typedef struct TextSearch {
+	TextFile* tf;
+	gchar *path, *find;
+	gsize offset;
+	gint fd;
+} TextSearch;
+
+typedef struct SbRequest {
+	SoupRequest parent;
+	GBytes* data;
+	gchar* content_type;
+} SbRequest;
+
+typedef struct SbRequestClass {
+	SoupRequestClass parent_class;
+} SbRequestClass;
+
+static GType sb_request_get_type (void);
+#define SB_TYPE_REQUEST (sb_request_get_type ())
+#define SB_REQUEST(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), SB_TYPE_REQUEST, SbRequest))
 
 typedef struct engine {
 	char* name;
@@ -64,1047 +327,8165 @@ static engine search_engines[] = {
 	{"Duck Duck Go", "https://duckduckgo.com/?q="}
 };
 
-static void activate_uri_entry_cb (GtkWidget*, gpointer);
-static void activate_search_engine_entry_cb (GtkWidget*, gpointer);
-static void choose_search_engine_dialog ();
-static void search_engine_entry_icon_cb (GtkEntry*, GtkEntryIconPosition, GdkEvent*, gpointer);
-static void update_title (GtkWindow*);
-static void link_hover_cb (WebKitWebView*, const gchar*, const gchar*, gpointer);
+/* Origins allowed more web database space than storage_database_quota - see also --storage-quota */
+typedef struct StorageQuota {
+	char* origin;
+	guint64 quota;
+} StorageQuota;
+
+static StorageQuota storage_quotas[] = {
+	{"http://localhost", 512 * 1024 * 1024},
+};
+
+typedef struct JankScope {
+	const gchar* name;
+	Client* client;
+} JankScope;
+
+/* Marks the enclosing callback as running, for the jank monitor, until it returns */
+#define JANK_ENTER(client) gint jank_scope __attribute__ ((cleanup (jank_leave))) = jank_enter (__func__, (client))
+#define JANK_BUCKETS 6
+#define JANK_DEPTH 16
+
+/* Running callbacks, innermost last - written by the main thread, read by the watchdog */
+static JankScope jank_stack[JANK_DEPTH];
+static gint jank_depth = 0;
+static JankScope jank_stall_stack[JANK_DEPTH];
+static gint jank_stall_depth = 0;
+static gint jank_beats = 0;
+static gint jank_detected = FALSE;
+static gint64 jank_last_beat;
+static const gint jank_beat_interval = 10;
+static guint jank_histogram[JANK_BUCKETS];
+static pthread_t jank_main_thread;
+static void* volatile jank_stall_pc = NULL;
+
+static guint prerender_active = 0;
+static guint prerender_started = 0;
+static guint prerender_hits = 0;
+
+/* Command-line options */
+static gboolean show_version = FALSE;
+static gint window_count = 1;
+static gboolean memory_report = FALSE;
+static gint quit_after = 0;
+static gboolean jank_monitor = FALSE;
+static gboolean startup_time = FALSE;
+static gint64 startup_start;
+static gint64 startup_first_paint = 0;
+static gchar* render_file = NULL;
+static gchar* render_out = ".";
+static gchar* render_format = "png";
+static gint render_jobs = 0;
+static gboolean render_worker = FALSE;
+static gchar* bench_scroll_file = NULL;
+static gint soak_cycles = 0;
+static gchar* record_file = NULL;
+static gchar* replay_file = NULL;
+static gint replay_latency = -1;
+static gint replay_bandwidth = 0;
+static gint tab_processes = 0;
+static gint renderer_fd = -1;
+static gchar* profile = NULL;
+static gchar** storage_quota_options = NULL;
+static gchar* storage_clear_origin = NULL;
+static gchar* kiosk_file = NULL;
+static gchar* metrics_socket = NULL;
+static gint metrics_port = 0;
+static gboolean check_io = FALSE;
+
+static GOptionEntry option_entries[] = {
+	{"version", 'v', 0, G_OPTION_ARG_NONE, &show_version, "Print version and exit", NULL},
+	{"windows", 'w', 0, G_OPTION_ARG_INT, &window_count, "Open N windows", "N"},
+	{"memory", 'm', 0, G_OPTION_ARG_NONE, &memory_report, "Print peak resident memory on exit", NULL},
+	{"quit-after", 0, 0, G_OPTION_ARG_INT, &quit_after, "Quit S seconds after the windows are open, as if closed - for measurements", "S"},
+	{"jank", 'j', 0, G_OPTION_ARG_NONE, &jank_monitor, "Report main loop stalls, and a histogram of them on exit", NULL},
+	{"jank-threshold", 0, 0, G_OPTION_ARG_INT, &jank_threshold, "Shortest stall reported by --jank (ms)", "MS"},
+#ifdef CHECK_IO
+	{"check-io", 0, 0, G_OPTION_ARG_NONE, &check_io, "Report file I/O done on the main thread, with a backtrace", NULL},
+#endif
+	{"startup-time", 0, 0, G_OPTION_ARG_NONE, &startup_time, "Print the time until the first page has loaded, then exit", NULL},
+	{"render", 0, 0, G_OPTION_ARG_FILENAME, &render_file, "Render the urls listed in FILE to images, then exit", "FILE"},
+	{"out", 0, 0, G_OPTION_ARG_FILENAME, &render_out, "Directory for rendered pages (default .)", "DIR"},
+	{"jobs", 0, 0, G_OPTION_ARG_INT, &render_jobs, "Render with N processes (default: one per core)", "N"},
+	{"format", 0, 0, G_OPTION_ARG_STRING, &render_format, "Render to png, pdf or both (default png)", "FORMAT"},
+	{"timeout", 0, 0, G_OPTION_ARG_INT, &render_timeout, "Seconds allowed per rendered page", "S"},
+	{"bench-scroll", 0, 0, G_OPTION_ARG_FILENAME, &bench_scroll_file, "Scroll through the pages listed in FILE and print frame times as JSON", "FILE"},
+	{"soak", 0, 0, G_OPTION_ARG_INT, &soak_cycles, "Open and close a tab on URI N times, and fail if memory keeps growing", "N"},
+	{"record", 0, 0, G_OPTION_ARG_FILENAME, &record_file, "Record every HTTP response to FILE on exit, for --replay", "FILE"},
+	{"replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_file, "Serve HTTP from the recording in FILE instead of the network", "FILE"},
+	{"latency", 0, 0, G_OPTION_ARG_INT, &replay_latency, "Delay before each replayed response (default: as recorded)", "MS"},
+	{"bandwidth", 0, 0, G_OPTION_ARG_INT, &replay_bandwidth, "Limit replayed responses to KB kilobytes per second", "KB"},
+	{"smooth-scrolling", 0, 0, G_OPTION_ARG_NONE, &enablesmoothscrolling, "Enable smooth scrolling", NULL},
+	{"no-full-content-zoom", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &fullcontentzoom, "Zoom text only", NULL},
+	{"transparent", 0, 0, G_OPTION_ARG_NONE, &hidebackground, "Make the page background transparent", NULL},
+	{"tab-processes", 0, 0, G_OPTION_ARG_INT, &tab_processes, "Run tabs in up to N renderer processes", "N"},
+	{"profile", 0, 0, G_OPTION_ARG_STRING, &profile, "Keep cookies, history and site storage in profile NAME", "NAME"},
+	{"storage-quota", 0, 0, G_OPTION_ARG_STRING_ARRAY, &storage_quota_options, "Allow ORIGIN (scheme://host[:port]) MB of web databases; repeatable", "ORIGIN=MB"},
+	{"clear-storage", 0, 0, G_OPTION_ARG_STRING, &storage_clear_origin, "Delete the site storage of ORIGIN, or of all origins, then exit", "ORIGIN|all"},
+	{"kiosk", 0, 0, G_OPTION_ARG_FILENAME, &kiosk_file, "Show the pages listed in FILE full screen, one after another", "FILE"},
+	{"metrics-socket", 0, 0, G_OPTION_ARG_FILENAME, &metrics_socket, "Serve Prometheus metrics over HTTP on the Unix socket PATH", "PATH"},
+	{"metrics-port", 0, 0, G_OPTION_ARG_INT, &metrics_port, "Serve Prometheus metrics on 127.0.0.1:PORT", "PORT"},
+	{"render-worker", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &render_worker, NULL, NULL},
+	{"renderer", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &renderer_fd, NULL, NULL},
+	{NULL}
+};
+
+static void activate_uri_entry_cb (GtkWidget*, Browser*);
+static void activate_search_engine_entry_cb (GtkWidget*, Browser*);
+static void choose_search_engine_dialog (Browser*);
+static void search_engine_entry_icon_cb (GtkEntry*, GtkEntryIconPosition, GdkEvent*, Browser*);
+static void update_title (Browser*);
+static void link_hover_cb (WebKitWebView*, const gchar*, const gchar*, Client*);
 static gboolean decide_download_cb (WebKitWebView*, WebKitWebFrame*, WebKitNetworkRequest*, gchar*,  WebKitWebPolicyDecision*, gpointer);
 static gboolean init_download_cb (WebKitWebView*, WebKitDownload*, gpointer);
 
 
-static Client* create_new_client ();
+static Client* create_new_client (Browser*);
+static Client* create_client (Browser*);
+static void client_free (Client*);
+static void client_load_uri (Client*, const gchar*);
+static const gchar* client_get_uri (Client*);
+static void client_focus (Client*);
+static WebKitWebInspector* client_inspector (Client*);
+static gboolean remote_send (Client*, const gchar*, const gchar*);
+static void remote_reload (Client*);
+static void find_bar_update_status (Browser*);
+static void find_bar_show_cb (GtkWidget*, Browser*);
+static GtkWidget* create_find_bar (Browser*);
+static void prerender_discard (Browser*);
+static void prerender_hover (Browser*, const gchar*);
+static void prerender_next_page (Client*);
+static void lite_load_status (Client*, WebKitLoadStatus);
+static void lite_item_update (Browser*);
+static gboolean navigation_policy_cb (WebKitWebView*, WebKitWebFrame*, WebKitNetworkRequest*, WebKitWebNavigationAction*, WebKitWebPolicyDecision*, Client*);
+static Browser* create_browser ();
 
 /*
- * Callback to exit program
+ * Build the path of a file in sb's data directory - that of the --profile, if
+ * one was given. data_mkdir makes the directories, at startup.
  */
+static gchar*
+data_path (const gchar* name)
+{
+	gchar* dir = profile ? g_build_filename (g_get_user_data_dir (), "sb", "profiles", profile, NULL)
+						 : g_build_filename (g_get_user_data_dir (), "sb", NULL);
+	gchar* path = g_build_filename (dir, name, NULL);
+	g_free (dir);
+	return path;
+}
+
+static gboolean
+data_mkdir_job (gpointer data, GError** error)
+{
+	if (g_mkdir_with_parents (data, 0700) == 0)
+		return TRUE;
+	g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Cannot create %s: %s", (gchar*) data, g_strerror (errno));
+	return FALSE;
+}
+
 static void
-destroy_cb (GtkWidget* widget, gpointer data)
+data_mkdir_done (const GError* error, gpointer data)
 {
-	gtk_main_quit ();
+	if (error)
+		fprintf (stderr, "sb: %s\n", error->message);
+	g_free (data);
 }
 
 /*
- * Callback for activation of the url-bar - open web page in web-view
+ * Make a directory and its parents in the I/O thread - queued before the
+ * jobs that use it. WebKit makes its own directories again as it opens them.
  */
 static void
-activate_uri_entry_cb (GtkWidget* entry, gpointer data)
+data_mkdir (const gchar* path)
 {
-	const gchar* uri;
-	const gchar* temp = gtk_entry_get_text (GTK_ENTRY (entry));
-	
-	/* Append appropriate prefix */
-	if (temp[0] == '/')
-		uri = g_strdup_printf("file://%s", temp);
-	else
-		uri = g_strrstr(temp, "://") ? g_strdup(temp) : g_strdup_printf("http://%s", temp);
-	
-	webkit_web_view_load_uri (web_view, uri);
+	gchar* copy = g_strdup (path);
+	io_call (data_mkdir_job, copy, data_mkdir_done, copy);
 }
 
+/*
+ * Jank monitor (--jank): a heartbeat on the main loop and a watchdog thread.
+ * When the heartbeat stops for jank_threshold ms, the watchdog copies the
+ * callbacks that are running - pushed by JANK_ENTER at the top of callbacks,
+ * nested dispatches innermost last - and has the main thread note where it
+ * is with SIGUSR2. The stall is reported, with its full length, once the main
+ * loop gets going again.
+ */
 static void
-activate_search_engine_entry_cb (GtkWidget* entry, gpointer data)
+jank_trace_cb (int signum, siginfo_t* info, void* context)
 {
-	const gchar* uri = g_strconcat (search_engines[search_engine_current].url, gtk_entry_get_text (GTK_ENTRY (entry)), NULL);
-	g_assert (uri);
-	webkit_web_view_load_uri (web_view, uri);
+	/* Only a read - backtrace () is not safe in a signal handler */
+#ifdef REG_RIP
+	jank_stall_pc = (void*) ((ucontext_t*) context)->uc_mcontext.gregs[REG_RIP];
+#endif
 }
 
-static void
-choose_search_engine_dialog ()
+/*
+ * Push a callback onto the stack the watchdog reads. Entries are published
+ * before the depth that covers them, and each field is a single atomic store.
+ */
+static gint
+jank_enter (const gchar* name, Client* c)
 {
-	GtkWidget* dialog = gtk_dialog_new_with_buttons ("Engine...",
-													GTK_WINDOW (main_window),
-													GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-													GTK_STOCK_CANCEL,
-													GTK_RESPONSE_REJECT,
-													GTK_STOCK_OK,
-													GTK_RESPONSE_ACCEPT,
-													NULL);
-													
-	GtkWidget* vbox = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
-	
-	GtkWidget* combo_box = gtk_combo_box_text_new ();
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Google");
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Duck Duck Go");
-	gtk_combo_box_set_active (GTK_COMBO_BOX (combo_box), search_engine_current);
-	gtk_box_pack_start (GTK_BOX (vbox), combo_box, FALSE, FALSE, 10);
-	gtk_widget_show (combo_box);
+	gint depth = g_atomic_int_get (&jank_depth);
 	
-	gint result = gtk_dialog_run (GTK_DIALOG (dialog));
-	switch (result)
+	if (depth < JANK_DEPTH)
 	{
-		case GTK_RESPONSE_ACCEPT:
-			search_engine_current = gtk_combo_box_get_active (GTK_COMBO_BOX (combo_box));
-			break;
-		default:
-			break;
+		g_atomic_pointer_set (&jank_stack[depth].name, name);
+		g_atomic_pointer_set (&jank_stack[depth].client, c);
 	}
-	
-	gtk_widget_destroy (dialog);
+	g_atomic_int_set (&jank_depth, depth + 1);
+	return depth;
 }
 
 static void
-search_engine_entry_icon_cb (GtkEntry* entry, GtkEntryIconPosition icon_pos, GdkEvent* event, gpointer data)
+jank_leave (gint* depth)
 {
-	switch (icon_pos)
-	{
-		case GTK_ENTRY_ICON_PRIMARY:
-			choose_search_engine_dialog ();
-			break;
-		case GTK_ENTRY_ICON_SECONDARY:
-			activate_search_engine_entry_cb (GTK_WIDGET (entry), data);
-			break;
-	}
+	g_atomic_int_set (&jank_depth, *depth);
 }
 
 /*
- * Update the title of the window with name of web page and load progress
+ * "event" and "event-after" bracket every event a view handles, so redraws
+ * and input get a marker too - events dispatched inside one nest on the stack.
+ * The depth before the outermost one is kept with the view, and restored
+ * exactly when it is done.
  */
-static void
-update_title (GtkWindow* window)
+static gboolean
+jank_event_cb (GtkWidget* widget, GdkEvent* event, Client* c)
 {
-	GString* string = g_string_new (main_title);
-	g_string_append (string, " - sb");
-	if (load_progress < 100)
-		g_string_append_printf (string, " (%d%%)", load_progress);
-	gchar* title = g_string_free (string, FALSE);
-	gtk_window_set_title (window, title);
-	g_free (title);
+	gint depth = jank_enter (event->type == GDK_EXPOSE ? "expose" : "input event", c);
+	
+	if (c->jank_events++ == 0)
+		c->jank_event_depth = depth;
+	return FALSE;
 }
 
-/*
 static void
-tab_switched_cb (GtkNotebook* notebook, gpointer page, guint page_num, gpointer data)
+jank_event_after_cb (GtkWidget* widget, GdkEvent* event, Client* c)
 {
-	web_view = (WebKitWebView*)gtk_paned_get_child1 (GTK_PANED ( (gtk_notebook_get_nth_page (GTK_NOTEBOOK (main_book), page_num))));
-	WebKitWebFrame* frame = webkit_web_view_get_main_frame (web_view);
-	const gchar* uri = webkit_web_frame_get_uri (frame);
-	if (uri)
-		gtk_entry_set_text (GTK_ENTRY (uri_entry), uri);
-}*/
+	gint depth = g_atomic_int_get (&jank_depth) - 1;
+	
+	if (c->jank_events == 0)
+		return;
+	if (--c->jank_events == 0)
+		jank_leave (&c->jank_event_depth);
+	else if (depth >= c->jank_event_depth)
+		jank_leave (&depth);
+}
+
+/* Back to the depth before an event whose "event-after" never came */
+static gboolean
+jank_event_reset_cb (gpointer data)
+{
+	gint depth = GPOINTER_TO_INT (data);
+	
+	if (g_atomic_int_get (&jank_depth) > depth)
+		jank_leave (&depth);
+	return FALSE;
+}
 
 /*
- * Callback for hovering over a link - show in statusbar
+ * GTK sends no "event-after" to a view unrealized or closed while it handles
+ * an event - once the callbacks still running are done, drop what it pushed
  */
 static void
-link_hover_cb (WebKitWebView* page, const gchar* title, const gchar* link, gpointer data)
+jank_event_abandon (Client* c)
 {
-	/* underflow is allowed */
-	gtk_statusbar_pop (main_statusbar, status_context_id);
-	if (link)
-		gtk_statusbar_push (main_statusbar, status_context_id, link);
+	if (c->jank_events == 0)
+		return;
+	g_idle_add_full (G_PRIORITY_HIGH, jank_event_reset_cb, GINT_TO_POINTER (c->jank_event_depth), NULL);
+	c->jank_events = 0;
+}
+
+static void
+jank_unrealize_cb (GtkWidget* widget, Client* c)
+{
+	jank_event_abandon (c);
 }
 
 /*
- * Decide if the web page/file can be viewed - if not, then download it
+ * Is c still a live tab? Only then is it safe to look at.
  */
 static gboolean
-decide_download_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitNetworkRequest* request, gchar* mimetype,  WebKitWebPolicyDecision* policy_decision, gpointer data)
+jank_client_alive (Client* c)
 {
-	if (!webkit_web_view_can_show_mime_type (web_view, mimetype))
+	GList* l;
+	guint i;
+	
+	for (l = browsers; l; l = l->next)
 	{
-		webkit_web_policy_decision_download (policy_decision);
-		return TRUE;
+		Browser* b = l->data;
+		for (i = 0; i < b->clients->len; i++)
+			if (g_ptr_array_index (b->clients, i) == c)
+				return TRUE;
 	}
 	return FALSE;
 }
 
 /*
- * Start the download of a file - use the server-recommended file name
+ * Main thread: beat, and report the stall that just ended if there was one
  */
 static gboolean
-init_download_cb (WebKitWebView* web_view, WebKitDownload* download, gpointer data)
-{
-	const gchar* uri = g_strconcat ("file://", download_dir, webkit_download_get_suggested_filename (download), NULL);
-	webkit_download_set_destination_uri (download, uri);
-	return TRUE;
-}
-
-static void
-notebook_tab_close_clicked_cb (GtkButton *button, gpointer data)
+jank_beat_cb (gpointer data)
 {
-	/* Close browser if only one tab open */
-	if (gtk_notebook_get_n_pages (GTK_NOTEBOOK (main_book)) == 1)
+	gint64 now = g_get_monotonic_time ();
+	gint64 stall = (now - jank_last_beat) / 1000 - jank_beat_interval;
+	
+	jank_last_beat = now;
+	g_atomic_int_inc (&jank_beats);
+	if (stall < jank_threshold)
 	{
-		destroy_cb (main_window, NULL);
+		g_atomic_int_set (&jank_detected, FALSE);
+		return TRUE;
 	}
-	gint page_num = gtk_notebook_page_num (GTK_NOTEBOOK (main_book), GTK_WIDGET (data));
-	gtk_notebook_remove_page (GTK_NOTEBOOK (main_book), page_num);
-}
-
-static void
-notebook_tab_close_button_style_set (GtkWidget *btn, GtkRcStyle *prev_style, gpointer data)
-{
-	gint w, h;
-
-	gtk_icon_size_lookup_for_settings(gtk_widget_get_settings(btn), GTK_ICON_SIZE_MENU, &w, &h);
-	gtk_widget_set_size_request(btn, w + 2, h + 2);
-}
-
-static GtkWidget*
-create_tab_label (Client *c, const gchar *label_text)
-{
-	GtkWidget *hbox, *label, *button, *image, *align;
 	
-	hbox = gtk_hbox_new (FALSE, 2);
+	/* Bucket by powers of two above the threshold */
+	guint bucket = 0;
+	while (bucket < JANK_BUCKETS - 1 && stall >= (gint64) jank_threshold << (bucket + 1))
+		bucket++;
+	jank_histogram[bucket]++;
 	
-	label = gtk_label_new (label_text);
+	/* The watchdog wrote the stall stack before setting jank_detected */
+	gint depth = g_atomic_int_get (&jank_detected) ? MIN (jank_stall_depth, JANK_DEPTH) : 0;
+	const gchar* name = depth ? jank_stall_stack[depth - 1].name : NULL;
+	Client* c = depth ? jank_stall_stack[depth - 1].client : NULL;
+	const gchar* uri = c && jank_client_alive (c) ? client_get_uri (c) : NULL;
+	void* pc = jank_stall_pc;
 	
-	button = gtk_button_new ();
-	gtk_button_set_relief (GTK_BUTTON (button), GTK_RELIEF_NONE);
-	gtk_button_set_focus_on_click (GTK_BUTTON (button), FALSE);
-	gtk_widget_set_name (button, "sb-close-tab-button");
-		
-	image = gtk_image_new_from_stock (GTK_STOCK_CLOSE, GTK_ICON_SIZE_MENU);
-	gtk_container_add (GTK_CONTAINER (button), image);
-	
-	align = gtk_alignment_new (1.0, 0.5, 0.0, 0.0);
-	gtk_container_add (GTK_CONTAINER (align), button);
-	gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
-	gtk_box_pack_start (GTK_BOX (hbox), align, TRUE, TRUE, 0);
-	
-	g_signal_connect (button, "clicked", G_CALLBACK (notebook_tab_close_clicked_cb), c->pane);
-	g_signal_connect (button, "style-set", G_CALLBACK (notebook_tab_close_button_style_set), NULL);
-	
-	gtk_widget_show_all (hbox);
+	flight_record (FLIGHT_STALL, 0, uri ? c->flight_id : 0, stall);
+	metrics_add (METRIC_STALLS, 1);
+	metrics_add (METRIC_STALL_MS, stall);
+	fprintf (stderr, "sb: main loop stalled %" G_GINT64_FORMAT " ms in %s%s%s\n", stall,
+			 name ? name : "(main loop)", uri ? " for " : "", uri ? uri : "");
+	while (--depth > 0)
+		fprintf (stderr, "  inside %s\n", jank_stall_stack[depth - 1].name);
+	if (pc)
+		backtrace_symbols_fd (&pc, 1, STDERR_FILENO);
 	
-	return hbox;
+	jank_stall_pc = NULL;
+	g_atomic_int_set (&jank_detected, FALSE);
+	return TRUE;
 }
 
-static WebKitWebView*
-create_new_tab (WebKitWebView  *v, WebKitWebFrame *f, Client *c)
+/*
+ * Watchdog thread: notice a stall while it is still going on
+ */
+static gpointer
+jank_watchdog_thread (gpointer data)
 {
-	Client* n;
-	GtkWidget* hbox;
-	const gchar* label_text;
+	gint beats = g_atomic_int_get (&jank_beats);
+	gint64 changed = g_get_monotonic_time ();
 	
-	n = create_new_client ();
+	while (TRUE)
+	{
+		g_usleep (jank_threshold * 1000 / 4);
 		
-	label_text = webkit_web_frame_get_name (f);
-	
-	hbox = create_tab_label (n, label_text);
-	
-	gtk_notebook_append_page (GTK_NOTEBOOK (main_book), n->pane, hbox);
-	gtk_notebook_set_tab_reorderable (GTK_NOTEBOOK (main_book), n->pane, TRUE);
-	gtk_widget_show_all (n->pane);
-	if (!openinbackground)
-		gtk_notebook_set_current_page (GTK_NOTEBOOK(main_book), gtk_notebook_get_n_pages (GTK_NOTEBOOK(main_book)) - 1);
-	current_client = n;
-	return n->view;
+		gint64 now = g_get_monotonic_time ();
+		if (g_atomic_int_get (&jank_beats) != beats)
+		{
+			beats = g_atomic_int_get (&jank_beats);
+			changed = now;
+		}
+		else if (now - changed > (jank_threshold + jank_beat_interval) * 1000 && !g_atomic_int_get (&jank_detected))
+		{
+			gint i;
+			
+			jank_stall_depth = g_atomic_int_get (&jank_depth);
+			for (i = 0; i < MIN (jank_stall_depth, JANK_DEPTH); i++)
+			{
+				jank_stall_stack[i].name = g_atomic_pointer_get (&jank_stack[i].name);
+				jank_stall_stack[i].client = g_atomic_pointer_get (&jank_stack[i].client);
+			}
+			g_atomic_int_set (&jank_detected, TRUE);
+			pthread_kill (jank_main_thread, SIGUSR2);
+		}
+	}
+	return NULL;
 }
 
-static WebKitWebView*
-inspector_new (WebKitWebInspector* i, WebKitWebView* v, Client* c)
+static void
+jank_init (void)
 {
-	return WEBKIT_WEB_VIEW (webkit_web_view_new ());
+	struct sigaction action;
+	
+	jank_main_thread = pthread_self ();
+	memset (&action, 0, sizeof action);
+	action.sa_sigaction = jank_trace_cb;
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset (&action.sa_mask);
+	sigaction (SIGUSR2, &action, NULL);
+	
+	jank_last_beat = g_get_monotonic_time ();
+	g_timeout_add_full (G_PRIORITY_HIGH, jank_beat_interval, jank_beat_cb, NULL, NULL);
+	g_thread_unref (g_thread_new ("sb-jank-watchdog", jank_watchdog_thread, NULL));
 }
 
-static gboolean
-inspector_show (WebKitWebInspector *i, Client *c)
+/*
+ * Summary of all stalls, on exit
+ */
+static void
+jank_report (void)
 {
-	WebKitWebView *w;
-
-	if (c->isinspecting)
-		return false;
-
-	w = webkit_web_inspector_get_web_view (i);
-	gtk_paned_pack2 (GTK_PANED (c->pane), GTK_WIDGET (w), TRUE, TRUE);
-	gtk_widget_show(GTK_WIDGET (w));
-	c->isinspecting = true;
-
-	return true;
+	guint i, total = 0;
+	
+	for (i = 0; i < JANK_BUCKETS; i++)
+		total += jank_histogram[i];
+	fprintf (stderr, "sb: %u main loop stall(s) over %d ms\n", total, jank_threshold);
+	for (i = 0; i < JANK_BUCKETS; i++)
+	{
+		if (i < JANK_BUCKETS - 1)
+			fprintf (stderr, "  %6d - %6d ms: %u\n", jank_threshold << i, jank_threshold << (i + 1), jank_histogram[i]);
+		else
+			fprintf (stderr, "  %6d+         ms: %u\n", jank_threshold << i, jank_histogram[i]);
+	}
 }
 
-static gboolean
-inspector_close (WebKitWebInspector *i, Client *c)
+/*
+ * Step a statement, retrying while another connection holds the database
+ */
+static int
+cookie_step (sqlite3_stmt* stmt)
 {
-	GtkWidget *w;
-
-	if (!c->isinspecting)
-		return false;
-
-	w = GTK_WIDGET (webkit_web_inspector_get_web_view(i));
-	gtk_widget_hide (w);
-	gtk_widget_destroy (w);
-	c->isinspecting = false;
-
-	return true;
+	guint tries = 0;
+	int rc;
+	
+	while ((rc = sqlite3_step (stmt)) == SQLITE_BUSY && tries++ < cookie_busy_retries)
+	{
+		sqlite3_reset (stmt);
+		g_usleep (cookie_busy_delay * 1000);
+	}
+	sqlite3_reset (stmt);
+	return rc;
 }
 
-static void
-inspector_finished (WebKitWebInspector *i, Client *c)
+static int
+cookie_exec (const gchar* sql)
 {
-	g_free (c->inspector);
+	guint tries = 0;
+	int rc;
+	
+	while ((rc = sqlite3_exec (cookie_db, sql, NULL, NULL, NULL)) == SQLITE_BUSY && tries++ < cookie_busy_retries)
+		g_usleep (cookie_busy_delay * 1000);
+	return rc;
 }
 
 static void
-inspector (GtkCheckMenuItem *checkmenuitem, gpointer data)
+cookie_change_free (CookieChange* change)
 {
-	if (gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (checkmenuitem)))
-	{
-		inspector_close (current_client->inspector, current_client);
-	} else
-	{
-		inspector_new (current_client->inspector, web_view, current_client);
-	}
+	if (change->old_cookie)
+		soup_cookie_free (change->old_cookie);
+	if (change->new_cookie)
+		soup_cookie_free (change->new_cookie);
+	g_slice_free (CookieChange, change);
 }
 
 /*
- * Callback for a change in the title of a web page - update window title
+ * Open the database and read the stored cookies into data, a GPtrArray. Runs
+ * in the I/O thread, like everything else that touches the database.
  */
-static void
-title_change_cb (WebKitWebView* web_view, WebKitWebFrame* web_frame, const gchar* title, gpointer data)
-{
-	if (main_title)
-		g_free (main_title);
-	main_title = g_strdup (title);
-	update_title (GTK_WINDOW (main_window));
-}
-
-/*
- * Callback for change in progress of a page being loaded - update title of window
- *
-static void
-progress_change_cb (WebKitWebView* web_view, gint progress, gpointer data)
-{
-	load_progress = progress;
-	update_title (GTK_WINDOW (main_window));
-}*/
-
-static void
-progress_change_cb (WebKitWebView *view, GParamSpec *pspec, Client *c)
+static gboolean
+cookie_open_job (gpointer data, GError** error)
 {
-	c->progress = webkit_web_view_get_progress(c->view) * 100;
+	GPtrArray* cookies = data;
+	gchar* path = data_path (cookie_file);
+	sqlite3_stmt* stmt;
+	time_t now = time (NULL);
+	
+	if (sqlite3_open (path, &cookie_db) != SQLITE_OK)
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot open cookie database %s", path);
+		sqlite3_close (cookie_db);
+		cookie_db = NULL;
+		g_free (path);
+		return FALSE;
+	}
+	g_free (path);
+	
+	cookie_exec ("PRAGMA journal_mode=WAL;"
+				"PRAGMA synchronous=NORMAL;"
+				"CREATE TABLE IF NOT EXISTS moz_cookies (id INTEGER PRIMARY KEY, name TEXT, value TEXT, "
+				"host TEXT, path TEXT, expiry INTEGER, lastAccessed INTEGER, isSecure INTEGER, isHttpOnly INTEGER);"
+				"CREATE UNIQUE INDEX IF NOT EXISTS moz_cookies_key ON moz_cookies (host, name, path);");
+	sqlite3_prepare_v2 (cookie_db, "DELETE FROM moz_cookies WHERE host = ?1 AND name = ?2 AND path = ?3", -1, &cookie_delete_stmt, NULL);
+	sqlite3_prepare_v2 (cookie_db, "INSERT OR REPLACE INTO moz_cookies (name, value, host, path, expiry, isSecure, isHttpOnly) "
+							"VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)", -1, &cookie_insert_stmt, NULL);
+	sqlite3_prepare_v2 (cookie_db, "DELETE FROM moz_cookies WHERE expiry <= ?1", -1, &cookie_purge_stmt, NULL);
+	
+	if (sqlite3_prepare_v2 (cookie_db, "SELECT name, value, host, path, expiry, isSecure, isHttpOnly "
+							"FROM moz_cookies WHERE expiry > ?1", -1, &stmt, NULL) != SQLITE_OK)
+		return TRUE;
+	
+	sqlite3_bind_int64 (stmt, 1, (sqlite3_int64) now);
+	while (sqlite3_step (stmt) == SQLITE_ROW)
+	{
+		SoupCookie* cookie = soup_cookie_new ((const char*) sqlite3_column_text (stmt, 0),
+											(const char*) sqlite3_column_text (stmt, 1),
+											(const char*) sqlite3_column_text (stmt, 2),
+											(const char*) sqlite3_column_text (stmt, 3),
+											(int) (sqlite3_column_int64 (stmt, 4) - now));
+		soup_cookie_set_secure (cookie, sqlite3_column_int (stmt, 5));
+		soup_cookie_set_http_only (cookie, sqlite3_column_int (stmt, 6));
+		g_ptr_array_add (cookies, cookie);
+	}
+	sqlite3_finalize (stmt);
+	return TRUE;
 }
 
 /*
- * Callback for a change in the load status of a web view
+ * Purge expired cookies
  */
-static void
-load_status_change_cb (WebKitWebView* web_view, gpointer data)
+static gboolean
+cookie_purge_job (gpointer data, GError** error)
 {
-	WebKitWebFrame* frame;
-	GtkWidget* hbox;
-	const gchar *uri, *label;
+	if (!cookie_db)
+		return TRUE;
 	
-	switch (webkit_web_view_get_load_status (web_view))
+	sqlite3_bind_int64 (cookie_purge_stmt, 1, (sqlite3_int64) time (NULL));
+	if (cookie_step (cookie_purge_stmt) != SQLITE_DONE)
 	{
-		case WEBKIT_LOAD_COMMITTED:
-			/* Update uri in entry-bar */
-			frame = webkit_web_view_get_main_frame (web_view);
-			uri = webkit_web_frame_get_uri (frame);
-			label = webkit_web_frame_get_name (frame);
-			if (uri)
-				gtk_entry_set_text (GTK_ENTRY (uri_entry), uri);
-			/* Update tab-label */
-			hbox = create_tab_label (current_client, label);
-			gtk_notebook_set_tab_label (GTK_NOTEBOOK (main_book), current_client->pane, hbox);
-			break;
-		case WEBKIT_LOAD_FINISHED:
-			break;
-		default:
-			break;
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot purge cookies: %s", sqlite3_errmsg (cookie_db));
+		return FALSE;
 	}
-	
-	/* Update buttons - back, forward */
-	gtk_widget_set_sensitive (GTK_WIDGET (back_button), webkit_web_view_can_go_back (web_view));
-	gtk_widget_set_sensitive (GTK_WIDGET (forward_button), webkit_web_view_can_go_forward (web_view));
+	return TRUE;
 }
 
 /*
- * Callback for file.open - open file-chooser dialog and open selected file in webview
+ * Write a batch of cookie changes to the database in a single transaction.
+ * If any of it fails, none of it is written, and the batch is kept for the
+ * next try.
  */
-static void
-openfile_cb (GtkWidget* widget, gpointer data)
+static gboolean
+cookie_write_job (gpointer data, GError** error)
 {
-	GtkWidget* file_dialog = gtk_file_chooser_dialog_new ("Open File",
-														GTK_WINDOW (main_window),
-														GTK_FILE_CHOOSER_ACTION_OPEN,
-														"Cancel", GTK_RESPONSE_CANCEL,
-														"Open", GTK_RESPONSE_ACCEPT,
-														NULL);
-	
-	/* Add filters to dialog - all and html files */
-	GtkFileFilter* filter = gtk_file_filter_new ();
-	gtk_file_filter_set_name (filter, "All files");
-	gtk_file_filter_add_pattern (filter, "*");
-	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (file_dialog), filter);
+	GPtrArray* changes = data;
+	int rc = SQLITE_DONE;
+	guint i;
 	
-	filter = gtk_file_filter_new ();
-	gtk_file_filter_set_name (filter, "HTML files");
-	gtk_file_filter_add_mime_type (filter, "text/html");
-	gtk_file_filter_add_pattern (filter, "*.htm");
-	gtk_file_filter_add_pattern (filter, "*.html");
-	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (file_dialog), filter);
+	if (!cookie_db)
+		return TRUE;
 	
-	/* Run the dialog and check result. If a file was selected, open it in the web-view. */							
-	if (gtk_dialog_run (GTK_DIALOG (file_dialog)) == GTK_RESPONSE_ACCEPT)
+	/* Take the write lock now - a busy database is waited for here, not half way through */
+	if (cookie_exec ("BEGIN IMMEDIATE") != SQLITE_OK)
 	{
-		gchar *filename;
-		filename = g_strdup_printf("file://%s", gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)));
-		webkit_web_view_load_uri (web_view, filename);
-		g_free (filename);
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot write cookies: %s", sqlite3_errmsg (cookie_db));
+		return FALSE;
+	}
+	for (i = 0; i < changes->len && rc == SQLITE_DONE; i++)
+	{
+		CookieChange* change = g_ptr_array_index (changes, i);
+		SoupCookie* cookie = change->old_cookie;
+		
+		if (cookie)
+		{
+			sqlite3_bind_text (cookie_delete_stmt, 1, soup_cookie_get_domain (cookie), -1, SQLITE_STATIC);
+			sqlite3_bind_text (cookie_delete_stmt, 2, soup_cookie_get_name (cookie), -1, SQLITE_STATIC);
+			sqlite3_bind_text (cookie_delete_stmt, 3, soup_cookie_get_path (cookie), -1, SQLITE_STATIC);
+			rc = cookie_step (cookie_delete_stmt);
+		}
+		
+		/* Session cookies are not persisted */
+		cookie = change->new_cookie;
+		if (rc == SQLITE_DONE && cookie && soup_cookie_get_expires (cookie))
+		{
+			sqlite3_bind_text (cookie_insert_stmt, 1, soup_cookie_get_name (cookie), -1, SQLITE_STATIC);
+			sqlite3_bind_text (cookie_insert_stmt, 2, soup_cookie_get_value (cookie), -1, SQLITE_STATIC);
+			sqlite3_bind_text (cookie_insert_stmt, 3, soup_cookie_get_domain (cookie), -1, SQLITE_STATIC);
+			sqlite3_bind_text (cookie_insert_stmt, 4, soup_cookie_get_path (cookie), -1, SQLITE_STATIC);
+			sqlite3_bind_int64 (cookie_insert_stmt, 5, (sqlite3_int64) soup_date_to_time_t (soup_cookie_get_expires (cookie)));
+			sqlite3_bind_int (cookie_insert_stmt, 6, soup_cookie_get_secure (cookie));
+			sqlite3_bind_int (cookie_insert_stmt, 7, soup_cookie_get_http_only (cookie));
+			rc = cookie_step (cookie_insert_stmt);
+		}
 	}
 	
-	gtk_widget_destroy (file_dialog);
+	if (rc != SQLITE_DONE || cookie_exec ("COMMIT") != SQLITE_OK)
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot write cookies: %s", sqlite3_errmsg (cookie_db));
+		cookie_exec ("ROLLBACK");
+		return FALSE;
+	}
+	return TRUE;
 }
 
+static gboolean cookie_flush_cb (gpointer);
+
 /*
- * Open print dialog for the current web page
+ * A batch is written, or it failed - then it goes back in front of the
+ * changes made since, to be written with them
  */
 static void
-print_cb (GtkWidget* widget, gpointer data)
+cookie_written_cb (const GError* error, gpointer data)
 {
-	webkit_web_frame_print (webkit_web_view_get_main_frame (web_view));
+	GPtrArray* changes = data;
+	guint i;
+	
+	if (!error)
+	{
+		g_ptr_array_free (changes, TRUE);
+		return;
+	}
+	fprintf (stderr, "sb: %s - will try again\n", error->message);
+	for (i = 0; i < cookie_changes->len; i++)
+		g_ptr_array_add (changes, g_ptr_array_index (cookie_changes, i));
+	g_free (g_ptr_array_free (cookie_changes, FALSE));
+	cookie_changes = changes;
+	
+	if (!cookie_flush_id)
+		cookie_flush_id = g_timeout_add_seconds (cookie_flush_interval, cookie_flush_cb, NULL);
 }
 
-/*
- * Callback for edit.cut - cut current selection
- */
 static void
-cut_cb (GtkWidget* widget, gpointer data)
+cookie_purged_cb (const GError* error, gpointer data)
 {
-	webkit_web_view_cut_clipboard (web_view);
+	if (error)
+		fprintf (stderr, "sb: %s\n", error->message);
 }
 
 /*
- * Callback for edit.copy - copy current selection
+ * Hand the pending cookie changes to the I/O thread
  */
-static void
-copy_cb (GtkWidget* widget, gpointer data)
+static gboolean
+cookie_flush_cb (gpointer data)
 {
-	webkit_web_view_copy_clipboard (web_view);
+	JANK_ENTER (NULL);
+	cookie_flush_id = 0;
+	
+	if (cookie_changes->len > 0)
+	{
+		io_call (cookie_write_job, cookie_changes, cookie_written_cb, cookie_changes);
+		cookie_changes = g_ptr_array_new_with_free_func ((GDestroyNotify) cookie_change_free);
+	}
+	
+	return FALSE;
 }
 
-/*
- * Callback for edit.paste - paste current selection
- */
-static void
-paste_cb (GtkWidget* widget, gpointer data)
+static gboolean
+cookie_purge_cb (gpointer data)
 {
-	webkit_web_view_paste_clipboard (web_view);
+	io_call (cookie_purge_job, NULL, cookie_purged_cb, NULL);
+	return TRUE;
 }
 
-/* 
- * Callback for edit.delete - delete current selection
+/*
+ * Queue a change to the cookie jar - written out with the next batch
  */
 static void
-delete_cb (GtkWidget* widget, gpointer data)
+cookie_changed_cb (SoupCookieJar* jar, SoupCookie* old_cookie, SoupCookie* new_cookie, gpointer data)
 {
-	webkit_web_view_delete_selection (web_view);
+	CookieChange* change = g_slice_new (CookieChange);
+	change->old_cookie = old_cookie ? soup_cookie_copy (old_cookie) : NULL;
+	change->new_cookie = new_cookie ? soup_cookie_copy (new_cookie) : NULL;
+	g_ptr_array_add (cookie_changes, change);
+	
+	if (!cookie_flush_id)
+		cookie_flush_id = g_timeout_add_seconds (cookie_flush_interval, cookie_flush_cb, NULL);
 }
 
 /*
- * Dialog to search for text in current web-view
+ * The stored cookies are read - put them in the jar, and start recording
+ * changes to it
  */
 static void
-find_dialog_cb (GtkWidget* widget, gpointer data)
+cookie_opened_cb (const GError* error, gpointer data)
 {
-	GtkWidget* dialog = gtk_dialog_new_with_buttons ("Find",
-													GTK_WINDOW (main_window),
-													GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-													GTK_STOCK_CANCEL,
-													GTK_RESPONSE_REJECT,
-													GTK_STOCK_FIND,
-													GTK_RESPONSE_ACCEPT,
-													NULL);
+	GPtrArray* cookies = data;
+	guint i;
 	
-	/* Get area for entry and toggles, and get the find button */
-	GtkWidget* content_area = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
-	GtkWidget* find_button = gtk_dialog_get_widget_for_response (GTK_DIALOG (dialog), GTK_RESPONSE_ACCEPT);
+	cookie_loading = FALSE;
+	if (error)
+		fprintf (stderr, "sb: %s\n", error->message);
 	
-	/* Set "Find" button as default button */
-	gtk_widget_set_can_default (find_button, TRUE);
-	gtk_widget_grab_default (find_button);
+	for (i = 0; i < cookies->len; i++)
+		soup_cookie_jar_add_cookie (cookie_jar, g_ptr_array_index (cookies, i));
+	g_ptr_array_free (cookies, TRUE);
 	
-	/* Create a hbox to hold label and entry */
-	GtkWidget* hbox = gtk_hbox_new (FALSE, 0);
-	GtkWidget* label = gtk_label_new ("Find what:");
+	if (error)
+		return;
+	g_signal_connect (G_OBJECT (cookie_jar), "changed", G_CALLBACK (cookie_changed_cb), NULL);
 	
-	/* Set up entry - entry activation activates the find button as well */
-	GtkWidget* find_entry = gtk_entry_new_with_buffer (GTK_ENTRY_BUFFER (search_buffer));
-	gtk_entry_set_activates_default (GTK_ENTRY (find_entry), TRUE);
-	
-	/* Pack label and entry into hbox */
-	gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 5);
-	gtk_box_pack_start (GTK_BOX (hbox), find_entry, FALSE, FALSE, 5);
-	
-	/* Pack hbox into the content area */
-	gtk_box_pack_start (GTK_BOX (content_area), hbox, FALSE, FALSE, 5);
-	
-	/* Set up toggles for matching case, searching forward, and wrapping the search */
-	GtkWidget* case_button = gtk_check_button_new_with_label ("Match case");
-	gtk_box_pack_start (GTK_BOX (content_area), case_button, FALSE, FALSE, 5);
-	
-	GtkWidget* find_forward_button = gtk_check_button_new_with_label ("Search forward");
-	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (find_forward_button), TRUE);
-	gtk_box_pack_start (GTK_BOX (content_area), find_forward_button, FALSE, FALSE, 5);
-	
-	GtkWidget* wrap_button = gtk_check_button_new_with_label ("Wrap search");
-	gtk_box_pack_start (GTK_BOX (content_area), wrap_button, FALSE, FALSE, 5);
-	
-	/* Show all widgets */
-	gtk_widget_show (label);
-	gtk_widget_show (find_entry);
-	gtk_widget_show (hbox);
-	gtk_widget_show (case_button);
-	gtk_widget_show (wrap_button);
-	gtk_widget_show (find_forward_button);
-	
-	/* Run dialog and check result */
-	gint result = gtk_dialog_run (GTK_DIALOG (dialog));
-	switch (result)
-	{
-		/* "Find" button was pressed/activated - perform search */
-		case GTK_RESPONSE_ACCEPT:
-			webkit_web_view_search_text (web_view,
-										gtk_entry_get_text (GTK_ENTRY (find_entry)),
-										gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (case_button)),
-										gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (find_forward_button)),
-										gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wrap_button)));
-			break;
-		/* Cancelled or closed - do nothing */
-		default:
-			break;
-	}
-
-	/* Destroy the dialog */
-	gtk_widget_destroy (dialog);
+	/* Purge expired cookies now, then periodically */
+	cookie_purge_cb (NULL);
+	g_timeout_add_seconds (cookie_purge_interval, cookie_purge_cb, NULL);
 }
 
 /*
- * Zoom in web-view by 10%
+ * Attach a persistent cookie jar to the shared session. Cookies are looked up
+ * in memory; the database is read, and changes are written to it in
+ * batches, by the I/O thread.
  */
 static void
-zoom_in_cb (GtkWidget* widget, gpointer data)
+cookie_jar_init ()
 {
-	webkit_web_view_zoom_in (web_view);
+	cookie_jar = soup_cookie_jar_new ();
+	soup_session_add_feature (webkit_get_default_session (), SOUP_SESSION_FEATURE (cookie_jar));
+	cookie_changes = g_ptr_array_new_with_free_func ((GDestroyNotify) cookie_change_free);
+	
+	cookie_loading = TRUE;
+	io_call (cookie_open_job, g_ptr_array_new (), cookie_opened_cb, NULL);
 }
 
 /*
- * Zoom out web-view by 10%
+ * Wait for the stored cookies - before the first page is requested
  */
 static void
-zoom_out_cb (GtkWidget* widget, gpointer data)
+cookie_jar_wait ()
 {
-	webkit_web_view_zoom_out (web_view);
+	if (cookie_loading)
+		io_flush ();
 }
 
-/*
- * Reset zoom level to 100%
- */
-static void
-zoom_reset_cb (GtkWidget* widget, gpointer data)
+static gboolean
+cookie_close_job (gpointer data, GError** error)
 {
-	webkit_web_view_set_zoom_level (web_view, 1.0);
+	sqlite3_finalize (cookie_delete_stmt);
+	sqlite3_finalize (cookie_insert_stmt);
+	sqlite3_finalize (cookie_purge_stmt);
+	sqlite3_close (cookie_db);
+	cookie_db = NULL;
+	return TRUE;
 }
 
+/*
+ * Write out pending cookie changes and wait for the I/O thread to finish them
+ */
 static void
-fullscreen_cb (GtkWidget* widget, gpointer data)
+cookie_jar_close ()
 {
-	if (!fullscreen)
-	{
-		gtk_window_fullscreen (GTK_WINDOW (main_window));
-		fullscreen = TRUE;
-	} else
+	if (!cookie_jar)
+		return;
+	
+	if (cookie_flush_id)
 	{
-		gtk_window_unfullscreen (GTK_WINDOW (main_window));
-		fullscreen = FALSE;
+		g_source_remove (cookie_flush_id);
+		cookie_flush_id = 0;
 	}
+	cookie_flush_cb (NULL);
+	io_call (cookie_close_job, NULL, NULL, NULL);
+	io_flush ();
+	cookie_jar = NULL;
 }
 
 /*
- * Settings dialog - set smooth-scrolling, private browsing, useragent
+ * Write the pages visited lately to the history index, even if there are not
+ * enough of them for a full segment yet
+ */
+static gboolean
+history_flush_cb (gpointer data)
+{
+	history_index_flush (history_index);
+	return TRUE;
+}
+
+/*
+ * Open the history index. Pages are added once loaded and written in the
+ * background; segments are merged by the writer as they pile up.
  */
 static void
-settings_dialog_cb (GtkWidget* widget, gpointer data)
+history_init ()
 {
-	GtkWidget* dialog = gtk_dialog_new_with_buttons ("sb Settings",
-													GTK_WINDOW (main_window),
-													GTK_DIALOG_DESTROY_WITH_PARENT,
-													GTK_STOCK_CANCEL,
-													GTK_RESPONSE_REJECT,
-													GTK_STOCK_OK,
-													GTK_RESPONSE_ACCEPT,
-													NULL);
-	
-	GtkWidget* vbox = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
-	WebKitWebSettings* settings = webkit_web_view_get_settings (web_view);
-	gboolean isactive = FALSE;
-	
-	/* Check-button to control smooth-scrolling */
-	GtkWidget* smooth_scrolling_button = gtk_check_button_new_with_label ("Enable smooth-scrolling");
-	g_object_get (G_OBJECT (settings), "enable-smooth-scrolling", &isactive, NULL);
-	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (smooth_scrolling_button), isactive);
-	gtk_box_pack_start (GTK_BOX (vbox), smooth_scrolling_button, TRUE, TRUE, 2);
-	gtk_widget_show (smooth_scrolling_button);
-	
-	/* Check-button to control private browsing */
-	GtkWidget* private_browsing_button = gtk_check_button_new_with_label ("Enable private browsing");
-	g_object_get (G_OBJECT (settings), "enable-private-browsing", &isactive, NULL);
-	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (private_browsing_button), isactive);
-	gtk_box_pack_start (GTK_BOX (vbox), private_browsing_button, TRUE, TRUE, 2);
-	gtk_widget_show (private_browsing_button);
-	
-	/* Combox-box to choose the useragent to use */
-	GtkWidget* combo_box = gtk_combo_box_text_new ();
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "sb (Default)");
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Firefox");
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Chrome");
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Internet Explorer");
-	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Mobile");
-	gtk_combo_box_set_active (GTK_COMBO_BOX (combo_box), 0);
-	gtk_box_pack_start (GTK_BOX (vbox), combo_box, FALSE, FALSE, 5);
-	gtk_widget_show (combo_box);
-	
-	gint result = gtk_dialog_run (GTK_DIALOG (dialog));
-	switch (result)
-	{
-		case GTK_RESPONSE_ACCEPT:
-			/* Set smooth-scrolling from selection */
-			g_object_set (G_OBJECT (settings), "enable-smooth-scrolling", gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (smooth_scrolling_button)), NULL);
-			
-			/* Set private browsing from selection */
-			g_object_set (G_OBJECT (settings), "enable-private-browsing", gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (private_browsing_button)), NULL);
-						
-			/* Set user-agent from selection */
-			g_object_set (G_OBJECT (settings), "user-agent", useragents[gtk_combo_box_get_active (GTK_COMBO_BOX (combo_box))], NULL);
-			webkit_web_view_set_settings (WEBKIT_WEB_VIEW(web_view), settings);
-			
-			break;
-		default:
-			break;
-	}
+	gchar* path = data_path (history_index_dir);
 	
-	/* Destroy the dialog */
-	gtk_widget_destroy (dialog);
+	history_index = history_index_open (path, history_index_flush_pages, history_index_merge_segments);
+	g_timeout_add_seconds (history_index_flush_interval, history_flush_cb, NULL);
+	g_free (path);
 }
 
 /*
- * Callback for about menu item - open about dialog
+ * Write out the pages not yet in the history index and wait for the writer
  */
 static void
-about_cb (GtkWidget* widget, gpointer data)
+history_close ()
 {
-	GtkWidget* about_dialog = gtk_about_dialog_new ();
-	
-	const gchar *authors[] = {"David Luco", "<dluco11@gmail.com>", NULL};
-	
-	/* Set program name and comments */
-	gtk_about_dialog_set_program_name (GTK_ABOUT_DIALOG (about_dialog), "sb");
-	gtk_about_dialog_set_comments (GTK_ABOUT_DIALOG (about_dialog), "A simple webkit/gtk browser, in the style of surf and midori");
-	
-	/* Set logo to display in dialog */
-	gtk_about_dialog_set_logo_icon_name (GTK_ABOUT_DIALOG (about_dialog), "web-browser");
-	/* Set taskbar/window icon */
-	gtk_window_set_icon_name (GTK_WINDOW (about_dialog), "web-browser");
-	
-	/* Set authors, license, and website in dialog */
-	gtk_about_dialog_set_authors (GTK_ABOUT_DIALOG (about_dialog), authors);
-	gtk_about_dialog_set_license (GTK_ABOUT_DIALOG (about_dialog), "Distributed under the MIT license.\nhttp://www.opensource.org/licenses/mit-license.php");
-	gtk_about_dialog_set_website (GTK_ABOUT_DIALOG (about_dialog), "http://dluco.github.io/sb/");
-	
-	gtk_dialog_run (GTK_DIALOG (about_dialog));
+	if (!history_index)
+		return;
 	
-	gtk_widget_destroy (about_dialog);
+	history_index_close (history_index);
+	history_index = NULL;
 }
 
 /*
- * Callback for back button
+ * Add a loaded page to the history index - web pages only, and at most
+ * history_index_page_limit bytes of their text
  */
 static void
-go_back_cb (GtkWidget* widget, gpointer data)
+history_add (WebKitWebView* web_view, const gchar* text, gsize length)
 {
-	webkit_web_view_go_back (web_view);
+	const gchar* uri = webkit_web_view_get_uri (web_view);
+	
+	if (!history_index || !uri || (!g_str_has_prefix (uri, "http://") && !g_str_has_prefix (uri, "https://")))
+		return;
+	
+	history_index_add (history_index, uri, webkit_web_view_get_title (web_view), text, MIN (length, history_index_page_limit));
 }
 
+
 /*
- * Callback for forward button
+ * Name of an origin as written in --storage-quota: scheme://host[:port], the
+ * port only if it is not the default
  */
-static void
-go_forward_cb (GtkWidget* widget, gpointer data)
+static gchar*
+storage_origin_name (WebKitSecurityOrigin* origin)
 {
-	webkit_web_view_go_forward (web_view);
+	guint port = webkit_security_origin_get_port (origin);
+	
+	if (port)
+		return g_strdup_printf ("%s://%s:%u", webkit_security_origin_get_protocol (origin), webkit_security_origin_get_host (origin), port);
+	return g_strdup_printf ("%s://%s", webkit_security_origin_get_protocol (origin), webkit_security_origin_get_host (origin));
 }
 
 /*
- * Callback for refresh button - reload web page
+ * The web database quota configured for an origin, or 0 if it has none of
+ * its own - --storage-quota takes precedence over storage_quotas
  */
-static void
-refresh_cb (GtkWidget* widget, gpointer data)
+static guint64
+storage_origin_quota (const gchar* origin)
 {
-	webkit_web_view_reload (web_view);
+	gsize length = strlen (origin);
+	guint i;
+	
+	for (i = 0; storage_quota_options && storage_quota_options[i]; i++)
+		if (strncmp (storage_quota_options[i], origin, length) == 0 && storage_quota_options[i][length] == '=')
+			return g_ascii_strtoull (storage_quota_options[i] + length + 1, NULL, 10) * 1024 * 1024;
+	for (i = 0; i < G_N_ELEMENTS (storage_quotas); i++)
+		if (strcmp (storage_quotas[i].origin, origin) == 0)
+			return storage_quotas[i].quota;
+	return 0;
 }
 
 /*
- * Callback for home button - open home page
+ * Callback for a site running out of web database space - raise its quota if
+ * one is configured for it. WebKit retries the write once this returns.
  */
 static void
-home_cb (GtkWidget* widget, gpointer data)
+database_quota_exceeded_cb (WebKitWebView* web_view, GObject* frame, GObject* database, gpointer data)
 {
-	webkit_web_view_load_uri (web_view, home_page);
+	WebKitSecurityOrigin* origin = webkit_web_database_get_security_origin (WEBKIT_WEB_DATABASE (database));
+	gchar* name = storage_origin_name (origin);
+	guint64 quota = storage_origin_quota (name);
+	
+	if (quota > webkit_security_origin_get_web_database_quota (origin))
+		webkit_security_origin_set_web_database_quota (origin, quota);
+	g_free (name);
 }
 
 /*
- * Apply default settings to web-view
+ * Set up HTML5 storage for the profile: web databases, local storage and the
+ * application cache are kept under its storage_dir, so sites keep their data
+ * across restarts and profiles share none of it. Run
+ * in renderer processes too, since WebKit's storage settings are global to a
+ * process.
  */
 static void
-set_settings (WebKitWebView* web_view)
+storage_init ()
 {
-	WebKitWebSettings *settings = webkit_web_settings_new ();
+	gchar* storage = data_path (storage_dir);
 	
-	/* Apply default settings from config.h */
-	g_object_set (G_OBJECT (settings), "user-agent", useragents[user_agent_current], NULL);
-	g_object_set (G_OBJECT (settings), "auto-load-images", loadimages, NULL);
-	g_object_set (G_OBJECT (settings), "enable-plugins", enableplugins, NULL);
-	g_object_set (G_OBJECT (settings), "enable-scripts", enablescripts, NULL);
-	g_object_set (G_OBJECT (settings), "enable-spatial-navigation", enablespatialbrowsing, NULL);
-	g_object_set (G_OBJECT (settings), "enable-spell-checking", enablespellchecking, NULL);
-	g_object_set (G_OBJECT (settings), "enable-file-access-from-file-uris", TRUE, NULL);
-	g_object_set (G_OBJECT (settings), "enable-developer-extras", enableinspector, NULL);
+	storage_database_path = g_build_filename (storage, "databases", NULL);
+	storage_local_path = g_build_filename (storage, "localstorage", NULL);
+	storage_appcache_path = g_build_filename (storage, "appcache", NULL);
+	data_mkdir (storage_database_path);
+	data_mkdir (storage_local_path);
+	data_mkdir (storage_appcache_path);
 	
-	if (hidebackground)
-		webkit_web_view_set_transparent(web_view, TRUE);
-		
-	if (fullcontentzoom)
-		webkit_web_view_set_full_content_zoom(web_view, TRUE);
+	webkit_set_web_database_directory_path (storage_database_path);
+	webkit_set_default_web_database_quota (storage_database_quota);
+	webkit_application_cache_set_database_directory_path (storage_appcache_path);
+	webkit_application_cache_set_maximum_size (storage_appcache_size);
 	
-	/* Apply settings */
-	webkit_web_view_set_settings (WEBKIT_WEB_VIEW (web_view), settings);
+	g_free (storage);
 }
 
 /*
- * Set up menubar - file, edit, options, and help menus
+ * WebKit names the storage of an origin scheme_host_port, the port 0 if it is
+ * the default one. Returns the origin as scheme://host[:port].
  */
-static GtkWidget*
-create_menubar ()
+static gchar*
+storage_origin_from_id (const gchar* id)
 {
-	/* Create menubar */
-	GtkWidget* menu_bar = gtk_menu_bar_new ();
-	gtk_widget_show (menu_bar);
+	const gchar* host = strchr (id, '_');
+	const gchar* port = strrchr (id, '_');
 	
-	/* Create File, Edit, and Help Menus */
-	GtkWidget* file_menu = gtk_menu_new ();
-	GtkWidget* edit_menu = gtk_menu_new ();
-	GtkWidget* view_menu = gtk_menu_new ();
-	GtkWidget* tools_menu = gtk_menu_new ();
+	if (!host || port == host)
+		return g_strdup (id);
+	if (strcmp (port, "_0") == 0)
+		return g_strdup_printf ("%.*s://%.*s", (int) (host - id), id, (int) (port - host - 1), host + 1);
+	return g_strdup_printf ("%.*s://%.*s:%s", (int) (host - id), id, (int) (port - host - 1), host + 1, port + 1);
+}
+
+/* The storage id of an origin given as scheme://host[:port], or NULL */
+static gchar*
+storage_origin_to_id (const gchar* origin)
+{
+	SoupURI* uri = soup_uri_new (origin);
+	gchar* id;
+	
+	if (!uri || !uri->host)
+	{
+		if (uri)
+			soup_uri_free (uri);
+		return NULL;
+	}
+	id = g_strdup_printf ("%s_%s_%u", uri->scheme, uri->host, soup_uri_uses_default_port (uri) ? 0 : uri->port);
+	soup_uri_free (uri);
+	return id;
+}
+
+/* Total size of the files in a directory, not counting subdirectories */
+static guint64
+storage_directory_size (const gchar* path)
+{
+	GDir* dir = g_dir_open (path, 0, NULL);
+	const gchar* name;
+	guint64 size = 0;
+	
+	while (dir && (name = g_dir_read_name (dir)))
+	{
+		gchar* file = g_build_filename (path, name, NULL);
+		GStatBuf info;
+		
+		if (g_stat (file, &info) == 0 && S_ISREG (info.st_mode))
+			size += info.st_size;
+		g_free (file);
+	}
+	if (dir)
+		g_dir_close (dir);
+	return size;
+}
+
+/* Delete a directory and the files in it */
+static void
+storage_remove_directory (const gchar* path)
+{
+	GDir* dir = g_dir_open (path, 0, NULL);
+	const gchar* name;
+	
+	while (dir && (name = g_dir_read_name (dir)))
+	{
+		gchar* file = g_build_filename (path, name, NULL);
+		g_unlink (file);
+		g_free (file);
+	}
+	if (dir)
+		g_dir_close (dir);
+	g_rmdir (path);
+}
+
+/*
+ * --clear-storage: delete the web databases and local storage of an origin,
+ * or of every origin and the application cache too. Runs before any page is
+ * open, so WebKit holds none of the files.
+ */
+static int
+storage_clear_main (const gchar* origin)
+{
+	gchar* databases = g_strdup (webkit_get_web_database_directory_path ());
+	gchar *id, *path;
+	sqlite3* tracker;
+	
+	if (strcmp (origin, "all") == 0)
+	{
+		GDir* dir = g_dir_open (storage_local_path, 0, NULL);
+		const gchar* name;
+		
+		webkit_remove_all_web_databases ();
+		while (dir && (name = g_dir_read_name (dir)))
+		{
+			path = g_build_filename (storage_local_path, name, NULL);
+			g_unlink (path);
+			g_free (path);
+		}
+		if (dir)
+			g_dir_close (dir);
+		path = g_build_filename (storage_appcache_path, "ApplicationCache.db", NULL);
+		g_unlink (path);
+		g_free (path);
+		printf ("Deleted all site storage\n");
+		g_free (databases);
+		return 0;
+	}
+	
+	if (!(id = storage_origin_to_id (origin)))
+	{
+		fprintf (stderr, "Not an origin: %s (expected scheme://host[:port] or all)\n", origin);
+		g_free (databases);
+		return 1;
+	}
+	
+	/* Web databases, and their entries in WebKit's tracker */
+	path = g_build_filename (databases, id, NULL);
+	storage_remove_directory (path);
+	g_free (path);
+	path = g_build_filename (databases, "Databases.db", NULL);
+	if (sqlite3_open_v2 (path, &tracker, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK)
+	{
+		gchar* sql = sqlite3_mprintf ("DELETE FROM Databases WHERE origin = %Q; DELETE FROM Origins WHERE origin = %Q;", id, id);
+		sqlite3_exec (tracker, sql, NULL, NULL, NULL);
+		sqlite3_free (sql);
+	}
+	sqlite3_close (tracker);
+	g_free (path);
+	
+	/* Local storage */
+	gchar* name = g_strconcat (id, ".localstorage", NULL);
+	path = g_build_filename (storage_local_path, name, NULL);
+	g_unlink (path);
+	g_free (path);
+	g_free (name);
+	
+	printf ("Deleted the site storage of %s\n", origin);
+	g_free (id);
+	g_free (databases);
+	return 0;
+}
+
+/*
+ * Set up the favicon database - WebKit stores icons on disk under the XDG cache
+ * directory, so they come back without network access on later visits
+ */
+static void
+favicon_init ()
+{
+	gchar* path = g_build_filename (g_get_user_cache_dir (), "sb", "icons", NULL);
+	data_mkdir (path);
+	webkit_favicon_database_set_path (webkit_get_favicon_database (), path);
+	favicon_db_path = g_build_filename (path, "WebpageIcons.db", NULL);
+	g_free (path);
+	
+	favicons = g_hash_table_new (g_str_hash, g_str_equal);
+	favicon_pages = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+/*
+ * Remember which icon a page has, most recently used first - the least
+ * recently used page is forgotten beyond favicon_page_limit
+ */
+static void
+favicon_page_remember (const gchar* page_uri, const gchar* hash)
+{
+	FaviconPage* page = g_hash_table_lookup (favicon_pages, page_uri);
+	
+	if (page)
+	{
+		g_free (page->hash);
+		g_queue_unlink (&favicon_page_lru, page->link);
+	} else
+	{
+		page = g_slice_new (FaviconPage);
+		page->uri = g_strdup (page_uri);
+		page->link = g_list_alloc ();
+		page->link->data = page;
+		g_hash_table_insert (favicon_pages, page->uri, page);
+	}
+	page->hash = g_strdup (hash);
+	g_queue_push_head_link (&favicon_page_lru, page->link);
+	
+	while (favicon_page_lru.length > favicon_page_limit)
+	{
+		FaviconPage* old = g_queue_pop_tail (&favicon_page_lru);
+		g_hash_table_remove (favicon_pages, old->uri);
+		g_free (old->uri);
+		g_free (old->hash);
+		g_slice_free (FaviconPage, old);
+	}
+}
+
+/*
+ * Look up the decoded icon with this hash in memory
+ */
+static Favicon*
+favicon_lookup_hash (const gchar* hash)
+{
+	Favicon* icon = g_hash_table_lookup (favicons, hash);
+	
+	if (!icon)
+		return NULL;
+	
+	/* Most recently used first */
+	g_queue_unlink (&favicon_lru, icon->link);
+	g_queue_push_head_link (&favicon_lru, icon->link);
+	
+	return icon;
+}
+
+/*
+ * Look up the decoded favicon of a page in memory
+ */
+static Favicon*
+favicon_lookup (const gchar* page_uri)
+{
+	FaviconPage* page = g_hash_table_lookup (favicon_pages, page_uri);
+	Favicon* icon = page ? favicon_lookup_hash (page->hash) : NULL;
+	
+	if (icon)
+	{
+		g_queue_unlink (&favicon_page_lru, page->link);
+		g_queue_push_head_link (&favicon_page_lru, page->link);
+	}
+	return icon;
+}
+
+/*
+ * Keep a decoded favicon in memory under the hash of its stored bytes, so
+ * identical icons are decoded and stored once; the least recently used icons
+ * are dropped beyond favicon_cache_size. An icon not stored yet is kept under
+ * the hash of its pixels, provisionally, until favicon_rekey. Returns the
+ * pixbuf to use, owned by the cache.
+ */
+static GdkPixbuf*
+favicon_store (const gchar* page_uri, const gchar* hash, GdkPixbuf* pixbuf, gboolean provisional)
+{
+	gsize size = gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+	Favicon* icon = g_slice_new (Favicon);
+	
+	icon->hash = g_strdup (hash);
+	icon->pixbuf = g_object_ref (pixbuf);
+	icon->size = size;
+	icon->provisional = provisional;
+	g_queue_push_head (&favicon_lru, icon);
+	icon->link = favicon_lru.head;
+	g_hash_table_insert (favicons, icon->hash, icon);
+	favicon_cache_bytes += size;
+	favicon_page_remember (page_uri, hash);
+	
+	while (favicon_cache_bytes > favicon_cache_size && favicon_lru.length > 1)
+	{
+		Favicon* old = g_queue_pop_tail (&favicon_lru);
+		g_hash_table_remove (favicons, old->hash);
+		favicon_cache_bytes -= old->size;
+		g_object_unref (old->pixbuf);
+		g_free (old->hash);
+		g_slice_free (Favicon, old);
+	}
+	
+	return icon->pixbuf;
+}
+
+/*
+ * The stored bytes of a provisional icon have been read - key it by their
+ * hash from now on, like every other icon. Pages remembered under the old
+ * key find it again through the database.
+ */
+static void
+favicon_rekey (Favicon* icon, const gchar* hash)
+{
+	g_hash_table_remove (favicons, icon->hash);
+	g_free (icon->hash);
+	icon->hash = g_strdup (hash);
+	icon->provisional = FALSE;
+	g_hash_table_insert (favicons, icon->hash, icon);
+}
+
+/*
+ * Read the stored icon of a page from WebKit's database, and hash it - runs
+ * in the I/O thread, which alone uses favicon_db
+ */
+static gboolean
+favicon_read_job (gpointer data, GError** error)
+{
+	FaviconRead* read = data;
+	sqlite3_stmt* stmt;
+	
+	if (!favicon_db && sqlite3_open_v2 (favicon_db_path, &favicon_db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		sqlite3_close (favicon_db);
+		favicon_db = NULL;
+		return TRUE;
+	}
+	if (sqlite3_prepare_v2 (favicon_db, "SELECT IconData.data FROM PageURL, IconData "
+		"WHERE PageURL.url = ?1 AND IconData.iconID = PageURL.iconID", -1, &stmt, NULL) != SQLITE_OK)
+		return TRUE;
+	sqlite3_bind_text (stmt, 1, read->page_uri, -1, SQLITE_STATIC);
+	if (sqlite3_step (stmt) == SQLITE_ROW && sqlite3_column_bytes (stmt, 0) > 0)
+	{
+		read->data = g_bytes_new (sqlite3_column_blob (stmt, 0), sqlite3_column_bytes (stmt, 0));
+		read->hash = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, read->data);
+	}
+	sqlite3_finalize (stmt);
+	return TRUE;
+}
+
+/*
+ * Decode stored icon bytes at the size of a menu icon
+ */
+static GdkPixbuf*
+favicon_decode (GBytes* data, gint w, gint h)
+{
+	GdkPixbufLoader* loader = gdk_pixbuf_loader_new ();
+	GdkPixbuf* pixbuf = NULL;
+	gsize size;
+	const guchar* bytes = g_bytes_get_data (data, &size);
+	
+	gdk_pixbuf_loader_set_size (loader, w, h);
+	if (gdk_pixbuf_loader_write (loader, bytes, size, NULL) && gdk_pixbuf_loader_close (loader, NULL))
+		pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+	else
+		gdk_pixbuf_loader_close (loader, NULL);
+	g_object_unref (loader);
+	return pixbuf;
+}
+
+/*
+ * The stored icon of a page has been read - decode it only if no identical
+ * icon is in memory yet
+ */
+static void
+favicon_read_cb (const GError* error, gpointer data)
+{
+	FaviconRead* read = data;
+	Client* c = read->c;
+	const gchar* uri;
+	GdkPixbuf *pixbuf = NULL, *decoded = NULL;
+	Favicon* icon;
+	gint w, h;
+	
+	/* The tab may be gone, or on another page by now */
+	if (!jank_client_alive (c) || !(uri = webkit_web_view_get_uri (c->view)) || strcmp (uri, read->page_uri) != 0)
+		goto out;
+	
+	gtk_icon_size_lookup (GTK_ICON_SIZE_MENU, &w, &h);
+	if (read->hash && (icon = favicon_lookup_hash (read->hash)))
+	{
+		metrics_add (METRIC_FAVICON_HITS, 1);
+		favicon_page_remember (uri, read->hash);
+		pixbuf = icon->pixbuf;
+	}
+	/* Shown before it was stored - the same icon, now under its real key */
+	else if (read->hash && (icon = favicon_lookup (uri)) && icon->provisional)
+	{
+		metrics_add (METRIC_FAVICON_HITS, 1);
+		favicon_rekey (icon, read->hash);
+		favicon_page_remember (uri, read->hash);
+		pixbuf = icon->pixbuf;
+	}
+	else if (read->hash && (decoded = favicon_decode (read->data, w, h)))
+		pixbuf = favicon_store (uri, read->hash, decoded, FALSE);
+	/*
+	 * WebKit writes its database a few seconds after an icon arrives - until
+	 * then only WebKit's own decoded copy exists, so it is kept under the
+	 * hash of its pixels, provisionally
+	 */
+	else if (!read->hash && (decoded = webkit_favicon_database_try_get_favicon_pixbuf (webkit_get_favicon_database (), uri, w, h)))
+	{
+		gchar* hash = g_compute_checksum_for_data (G_CHECKSUM_SHA1, gdk_pixbuf_get_pixels (decoded),
+			gdk_pixbuf_get_rowstride (decoded) * gdk_pixbuf_get_height (decoded));
+		if ((icon = favicon_lookup_hash (hash)))
+		{
+			favicon_page_remember (uri, hash);
+			pixbuf = icon->pixbuf;
+		}
+		else
+			pixbuf = favicon_store (uri, hash, decoded, TRUE);
+		g_free (hash);
+	}
+	if (decoded)
+	{
+		metrics_add (METRIC_FAVICON_MISSES, 1);
+		g_object_unref (decoded);
+	}
+	if (pixbuf)
+		gtk_image_set_from_pixbuf (GTK_IMAGE (c->icon), pixbuf);
+	
+out:
+	if (read->data)
+		g_bytes_unref (read->data);
+	g_free (read->hash);
+	g_free (read->page_uri);
+	g_slice_free (FaviconRead, read);
+}
+
+/*
+ * Show the favicon of a client's page in its tab label, if it is known -
+ * from memory first, then from WebKit's database, read in the I/O thread.
+ * A provisional icon is shown, and read again until its stored bytes are.
+ */
+static void
+update_favicon (Client* c)
+{
+	const gchar* uri = webkit_web_view_get_uri (c->view);
+	Favicon* icon = uri ? favicon_lookup (uri) : NULL;
+	
+	if (icon)
+	{
+		metrics_add (METRIC_FAVICON_HITS, 1);
+		gtk_image_set_from_pixbuf (GTK_IMAGE (c->icon), icon->pixbuf);
+		if (!icon->provisional)
+			return;
+	}
+	else
+		gtk_image_set_from_stock (GTK_IMAGE (c->icon), GTK_STOCK_FILE, GTK_ICON_SIZE_MENU);
+	if (uri)
+	{
+		FaviconRead* read = g_slice_new0 (FaviconRead);
+		read->c = c;
+		read->page_uri = g_strdup (uri);
+		io_call (favicon_read_job, read, favicon_read_cb, read);
+	}
+}
+
+/*
+ * Callback for the favicon of a page becoming available
+ */
+static void
+icon_loaded_cb (WebKitWebView* web_view, const gchar* icon_uri, Client* c)
+{
+	JANK_ENTER (c);
+	update_favicon (c);
+}
+
+/*
+ * Build the path of an offline archive - the directory is made when one is written
+ */
+static gchar*
+archive_path (const gchar* name)
+{
+	gchar* dir = data_path ("archives");
+	gchar* file = g_strconcat (name, ".sbar", NULL);
+	gchar* path = g_build_filename (dir, file, NULL);
+	g_free (file);
+	g_free (dir);
+	return path;
+}
+
+static void
+archive_free (Archive* archive)
+{
+	guint i;
+	
+	for (i = 0; i < archive->entries->len; i++)
+	{
+		ArchiveEntry* entry = &g_array_index (archive->entries, ArchiveEntry, i);
+		g_free (entry->mime);
+		g_free (entry->uri);
+	}
+	g_array_free (archive->entries, TRUE);
+	g_hash_table_destroy (archive->index);
+	g_mapped_file_unref (archive->file);
+	g_slice_free (Archive, archive);
+}
+
+/*
+ * Open an archive file - it is memory-mapped and only its index is parsed.
+ * Archives stay open once used.
+ *
+ * Format: a text header, then the resources back to back:
+ *   SBAR 2
+ *   <count>
+ *   <offset> <length> <header length> <status> <msec> <mime> <uri>   (count lines)
+ *   <empty line>
+ *   <data>
+ * Offsets are relative to the data. Each resource is its HTTP response
+ * headers ("Name: value\r\n" lines, header length bytes) followed by the
+ * body. Version 1 files have no header length and no headers.
+ */
+static Archive*
+archive_load (const gchar* path)
+{
+	Archive* archive;
+	GMappedFile* file;
+	gchar *p, *end, *eol;
+	guint64 i, count;
+	guint version, fields;
+	
+	if (!archives)
+		archives = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) archive_free);
+	if ((archive = g_hash_table_lookup (archives, path)))
+		return archive;
+	
+	if (!(file = g_mapped_file_new (path, FALSE, NULL)))
+		return NULL;
+	
+	p = g_mapped_file_get_contents (file);
+	end = p + g_mapped_file_get_length (file);
+	if (end - p < 7 || strncmp (p, "SBAR ", 5) != 0 || (p[5] != '1' && p[5] != '2') || p[6] != '\n')
+	{
+		g_mapped_file_unref (file);
+		return NULL;
+	}
+	version = p[5] - '0';
+	fields = version == 1 ? 6 : 7;
+	p += 7;
+	
+	archive = g_slice_new (Archive);
+	archive->file = file;
+	archive->entries = g_array_new (FALSE, TRUE, sizeof (ArchiveEntry));
+	archive->index = g_hash_table_new (g_str_hash, g_str_equal);
+	
+	count = g_ascii_strtoull (p, &p, 10);
+	if (p < end && *p == '\n')
+		p++;
+	for (i = 0; i < count && p < end; i++)
+	{
+		ArchiveEntry entry;
+		gchar** values;
+		gchar* line;
+		
+		if (!(eol = memchr (p, '\n', end - p)))
+			break;
+		line = g_strndup (p, eol - p);
+		values = g_strsplit (line, " ", fields);
+		g_free (line);
+		p = eol + 1;
+		
+		if (g_strv_length (values) == fields)
+		{
+			gchar** v = values;
+			entry.offset = g_ascii_strtoull (*v++, NULL, 10);
+			entry.length = g_ascii_strtoull (*v++, NULL, 10);
+			entry.header_length = version == 1 ? 0 : g_ascii_strtoull (*v++, NULL, 10);
+			entry.status = g_ascii_strtoull (*v++, NULL, 10);
+			entry.msec = g_ascii_strtoull (*v++, NULL, 10);
+			entry.mime = g_strdup (*v++);
+			entry.uri = g_strdup (*v++);
+			entry.data = NULL;
+			g_array_append_val (archive->entries, entry);
+		}
+		g_strfreev (values);
+	}
+	
+	/* The data follows the empty line after the index */
+	if (p < end && *p == '\n')
+		p++;
+	archive->data = p;
+	archive->length = end - p;
+	
+	for (i = 0; i < archive->entries->len; i++)
+	{
+		ArchiveEntry* entry = &g_array_index (archive->entries, ArchiveEntry, i);
+		
+		/* Drop entries pointing outside the file */
+		if (entry->offset > archive->length || entry->length > archive->length - entry->offset)
+			entry->length = 0;
+		entry->header_length = MIN (entry->header_length, entry->length);
+		
+		/* The first response recorded for a uri wins */
+		if (!g_hash_table_lookup (archive->index, entry->uri))
+			g_hash_table_insert (archive->index, entry->uri, GUINT_TO_POINTER (i + 1));
+	}
+	
+	g_hash_table_insert (archives, g_strdup (path), archive);
+	return archive;
+}
+
+/*
+ * Open an offline archive by name
+ */
+static Archive*
+archive_open (const gchar* name)
+{
+	/* Archive names are plain file names in the archive directory */
+	if (strchr (name, '/') || name[0] == '.')
+		return NULL;
+	
+	gchar* path = archive_path (name);
+	Archive* archive = archive_load (path);
+	g_free (path);
+	return archive;
+}
+
+/*
+ * Body of an archived resource, straight from the mapped file
+ */
+static GBytes*
+archive_body (Archive* archive, ArchiveEntry* entry)
+{
+	return g_bytes_new_with_free_func (archive->data + entry->offset + entry->header_length, entry->length - entry->header_length,
+									   (GDestroyNotify) g_mapped_file_unref, g_mapped_file_ref (archive->file));
+}
+
+/*
+ * Value of a recorded response header, in a static buffer, or NULL
+ */
+static const gchar*
+archive_header (Archive* archive, ArchiveEntry* entry, const gchar* name)
+{
+	static gchar value[1024];
+	const gchar *p = archive->data + entry->offset, *end = p + entry->header_length, *eol;
+	gsize length = strlen (name);
+	
+	for (; p < end; p = eol + 1)
+	{
+		if (!(eol = memchr (p, '\n', end - p)))
+			break;
+		if ((gsize) (eol - p) > length + 1 && p[length] == ':' && g_ascii_strncasecmp (p, name, length) == 0)
+		{
+			const gchar *start = p + length + 1, *stop = eol;
+			while (start < stop && *start == ' ')
+				start++;
+			while (stop > start && (stop[-1] == '\r' || stop[-1] == ' '))
+				stop--;
+			g_strlcpy (value, start, MIN ((gsize) (stop - start) + 1, sizeof value));
+			return value;
+		}
+	}
+	return NULL;
+}
+
+
+
+/*
+ * Serve sb://archive/<name>[/<n>] - resource n (default the page itself) of an
+ * offline archive, straight from the mapped file
+ */
+static gboolean
+archive_page (SoupURI* uri, GBytes** data, gchar** content_type, GError** error)
+{
+	gchar** parts = g_strsplit (uri->path[0] == '/' ? uri->path + 1 : uri->path, "/", 2);
+	guint64 n = parts[0] && parts[1] ? g_ascii_strtoull (parts[1], NULL, 10) : 0;
+	Archive* archive;
+	
+	/* Served from a worker thread - the body holds the mapping, not the archive */
+	g_mutex_lock (&archives_lock);
+	archive = parts[0] ? archive_open (parts[0]) : NULL;
+	g_strfreev (parts);
+	if (!archive || n >= archive->entries->len)
+	{
+		g_mutex_unlock (&archives_lock);
+		g_set_error (error, SOUP_REQUEST_ERROR, SOUP_REQUEST_ERROR_BAD_URI, "No such offline page: %s", uri->path);
+		return FALSE;
+	}
+	
+	ArchiveEntry* entry = &g_array_index (archive->entries, ArchiveEntry, n);
+	*data = archive_body (archive, entry);
+	*content_type = g_strdup (entry->mime);
+	g_mutex_unlock (&archives_lock);
+	
+	return TRUE;
+}
+
+/*
+ * Point requests for resources of an archived page at the archive
+ */
+static void
+archive_resource_request (WebKitWebView* web_view, WebKitNetworkRequest* request)
+{
+	const gchar* page = webkit_web_view_get_uri (web_view);
+	const gchar* uri = webkit_network_request_get_uri (request);
+	
+	if (!page || !g_str_has_prefix (page, "sb://archive/") || g_str_has_prefix (uri, "sb:"))
+		return;
+	
+	gchar** parts = g_strsplit (page + strlen ("sb://archive/"), "/", 2);
+	g_mutex_lock (&archives_lock);
+	Archive* archive = archive_open (parts[0]);
+	guint n = archive ? GPOINTER_TO_UINT (g_hash_table_lookup (archive->index, uri)) : 0;
+	g_mutex_unlock (&archives_lock);
+	
+	if (n > 0)
+	{
+		gchar* local = g_strdup_printf ("sb://archive/%s/%u", parts[0], n - 1);
+		webkit_network_request_set_uri (request, local);
+		g_free (local);
+	}
+	g_strfreev (parts);
+}
+
+/*
+ * Lay out an archive - for offline pages, the page first, then its subresources
+ */
+static GBytes*
+archive_build (GPtrArray* resources)
+{
+	GString* index = g_string_new ("SBAR 2\n");
+	GString* data = g_string_new (NULL);
+	guint i;
+	
+	g_string_append_printf (index, "%u\n", resources->len);
+	for (i = 0; i < resources->len; i++)
+	{
+		ArchiveEntry* entry = g_ptr_array_index (resources, i);
+		g_string_append_printf (index, "%" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT " %u %u %s %s\n",
+								data->len, entry->length, entry->header_length, entry->status, entry->msec,
+								entry->mime && entry->mime[0] ? entry->mime : "application/octet-stream", entry->uri);
+		g_string_append_len (data, entry->data, entry->length);
+	}
+	g_string_append_c (index, '\n');
+	g_string_append_len (index, data->str, data->len);
+	g_string_free (data, TRUE);
+	
+	return g_string_free_to_bytes (index);
+}
+
+/*
+ * Write an archive file at once - on exit, when nothing else is waiting
+ */
+static gboolean
+archive_write_file (const gchar* path, GPtrArray* resources, GError** error)
+{
+	GBytes* archive = archive_build (resources);
+	gsize length;
+	const gchar* data = g_bytes_get_data (archive, &length);
+	gboolean ok = g_file_set_contents (path, data, length, error);
+	
+	g_bytes_unref (archive);
+	return ok;
+}
+
+/* An offline page being written by the I/O thread */
+typedef struct ArchiveSave {
+	Browser* b;
+	gchar *name, *path;
+	guint resources;
+} ArchiveSave;
+
+static void
+archive_saved_cb (const GError* error, gpointer data)
+{
+	ArchiveSave* save = data;
+	gchar* message = error ? g_strdup_printf ("Cannot save page: %s", error->message)
+		: g_strdup_printf ("Saved for offline reading as sb://archive/%s (%u resources)", save->name, save->resources);
+	
+	/* Reopen it next time */
+	g_mutex_lock (&archives_lock);
+	if (archives)
+		g_hash_table_remove (archives, save->path);
+	g_mutex_unlock (&archives_lock);
+	
+	/* The window may be gone by now */
+	if (g_list_find (browsers, save->b))
+	{
+		gtk_statusbar_pop (save->b->statusbar, save->b->status_context_id);
+		gtk_statusbar_push (save->b->statusbar, save->b->status_context_id, message);
+	}
+	g_free (message);
+	g_free (save->name);
+	g_free (save->path);
+	g_free (save);
+}
+
+/*
+ * Write an archive in the background - the status bar tells how it went
+ */
+static void
+archive_write (Browser* b, const gchar* name, GPtrArray* resources)
+{
+	ArchiveSave* save = g_new0 (ArchiveSave, 1);
+	GBytes* archive = archive_build (resources);
+	
+	save->b = b;
+	save->name = g_strdup (name);
+	save->path = archive_path (name);
+	save->resources = resources->len;
+	io_write (save->path, archive, archive_saved_cb, save);
+	g_bytes_unref (archive);
+}
+
+/*
+ * Archive name for a page - its host and a hash of its uri
+ */
+static gchar*
+archive_name (const gchar* uri)
+{
+	SoupURI* soup_uri = soup_uri_new (uri);
+	gchar* hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+	gchar* name = g_strdup_printf ("%s-%.12s", soup_uri && soup_uri->host ? soup_uri->host : "page", hash);
+	
+	g_strdelimit (name, "/\\:", '_');
+	if (soup_uri)
+		soup_uri_free (soup_uri);
+	g_free (hash);
+	return name;
+}
+
+/*
+ * Insert <base href="uri"> into a page, so its relative links resolve against
+ * the original location when it is served from an archive
+ */
+static GString*
+archive_rebase (const gchar* html, gsize length, const gchar* uri)
+{
+	GString* page = g_string_new_len (html, length);
+	gchar* escaped = g_markup_escape_text (uri, -1);
+	gchar* base = g_strdup_printf ("<base href=\"%s\">", escaped);
+	gsize pos = 0, i;
+	
+	/* After the opening <head> tag if there is one, else at the start */
+	for (i = 0; i + 5 < length; i++)
+	{
+		if (html[i] == '<' && g_ascii_strncasecmp (html + i + 1, "head", 4) == 0
+			&& (html[i + 5] == '>' || g_ascii_isspace (html[i + 5])))
+		{
+			const gchar* close = memchr (html + i, '>', length - i);
+			if (close)
+				pos = close - html + 1;
+			break;
+		}
+	}
+	g_string_insert (page, pos, base);
+	
+	g_free (base);
+	g_free (escaped);
+	return page;
+}
+
+/*
+ * Large local files: sb://file/<path>[?offset=N|line=N][&find=TEXT]
+ *
+ * The file is read with pread and served text_page_size bytes at a time as
+ * HTML, so a page of a multi-GB log costs as much as a page of a small one.
+ * It is not mapped: logs are truncated and rotated while they are read, and
+ * a mapping of a file that shrank faults instead of coming up short. A
+ * background thread records the offset of every text_line_stride-th line for
+ * line numbers and jumps; paging by offset and searching work without it.
+ * Searches run in a thread of their own and stream the page back. The
+ * text_file_limit most recently used files stay open - until they change on
+ * disk - and a file is closed once it is dropped from those and no thread
+ * uses it any more.
+ */
+static GHashTable* text_files = NULL;
+static GQueue text_file_lru = G_QUEUE_INIT;
+static GMutex text_files_lock;
+
+static void
+text_file_unref (TextFile* tf)
+{
+	if (!g_atomic_int_dec_and_test (&tf->ref_count))
+		return;
+	close (tf->fd);
+	g_array_free (tf->lines, TRUE);
+	g_mutex_clear (&tf->lock);
+	g_free (tf->path);
+	g_free (tf);
+}
+
+/*
+ * Read up to size bytes at offset - fewer at the end of the file, which may
+ * have become shorter than when it was opened
+ */
+static gsize
+text_file_read (TextFile* tf, gsize offset, gchar* buffer, gsize size)
+{
+	gsize done = 0;
+	gssize n;
+	
+	while (done < size)
+	{
+		if ((n = pread (tf->fd, buffer + done, size - done, offset + done)) > 0)
+			done += n;
+		else if (n == 0 || errno != EINTR)
+			break;
+	}
+	return done;
+}
+
+/*
+ * Background thread: index the line starts of a file, until it is dropped
+ */
+static gpointer
+text_file_index_thread (gpointer data)
+{
+	TextFile* tf = data;
+	gchar* buffer = g_malloc (text_read_size);
+	const gchar *p, *end, *nl;
+	guint64 line = 0;
+	gsize at = 0, n;
+	gboolean open_line = FALSE;
+	
+	while (at < tf->length && !g_atomic_int_get (&tf->closed))
+	{
+		if (!(n = text_file_read (tf, at, buffer, MIN (text_read_size, tf->length - at))))
+			break;
+		for (p = buffer, end = buffer + n; p < end && (nl = memchr (p, '\n', end - p)); p = nl + 1)
+		{
+			if (++line % text_line_stride == 0)
+			{
+				gsize offset = at + (nl + 1 - buffer);
+				g_mutex_lock (&tf->lock);
+				g_array_append_val (tf->lines, offset);
+				tf->indexed = offset;
+				g_mutex_unlock (&tf->lock);
+			}
+		}
+		open_line = p < end;
+		at += n;
+	}
+	
+	g_mutex_lock (&tf->lock);
+	if (!g_atomic_int_get (&tf->closed))
+	{
+		tf->indexed = tf->length;
+		tf->line_count = line + (open_line ? 1 : 0);
+	}
+	g_mutex_unlock (&tf->lock);
+	g_free (buffer);
+	text_file_unref (tf);
+	return NULL;
+}
+
+/* Forget a file - threads still using it keep it open. Under text_files_lock. */
+static void
+text_file_drop (TextFile* tf)
+{
+	g_queue_delete_link (&text_file_lru, tf->link);
+	g_hash_table_remove (text_files, tf->path);
+	g_atomic_int_set (&tf->closed, 1);
+	text_file_unref (tf);
+}
+
+/*
+ * Open a file, and start indexing it on first use - or again, once it has
+ * changed on disk. Returns a reference, and drops the least recently used
+ * file beyond text_file_limit.
+ */
+static TextFile*
+text_file_open (const gchar* path, GError** error)
+{
+	TextFile* tf;
+	GStatBuf info;
+	gsize zero = 0;
+	gint fd;
+	
+	g_mutex_lock (&text_files_lock);
+	if (!text_files)
+		text_files = g_hash_table_new (g_str_hash, g_str_equal);
+	if ((tf = g_hash_table_lookup (text_files, path)))
+	{
+		if (g_stat (path, &info) == 0 && info.st_dev == tf->device && info.st_ino == tf->inode
+			&& (gsize) info.st_size == tf->length && info.st_mtime == tf->mtime)
+		{
+			g_queue_unlink (&text_file_lru, tf->link);
+			g_queue_push_head_link (&text_file_lru, tf->link);
+			g_atomic_int_inc (&tf->ref_count);
+			g_mutex_unlock (&text_files_lock);
+			return tf;
+		}
+		text_file_drop (tf);
+	}
+	
+	if ((fd = g_open (path, O_RDONLY | O_CLOEXEC, 0)) < 0 || fstat (fd, &info) != 0)
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Cannot open %s: %s", path, g_strerror (errno));
+		if (fd >= 0)
+			close (fd);
+		g_mutex_unlock (&text_files_lock);
+		return NULL;
+	}
+	
+	tf = g_new0 (TextFile, 1);
+	tf->path = g_strdup (path);
+	tf->fd = fd;
+	tf->length = info.st_size;
+	tf->device = info.st_dev;
+	tf->inode = info.st_ino;
+	tf->mtime = info.st_mtime;
+	tf->lines = g_array_new (FALSE, FALSE, sizeof (gsize));
+	g_array_append_val (tf->lines, zero);
+	g_mutex_init (&tf->lock);
+	/* One for the table, one for the index thread, one for the caller */
+	tf->ref_count = 3;
+	g_hash_table_insert (text_files, tf->path, tf);
+	g_queue_push_head (&text_file_lru, tf);
+	tf->link = text_file_lru.head;
+	
+	while (text_file_lru.length > text_file_limit)
+		text_file_drop (g_queue_peek_tail (&text_file_lru));
+	g_mutex_unlock (&text_files_lock);
+	
+	g_thread_unref (g_thread_new ("sb-line-index", text_file_index_thread, tf));
+	return tf;
+}
+
+/*
+ * Number of lines starting in [from, to)
+ */
+static guint64
+text_file_count_lines (TextFile* tf, gsize from, gsize to)
+{
+	gchar* buffer = g_malloc (text_read_size);
+	const gchar *p, *end;
+	guint64 count = 0;
+	gsize n;
+	
+	while (from < to && (n = text_file_read (tf, from, buffer, MIN (text_read_size, to - from))))
+	{
+		for (p = buffer, end = buffer + n; p < end && (p = memchr (p, '\n', end - p)); p++)
+			count++;
+		from += n;
+	}
+	g_free (buffer);
+	return count;
+}
+
+/*
+ * Line number of a byte offset, or -1 if the index has not got that far
+ */
+static gint64
+text_file_line_at (TextFile* tf, gsize offset)
+{
+	guint lo = 0, hi, mid;
+	gsize base;
+	
+	g_mutex_lock (&tf->lock);
+	if (offset > tf->indexed)
+	{
+		g_mutex_unlock (&tf->lock);
+		return -1;
+	}
+	/* Last indexed line start at or before offset */
+	hi = tf->lines->len;
+	while (hi - lo > 1)
+	{
+		mid = (lo + hi) / 2;
+		if (g_array_index (tf->lines, gsize, mid) <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	base = g_array_index (tf->lines, gsize, lo);
+	g_mutex_unlock (&tf->lock);
+	
+	return (gint64) lo * text_line_stride + text_file_count_lines (tf, base, offset);
+}
+
+/*
+ * Byte offset of a line, or -1 if the index has not got that far
+ */
+static gint64
+text_file_line_offset (TextFile* tf, guint64 line)
+{
+	guint64 entry = line / text_line_stride, skip = line % text_line_stride;
+	gchar* buffer;
+	const gchar *p, *end;
+	gsize at, n;
+	
+	g_mutex_lock (&tf->lock);
+	if (entry >= tf->lines->len)
+	{
+		g_mutex_unlock (&tf->lock);
+		return -1;
+	}
+	at = g_array_index (tf->lines, gsize, entry);
+	g_mutex_unlock (&tf->lock);
+	
+	buffer = g_malloc (text_read_size);
+	while (skip && at < tf->length && (n = text_file_read (tf, at, buffer, MIN (text_read_size, tf->length - at))))
+	{
+		for (p = buffer, end = buffer + n; skip && p < end && (p = memchr (p, '\n', end - p)); p++)
+			skip--;
+		at += (skip ? n : (gsize) (p - buffer));
+		if (skip && n < MIN (text_read_size, tf->length - (at - n)))
+			break;
+	}
+	g_free (buffer);
+	return skip ? (gint64) tf->length : (gint64) MIN (at, tf->length);
+}
+
+/*
+ * Append text as HTML, marking each occurrence of find
+ */
+static void
+text_escape (GString* html, const gchar* p, const gchar* end, const gchar* find)
+{
+	gsize find_length = find ? strlen (find) : 0;
+	const gchar *match, *run;
+	
+	while (p < end)
+	{
+		match = find_length ? memmem (p, end - p, find, find_length) : NULL;
+		const gchar* stop = match ? match : end;
+		
+		for (run = p; p < stop; p++)
+		{
+			const gchar* entity = *p == '<' ? "&lt;" : *p == '>' ? "&gt;" : *p == '&' ? "&amp;" : NULL;
+			if (entity)
+			{
+				g_string_append_len (html, run, p - run);
+				g_string_append (html, entity);
+				run = p + 1;
+			}
+		}
+		g_string_append_len (html, run, p - run);
+		
+		if (match)
+		{
+			g_string_append (html, "<mark>");
+			text_escape (html, match, match + find_length, NULL);
+			g_string_append (html, "</mark>");
+			p = match + find_length;
+		}
+	}
+}
+
+/*
+ * Start of a text file page, up to the page bar
+ */
+static void
+text_file_head (GString* html, const gchar* path)
+{
+	gchar* name = g_path_get_basename (path);
+	gchar* escaped = g_markup_escape_text (name, -1);
+	
+	g_string_append_printf (html, "<html><head><meta charset=\"utf-8\"><title>%s</title>"
+							"<style>body{margin:0} .bar{position:fixed;top:0;left:0;right:0;background:#eee;"
+							"border-bottom:1px solid #ccc;padding:4px;font:small sans-serif} pre{margin:3em 4px 4px;"
+							"white-space:pre-wrap} mark{background:#ff0}</style></head><body>",
+							escaped);
+	g_free (escaped);
+	g_free (name);
+}
+
+/*
+ * Rest of a text file page - the bar and text_page_size bytes of whole lines
+ * from offset, with find marked. match is the offset where find was found,
+ * or -1.
+ */
+static void
+text_file_body (GString* html, TextFile* tf, gsize offset, const gchar* find, gint64 match)
+{
+	/* Enough to back up a page to a line start, and go on a page past a page */
+	gsize base = offset > text_page_size ? offset - text_page_size : 0;
+	gchar* window = g_malloc (3 * text_page_size);
+	gsize size = text_file_read (tf, base, window, MIN (3 * text_page_size, tf->length - MIN (base, tf->length)));
+	const gchar *at = window + MIN (offset - base, size), *start, *end, *value;
+	gchar* escaped;
+	gint64 line;
+	
+	/* Whole lines only - back up to the start of the line, and stop at the end of one */
+	start = at;
+	while (start > window && start[-1] != '\n' && at - start < (gssize) text_page_size)
+		start--;
+	end = start + MIN (text_page_size, size - (start - window));
+	if (end < window + size && (value = memchr (end, '\n', (window + size) - end)))
+		end = MIN (value + 1, end + text_page_size);
+	
+	g_string_append (html, "<div class=\"bar\">");
+	
+	/* Navigation */
+	gsize start_offset = base + (start - window), end_offset = base + (end - window);
+	gsize previous = start_offset > text_page_size ? start_offset - text_page_size : 0;
+	gsize last = tf->length > text_page_size ? tf->length - text_page_size : 0;
+	g_string_append_printf (html, "<a href=\"?offset=0\">First</a> <a href=\"?offset=%" G_GSIZE_FORMAT "\">Previous</a> "
+							"<a href=\"?offset=%" G_GSIZE_FORMAT "\">Next</a> <a href=\"?offset=%" G_GSIZE_FORMAT "\">Last</a> | ",
+							previous, end_offset, last);
+	g_string_append_printf (html, "bytes %" G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " (%.1f%%) | ",
+							start_offset, end_offset, tf->length, tf->length ? 100.0 * end_offset / tf->length : 100.0);
+	
+	line = text_file_line_at (tf, start_offset);
+	g_mutex_lock (&tf->lock);
+	if (line >= 0)
+		g_string_append_printf (html, "line %" G_GINT64_FORMAT, line + 1);
+	if (tf->indexed == tf->length)
+		g_string_append_printf (html, " of %" G_GUINT64_FORMAT, tf->line_count);
+	else
+		g_string_append_printf (html, " (indexing lines, %.0f%%)", tf->length ? 100.0 * tf->indexed / tf->length : 100.0);
+	g_mutex_unlock (&tf->lock);
+	
+	escaped = g_markup_escape_text (find ? find : "", -1);
+	g_string_append_printf (html, " | <form style=\"display:inline\"><input name=\"line\" size=\"8\" placeholder=\"Line\"></form>"
+							" <form style=\"display:inline\"><input name=\"find\" value=\"%s\" placeholder=\"Find\">"
+							"<input type=\"hidden\" name=\"offset\" value=\"%" G_GSIZE_FORMAT "\"></form>",
+							escaped, match >= 0 ? (gsize) match + 1 : start_offset);
+	if (find && match < 0)
+		g_string_append (html, " Not found");
+	g_string_append (html, "</div><pre>");
+	
+	text_escape (html, start, end, find);
+	g_string_append (html, "</pre></body></html>");
+	g_free (escaped);
+	g_free (window);
+}
+
+/*
+ * Send all of html to a page being streamed - FALSE once nobody reads it
+ */
+static gboolean
+text_search_send (gint fd, GString* html)
+{
+	gsize sent = 0;
+	gssize n;
+	
+	while (sent < html->len)
+	{
+		if ((n = send (fd, html->str + sent, html->len - sent, MSG_NOSIGNAL)) < 0 && errno != EINTR)
+			return FALSE;
+		if (n > 0)
+			sent += n;
+	}
+	g_string_truncate (html, 0);
+	return TRUE;
+}
+
+/*
+ * Search thread: search forward from the offset, text_search_chunk at a time,
+ * giving up once the page is closed - then send the page at the first match
+ */
+static gpointer
+text_search_thread (gpointer data)
+{
+	TextSearch* search = data;
+	TextFile* tf = search->tf;
+	gsize find_length = strlen (search->find), at = search->offset, chunk, n;
+	gchar* buffer = g_malloc (text_search_chunk + find_length - 1);
+	const gchar* found;
+	gint64 match = -1;
+	GString* html = g_string_new (NULL);
+	struct pollfd closed = {search->fd, POLLRDHUP, 0};
+	
+	text_file_head (html, search->path);
+	if (!text_search_send (search->fd, html))
+		goto out;
+	
+	while (match < 0 && at < tf->length)
+	{
+		/* Chunks overlap by a match less one byte, so none is missed */
+		chunk = MIN (text_search_chunk + find_length - 1, tf->length - at);
+		n = text_file_read (tf, at, buffer, chunk);
+		if ((found = memmem (buffer, n, search->find, find_length)))
+			match = at + (found - buffer);
+		if (n < chunk)
+			break;
+		at += text_search_chunk;
+		if (poll (&closed, 1, 0) > 0)
+			goto out;
+	}
+	
+	text_file_body (html, tf, match >= 0 ? (gsize) match : search->offset, search->find, match);
+	text_search_send (search->fd, html);
+	
+out:
+	close (search->fd);
+	g_string_free (html, TRUE);
+	g_free (buffer);
+	text_file_unref (tf);
+	g_free (search->find);
+	g_free (search->path);
+	g_free (search);
+	return NULL;
+}
+
+/*
+ * Offset of a text file page, from ?offset= or ?line=
+ */
+static gsize
+text_file_offset (TextFile* tf, GHashTable* query)
+{
+	const gchar* value;
+	gsize offset = 0;
+	gint64 line;
+	
+	if ((value = g_hash_table_lookup (query, "offset")))
+		offset = MIN (g_ascii_strtoull (value, NULL, 10), tf->length);
+	if ((value = g_hash_table_lookup (query, "line")) && value[0])
+	{
+		line = text_file_line_offset (tf, MAX (g_ascii_strtoull (value, NULL, 10), 1) - 1);
+		if (line >= 0)
+			offset = line;
+	}
+	return offset;
+}
+
+static gboolean
+text_file_page (SoupURI* uri, GBytes** data, gchar** content_type, GError** error)
+{
+	gchar* path = soup_uri_decode (uri->path);
+	GHashTable* query = uri->query ? soup_form_decode (uri->query) : g_hash_table_new (g_str_hash, g_str_equal);
+	TextFile* tf = text_file_open (path, error);
+	
+	if (!tf)
+	{
+		g_hash_table_destroy (query);
+		g_free (path);
+		return FALSE;
+	}
+	
+	GString* html = g_string_sized_new (text_page_size + 4096);
+	text_file_head (html, path);
+	text_file_body (html, tf, text_file_offset (tf, query), NULL, -1);
+	
+	*data = g_string_free_to_bytes (html);
+	*content_type = g_strdup ("text/html; charset=utf-8");
+	text_file_unref (tf);
+	g_hash_table_destroy (query);
+	g_free (path);
+	return TRUE;
+}
+
+/*
+ * sb://file/<path>?find=TEXT - the search can cover gigabytes, so it runs in
+ * a thread and the page is streamed from it. NULL without an error when there
+ * is nothing to find, for text_file_page to serve.
+ */
+static GInputStream*
+text_file_search_stream (SoupURI* uri, gchar** content_type, GError** error)
+{
+	GHashTable* query = uri->query ? soup_form_decode (uri->query) : NULL;
+	const gchar* find = query ? g_hash_table_lookup (query, "find") : NULL;
+	TextSearch* search;
+	gchar* path;
+	gint fds[2];
+	
+	if (!find || !find[0])
+	{
+		if (query)
+			g_hash_table_destroy (query);
+		return NULL;
+	}
+	
+	path = soup_uri_decode (uri->path);
+	search = g_new0 (TextSearch, 1);
+	if (!(search->tf = text_file_open (path, error)) || socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+	{
+		if (search->tf)
+		{
+			text_file_unref (search->tf);
+			g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno), "%s", g_strerror (errno));
+		}
+		g_free (search);
+		g_free (path);
+		g_hash_table_destroy (query);
+		return NULL;
+	}
+	search->path = path;
+	search->find = g_strdup (find);
+	search->offset = text_file_offset (search->tf, query);
+	search->fd = fds[1];
+	g_thread_unref (g_thread_new ("sb-text-search", text_search_thread, search));
+	
+	*content_type = g_strdup ("text/html; charset=utf-8");
+	g_hash_table_destroy (query);
+	return g_unix_input_stream_new (fds[0], TRUE);
+}
+
+/*
+ * Uri for a local file - files over large_file_size are paged through sb://file
+ */
+static gchar*
+local_file_uri (const gchar* path)
+{
+	GStatBuf info;
+	
+	if (g_stat (path, &info) == 0 && S_ISREG (info.st_mode) && info.st_size > large_file_size)
+	{
+		gchar* encoded = soup_uri_encode (path, "?#%");
+		gchar* uri = g_strconcat ("sb://file", encoded, NULL);
+		g_free (encoded);
+		return uri;
+	}
+	return g_strdup_printf ("file://%s", path);
+}
+
+/*
+ * Serve sb://home/ - the home page and its image, compiled into the binary
+ */
+static gboolean
+home_page_handler (SoupURI* uri, GBytes** data, gchar** content_type, GError** error)
+{
+	const gchar* name = uri->path && strlen (uri->path) > 1 ? uri->path + 1 : "home.html";
+	gchar* path = g_strconcat ("/sb/home/", name, NULL);
+	
+	*data = g_resources_lookup_data (path, G_RESOURCE_LOOKUP_FLAGS_NONE, error);
+	g_free (path);
+	if (!*data)
+		return FALSE;
+	
+	*content_type = g_content_type_guess (name, g_bytes_get_data (*data, NULL), g_bytes_get_size (*data), NULL);
+	return TRUE;
+}
+
+/*
+ * Serve sb://history/?q=... - visited pages containing the words searched for.
+ * The index locks what it shares, so this runs in a thread.
+ */
+static gboolean
+history_page (SoupURI* uri, GBytes** data, gchar** content_type, GError** error)
+{
+	GHashTable* query = uri->query ? soup_form_decode (uri->query) : g_hash_table_new (g_str_hash, g_str_equal);
+	const gchar* q = g_hash_table_lookup (query, "q");
+	GString* html = g_string_new (NULL);
+	guint pages, segments = 0, i;
+	gchar* escaped;
+	
+	if (!history_index)
+	{
+		g_set_error (error, SOUP_REQUEST_ERROR, SOUP_REQUEST_ERROR_BAD_URI, "History is not recorded");
+		g_hash_table_destroy (query);
+		g_string_free (html, TRUE);
+		return FALSE;
+	}
+	
+	pages = history_index_pages (history_index, &segments);
+	escaped = g_markup_escape_text (q ? q : "", -1);
+	g_string_append_printf (html, "<html><head><meta charset=\"utf-8\"><title>History</title>"
+							"<style>body{font:small sans-serif;margin:1em 2em} li{margin:.5em 0} .uri{color:#080}</style>"
+							"</head><body><form><input name=\"q\" size=\"50\" value=\"%s\" placeholder=\"Search history\" autofocus>"
+							"</form><p>%u pages in %u segments", escaped, pages, segments);
+	g_free (escaped);
+	
+	if (q && q[0])
+	{
+		gint64 start = g_get_monotonic_time ();
+		GArray* hits = history_index_search (history_index, q, history_index_results);
+		
+		g_string_append_printf (html, " - %u found in %.1f ms</p><ol>", hits->len, (g_get_monotonic_time () - start) / 1000.0);
+		for (i = 0; i < hits->len; i++)
+		{
+			HistoryHit* hit = &g_array_index (hits, HistoryHit, i);
+			GDateTime* time = g_date_time_new_from_unix_local (hit->time);
+			gchar* date = g_date_time_format (time, "%Y-%m-%d %H:%M");
+			gchar* href = g_markup_escape_text (hit->uri, -1);
+			gchar* title = g_markup_escape_text (hit->title && hit->title[0] ? hit->title : hit->uri, -1);
+			
+			g_string_append_printf (html, "<li><a href=\"%s\">%s</a><br><span class=\"uri\">%s</span> - %s</li>", href, title, href, date);
+			g_free (title);
+			g_free (href);
+			g_free (date);
+			g_date_time_unref (time);
+		}
+		g_string_append (html, "</ol>");
+		history_index_hits_free (hits);
+	}
+	else
+		g_string_append (html, "</p>");
+	g_string_append (html, "</body></html>");
+	
+	*data = g_string_free_to_bytes (html);
+	*content_type = g_strdup ("text/html; charset=utf-8");
+	g_hash_table_destroy (query);
+	return TRUE;
+}
+
+/* Storage used by one origin, for sb://storage/ */
+typedef struct StorageUsage {
+	gchar* origin;
+	guint64 databases, local, quota;
+} StorageUsage;
+
+static void
+storage_usage_free (StorageUsage* usage)
+{
+	g_free (usage->origin);
+	g_free (usage);
+}
+
+static StorageUsage*
+storage_usage_get (GHashTable* usages, const gchar* id)
+{
+	StorageUsage* usage = g_hash_table_lookup (usages, id);
+	
+	if (!usage)
+	{
+		usage = g_new0 (StorageUsage, 1);
+		usage->origin = storage_origin_from_id (id);
+		g_hash_table_insert (usages, g_strdup (id), usage);
+	}
+	return usage;
+}
+
+static gint
+storage_usage_compare (gconstpointer a, gconstpointer b)
+{
+	const StorageUsage *x = *(StorageUsage**) a, *y = *(StorageUsage**) b;
+	guint64 i = x->databases + x->local, j = y->databases + y->local;
+	return i < j ? 1 : i > j ? -1 : 0;
+}
+
+/*
+ * Serve sb://storage/ - the site storage of the profile, by origin, largest
+ * first. Sizes are read from WebKit's files, so sites need not be open; only
+ * paths and limits copied by storage_init are used, so it runs in a thread.
+ */
+static gboolean
+storage_page (SoupURI* uri, GBytes** data, gchar** content_type, GError** error)
+{
+	GHashTable* usages = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) storage_usage_free);
+	const gchar* databases = storage_database_path;
+	GString* html = g_string_new (NULL);
+	GPtrArray* sorted = g_ptr_array_new ();
+	GHashTableIter iter;
+	gpointer value;
+	const gchar* name;
+	sqlite3* tracker;
+	GStatBuf info;
+	GDir* dir;
+	gchar* path;
+	guint i;
+	
+	/* Web databases - a directory per origin, quotas in WebKit's tracker */
+	if ((dir = g_dir_open (databases, 0, NULL)))
+	{
+		while ((name = g_dir_read_name (dir)))
+		{
+			path = g_build_filename (databases, name, NULL);
+			if (g_file_test (path, G_FILE_TEST_IS_DIR))
+				storage_usage_get (usages, name)->databases = storage_directory_size (path);
+			g_free (path);
+		}
+		g_dir_close (dir);
+	}
+	path = g_build_filename (databases, "Databases.db", NULL);
+	if (sqlite3_open_v2 (path, &tracker, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK)
+	{
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2 (tracker, "SELECT origin, quota FROM Origins", -1, &stmt, NULL) == SQLITE_OK)
+		{
+			while (sqlite3_step (stmt) == SQLITE_ROW)
+				storage_usage_get (usages, (const gchar*) sqlite3_column_text (stmt, 0))->quota = sqlite3_column_int64 (stmt, 1);
+			sqlite3_finalize (stmt);
+		}
+	}
+	sqlite3_close (tracker);
+	g_free (path);
+	
+	/* Local storage - a file per origin */
+	if (storage_local_path && (dir = g_dir_open (storage_local_path, 0, NULL)))
+	{
+		while ((name = g_dir_read_name (dir)))
+		{
+			if (!g_str_has_suffix (name, ".localstorage"))
+				continue;
+			path = g_build_filename (storage_local_path, name, NULL);
+			gchar* id = g_strndup (name, strlen (name) - strlen (".localstorage"));
+			if (g_stat (path, &info) == 0)
+				storage_usage_get (usages, id)->local = info.st_size;
+			g_free (id);
+			g_free (path);
+		}
+		g_dir_close (dir);
+	}
+	
+	g_string_append (html, "<html><head><meta charset=\"utf-8\"><title>Site storage</title>"
+					 "<style>body{font:small sans-serif;margin:1em 2em} td,th{padding:2px 1em 2px 0;text-align:right}"
+					 " td:first-child,th:first-child{text-align:left}</style></head><body><h3>Site storage</h3>"
+					 "<table><tr><th>Origin</th><th>Databases</th><th>Quota</th><th>Local storage</th></tr>");
+	g_hash_table_iter_init (&iter, usages);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_ptr_array_add (sorted, value);
+	g_ptr_array_sort (sorted, storage_usage_compare);
+	for (i = 0; i < sorted->len; i++)
+	{
+		StorageUsage* usage = g_ptr_array_index (sorted, i);
+		gchar* origin = g_markup_escape_text (usage->origin, -1);
+		gchar* size = g_format_size (usage->databases);
+		gchar* quota = g_format_size (usage->quota ? usage->quota : storage_database_quota);
+		gchar* local = g_format_size (usage->local);
+		
+		g_string_append_printf (html, "<tr><td>%s</td><td>%s</td><td>%s</td><td>%s</td></tr>", origin, size, quota, local);
+		g_free (origin);
+		g_free (size);
+		g_free (quota);
+		g_free (local);
+	}
+	g_string_append (html, "</table>");
+	
+	/* The application cache is one database for all origins of the profile */
+	path = g_build_filename (storage_appcache_path, "ApplicationCache.db", NULL);
+	gchar* used = g_format_size (g_stat (path, &info) == 0 ? info.st_size : 0);
+	gchar* limit = g_format_size (storage_appcache_size);
+	g_string_append_printf (html, "<p>Application cache: %s of %s</p>"
+							"<p>Delete the storage of a site with <code>sb --clear-storage scheme://host</code>, "
+							"or of all sites with <code>sb --clear-storage all</code>.</p></body></html>", used, limit);
+	g_free (used);
+	g_free (limit);
+	g_free (path);
+	
+	*data = g_string_free_to_bytes (html);
+	*content_type = g_strdup ("text/html; charset=utf-8");
+	g_ptr_array_free (sorted, TRUE);
+	g_hash_table_destroy (usages);
+	return TRUE;
+}
+
+/*
+ * The sb: scheme - local pages built into the browser, served without touching
+ * the network. sb://<page>/... is dispatched to the handler for <page>.
+ * Handlers of threaded pages only read files and their own locked state, so
+ * they run in a worker thread; a page using WebKit or main loop state would
+ * have to run in the main loop.
+ */
+typedef gboolean (*SbPageHandler) (SoupURI*, GBytes**, gchar**, GError**);
+
+/* Pages produced over time - NULL without an error falls back to the handler */
+typedef GInputStream* (*SbStreamHandler) (SoupURI*, gchar**, GError**);
+
+static struct {
+	const gchar* name;
+	SbPageHandler handler;
+	SbStreamHandler stream;
+	gboolean threaded;
+} sb_pages[] = {
+	{"archive", archive_page, NULL, TRUE},
+	{"home", home_page_handler, NULL, TRUE},
+	{"file", text_file_page, text_file_search_stream, TRUE},
+	{"history", history_page, NULL, TRUE},
+	{"storage", storage_page, NULL, TRUE},
+};
+
+static const char* sb_request_schemes[] = {"sb", NULL};
+
+G_DEFINE_TYPE (SbRequest, sb_request, SOUP_TYPE_REQUEST)
+
+static void
+sb_request_init (SbRequest* request)
+{
+}
+
+static void
+sb_request_finalize (GObject* object)
+{
+	SbRequest* request = SB_REQUEST (object);
+	
+	if (request->data)
+		g_bytes_unref (request->data);
+	g_free (request->content_type);
+	
+	G_OBJECT_CLASS (sb_request_parent_class)->finalize (object);
+}
+
+static gboolean
+sb_request_check_uri (SoupRequest* request, SoupURI* uri, GError** error)
+{
+	return uri->host && uri->host[0];
+}
+
+static GInputStream*
+sb_request_send (SoupRequest* request, GCancellable* cancellable, GError** error)
+{
+	SbRequest* r = SB_REQUEST (request);
+	SoupURI* uri = soup_request_get_uri (request);
+	GInputStream* stream;
+	GError* stream_error = NULL;
+	guint i;
+	
+	for (i = 0; i < G_N_ELEMENTS (sb_pages); i++)
+	{
+		if (g_strcmp0 (uri->host, sb_pages[i].name) != 0)
+			continue;
+		if (sb_pages[i].stream && (stream = sb_pages[i].stream (uri, &r->content_type, &stream_error)))
+			return stream;
+		if (stream_error)
+		{
+			g_propagate_error (error, stream_error);
+			return NULL;
+		}
+		if (!sb_pages[i].handler (uri, &r->data, &r->content_type, error))
+			return NULL;
+		return g_memory_input_stream_new_from_bytes (r->data);
+	}
+	
+	g_set_error (error, SOUP_REQUEST_ERROR, SOUP_REQUEST_ERROR_BAD_URI, "No such page: sb://%s", uri->host);
+	return NULL;
+}
+
+static void
+sb_request_send_thread (GTask* task, gpointer source, gpointer task_data, GCancellable* cancellable)
+{
+	GError* error = NULL;
+	GInputStream* stream = sb_request_send (SOUP_REQUEST (source), cancellable, &error);
+	
+	if (stream)
+		g_task_return_pointer (task, stream, g_object_unref);
+	else
+		g_task_return_error (task, error);
+}
+
+/*
+ * What WebKit calls - threaded pages are built in a worker thread, so reading
+ * an archive or a large file never holds up the main loop
+ */
+static void
+sb_request_send_async (SoupRequest* request, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	SoupURI* uri = soup_request_get_uri (request);
+	GTask* task = g_task_new (request, cancellable, callback, user_data);
+	guint i;
+	
+	for (i = 0; i < G_N_ELEMENTS (sb_pages); i++)
+		if (g_strcmp0 (uri->host, sb_pages[i].name) == 0 && sb_pages[i].threaded)
+			break;
+	if (i < G_N_ELEMENTS (sb_pages))
+		g_task_run_in_thread (task, sb_request_send_thread);
+	else
+		sb_request_send_thread (task, request, NULL, cancellable);
+	g_object_unref (task);
+}
+
+static GInputStream*
+sb_request_send_finish (SoupRequest* request, GAsyncResult* result, GError** error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static goffset
+sb_request_get_content_length (SoupRequest* request)
+{
+	SbRequest* r = SB_REQUEST (request);
+	return r->data ? (goffset) g_bytes_get_size (r->data) : -1;
+}
+
+static const char*
+sb_request_get_content_type (SoupRequest* request)
+{
+	SbRequest* r = SB_REQUEST (request);
+	return r->content_type ? r->content_type : "text/html";
+}
+
+static void
+sb_request_class_init (SbRequestClass* klass)
+{
+	GObjectClass* object_class = G_OBJECT_CLASS (klass);
+	SoupRequestClass* request_class = SOUP_REQUEST_CLASS (klass);
+	
+	object_class->finalize = sb_request_finalize;
+	request_class->schemes = sb_request_schemes;
+	request_class->check_uri = sb_request_check_uri;
+	request_class->send = sb_request_send;
+	request_class->send_async = sb_request_send_async;
+	request_class->send_finish = sb_request_send_finish;
+	request_class->get_content_length = sb_request_get_content_length;
+	request_class->get_content_type = sb_request_get_content_type;
+}
+
+/*
+ * Network record and replay: sb --record FILE, then sb --replay FILE
+ *
+ * Recording keeps the status, headers and time to first byte of every HTTP
+ * response the session receives, and the bodies of everything pages finished
+ * loading, and writes them to FILE as an archive on exit. Replaying runs a
+ * loopback HTTP proxy that serves the archive, so pages go through the usual
+ * HTTP stack but never reach the network. https is requested from it as
+ * http.
+ */
+
+/* Headers that describe the transfer rather than the resource */
+static const gchar* record_skip_headers[] = {"Content-Length", "Content-Encoding", "Transfer-Encoding", "Connection", "Keep-Alive", NULL};
+
+static void
+record_entry_free (RecordEntry* entry)
+{
+	if (entry->headers)
+		g_string_free (entry->headers, TRUE);
+	if (entry->body)
+		g_bytes_unref (entry->body);
+	g_free (entry->mime);
+	g_free (entry);
+}
+
+/*
+ * The recorded response for a uri, added if it is new
+ */
+static RecordEntry*
+record_entry (const gchar* uri)
+{
+	RecordEntry* entry = g_hash_table_lookup (record_entries, uri);
+	
+	if (!entry)
+	{
+		gchar* key = g_strdup (uri);
+		entry = g_new0 (RecordEntry, 1);
+		entry->status = SOUP_STATUS_OK;
+		g_hash_table_insert (record_entries, key, entry);
+		g_ptr_array_add (record_uris, key);
+	}
+	return entry;
+}
+
+static void
+record_header_cb (const char* name, const char* value, gpointer data)
+{
+	guint i;
+	
+	for (i = 0; record_skip_headers[i]; i++)
+		if (g_ascii_strcasecmp (name, record_skip_headers[i]) == 0)
+			return;
+	g_string_append_printf (data, "%s: %s\r\n", name, value);
+}
+
+static void
+record_restarted_cb (SoupMessage* msg, gpointer data)
+{
+	gint64* start = g_object_get_data (G_OBJECT (msg), "record-start");
+	*start = g_get_monotonic_time ();
+}
+
+/*
+ * Keep the first response seen for each uri, redirects included
+ */
+static void
+record_got_headers_cb (SoupMessage* msg, gpointer data)
+{
+	gint64* start = g_object_get_data (G_OBJECT (msg), "record-start");
+	gchar* uri = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
+	RecordEntry* entry;
+	
+	if (record_entries && !(entry = record_entry (uri))->headers)
+	{
+		entry->status = msg->status_code;
+		entry->msec = (g_get_monotonic_time () - *start) / 1000;
+		entry->headers = g_string_new (NULL);
+		soup_message_headers_foreach (msg->response_headers, record_header_cb, entry->headers);
+	}
+	g_free (uri);
+}
+
+static void
+record_request_queued_cb (SoupSession* session, SoupMessage* msg, gpointer data)
+{
+	gint64* start = g_new (gint64, 1);
+	
+	*start = g_get_monotonic_time ();
+	g_object_set_data_full (G_OBJECT (msg), "record-start", start, g_free);
+	g_signal_connect (G_OBJECT (msg), "restarted", G_CALLBACK (record_restarted_cb), NULL);
+	g_signal_connect (G_OBJECT (msg), "got-headers", G_CALLBACK (record_got_headers_cb), NULL);
+}
+
+static void
+record_resource (WebKitWebResource* resource, GString* data)
+{
+	const gchar* uri = webkit_web_resource_get_uri (resource);
+	
+	if (!data || !uri || (!g_str_has_prefix (uri, "http:") && !g_str_has_prefix (uri, "https:")))
+		return;
+	
+	gchar* key = g_strndup (uri, strcspn (uri, "#"));
+	RecordEntry* entry = record_entry (key);
+	if (!entry->body)
+	{
+		entry->body = g_bytes_new (data->str, data->len);
+		entry->mime = g_strdup (webkit_web_resource_get_mime_type (resource));
+	}
+	g_free (key);
+}
+
+/*
+ * Keep the bodies of a page that finished loading and of its subresources
+ */
+static void
+record_page (WebKitWebView* web_view)
+{
+	WebKitWebDataSource* source = webkit_web_frame_get_data_source (webkit_web_view_get_main_frame (web_view));
+	GList *resources, *l;
+	
+	if (!record_entries || !source)
+		return;
+	
+	record_resource (webkit_web_data_source_get_main_resource (source), webkit_web_data_source_get_data (source));
+	resources = webkit_web_data_source_get_subresources (source);
+	for (l = resources; l; l = l->next)
+		record_resource (l->data, webkit_web_resource_get_data (l->data));
+	g_list_free (resources);
+}
+
+static void
+record_init (void)
+{
+	record_entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) record_entry_free);
+	record_uris = g_ptr_array_new ();
+	g_signal_connect (G_OBJECT (webkit_get_default_session ()), "request-queued", G_CALLBACK (record_request_queued_cb), NULL);
+}
+
+/*
+ * Write the recording - headers then body for each response, in the order
+ * they were requested. Responses whose body no page finished loading are
+ * left out, except redirects, which have none.
+ */
+static void
+record_write (void)
+{
+	GPtrArray* entries;
+	GPtrArray* blocks;
+	GError* error = NULL;
+	guint i;
+	
+	if (!record_entries)
+		return;
+	
+	entries = g_ptr_array_new_with_free_func (g_free);
+	blocks = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+	for (i = 0; i < record_uris->len; i++)
+	{
+		const gchar* uri = g_ptr_array_index (record_uris, i);
+		RecordEntry* r = g_hash_table_lookup (record_entries, uri);
+		gsize length = 0;
+		
+		if (!r->body && (r->status < 300 || r->status == SOUP_STATUS_NOT_MODIFIED))
+			continue;
+		
+		GString* block = g_string_new (r->headers ? r->headers->str : "");
+		ArchiveEntry* entry = g_new0 (ArchiveEntry, 1);
+		entry->header_length = block->len;
+		if (r->body)
+			g_string_append_len (block, g_bytes_get_data (r->body, &length), length);
+		
+		/* A revalidated resource was replayed from the cache - serve it whole */
+		entry->status = r->status == SOUP_STATUS_NOT_MODIFIED ? SOUP_STATUS_OK : r->status;
+		entry->msec = r->msec;
+		entry->mime = r->mime;
+		entry->uri = (gchar*) uri;
+		entry->length = block->len;
+		g_ptr_array_add (blocks, g_string_free_to_bytes (block));
+		entry->data = g_bytes_get_data (g_ptr_array_index (blocks, blocks->len - 1), NULL);
+		g_ptr_array_add (entries, entry);
+	}
+	
+	if (archive_write_file (record_file, entries, &error))
+		fprintf (stderr, "sb: recorded %u responses to %s\n", entries->len, record_file);
+	else
+		fprintf (stderr, "sb: cannot write recording: %s\n", error->message);
+	
+	g_clear_error (&error);
+	g_ptr_array_free (entries, TRUE);
+	g_ptr_array_free (blocks, TRUE);
+	g_hash_table_destroy (record_entries);
+	g_ptr_array_free (record_uris, TRUE);
+	record_entries = NULL;
+}
+
+/*
+ * Send the next part of a replayed body - all of it, or as much as
+ * --bandwidth allows per replay_interval
+ */
+static gboolean
+replay_send_cb (gpointer data)
+{
+	ReplayResponse* r = data;
+	gsize chunk = r->length - r->sent;
+	
+	if (replay_bandwidth > 0)
+		chunk = MIN (chunk, MAX ((gsize) replay_bandwidth * 1024 * replay_interval / 1000, 1));
+	soup_message_body_append (r->msg->response_body, SOUP_MEMORY_TEMPORARY, r->data + r->sent, chunk);
+	r->sent += chunk;
+	if (r->sent == r->length)
+	{
+		soup_message_body_complete (r->msg->response_body);
+		r->timeout_id = 0;
+	}
+	soup_server_unpause_message (r->server, r->msg);
+	
+	return r->sent < r->length;
+}
+
+/*
+ * The latency is over - start the body
+ */
+static gboolean
+replay_start_cb (gpointer data)
+{
+	ReplayResponse* r = data;
+	
+	r->timeout_id = 0;
+	if (replay_send_cb (r))
+		r->timeout_id = g_timeout_add (replay_interval, replay_send_cb, r);
+	return FALSE;
+}
+
+static void
+replay_finished_cb (SoupMessage* msg, ReplayResponse* r)
+{
+	if (r->timeout_id)
+		g_source_remove (r->timeout_id);
+	g_free (r);
+}
+
+/*
+ * Answer a proxied request from the recording, or with 404 if it was not
+ * recorded
+ */
+static void
+replay_server_cb (SoupServer* server, SoupMessage* msg, const char* path, GHashTable* query, SoupClientContext* client, gpointer data)
+{
+	gchar* uri = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
+	guint n = GPOINTER_TO_UINT (g_hash_table_lookup (replay_archive->index, uri));
+	
+	/* Requests for https uris arrive as http */
+	if (!n && g_str_has_prefix (uri, "http:"))
+	{
+		gchar* secure = g_strconcat ("https:", uri + 5, NULL);
+		n = GPOINTER_TO_UINT (g_hash_table_lookup (replay_archive->index, secure));
+		g_free (secure);
+	}
+	if (!n)
+	{
+		fprintf (stderr, "sb: not in recording: %s\n", uri);
+		soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+		g_free (uri);
+		return;
+	}
+	g_free (uri);
+	
+	ArchiveEntry* entry = &g_array_index (replay_archive->entries, ArchiveEntry, n - 1);
+	const gchar *p = replay_archive->data + entry->offset, *end = p + entry->header_length, *eol;
+	for (; p < end && (eol = memchr (p, '\n', end - p)); p = eol + 1)
+	{
+		const gchar* colon = memchr (p, ':', eol - p);
+		if (!colon)
+			continue;
+		gchar* name = g_strndup (p, colon - p);
+		gchar* value = g_strstrip (g_strndup (colon + 1, eol - colon - 1));
+		soup_message_headers_append (msg->response_headers, name, value);
+		g_free (name);
+		g_free (value);
+	}
+	if (!soup_message_headers_get_one (msg->response_headers, "Content-Type"))
+		soup_message_headers_set_content_type (msg->response_headers, entry->mime, NULL);
+	soup_message_headers_set_content_length (msg->response_headers, entry->length - entry->header_length);
+	soup_message_set_status (msg, entry->status);
+	
+	ReplayResponse* r = g_new0 (ReplayResponse, 1);
+	r->server = server;
+	r->msg = msg;
+	r->data = replay_archive->data + entry->offset + entry->header_length;
+	r->length = entry->length - entry->header_length;
+	g_signal_connect (G_OBJECT (msg), "finished", G_CALLBACK (replay_finished_cb), r);
+	
+	soup_server_pause_message (server, msg);
+	r->timeout_id = g_timeout_add (replay_latency < 0 ? entry->msec : (guint) replay_latency, replay_start_cb, r);
+}
+
+/*
+ * Requests for https uris go to the replay proxy as http - it cannot answer
+ * a CONNECT
+ */
+static void
+replay_resource_request (WebKitNetworkRequest* request)
+{
+	const gchar* uri = webkit_network_request_get_uri (request);
+	
+	if (replay_server && g_str_has_prefix (uri, "https:"))
+	{
+		gchar* plain = g_strconcat ("http:", uri + 6, NULL);
+		webkit_network_request_set_uri (request, plain);
+		g_free (plain);
+	}
+}
+
+/*
+ * Start the replay proxy on a loopback port and send the session through it
+ */
+static gboolean
+replay_init (void)
+{
+	SoupAddress* address;
+	SoupURI* proxy;
+	gchar* proxy_uri;
+	
+	g_mutex_lock (&archives_lock);
+	replay_archive = archive_load (replay_file);
+	g_mutex_unlock (&archives_lock);
+	if (!replay_archive)
+	{
+		fprintf (stderr, "sb: cannot read recording %s\n", replay_file);
+		return FALSE;
+	}
+	
+	address = soup_address_new ("127.0.0.1", SOUP_ADDRESS_ANY_PORT);
+	soup_address_resolve_sync (address, NULL);
+	replay_server = soup_server_new (SOUP_SERVER_INTERFACE, address, NULL);
+	g_object_unref (address);
+	if (!replay_server)
+	{
+		fprintf (stderr, "sb: cannot start the replay proxy\n");
+		return FALSE;
+	}
+	soup_server_add_handler (replay_server, NULL, replay_server_cb, NULL, NULL);
+	soup_server_run_async (replay_server);
+	
+	proxy_uri = g_strdup_printf ("http://127.0.0.1:%u/", soup_server_get_port (replay_server));
+	proxy = soup_uri_new (proxy_uri);
+	g_object_set (G_OBJECT (webkit_get_default_session ()), SOUP_SESSION_PROXY_URI, proxy, NULL);
+	soup_uri_free (proxy);
+	g_free (proxy_uri);
+	
+	return TRUE;
+}
+
+/*
+ * Callback to exit program
+ */
+static void
+destroy_cb (GtkWidget* widget, gpointer data)
+{
+	record_write ();
+	cookie_jar_close ();
+	history_close ();
+	io_flush ();
+	gtk_main_quit ();
+}
+
+/*
+ * --quit-after: close everything, as the last window would
+ */
+static gboolean
+quit_after_cb (gpointer data)
+{
+	destroy_cb (NULL, NULL);
+	return FALSE;
+}
+
+/*
+ * Callback for activation of the url-bar - open web page in web-view
+ */
+static void
+activate_uri_entry_cb (GtkWidget* entry, Browser* b)
+{
+	JANK_ENTER (b->current);
+	const gchar* text = gtk_entry_get_text (GTK_ENTRY (entry));
+	const gchar* search = search_engines[search_engine_current].url;
+	gchar buffer[2048], *uri = buffer;
+	UrlKind kind;
+	
+	/* Addresses get a scheme, paths become file:// and anything else is searched for */
+	gsize length = url_normalize (text, strlen (text), search, buffer, sizeof buffer, &kind);
+	if (length >= sizeof buffer)
+	{
+		uri = g_malloc (length + 1);
+		url_normalize (text, strlen (text), search, uri, length + 1, NULL);
+	}
+	
+	if (kind != URL_KIND_EMPTY && g_str_has_prefix (uri, "file://"))
+	{
+		/* Large files are paged through sb://file */
+		gchar* path = g_filename_from_uri (uri, NULL, NULL);
+		gchar* local = path ? local_file_uri (path) : g_strdup (uri);
+		client_load_uri (b->current, local);
+		g_free (local);
+		g_free (path);
+	}
+	else if (kind != URL_KIND_EMPTY)
+		client_load_uri (b->current, uri);
+	
+	if (uri != buffer)
+		g_free (uri);
+}
+
+static void
+activate_search_engine_entry_cb (GtkWidget* entry, Browser* b)
+{
+	JANK_ENTER (b->current);
+	const gchar* text = gtk_entry_get_text (GTK_ENTRY (entry));
+	const gchar* search = search_engines[search_engine_current].url;
+	gchar buffer[2048], *uri = buffer;
+	
+	gsize length = url_search (search, text, strlen (text), buffer, sizeof buffer);
+	if (length >= sizeof buffer)
+	{
+		uri = g_malloc (length + 1);
+		url_search (search, text, strlen (text), uri, length + 1);
+	}
+	client_load_uri (b->current, uri);
+	
+	if (uri != buffer)
+		g_free (uri);
+}
+
+static void
+choose_search_engine_dialog (Browser* b)
+{
+	GtkWidget* dialog = gtk_dialog_new_with_buttons ("Engine...",
+													GTK_WINDOW (b->window),
+													GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+													GTK_STOCK_CANCEL,
+													GTK_RESPONSE_REJECT,
+													GTK_STOCK_OK,
+													GTK_RESPONSE_ACCEPT,
+													NULL);
+													
+	GtkWidget* vbox = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
+	
+	GtkWidget* combo_box = gtk_combo_box_text_new ();
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Google");
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Duck Duck Go");
+	gtk_combo_box_set_active (GTK_COMBO_BOX (combo_box), search_engine_current);
+	gtk_box_pack_start (GTK_BOX (vbox), combo_box, FALSE, FALSE, 10);
+	gtk_widget_show (combo_box);
+	
+	gint result = gtk_dialog_run (GTK_DIALOG (dialog));
+	switch (result)
+	{
+		case GTK_RESPONSE_ACCEPT:
+			search_engine_current = gtk_combo_box_get_active (GTK_COMBO_BOX (combo_box));
+			break;
+		default:
+			break;
+	}
+	
+	gtk_widget_destroy (dialog);
+}
+
+static void
+search_engine_entry_icon_cb (GtkEntry* entry, GtkEntryIconPosition icon_pos, GdkEvent* event, Browser* b)
+{
+	switch (icon_pos)
+	{
+		case GTK_ENTRY_ICON_PRIMARY:
+			choose_search_engine_dialog (b);
+			break;
+		case GTK_ENTRY_ICON_SECONDARY:
+			activate_search_engine_entry_cb (GTK_WIDGET (entry), b);
+			break;
+	}
+}
+
+/*
+ * Update the title of the window with name of the current web page and load progress
+ */
+static void
+update_title (Browser* b)
+{
+	GString* string = g_string_new (b->current->title);
+	g_string_append (string, " - sb");
+	if (b->current->progress < 100)
+		g_string_append_printf (string, " (%d%%)", b->current->progress);
+	gchar* title = g_string_free (string, FALSE);
+	gtk_window_set_title (GTK_WINDOW (b->window), title);
+	g_free (title);
+}
+
+/*
+ * Update the back and forward buttons for the current web page
+ */
+static void
+update_buttons (Browser* b)
+{
+	Client* c = b->current;
+	
+	gtk_widget_set_sensitive (GTK_WIDGET (b->back_button), c->remote ? c->can_go_back : webkit_web_view_can_go_back (c->view));
+	gtk_widget_set_sensitive (GTK_WIDGET (b->forward_button), c->remote ? c->can_go_forward : webkit_web_view_can_go_forward (c->view));
+}
+
+/*
+ * Stop counting matches - the page changed, or the search did
+ */
+static void
+find_count_stop (Browser* b)
+{
+	if (b->find_count_id)
+	{
+		g_source_remove (b->find_count_id);
+		b->find_count_id = 0;
+	}
+	if (b->find_walker)
+	{
+		g_object_unref (b->find_walker);
+		b->find_walker = NULL;
+	}
+	if (b->find_anchor)
+	{
+		g_object_unref (b->find_anchor);
+		b->find_anchor = NULL;
+	}
+}
+
+/*
+ * Cancel any search that is scheduled but has not run yet
+ */
+static void
+find_bar_cancel (Browser* b)
+{
+	if (b->find_timeout_id)
+	{
+		g_source_remove (b->find_timeout_id);
+		b->find_timeout_id = 0;
+	}
+	if (b->find_mark_id)
+	{
+		g_source_remove (b->find_mark_id);
+		b->find_mark_id = 0;
+	}
+	find_count_stop (b);
+}
+
+/*
+ * Callback for switching tabs - the window now shows another client
+ */
+static void
+tab_switched_cb (GtkNotebook* notebook, gpointer page, guint page_num, Browser* b)
+{
+	JANK_ENTER (b->current);
+	GtkWidget* pane = gtk_notebook_get_nth_page (notebook, page_num);
+	Client* c = g_object_get_data (G_OBJECT (pane), "client");
+	const gchar* uri;
+	
+	if (!c || c == b->current)
+		return;
+	b->current = c;
+	
+	/* A prerender is a guess about the previous tab */
+	if (b->prerender && !b->prerender_swap_id)
+		prerender_discard (b);
+	
+	/* A search in progress belongs to the previous tab */
+	find_bar_cancel (b);
+	g_free (b->find_last_text);
+	b->find_last_text = NULL;
+	
+	uri = client_get_uri (c);
+	gtk_entry_set_text (GTK_ENTRY (b->uri_entry), uri ? uri : "");
+	update_title (b);
+	update_buttons (b);
+	lite_item_update (b);
+}
+
+/*
+ * Callback for hovering over a link - show in statusbar
+ */
+static void
+link_hover_cb (WebKitWebView* page, const gchar* title, const gchar* link, Client* c)
+{
+	JANK_ENTER (c);
+	/* underflow is allowed */
+	gtk_statusbar_pop (c->b->statusbar, c->b->status_context_id);
+	if (link)
+		gtk_statusbar_push (c->b->statusbar, c->b->status_context_id, link);
+	if (c == c->b->current)
+		prerender_hover (c->b, link);
+}
+
+/*
+ * Decide if the web page/file can be viewed - if not, then download it
+ */
+static gboolean
+decide_download_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitNetworkRequest* request, gchar* mimetype,  WebKitWebPolicyDecision* policy_decision, gpointer data)
+{
+	Client* c = data;
+	JANK_ENTER (c);
+	
+	if (!webkit_web_view_can_show_mime_type (web_view, mimetype))
+	{
+		/* Never download on a guess */
+		if (c->prerender)
+		{
+			webkit_web_policy_decision_ignore (policy_decision);
+			return TRUE;
+		}
+		webkit_web_policy_decision_download (policy_decision);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * A download ended - note it in the flight recorder and the metrics
+ */
+static void
+download_status_cb (WebKitDownload* download, GParamSpec* pspec, gpointer data)
+{
+	guint32 size = webkit_download_get_current_size (download) / 1024;
+	
+	switch (webkit_download_get_status (download))
+	{
+		case WEBKIT_DOWNLOAD_STATUS_FINISHED:
+			flight_record (FLIGHT_DOWNLOAD, FLIGHT_DOWNLOAD_FINISHED, 0, size);
+			metrics_add (METRIC_DOWNLOAD_BYTES, webkit_download_get_current_size (download));
+			break;
+		case WEBKIT_DOWNLOAD_STATUS_ERROR:
+			flight_record (FLIGHT_DOWNLOAD, FLIGHT_DOWNLOAD_FAILED, 0, size);
+			metrics_add (METRIC_DOWNLOADS_FAILED, 1);
+			metrics_add (METRIC_DOWNLOAD_BYTES, webkit_download_get_current_size (download));
+			break;
+		case WEBKIT_DOWNLOAD_STATUS_CANCELLED:
+			flight_record (FLIGHT_DOWNLOAD, FLIGHT_DOWNLOAD_CANCELLED, 0, size);
+			metrics_add (METRIC_DOWNLOADS_FAILED, 1);
+			metrics_add (METRIC_DOWNLOAD_BYTES, webkit_download_get_current_size (download));
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Start the download of a file - use the server-recommended file name
+ */
+static gboolean
+init_download_cb (WebKitWebView* web_view, WebKitDownload* download, gpointer data)
+{
+	const gchar* uri = g_strconcat ("file://", download_dir, webkit_download_get_suggested_filename (download), NULL);
+	webkit_download_set_destination_uri (download, uri);
+	flight_record (FLIGHT_DOWNLOAD, FLIGHT_DOWNLOAD_STARTED, 0, 0);
+	metrics_add (METRIC_DOWNLOADS, 1);
+	g_signal_connect (G_OBJECT (download), "notify::status", G_CALLBACK (download_status_cb), NULL);
+	return TRUE;
+}
+
+/*
+ * Show the tab strip only while it is short enough to be useful - beyond that,
+ * tabs are reached through the tab switcher. Kiosk windows never show it.
+ */
+static void
+update_tab_strip (Browser* b)
+{
+	gtk_notebook_set_show_tabs (GTK_NOTEBOOK (b->book), !kiosk_file && b->clients->len <= tab_strip_limit);
+}
+
+static void
+notebook_tab_close_clicked_cb (GtkButton *button, Client *c)
+{
+	Browser* b = c->b;
+	
+	/* Close the window if only one tab open */
+	if (gtk_notebook_get_n_pages (GTK_NOTEBOOK (b->book)) == 1)
+	{
+		gtk_widget_destroy (b->window);
+		return;
+	}
+	GtkWidget* pane = c->pane;
+	g_ptr_array_remove (b->clients, c);
+	client_free (c);
+	gint page_num = gtk_notebook_page_num (GTK_NOTEBOOK (b->book), pane);
+	gtk_notebook_remove_page (GTK_NOTEBOOK (b->book), page_num);
+	update_tab_strip (b);
+}
+
+/*
+ * Callback for file.close-tab and the close button of the tab strip
+ */
+static void
+close_tab_cb (GtkWidget* widget, Browser* b)
+{
+	notebook_tab_close_clicked_cb (NULL, b->current);
+}
+
+static void
+notebook_tab_close_button_style_set (GtkWidget *btn, GtkRcStyle *prev_style, gpointer data)
+{
+	gint w, h;
+
+	gtk_icon_size_lookup_for_settings(gtk_widget_get_settings(btn), GTK_ICON_SIZE_MENU, &w, &h);
+	gtk_widget_set_size_request(btn, w + 2, h + 2);
+}
+
+/*
+ * Create the tab label - favicon and a fixed-width label, three widgets in
+ * all. The close button is shared by the tabs of a window, at the end of the
+ * tab strip. The label is created once per tab; later changes only update
+ * the icon and label text.
+ */
+static GtkWidget*
+create_tab_label (Client *c, const gchar *label_text)
+{
+	GtkWidget* hbox = gtk_hbox_new (FALSE, 2);
+	
+	c->icon = gtk_image_new_from_stock (GTK_STOCK_FILE, GTK_ICON_SIZE_MENU);
+	
+	c->label = gtk_label_new (label_text);
+	gtk_label_set_ellipsize (GTK_LABEL (c->label), PANGO_ELLIPSIZE_END);
+	gtk_label_set_width_chars (GTK_LABEL (c->label), tab_label_width);
+	gtk_misc_set_alignment (GTK_MISC (c->label), 0.0, 0.5);
+	
+	gtk_box_pack_start (GTK_BOX (hbox), c->icon, FALSE, FALSE, 0);
+	gtk_box_pack_start (GTK_BOX (hbox), c->label, TRUE, TRUE, 0);
+	gtk_widget_show_all (hbox);
+	
+	return hbox;
+}
+
+/*
+ * Add a client to the end of the window's notebook
+ */
+static void
+append_tab (Browser* b, Client* c, const gchar* label_text)
+{
+	gtk_notebook_append_page (GTK_NOTEBOOK (b->book), c->pane, create_tab_label (c, label_text));
+	gtk_notebook_set_tab_reorderable (GTK_NOTEBOOK (b->book), c->pane, TRUE);
+	g_ptr_array_add (b->clients, c);
+	update_tab_strip (b);
+}
+
+static WebKitWebView*
+create_new_tab (WebKitWebView  *v, WebKitWebFrame *f, Client *c)
+{
+	JANK_ENTER (c);
+	Browser* b = c->b;
+	Client* n;
+	
+	/* No popups from hidden pages */
+	if (c->prerender)
+		return NULL;
+	
+	n = create_new_client (b);
+	
+	append_tab (b, n, webkit_web_frame_get_name (f));
+	gtk_widget_show_all (n->pane);
+	if (!openinbackground)
+		gtk_notebook_set_current_page (GTK_NOTEBOOK (b->book), gtk_notebook_get_n_pages (GTK_NOTEBOOK (b->book)) - 1);
+	return n->view;
+}
+
+/*
+ * Fuzzy match a query against some text - every character of the query must
+ * appear in the text, in order, ignoring case. Returns 0 if there is no match,
+ * otherwise a score that favours runs of characters and starts of words.
+ */
+static gint
+fuzzy_match (const gchar* query, const gchar* text)
+{
+	gint score = 0, run = 0;
+	gchar prev = 0;
+	
+	if (!text)
+		return 0;
+	
+	for (; *query; query++)
+	{
+		gchar q = g_ascii_tolower (*query);
+		
+		if (q == ' ')
+			continue;
+		
+		while (*text && g_ascii_tolower (*text) != q)
+		{
+			prev = *text++;
+			run = 0;
+		}
+		if (!*text)
+			return 0;
+		
+		score += 1 + 2 * run;
+		if (!g_ascii_isalnum (prev))
+			score += 3;
+		run++;
+		prev = *text++;
+	}
+	
+	return MAX (score, 1);
+}
+
+/*
+ * Forget a tab's text, along with any part of it not yet indexed
+ */
+static void
+tab_index_drop (Client* c)
+{
+	if (c->index_id)
+		g_source_remove (c->index_id);
+	if (tab_index)
+		text_index_remove (tab_index, c->index_page);
+	g_free (c->index_text);
+	c->index_id = c->index_page = 0;
+	c->index_text = NULL;
+}
+
+/*
+ * Index a loaded page a chunk at a time, at low priority - the text is taken
+ * from the page on the first call, and one chunk is fed per call after that
+ */
+static gboolean
+tab_index_cb (gpointer data)
+{
+	Client* c = data;
+	JANK_ENTER (c);
+	gsize end;
+	
+	if (!c->index_text)
+	{
+		WebKitDOMDocument* document = webkit_web_view_get_dom_document (c->view);
+		WebKitDOMHTMLElement* body = document ? webkit_dom_document_get_body (document) : NULL;
+		
+		if (!body || !(c->index_text = webkit_dom_html_element_get_inner_text (body)))
+		{
+			c->index_id = 0;
+			return FALSE;
+		}
+		c->index_length = strlen (c->index_text);
+		history_add (c->view, c->index_text, c->index_length);
+		c->index_length = MIN (c->index_length, tab_index_page_limit);
+		c->index_offset = 0;
+		c->index_page = text_index_begin (tab_index, c);
+		return TRUE;
+	}
+	
+	/* Cut chunks at whitespace, so that no word is split between two */
+	end = MIN (c->index_offset + tab_index_chunk, c->index_length);
+	while (end < c->index_length && !g_ascii_isspace (c->index_text[end]))
+		end++;
+	text_index_feed (tab_index, c->index_page, c->index_text + c->index_offset, end - c->index_offset);
+	c->index_offset = end;
+	if (end < c->index_length)
+		return TRUE;
+	
+	text_index_end (tab_index, c->index_page);
+	g_free (c->index_text);
+	c->index_text = NULL;
+	c->index_id = 0;
+	return FALSE;
+}
+
+/*
+ * Replace a tab's text in the index with that of the page it just loaded
+ */
+static void
+tab_index_page (Client* c)
+{
+	tab_index_drop (c);
+	if (c->remote)
+		return;
+	if (!tab_index)
+		tab_index = text_index_new (tab_index_memory_limit);
+	c->index_id = g_idle_add_full (G_PRIORITY_LOW, tab_index_cb, c, NULL);
+}
+
+/*
+ * Filter and sort the tab switcher's rows for its query. The rows stay in the
+ * store - only whether they are shown, and their rank, change. Best fuzzy
+ * match on the title or uri first, then best match on the text.
+ */
+static void
+switcher_update (Browser* b)
+{
+	JANK_ENTER (b->current);
+	const gchar* query = gtk_entry_get_text (GTK_ENTRY (b->switcher_entry));
+	GtkTreeModel* store = GTK_TREE_MODEL (b->switcher_store);
+	TextIndexHit hits[tab_index_hits];
+	GtkTreeIter iter;
+	gboolean valid;
+	guint j, found = 0;
+	gint row = 0;
+	
+	/* Tabs whose text matches, from any window */
+	if (query[0] && tab_index)
+		found = text_index_search (tab_index, query, hits, tab_index_hits);
+	
+	/* Detach the model while updating it, so the view isn't updated per row */
+	g_object_ref (b->switcher_model);
+	gtk_tree_view_set_model (GTK_TREE_VIEW (b->switcher_view), NULL);
+	for (valid = gtk_tree_model_get_iter_first (store, &iter); valid; valid = gtk_tree_model_iter_next (store, &iter), row++)
+	{
+		Client* c;
+		gint score;
+		gdouble text_score = 0;
+		
+		gtk_tree_model_get (store, &iter, SWITCHER_COLUMN_CLIENT, &c, -1);
+		score = MAX (fuzzy_match (query, c->title), fuzzy_match (query, client_get_uri (c)));
+		for (j = 0; j < found; j++)
+			if (hits[j].owner == c)
+				text_score = hits[j].score;
+		
+		/* Without a query, tabs are listed in order; text scores add less than a point */
+		gtk_list_store_set (b->switcher_store, &iter,
+							SWITCHER_COLUMN_VISIBLE, score > 0 || text_score > 0,
+							SWITCHER_COLUMN_SCORE, score,
+							SWITCHER_COLUMN_RANK, query[0] ? score + text_score / (1 + text_score) : (gdouble) -row,
+							-1);
+	}
+	gtk_tree_view_set_model (GTK_TREE_VIEW (b->switcher_view), b->switcher_model);
+	g_object_unref (b->switcher_model);
+	
+	/* Select the best match */
+	if (gtk_tree_model_get_iter_first (b->switcher_model, &iter))
+		gtk_tree_selection_select_iter (gtk_tree_view_get_selection (GTK_TREE_VIEW (b->switcher_view)), &iter);
+}
+
+/*
+ * Fill the tab switcher with the tabs of all windows - when it is opened
+ */
+static void
+switcher_fill (Browser* b)
+{
+	GtkTreeIter iter;
+	GList* l;
+	guint i;
+	
+	gtk_list_store_clear (b->switcher_store);
+	for (l = browsers; l; l = l->next)
+	{
+		Browser* w = l->data;
+		
+		for (i = 0; i < w->clients->len; i++)
+		{
+			Client* c = g_ptr_array_index (w->clients, i);
+			const gchar* uri = client_get_uri (c);
+			gchar* text = g_strdup_printf ("%s - %s", c->title ? c->title : "Untitled", uri ? uri : "");
+			
+			gtk_list_store_insert_with_values (b->switcher_store, &iter, -1,
+											SWITCHER_COLUMN_TEXT, text,
+											SWITCHER_COLUMN_CLIENT, c,
+											-1);
+			g_free (text);
+		}
+	}
+}
+
+/*
+ * Switch to the tab selected in the tab switcher, and close the switcher
+ */
+static void
+switcher_activate (Browser* b)
+{
+	GtkTreeModel* model;
+	GtkTreeIter iter;
+	Client* c = NULL;
+	gint score = 0;
+	gboolean text_only = FALSE;
+	guint i;
+	
+	if (gtk_tree_selection_get_selected (gtk_tree_view_get_selection (GTK_TREE_VIEW (b->switcher_view)), &model, &iter))
+		gtk_tree_model_get (model, &iter, SWITCHER_COLUMN_CLIENT, &c, SWITCHER_COLUMN_SCORE, &score, -1);
+	text_only = c && score == 0;
+	
+	gtk_widget_hide (b->switcher);
+	
+	/* The tab may be in another window */
+	if (c)
+	{
+		b = c->b;
+		gtk_notebook_set_current_page (GTK_NOTEBOOK (b->book), gtk_notebook_page_num (GTK_NOTEBOOK (b->book), c->pane));
+		gtk_window_present (GTK_WINDOW (b->window));
+		client_focus (c);
+	}
+	
+	/* Found by its text - show where, by finding the longest word of the query */
+	if (text_only)
+	{
+		gchar** words = g_strsplit_set (gtk_entry_get_text (GTK_ENTRY (b->switcher_entry)), " \t", -1);
+		const gchar* word = "";
+		
+		for (i = 0; words[i]; i++)
+			if (strlen (words[i]) > strlen (word))
+				word = words[i];
+		find_bar_show_cb (NULL, b);
+		gtk_entry_set_text (GTK_ENTRY (b->find_entry), word);
+		g_strfreev (words);
+	}
+}
+
+/*
+ * Move the selection of the tab switcher up or down by some rows
+ */
+static void
+switcher_move (Browser* b, gint rows)
+{
+	GtkTreeSelection* selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (b->switcher_view));
+	GtkTreeModel* model;
+	GtkTreeIter iter;
+	gint n = gtk_tree_model_iter_n_children (b->switcher_model, NULL);
+	gint row = 0;
+	
+	if (n == 0)
+		return;
+	
+	if (gtk_tree_selection_get_selected (selection, &model, &iter))
+	{
+		GtkTreePath* path = gtk_tree_model_get_path (model, &iter);
+		row = gtk_tree_path_get_indices (path)[0] + rows;
+		gtk_tree_path_free (path);
+	}
+	row = CLAMP (row, 0, n - 1);
+	
+	GtkTreePath* path = gtk_tree_path_new_from_indices (row, -1);
+	gtk_tree_selection_select_path (selection, path);
+	gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (b->switcher_view), path, NULL, FALSE, 0, 0);
+	gtk_tree_path_free (path);
+}
+
+static void
+switcher_entry_changed_cb (GtkEditable* editable, Browser* b)
+{
+	switcher_update (b);
+}
+
+static void
+switcher_entry_activate_cb (GtkEntry* entry, Browser* b)
+{
+	switcher_activate (b);
+}
+
+static void
+switcher_row_activated_cb (GtkTreeView* view, GtkTreePath* path, GtkTreeViewColumn* column, Browser* b)
+{
+	switcher_activate (b);
+}
+
+static gboolean
+switcher_key_press_cb (GtkWidget* widget, GdkEventKey* event, Browser* b)
+{
+	switch (event->keyval)
+	{
+		case GDK_KEY_Escape:
+			gtk_widget_hide (b->switcher);
+			return TRUE;
+		case GDK_KEY_Up:
+			switcher_move (b, -1);
+			return TRUE;
+		case GDK_KEY_Down:
+			switcher_move (b, 1);
+			return TRUE;
+		case GDK_KEY_Page_Up:
+			switcher_move (b, -10);
+			return TRUE;
+		case GDK_KEY_Page_Down:
+			switcher_move (b, 10);
+			return TRUE;
+		default:
+			break;
+	}
+	
+	return FALSE;
+}
+
+static gboolean
+switcher_focus_out_cb (GtkWidget* widget, GdkEventFocus* event, Browser* b)
+{
+	gtk_widget_hide (b->switcher);
+	return FALSE;
+}
+
+/*
+ * Tabs may close while the switcher is hidden - forget them until it is
+ * opened again
+ */
+static void
+switcher_hide_cb (GtkWidget* widget, Browser* b)
+{
+	gtk_list_store_clear (b->switcher_store);
+}
+
+/*
+ * Create the tab switcher - an entry to filter tabs by title or uri, and a list
+ * of the matching tabs. Rows have a fixed height so only visible rows are laid out.
+ */
+static GtkWidget*
+create_switcher (Browser* b)
+{
+	GtkWidget* window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title (GTK_WINDOW (window), "Tabs");
+	gtk_window_set_transient_for (GTK_WINDOW (window), GTK_WINDOW (b->window));
+	gtk_window_set_position (GTK_WINDOW (window), GTK_WIN_POS_CENTER_ON_PARENT);
+	gtk_window_set_destroy_with_parent (GTK_WINDOW (window), TRUE);
+	gtk_window_set_default_size (GTK_WINDOW (window), 600, 400);
+	gtk_window_set_decorated (GTK_WINDOW (window), FALSE);
+	gtk_window_set_skip_taskbar_hint (GTK_WINDOW (window), TRUE);
+	g_signal_connect (G_OBJECT (window), "key-press-event", G_CALLBACK (switcher_key_press_cb), b);
+	g_signal_connect (G_OBJECT (window), "focus-out-event", G_CALLBACK (switcher_focus_out_cb), b);
+	g_signal_connect (G_OBJECT (window), "delete-event", G_CALLBACK (gtk_widget_hide_on_delete), NULL);
+	g_signal_connect (G_OBJECT (window), "hide", G_CALLBACK (switcher_hide_cb), b);
+	
+	GtkWidget* vbox = gtk_vbox_new (FALSE, 2);
+	
+	/* The filter entry */
+	b->switcher_entry = gtk_entry_new ();
+	g_signal_connect (G_OBJECT (b->switcher_entry), "changed", G_CALLBACK (switcher_entry_changed_cb), b);
+	g_signal_connect (G_OBJECT (b->switcher_entry), "activate", G_CALLBACK (switcher_entry_activate_cb), b);
+	gtk_box_pack_start (GTK_BOX (vbox), b->switcher_entry, FALSE, FALSE, 0);
+	
+	/* The list of matching tabs - the store filtered, then sorted best first */
+	b->switcher_store = gtk_list_store_new (SWITCHER_N_COLUMNS, G_TYPE_STRING, G_TYPE_POINTER, G_TYPE_BOOLEAN, G_TYPE_INT, G_TYPE_DOUBLE);
+	GtkTreeModel* filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (b->switcher_store), NULL);
+	gtk_tree_model_filter_set_visible_column (GTK_TREE_MODEL_FILTER (filter), SWITCHER_COLUMN_VISIBLE);
+	b->switcher_model = gtk_tree_model_sort_new_with_model (filter);
+	gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (b->switcher_model), SWITCHER_COLUMN_RANK, GTK_SORT_DESCENDING);
+	b->switcher_view = gtk_tree_view_new_with_model (b->switcher_model);
+	g_object_unref (b->switcher_model);
+	g_object_unref (filter);
+	g_object_unref (b->switcher_store);
+	gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (b->switcher_view), FALSE);
+	gtk_tree_view_set_enable_search (GTK_TREE_VIEW (b->switcher_view), FALSE);
+	
+	GtkCellRenderer* renderer = gtk_cell_renderer_text_new ();
+	g_object_set (G_OBJECT (renderer), "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+	GtkTreeViewColumn* column = gtk_tree_view_column_new_with_attributes ("Tab", renderer, "text", SWITCHER_COLUMN_TEXT, NULL);
+	gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_append_column (GTK_TREE_VIEW (b->switcher_view), column);
+	gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (b->switcher_view), TRUE);
+	g_signal_connect (G_OBJECT (b->switcher_view), "row-activated", G_CALLBACK (switcher_row_activated_cb), b);
+	
+	GtkWidget* scroll = gtk_scrolled_window_new (NULL, NULL);
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scroll), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+	gtk_container_add (GTK_CONTAINER (scroll), b->switcher_view);
+	gtk_box_pack_start (GTK_BOX (vbox), scroll, TRUE, TRUE, 0);
+	
+	gtk_container_add (GTK_CONTAINER (window), vbox);
+	gtk_widget_show_all (vbox);
+	
+	return window;
+}
+
+/*
+ * Callback for view.tabs - open the tab switcher
+ */
+static void
+switcher_show_cb (GtkWidget* widget, Browser* b)
+{
+	if (!b->switcher)
+		b->switcher = create_switcher (b);
+	
+	switcher_fill (b);
+	gtk_entry_set_text (GTK_ENTRY (b->switcher_entry), "");
+	switcher_update (b);
+	gtk_widget_show (b->switcher);
+	gtk_widget_grab_focus (b->switcher_entry);
+}
+
+static WebKitWebView*
+inspector_new (WebKitWebInspector* i, WebKitWebView* v, Client* c)
+{
+	return WEBKIT_WEB_VIEW (webkit_web_view_new ());
+}
+
+static gboolean
+inspector_show (WebKitWebInspector *i, Client *c)
+{
+	WebKitWebView *w;
+
+	if (c->isinspecting)
+		return false;
+
+	w = webkit_web_inspector_get_web_view (i);
+	gtk_paned_pack2 (GTK_PANED (c->pane), GTK_WIDGET (w), TRUE, TRUE);
+	gtk_widget_show(GTK_WIDGET (w));
+	c->isinspecting = true;
+
+	return true;
+}
+
+static gboolean
+inspector_close (WebKitWebInspector *i, Client *c)
+{
+	GtkWidget *w;
+
+	if (!c->isinspecting)
+		return false;
+
+	w = GTK_WIDGET (webkit_web_inspector_get_web_view(i));
+	gtk_widget_hide (w);
+	gtk_widget_destroy (w);
+	c->isinspecting = false;
+
+	return true;
+}
+
+static void
+inspector_finished (WebKitWebInspector *i, Client *c)
+{
+	/* The inspector belongs to the view - nothing to free */
+	c->isinspecting = false;
+}
+
+/*
+ * The inspector of a client, hooked up on first use - NULL for tabs in
+ * renderer processes
+ */
+static WebKitWebInspector*
+client_inspector (Client* c)
+{
+	if (c->inspector || c->remote || !enableinspector)
+		return c->inspector;
+	
+	c->inspector = WEBKIT_WEB_INSPECTOR (webkit_web_view_get_inspector (c->view));
+	
+	g_signal_connect (G_OBJECT (c->inspector), "inspect-web-view", G_CALLBACK (inspector_new), c);
+	g_signal_connect (G_OBJECT (c->inspector), "show-window", G_CALLBACK (inspector_show), c);
+	g_signal_connect (G_OBJECT (c->inspector), "close-window", G_CALLBACK (inspector_close), c);
+	g_signal_connect (G_OBJECT (c->inspector), "finished", G_CALLBACK (inspector_finished), c);
+	
+	c->isinspecting = FALSE;
+	return c->inspector;
+}
+
+static void
+inspector (GtkCheckMenuItem *checkmenuitem, Browser* b)
+{
+	if (!client_inspector (b->current))
+		return;
+	if (gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (checkmenuitem)))
+	{
+		inspector_close (b->current->inspector, b->current);
+	} else
+	{
+		inspector_new (b->current->inspector, b->current->view, b->current);
+	}
+}
+
+/*
+ * Callback for a change in the title of a web page - update window title
+ */
+static void
+title_change_cb (WebKitWebView* web_view, WebKitWebFrame* web_frame, const gchar* title, Client* c)
+{
+	JANK_ENTER (c);
+	g_free (c->title);
+	c->title = g_strdup (title);
+	gtk_label_set_text (GTK_LABEL (c->label), title);
+	if (c == c->b->current)
+		update_title (c->b);
+}
+
+/*
+ * Callback for change in progress of a page being loaded - update title of window
+ */
+static void
+progress_change_cb (WebKitWebView *view, GParamSpec *pspec, Client *c)
+{
+	JANK_ENTER (c);
+	c->progress = webkit_web_view_get_progress(c->view) * 100;
+	if (c == c->b->current)
+		update_title (c->b);
+}
+
+/*
+ * --startup-time: note the first time the page itself is drawn
+ */
+static gboolean
+startup_expose_cb (GtkWidget* widget, GdkEventExpose* event, gpointer data)
+{
+	WebKitLoadStatus status = webkit_web_view_get_load_status (WEBKIT_WEB_VIEW (widget));
+	
+	if (!startup_first_paint && (status == WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT || status == WEBKIT_LOAD_FINISHED))
+		startup_first_paint = g_get_monotonic_time ();
+	return FALSE;
+}
+
+/*
+ * --startup-time: report how long the first page took, then quit
+ */
+static void
+startup_time_report (WebKitWebView* web_view)
+{
+	const gchar* uri = webkit_web_view_get_uri (web_view);
+	
+	printf ("sb: %s %s %.1f ms after start, first paint %.1f ms\n", uri ? uri : "(none)",
+			webkit_web_view_get_load_status (web_view) == WEBKIT_LOAD_FAILED ? "failed" : "loaded",
+			(g_get_monotonic_time () - startup_start) / 1000.0,
+			startup_first_paint ? (startup_first_paint - startup_start) / 1000.0 : -1.0);
+	startup_time = FALSE;
+	destroy_cb (NULL, NULL);
+}
+
+/*
+ * Callback for a change in the load status of a web view
+ */
+static void
+load_status_change_cb (WebKitWebView* web_view, GParamSpec* pspec, Client* c)
+{
+	JANK_ENTER (c);
+	WebKitWebFrame* frame;
+	const gchar* uri;
+	
+	flight_record (FLIGHT_LOAD, webkit_web_view_get_load_status (web_view), c->flight_id, 0);
+	lite_load_status (c, webkit_web_view_get_load_status (web_view));
+	switch (webkit_web_view_get_load_status (web_view))
+	{
+		case WEBKIT_LOAD_COMMITTED:
+			metrics_add (METRIC_NAVIGATIONS, 1);
+			/* Update uri in entry-bar */
+			frame = webkit_web_view_get_main_frame (web_view);
+			uri = webkit_web_frame_get_uri (frame);
+			if (uri && c == c->b->current)
+				gtk_entry_set_text (GTK_ENTRY (c->b->uri_entry), uri);
+			/* Update tab-label - until the new page has a title */
+			if (uri)
+				gtk_label_set_text (GTK_LABEL (c->label), uri);
+			update_favicon (c);
+			/* The visible page moved on - the prediction no longer applies */
+			if (c == c->b->current)
+			{
+				prerender_discard (c->b);
+				find_count_stop (c->b);
+			}
+			tab_index_drop (c);
+			break;
+		case WEBKIT_LOAD_FINISHED:
+			record_page (web_view);
+			tab_index_page (c);
+			if (c == c->b->current)
+				prerender_next_page (c);
+			if (startup_time)
+				startup_time_report (web_view);
+			break;
+		case WEBKIT_LOAD_FAILED:
+			if (startup_time)
+				startup_time_report (web_view);
+			break;
+		default:
+			break;
+	}
+	
+	/* Update buttons - back, forward */
+	if (c == c->b->current)
+		update_buttons (c->b);
+}
+
+/*
+ * Callback for file.open - open file-chooser dialog and open selected file in webview
+ */
+static void
+openfile_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	GtkWidget* file_dialog = gtk_file_chooser_dialog_new ("Open File",
+														GTK_WINDOW (b->window),
+														GTK_FILE_CHOOSER_ACTION_OPEN,
+														"Cancel", GTK_RESPONSE_CANCEL,
+														"Open", GTK_RESPONSE_ACCEPT,
+														NULL);
+	
+	/* Add filters to dialog - all and html files */
+	GtkFileFilter* filter = gtk_file_filter_new ();
+	gtk_file_filter_set_name (filter, "All files");
+	gtk_file_filter_add_pattern (filter, "*");
+	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (file_dialog), filter);
+	
+	filter = gtk_file_filter_new ();
+	gtk_file_filter_set_name (filter, "HTML files");
+	gtk_file_filter_add_mime_type (filter, "text/html");
+	gtk_file_filter_add_pattern (filter, "*.htm");
+	gtk_file_filter_add_pattern (filter, "*.html");
+	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (file_dialog), filter);
+	
+	filter = gtk_file_filter_new ();
+	gtk_file_filter_set_name (filter, "Offline pages");
+	gtk_file_filter_add_pattern (filter, "*.sbar");
+	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (file_dialog), filter);
+	
+	/* Made at startup, in the I/O thread */
+	gchar* archive_dir = data_path ("archives");
+	gtk_file_chooser_add_shortcut_folder (GTK_FILE_CHOOSER (file_dialog), archive_dir, NULL);
+	g_free (archive_dir);
+	
+	/* Run the dialog and check result. If a file was selected, open it in the web-view. */							
+	if (gtk_dialog_run (GTK_DIALOG (file_dialog)) == GTK_RESPONSE_ACCEPT)
+	{
+		gchar* path = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog));
+		gchar *filename;
+		
+		/* Offline archives are opened through the sb: scheme */
+		if (g_str_has_suffix (path, ".sbar"))
+		{
+			gchar* base = g_path_get_basename (path);
+			base[strlen (base) - strlen (".sbar")] = '\0';
+			filename = g_strdup_printf ("sb://archive/%s", base);
+			g_free (base);
+		}
+		else
+			filename = local_file_uri (path);
+		
+		client_load_uri (b->current, filename);
+		g_free (filename);
+		g_free (path);
+	}
+	
+	gtk_widget_destroy (file_dialog);
+}
+
+/*
+ * Callback for view.history - search the pages visited before
+ */
+static void
+history_cb (GtkWidget* widget, Browser* b)
+{
+	client_load_uri (b->current, "sb://history/");
+	client_focus (b->current);
+}
+
+/*
+ * Callback for tools.site-storage - show what sites keep in the profile
+ */
+static void
+storage_cb (GtkWidget* widget, Browser* b)
+{
+	client_load_uri (b->current, "sb://storage/");
+	client_focus (b->current);
+}
+
+static gboolean
+flight_save_job (gpointer data, GError** error)
+{
+	if (flight_dump (flight_path))
+		return TRUE;
+	g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot write %s", flight_path);
+	return FALSE;
+}
+
+static void
+flight_saved_cb (const GError* error, gpointer data)
+{
+	Browser* b = data;
+	gchar* message = error ? g_strdup (error->message)
+		: g_strdup_printf ("Flight recording saved to %s - read it with sb-flight", flight_path);
+	
+	if (g_list_find (browsers, b))
+	{
+		gtk_statusbar_pop (b->statusbar, b->status_context_id);
+		gtk_statusbar_push (b->statusbar, b->status_context_id, message);
+	}
+	g_free (message);
+}
+
+/*
+ * Callback for tools.save-flight-recording - write out the recent events, for
+ * a bug report
+ */
+static void
+flight_save_cb (GtkWidget* widget, Browser* b)
+{
+	io_call (flight_save_job, NULL, flight_saved_cb, b);
+}
+
+/*
+ * Callback for file.new-window - open another window on the home page
+ */
+static void
+new_window_cb (GtkWidget* widget, Browser* b)
+{
+	Browser* n = create_browser ();
+	client_load_uri (n->current, home_page);
+	gtk_widget_show_all (n->window);
+}
+
+/*
+ * Open print dialog for the current web page
+ */
+static void
+print_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	if (!remote_send (b->current, "print", NULL))
+		webkit_web_frame_print (webkit_web_view_get_main_frame (b->current->view));
+}
+
+/*
+ * Callback for file.save-offline - archive the page and everything it loaded,
+ * so it can be read later without the network
+ */
+static void
+save_offline_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	if (b->current->remote)
+	{
+		gtk_statusbar_push (GTK_STATUSBAR (b->statusbar), b->status_context_id, "Pages in renderer processes cannot be saved");
+		return;
+	}
+	WebKitWebFrame* frame = webkit_web_view_get_main_frame (b->current->view);
+	WebKitWebDataSource* source = webkit_web_frame_get_data_source (frame);
+	const gchar* uri = webkit_web_frame_get_uri (frame);
+	GList *resources, *l;
+	
+	if (!uri || !source || webkit_web_data_source_is_loading (source) || g_str_has_prefix (uri, "sb:"))
+	{
+		gtk_statusbar_push (GTK_STATUSBAR (b->statusbar), b->status_context_id, "Nothing to save yet");
+		return;
+	}
+	
+	/* The page itself, rebased so relative links keep working */
+	WebKitWebResource* main_resource = webkit_web_data_source_get_main_resource (source);
+	GString* data = webkit_web_data_source_get_data (source);
+	GString* page = archive_rebase (data->str, data->len, uri);
+	GPtrArray* entries = g_ptr_array_new_with_free_func (g_free);
+	
+	ArchiveEntry* entry = g_new0 (ArchiveEntry, 1);
+	entry->status = SOUP_STATUS_OK;
+	entry->mime = (gchar*) webkit_web_resource_get_mime_type (main_resource);
+	entry->uri = (gchar*) uri;
+	entry->data = page->str;
+	entry->length = page->len;
+	g_ptr_array_add (entries, entry);
+	
+	/* Then whatever it loaded - images, stylesheets, scripts */
+	resources = webkit_web_data_source_get_subresources (source);
+	for (l = resources; l; l = l->next)
+	{
+		WebKitWebResource* resource = l->data;
+		GString* resource_data = webkit_web_resource_get_data (resource);
+		
+		if (!resource_data || !webkit_web_resource_get_uri (resource))
+			continue;
+		
+		entry = g_new0 (ArchiveEntry, 1);
+		entry->status = SOUP_STATUS_OK;
+		entry->mime = (gchar*) webkit_web_resource_get_mime_type (resource);
+		entry->uri = (gchar*) webkit_web_resource_get_uri (resource);
+		entry->data = resource_data->str;
+		entry->length = resource_data->len;
+		g_ptr_array_add (entries, entry);
+	}
+	
+	gchar* name = archive_name (uri);
+	archive_write (b, name, entries);
+	gtk_statusbar_push (GTK_STATUSBAR (b->statusbar), b->status_context_id, "Saving for offline reading...");
+	
+	g_free (name);
+	g_list_free (resources);
+	g_ptr_array_free (entries, TRUE);
+	g_string_free (page, TRUE);
+}
+
+/*
+ * Lite mode: whether a request loads something the page's text does without -
+ * a script, plugin content, a font, or a stylesheet from another site than
+ * the page. Documents, images and the page's own stylesheets are kept.
+ */
+static gboolean
+lite_blocked (WebKitNetworkRequest* request)
+{
+	SoupMessage* msg = webkit_network_request_get_message (request);
+	SoupURI *target, *page;
+	const gchar* accept;
+	gchar* path;
+	gboolean blocked = FALSE;
+	
+	if (!msg || !(target = soup_message_get_uri (msg)) || !SOUP_URI_VALID_FOR_HTTP (target))
+		return FALSE;
+	accept = soup_message_headers_get_one (msg->request_headers, "Accept");
+	if (accept && g_str_has_prefix (accept, "text/html"))
+		return FALSE;
+	
+	path = g_ascii_strdown (target->path, -1);
+	if (g_str_has_suffix (path, ".js") || g_str_has_suffix (path, ".mjs")
+		|| g_str_has_suffix (path, ".woff") || g_str_has_suffix (path, ".woff2")
+		|| g_str_has_suffix (path, ".ttf") || g_str_has_suffix (path, ".otf") || g_str_has_suffix (path, ".eot")
+		|| g_str_has_suffix (path, ".swf"))
+		blocked = TRUE;
+	else if ((accept && g_str_has_prefix (accept, "text/css")) || g_str_has_suffix (path, ".css"))
+	{
+		/* The first party is the page being loaded */
+		page = soup_message_get_first_party (msg);
+		blocked = !page || g_strcmp0 (page->host, target->host) != 0;
+	}
+	g_free (path);
+	return blocked;
+}
+
+/*
+ * Settings for lite tabs - the shared ones, without scripts and plugins, and
+ * with the lite stylesheet from config.h
+ */
+static WebKitWebSettings*
+lite_settings_get (void)
+{
+	if (!lite_settings)
+	{
+		gchar* css = g_base64_encode ((const guchar*) lite_stylesheet, strlen (lite_stylesheet));
+		gchar* uri = g_strconcat ("data:text/css;charset=utf-8;base64,", css, NULL);
+		
+		lite_settings = webkit_web_settings_copy (web_settings);
+		g_object_set (G_OBJECT (lite_settings), "enable-scripts", FALSE, NULL);
+		g_object_set (G_OBJECT (lite_settings), "enable-plugins", FALSE, NULL);
+		g_object_set (G_OBJECT (lite_settings), "user-stylesheet-uri", uri, NULL);
+		g_free (uri);
+		g_free (css);
+	}
+	return lite_settings;
+}
+
+/*
+ * Show what the lite load of the current page took, next to its last normal
+ * load
+ */
+static void
+lite_status (Client* c)
+{
+	gchar* bytes = g_format_size (c->load_bytes);
+	gchar *normal_bytes, *message;
+	
+	if (c->normal_uri && !g_strcmp0 (c->normal_uri, webkit_web_view_get_uri (c->view)))
+	{
+		normal_bytes = g_format_size (c->normal_bytes);
+		message = g_strdup_printf ("Lite: %u requests, %s in %.1f s, %u blocked - normal load: %u requests, %s in %.1f s",
+								c->load_requests, bytes, (g_get_monotonic_time () - c->load_start) / 1000000.0, c->load_blocked,
+								c->normal_requests, normal_bytes, c->normal_time / 1000000.0);
+		g_free (normal_bytes);
+	}
+	else
+		message = g_strdup_printf ("Lite: %u requests, %s in %.1f s, %u blocked",
+								c->load_requests, bytes, (g_get_monotonic_time () - c->load_start) / 1000000.0, c->load_blocked);
+	
+	gtk_statusbar_pop (c->b->statusbar, c->b->status_context_id);
+	gtk_statusbar_push (c->b->statusbar, c->b->status_context_id, message);
+	g_free (message);
+	g_free (bytes);
+}
+
+/*
+ * Count the requests and bytes of each load - a normal load is remembered to
+ * compare the lite one with
+ */
+static void
+lite_load_status (Client* c, WebKitLoadStatus status)
+{
+	const gchar* uri;
+	
+	if (status == WEBKIT_LOAD_PROVISIONAL)
+	{
+		c->load_requests = c->load_blocked = 0;
+		c->load_bytes = 0;
+		c->load_start = g_get_monotonic_time ();
+		return;
+	}
+	if (status != WEBKIT_LOAD_FINISHED || !(uri = webkit_web_view_get_uri (c->view)))
+		return;
+	
+	if (c->lite)
+	{
+		if (c == c->b->current)
+			lite_status (c);
+		return;
+	}
+	g_free (c->normal_uri);
+	c->normal_uri = g_strdup (uri);
+	c->normal_requests = c->load_requests;
+	c->normal_bytes = c->load_bytes;
+	c->normal_time = g_get_monotonic_time () - c->load_start;
+}
+
+/*
+ * Keep view.lite in step with the current tab
+ */
+static void
+lite_item_update (Browser* b)
+{
+	if (!b->lite_item)
+		return;
+	g_signal_handlers_block_matched (G_OBJECT (b->lite_item), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, b);
+	gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (b->lite_item), b->current->lite);
+	g_signal_handlers_unblock_matched (G_OBJECT (b->lite_item), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, b);
+}
+
+/*
+ * Callback for view.lite - reload the current tab with or without lite mode.
+ * Both reloads skip the cache, so that the loads compare.
+ */
+static void
+lite_cb (GtkCheckMenuItem* item, Browser* b)
+{
+	JANK_ENTER (b->current);
+	Client* c = b->current;
+	
+	if (c->remote)
+	{
+		gtk_statusbar_push (b->statusbar, b->status_context_id, "Lite mode is not available for pages in renderer processes");
+		lite_item_update (b);
+		return;
+	}
+	c->lite = gtk_check_menu_item_get_active (item);
+	webkit_web_view_set_settings (c->view, c->lite ? lite_settings_get () : web_settings);
+	if (webkit_web_view_get_uri (c->view))
+		webkit_web_view_reload_bypass_cache (c->view);
+}
+
+/*
+ * Send requests made by archived pages to the archive, and drop the ones a
+ * lite tab does without
+ */
+static void
+resource_request_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitWebResource* resource, WebKitNetworkRequest* request, WebKitNetworkResponse* response, Client* c)
+{
+	JANK_ENTER (c);
+	if (c->lite && lite_blocked (request))
+	{
+		c->load_blocked++;
+		webkit_network_request_set_uri (request, "about:blank");
+		return;
+	}
+	c->load_requests++;
+	metrics_add (METRIC_REQUESTS, 1);
+	archive_resource_request (web_view, request);
+	replay_resource_request (request);
+}
+
+static void
+resource_length_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitWebResource* resource, gint length, Client* c)
+{
+	c->load_bytes += length;
+	metrics_add (METRIC_RECEIVED_BYTES, length);
+}
+
+/*
+ * Callback for edit.cut - cut current selection
+ */
+static void
+cut_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "cut", NULL))
+		webkit_web_view_cut_clipboard (b->current->view);
+}
+
+/*
+ * Callback for edit.copy - copy current selection
+ */
+static void
+copy_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "copy", NULL))
+		webkit_web_view_copy_clipboard (b->current->view);
+}
+
+/*
+ * Callback for edit.paste - paste current selection
+ */
+static void
+paste_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "paste", NULL))
+		webkit_web_view_paste_clipboard (b->current->view);
+}
+
+/* 
+ * Callback for edit.delete - delete current selection
+ */
+static void
+delete_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "delete", NULL))
+		webkit_web_view_delete_selection (b->current->view);
+}
+
+/*
+ * Update the match counter of the find bar - "n of m", or just the number of
+ * matches while the position of the current one is not known
+ */
+static void
+find_bar_update_status (Browser* b)
+{
+	gchar* status;
+	
+	if (!b->find_last_text || !b->find_last_text[0])
+		status = g_strdup ("");
+	else if (b->find_found && b->find_match_count == 0)
+		status = g_strdup ("Counting matches...");
+	else if (b->find_match_count == 0)
+		status = g_strdup ("No matches");
+	else if (b->find_match_current == 0)
+		status = g_strdup_printf ("%u%s matches", b->find_match_count,
+								b->current->remote && b->find_match_count >= find_highlight_limit ? "+" : "");
+	else
+		status = g_strdup_printf ("%u of %u", b->find_match_current, b->find_match_count);
+	
+	gtk_label_set_text (GTK_LABEL (b->find_status_label), status);
+	g_free (status);
+}
+
+/*
+ * Highlight the matches of the current search - each slice marks at most
+ * twice as many as the one before, up to find_highlight_limit. Runs at low
+ * priority so that pending keystrokes are handled (and cancel this) first.
+ */
+static gboolean
+find_bar_mark_cb (gpointer data)
+{
+	Browser* b = data;
+	JANK_ENTER (b->current);
+	WebKitWebView* view = b->current->view;
+	guint marked;
+	
+	b->find_mark_limit = MIN (b->find_mark_limit ? b->find_mark_limit * 2 : find_mark_batch, find_highlight_limit);
+	webkit_web_view_unmark_text_matches (view);
+	marked = webkit_web_view_mark_text_matches (view, b->find_last_text, b->find_last_case, b->find_mark_limit);
+	webkit_web_view_set_highlight_text_matches (view,
+											gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (b->find_highlight_button)));
+	
+	if (marked < b->find_mark_limit || b->find_mark_limit >= find_highlight_limit)
+	{
+		b->find_mark_id = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * The text as it is compared - casefolded unless the search matches case
+ */
+static gchar*
+find_fold (const gchar* text, gssize length, gboolean case_sensitive)
+{
+	if (!case_sensitive)
+		return g_utf8_casefold (text, length);
+	return length < 0 ? g_strdup (text) : g_strndup (text, length);
+}
+
+static guint
+find_occurrences (const gchar* text, const gchar* needle)
+{
+	gsize length = strlen (needle);
+	guint n = 0;
+	
+	while ((text = strstr (text, needle)))
+	{
+		n++;
+		text += length;
+	}
+	return n;
+}
+
+/*
+ * Count the matches in the next find_count_batch text nodes of the page. The
+ * node holding the start of the selection - the match the view is at - gives
+ * the current match's position. Matches split across elements are found by
+ * WebKit but not counted here.
+ */
+static gboolean
+find_bar_count_cb (gpointer data)
+{
+	Browser* b = data;
+	JANK_ENTER (b->current);
+	gchar* needle = find_fold (b->find_last_text, -1, b->find_last_case);
+	WebKitDOMNode *node, *parent;
+	gchar *name, *value, *folded, *prefix;
+	guint i;
+	
+	for (i = 0; i < find_count_batch; i++)
+	{
+		if (!(node = webkit_dom_tree_walker_next_node (b->find_walker)))
+			break;
+		
+		/* Text in scripts and styles is not shown, so it can't match */
+		parent = webkit_dom_node_get_parent_node (node);
+		name = parent ? webkit_dom_node_get_node_name (parent) : NULL;
+		if (name && (!g_ascii_strcasecmp (name, "script") || !g_ascii_strcasecmp (name, "style") || !g_ascii_strcasecmp (name, "noscript")))
+		{
+			g_free (name);
+			continue;
+		}
+		g_free (name);
+		
+		if (!(value = webkit_dom_node_get_node_value (node)))
+			continue;
+		if (node == b->find_anchor)
+		{
+			glong offset = MIN (b->find_anchor_offset, g_utf8_strlen (value, -1));
+			prefix = find_fold (value, g_utf8_offset_to_pointer (value, offset) - value, b->find_last_case);
+			b->find_counted_current = b->find_counted + find_occurrences (prefix, needle) + 1;
+			g_free (prefix);
+		}
+		folded = find_fold (value, -1, b->find_last_case);
+		b->find_counted += find_occurrences (folded, needle);
+		g_free (folded);
+		g_free (value);
+	}
+	g_free (needle);
+	
+	if (i == find_count_batch)
+		return TRUE;
+	
+	/* WebKit found at least the match the view is at */
+	b->find_count_id = 0;
+	b->find_match_count = MAX (b->find_counted, 1);
+	b->find_match_current = MIN (b->find_counted_current, b->find_match_count);
+	find_count_stop (b);
+	find_bar_update_status (b);
+	return FALSE;
+}
+
+/*
+ * Count the matches of the current search, and find which one is selected
+ */
+static void
+find_count_start (Browser* b)
+{
+	WebKitDOMDocument* document = webkit_web_view_get_dom_document (b->current->view);
+	WebKitDOMHTMLElement* body = document ? webkit_dom_document_get_body (document) : NULL;
+	WebKitDOMDOMWindow* window;
+	WebKitDOMDOMSelection* selection;
+	
+	find_count_stop (b);
+	if (!body)
+		return;
+	
+	/* 4 is NodeFilter.SHOW_TEXT */
+	b->find_walker = webkit_dom_document_create_tree_walker (document, WEBKIT_DOM_NODE (body), 4, NULL, FALSE, NULL);
+	if (!b->find_walker)
+		return;
+	g_object_ref (b->find_walker);
+	
+	window = webkit_dom_document_get_default_view (document);
+	selection = window ? webkit_dom_dom_window_get_selection (window) : NULL;
+	if (selection && (b->find_anchor = webkit_dom_dom_selection_get_anchor_node (selection)))
+	{
+		g_object_ref (b->find_anchor);
+		b->find_anchor_offset = webkit_dom_dom_selection_get_anchor_offset (selection);
+	}
+	
+	b->find_counted = b->find_counted_current = 0;
+	b->find_count_id = g_idle_add_full (G_PRIORITY_LOW, find_bar_count_cb, b, NULL);
+}
+
+/*
+ * Search for the text in the find bar - called once the user stops typing
+ * for find_delay ms
+ */
+static gboolean
+find_bar_run_cb (gpointer data)
+{
+	Browser* b = data;
+	JANK_ENTER (b->current);
+	WebKitWebView* view = b->current->view;
+	const gchar* text = gtk_entry_get_text (GTK_ENTRY (b->find_entry));
+	gboolean case_sensitive = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (b->find_case_button));
+	
+	b->find_timeout_id = 0;
+	
+	/* A longer query can't match if the shorter one didn't - skip the search */
+	if (b->find_last_text && b->find_last_text[0] && !b->find_found
+		&& case_sensitive == b->find_last_case && g_str_has_prefix (text, b->find_last_text))
+	{
+		g_free (b->find_last_text);
+		b->find_last_text = g_strdup (text);
+		find_bar_update_status (b);
+		return FALSE;
+	}
+	
+	g_free (b->find_last_text);
+	b->find_last_text = g_strdup (text);
+	b->find_last_case = case_sensitive;
+	b->find_match_current = 0;
+	b->find_match_count = 0;
+	b->find_found = FALSE;
+	
+	if (!text[0])
+	{
+		if (!remote_send (b->current, "find-clear", NULL))
+			webkit_web_view_unmark_text_matches (view);
+		find_bar_update_status (b);
+		return FALSE;
+	}
+	
+	/* The renderer searches, counts and answers with "found" */
+	if (b->current->remote)
+	{
+		gchar* arg = g_strdup_printf ("%d %d %s", case_sensitive,
+									  gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (b->find_highlight_button)), text);
+		remote_send (b->current, "find", arg);
+		g_free (arg);
+		b->find_found = TRUE;
+		find_bar_update_status (b);
+		return FALSE;
+	}
+	
+	/* Jump to the first match now, count and highlight the rest in slices */
+	if (webkit_web_view_search_text (view, text, case_sensitive, TRUE, TRUE))
+	{
+		b->find_found = TRUE;
+		b->find_mark_limit = 0;
+		b->find_mark_id = g_idle_add_full (G_PRIORITY_LOW, find_bar_mark_cb, b, NULL);
+		find_count_start (b);
+	}
+	else
+		webkit_web_view_unmark_text_matches (view);
+	
+	find_bar_update_status (b);
+	
+	return FALSE;
+}
+
+/*
+ * Search again - the previous search is dropped if it hasn't run yet
+ */
+static void
+find_bar_schedule (Browser* b)
+{
+	find_bar_cancel (b);
+	b->find_timeout_id = g_timeout_add (find_delay, find_bar_run_cb, b);
+}
+
+/*
+ * Move to the next or previous match of the current search
+ */
+static void
+find_bar_step (Browser* b, gboolean forward)
+{
+	JANK_ENTER (b->current);
+	/* Run a pending (or dropped) search first instead of stepping through a stale one */
+	if (b->find_timeout_id || !b->find_last_text)
+	{
+		find_bar_cancel (b);
+		find_bar_run_cb (b);
+		return;
+	}
+	
+	if (!b->find_last_text[0])
+		return;
+	
+	if (b->current->remote)
+	{
+		gchar* arg = g_strdup_printf ("%d %d %s", b->find_last_case, forward, b->find_last_text);
+		remote_send (b->current, "find-next", arg);
+		g_free (arg);
+		return;
+	}
+	if (!webkit_web_view_search_text (b->current->view, b->find_last_text, b->find_last_case, forward, TRUE))
+		return;
+	
+	/* The position of the new match is known once the page is counted again */
+	b->find_match_current = 0;
+	find_count_start (b);
+	find_bar_update_status (b);
+}
+
+static void
+find_entry_changed_cb (GtkEditable* editable, Browser* b)
+{
+	find_bar_schedule (b);
+}
+
+static void
+find_entry_activate_cb (GtkEntry* entry, Browser* b)
+{
+	find_bar_step (b, TRUE);
+}
+
+static void
+find_next_cb (GtkWidget* widget, Browser* b)
+{
+	find_bar_step (b, TRUE);
+}
+
+static void
+find_previous_cb (GtkWidget* widget, Browser* b)
+{
+	find_bar_step (b, FALSE);
+}
+
+static void
+find_case_toggled_cb (GtkToggleButton* button, Browser* b)
+{
+	/* Force a new search - the skip for longer queries depends on the case */
+	g_free (b->find_last_text);
+	b->find_last_text = NULL;
+	find_bar_schedule (b);
+}
+
+static void
+find_highlight_toggled_cb (GtkToggleButton* button, Browser* b)
+{
+	if (!remote_send (b->current, "highlight", gtk_toggle_button_get_active (button) ? "1" : "0"))
+		webkit_web_view_set_highlight_text_matches (b->current->view, gtk_toggle_button_get_active (button));
+}
+
+/*
+ * Hide the find bar and remove highlighted matches
+ */
+static void
+find_bar_close_cb (GtkWidget* widget, Browser* b)
+{
+	find_bar_cancel (b);
+	if (!remote_send (b->current, "find-clear", NULL))
+	{
+		webkit_web_view_unmark_text_matches (b->current->view);
+		webkit_web_view_set_highlight_text_matches (b->current->view, FALSE);
+	}
+	gtk_widget_hide (b->find_bar);
+	client_focus (b->current);
+}
+
+static gboolean
+find_entry_key_press_cb (GtkWidget* widget, GdkEventKey* event, Browser* b)
+{
+	switch (event->keyval)
+	{
+		case GDK_KEY_Escape:
+			find_bar_close_cb (widget, b);
+			return TRUE;
+		case GDK_KEY_Return:
+		case GDK_KEY_KP_Enter:
+			if (event->state & GDK_SHIFT_MASK)
+			{
+				find_bar_step (b, FALSE);
+				return TRUE;
+			}
+			break;
+		default:
+			break;
+	}
+	
+	return FALSE;
+}
+
+/*
+ * Callback for edit.find - show the find bar and focus the entry
+ */
+static void
+find_bar_show_cb (GtkWidget* widget, Browser* b)
+{
+	/* Built on first use, below the tabs */
+	if (!b->find_bar)
+	{
+		GtkWidget* vbox = gtk_widget_get_parent (b->book);
+		gint position;
+		
+		b->find_bar = create_find_bar (b);
+		gtk_container_child_get (GTK_CONTAINER (vbox), b->book, "position", &position, NULL);
+		gtk_box_pack_start (GTK_BOX (vbox), b->find_bar, FALSE, FALSE, 0);
+		gtk_box_reorder_child (GTK_BOX (vbox), b->find_bar, position + 1);
+	}
+	gtk_widget_show (b->find_bar);
+	gtk_widget_grab_focus (b->find_entry);
+	gtk_editable_select_region (GTK_EDITABLE (b->find_entry), 0, -1);
+}
+
+/*
+ * Zoom in web-view by 10%
+ */
+static void
+zoom_in_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "zoom-in", NULL))
+		webkit_web_view_zoom_in (b->current->view);
+}
+
+/*
+ * Zoom out web-view by 10%
+ */
+static void
+zoom_out_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "zoom-out", NULL))
+		webkit_web_view_zoom_out (b->current->view);
+}
+
+/*
+ * Reset zoom level to 100%
+ */
+static void
+zoom_reset_cb (GtkWidget* widget, Browser* b)
+{
+	if (!remote_send (b->current, "zoom-reset", NULL))
+		webkit_web_view_set_zoom_level (b->current->view, 1.0);
+}
+
+static void
+fullscreen_cb (GtkWidget* widget, Browser* b)
+{
+	if (!b->fullscreen)
+	{
+		gtk_window_fullscreen (GTK_WINDOW (b->window));
+		b->fullscreen = TRUE;
+	} else
+	{
+		gtk_window_unfullscreen (GTK_WINDOW (b->window));
+		b->fullscreen = FALSE;
+	}
+}
+
+/*
+ * Settings dialog - set smooth-scrolling, private browsing, useragent.
+ * The settings are shared, so changes apply to every tab in every window.
+ */
+static void
+settings_dialog_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	GtkWidget* dialog = gtk_dialog_new_with_buttons ("sb Settings",
+													GTK_WINDOW (b->window),
+													GTK_DIALOG_DESTROY_WITH_PARENT,
+													GTK_STOCK_CANCEL,
+													GTK_RESPONSE_REJECT,
+													GTK_STOCK_OK,
+													GTK_RESPONSE_ACCEPT,
+													NULL);
+	
+	GtkWidget* vbox = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
+	WebKitWebSettings* settings = web_settings;
+	gboolean isactive = FALSE;
+	
+	/* Check-button to control smooth-scrolling */
+	GtkWidget* smooth_scrolling_button = gtk_check_button_new_with_label ("Enable smooth-scrolling");
+	g_object_get (G_OBJECT (settings), "enable-smooth-scrolling", &isactive, NULL);
+	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (smooth_scrolling_button), isactive);
+	gtk_box_pack_start (GTK_BOX (vbox), smooth_scrolling_button, TRUE, TRUE, 2);
+	gtk_widget_show (smooth_scrolling_button);
+	
+	/* Check-button to control private browsing */
+	GtkWidget* private_browsing_button = gtk_check_button_new_with_label ("Enable private browsing");
+	g_object_get (G_OBJECT (settings), "enable-private-browsing", &isactive, NULL);
+	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (private_browsing_button), isactive);
+	gtk_box_pack_start (GTK_BOX (vbox), private_browsing_button, TRUE, TRUE, 2);
+	gtk_widget_show (private_browsing_button);
+	
+	/* Combox-box to choose the useragent to use */
+	GtkWidget* combo_box = gtk_combo_box_text_new ();
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "sb (Default)");
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Firefox");
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Chrome");
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Internet Explorer");
+	gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo_box), "Mobile");
+	gtk_combo_box_set_active (GTK_COMBO_BOX (combo_box), user_agent_current);
+	gtk_box_pack_start (GTK_BOX (vbox), combo_box, FALSE, FALSE, 5);
+	gtk_widget_show (combo_box);
+	
+	gint result = gtk_dialog_run (GTK_DIALOG (dialog));
+	switch (result)
+	{
+		case GTK_RESPONSE_ACCEPT:
+			/* Set smooth-scrolling from selection */
+			g_object_set (G_OBJECT (settings), "enable-smooth-scrolling", gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (smooth_scrolling_button)), NULL);
+			
+			/* Set private browsing from selection */
+			g_object_set (G_OBJECT (settings), "enable-private-browsing", gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (private_browsing_button)), NULL);
+						
+			/* Set user-agent from selection */
+			user_agent_current = gtk_combo_box_get_active (GTK_COMBO_BOX (combo_box));
+			g_object_set (G_OBJECT (settings), "user-agent", useragents[user_agent_current], NULL);
+			
+			/* Lite tabs have settings of their own */
+			if (lite_settings)
+			{
+				g_object_set (G_OBJECT (lite_settings), "enable-smooth-scrolling", gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (smooth_scrolling_button)), NULL);
+				g_object_set (G_OBJECT (lite_settings), "enable-private-browsing", gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (private_browsing_button)), NULL);
+				g_object_set (G_OBJECT (lite_settings), "user-agent", useragents[user_agent_current], NULL);
+			}
+			break;
+		default:
+			break;
+	}
+	
+	/* Destroy the dialog */
+	gtk_widget_destroy (dialog);
+}
+
+/*
+ * Callback for about menu item - open about dialog
+ */
+static void
+about_cb (GtkWidget* widget, gpointer data)
+{
+	GtkWidget* about_dialog = gtk_about_dialog_new ();
+	
+	const gchar *authors[] = {"David Luco", "<dluco11@gmail.com>", NULL};
+	
+	/* Set program name and comments */
+	gtk_about_dialog_set_program_name (GTK_ABOUT_DIALOG (about_dialog), "sb");
+	gtk_about_dialog_set_comments (GTK_ABOUT_DIALOG (about_dialog), "A simple webkit/gtk browser, in the style of surf and midori");
+	
+	/* Set logo to display in dialog */
+	gtk_about_dialog_set_logo_icon_name (GTK_ABOUT_DIALOG (about_dialog), "web-browser");
+	/* Set taskbar/window icon */
+	gtk_window_set_icon_name (GTK_WINDOW (about_dialog), "web-browser");
+	
+	/* Set authors, license, and website in dialog */
+	gtk_about_dialog_set_authors (GTK_ABOUT_DIALOG (about_dialog), authors);
+	gtk_about_dialog_set_license (GTK_ABOUT_DIALOG (about_dialog), "Distributed under the MIT license.\nhttp://www.opensource.org/licenses/mit-license.php");
+	gtk_about_dialog_set_website (GTK_ABOUT_DIALOG (about_dialog), "http://dluco.github.io/sb/");
+	
+	gtk_dialog_run (GTK_DIALOG (about_dialog));
+	
+	gtk_widget_destroy (about_dialog);
+}
+
+/*
+ * Callback for back button
+ */
+static void
+go_back_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	if (!remote_send (b->current, "back", NULL))
+		webkit_web_view_go_back (b->current->view);
+}
+
+/*
+ * Callback for forward button
+ */
+static void
+go_forward_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	if (!remote_send (b->current, "forward", NULL))
+		webkit_web_view_go_forward (b->current->view);
+}
+
+/*
+ * Callback for refresh button - reload web page
+ */
+static void
+refresh_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	if (b->current->remote)
+		remote_reload (b->current);
+	else
+		webkit_web_view_reload (b->current->view);
+}
+
+/*
+ * Callback for home button - open home page
+ */
+static void
+home_cb (GtkWidget* widget, Browser* b)
+{
+	JANK_ENTER (b->current);
+	client_load_uri (b->current, home_page);
+}
+
+/*
+ * Apply default settings to web-view. All web-views share one settings object.
+ */
+static void
+set_settings (WebKitWebView* web_view)
+{
+	if (!web_settings)
+	{
+		web_settings = webkit_web_settings_new ();
+		
+		/* Apply default settings from config.h */
+		g_object_set (G_OBJECT (web_settings), "user-agent", useragents[user_agent_current], NULL);
+		g_object_set (G_OBJECT (web_settings), "auto-load-images", loadimages, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-plugins", enableplugins, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-scripts", enablescripts, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-spatial-navigation", enablespatialbrowsing, NULL);
+		/* Spell checking (and its dictionary) is turned on after the first page is drawn */
+		g_object_set (G_OBJECT (web_settings), "enable-spell-checking", enablespellchecking && spell_checking_started, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-smooth-scrolling", enablesmoothscrolling, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-file-access-from-file-uris", TRUE, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-developer-extras", enableinspector, NULL);
+		
+		/* Site storage, kept in the profile - see storage_init */
+		g_object_set (G_OBJECT (web_settings), "enable-html5-database", TRUE, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-html5-local-storage", TRUE, NULL);
+		if (storage_local_path)
+			g_object_set (G_OBJECT (web_settings), "html5-local-storage-database-path", storage_local_path, NULL);
+		g_object_set (G_OBJECT (web_settings), "enable-offline-web-application-cache", TRUE, NULL);
+	}
+	
+	if (hidebackground)
+		webkit_web_view_set_transparent(web_view, TRUE);
+		
+	if (fullcontentzoom)
+		webkit_web_view_set_full_content_zoom(web_view, TRUE);
+	
+	/* Apply settings */
+	webkit_web_view_set_settings (WEBKIT_WEB_VIEW (web_view), web_settings);
+}
+
+/*
+ * Turn on spell checking, which loads its dictionary - deferred from startup
+ */
+static gboolean
+spell_checking_start_cb (gpointer data)
+{
+	spell_checking_started = TRUE;
+	if (enablespellchecking && web_settings)
+		g_object_set (G_OBJECT (web_settings), "enable-spell-checking", TRUE, NULL);
+	if (enablespellchecking && lite_settings)
+		g_object_set (G_OBJECT (lite_settings), "enable-spell-checking", TRUE, NULL);
+	return FALSE;
+}
+
+/*
+ * Set up menubar - file, edit, options, and help menus
+ */
+static GtkWidget*
+create_menubar (Browser* b, GtkAccelGroup* accel_group)
+{
+	/* Create menubar */
+	GtkWidget* menu_bar = gtk_menu_bar_new ();
+	gtk_widget_show (menu_bar);
+	
+	/* Create File, Edit, and Help Menus */
+	GtkWidget* file_menu = gtk_menu_new ();
+	GtkWidget* edit_menu = gtk_menu_new ();
+	GtkWidget* view_menu = gtk_menu_new ();
+	GtkWidget* tools_menu = gtk_menu_new ();
 	GtkWidget* help_menu = gtk_menu_new ();
 	
-	/* Create the menu items (and set icons) */
-	GtkWidget* open_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_OPEN, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (open_item), "Open");
-	GtkWidget* print_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_PRINT, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (print_item), "Print");
-	GtkWidget* quit_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_QUIT, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (quit_item), "Quit");
-	GtkWidget* cut_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_CUT, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (cut_item), "Cut");
-	GtkWidget* copy_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_COPY, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (copy_item), "Copy");
-	GtkWidget* paste_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_PASTE, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (paste_item), "Paste");
-	GtkWidget* delete_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_DELETE, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (delete_item), "Delete");
-	GtkWidget* find_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_FIND, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (find_item), "Find...");
-	GtkWidget* zoom_in_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ZOOM_IN, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (zoom_in_item), "Zoom In");
-	GtkWidget* zoom_out_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ZOOM_OUT, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (zoom_out_item), "Zoom Out");
-	GtkWidget* zoom_reset_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ZOOM_100, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (zoom_reset_item), "Reset Zoom");
-	GtkWidget* fullscreen_item = gtk_check_menu_item_new_with_label ("Fullscreen");
-	GtkWidget* settings_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_PREFERENCES, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (settings_item), "Settings");
-	GtkWidget* inspector_item = gtk_check_menu_item_new_with_label ("Inspector");
-	GtkWidget* about_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ABOUT, NULL);
-	gtk_menu_item_set_label (GTK_MENU_ITEM (about_item), "About");
+	/* Create the menu items (and set icons) */
+	GtkWidget* new_window_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_NEW, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (new_window_item), "New Window");
+	gtk_widget_add_accelerator (new_window_item, "activate", accel_group, GDK_KEY_n, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* open_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_OPEN, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (open_item), "Open");
+	GtkWidget* save_offline_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_SAVE, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (save_offline_item), "Save for Offline");
+	gtk_widget_add_accelerator (save_offline_item, "activate", accel_group, GDK_KEY_s, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* print_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_PRINT, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (print_item), "Print");
+	GtkWidget* close_tab_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_CLOSE, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (close_tab_item), "Close Tab");
+	gtk_widget_add_accelerator (close_tab_item, "activate", accel_group, GDK_KEY_w, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* quit_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_QUIT, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (quit_item), "Quit");
+	GtkWidget* cut_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_CUT, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (cut_item), "Cut");
+	GtkWidget* copy_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_COPY, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (copy_item), "Copy");
+	GtkWidget* paste_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_PASTE, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (paste_item), "Paste");
+	GtkWidget* delete_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_DELETE, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (delete_item), "Delete");
+	GtkWidget* find_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_FIND, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (find_item), "Find...");
+	gtk_widget_add_accelerator (find_item, "activate", accel_group, GDK_KEY_f, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* zoom_in_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ZOOM_IN, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (zoom_in_item), "Zoom In");
+	GtkWidget* zoom_out_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ZOOM_OUT, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (zoom_out_item), "Zoom Out");
+	GtkWidget* zoom_reset_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ZOOM_100, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (zoom_reset_item), "Reset Zoom");
+	GtkWidget* fullscreen_item = gtk_check_menu_item_new_with_label ("Fullscreen");
+	b->lite_item = gtk_check_menu_item_new_with_label ("Lite Mode");
+	gtk_widget_add_accelerator (b->lite_item, "activate", accel_group, GDK_KEY_l, GDK_CONTROL_MASK | GDK_SHIFT_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* tabs_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_INDEX, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (tabs_item), "Tabs...");
+	gtk_widget_add_accelerator (tabs_item, "activate", accel_group, GDK_KEY_a, GDK_CONTROL_MASK | GDK_SHIFT_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* history_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_FIND, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (history_item), "History...");
+	gtk_widget_add_accelerator (history_item, "activate", accel_group, GDK_KEY_h, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+	GtkWidget* settings_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_PREFERENCES, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (settings_item), "Settings");
+	GtkWidget* storage_item = gtk_menu_item_new_with_label ("Site Storage");
+	GtkWidget* flight_item = gtk_menu_item_new_with_label ("Save Flight Recording");
+	GtkWidget* inspector_item = gtk_check_menu_item_new_with_label ("Inspector");
+	GtkWidget* about_item = gtk_image_menu_item_new_from_stock (GTK_STOCK_ABOUT, NULL);
+	gtk_menu_item_set_label (GTK_MENU_ITEM (about_item), "About");
+	
+	/* Add them to the appropriate menu */
+	gtk_menu_append (GTK_MENU (file_menu), new_window_item);
+	gtk_menu_append (GTK_MENU (file_menu), open_item);
+	gtk_menu_append (GTK_MENU (file_menu), save_offline_item);
+	gtk_menu_append (GTK_MENU (file_menu), print_item);
+	gtk_menu_append (GTK_MENU (file_menu), gtk_separator_menu_item_new ());
+	gtk_menu_append (GTK_MENU (file_menu), close_tab_item);
+	gtk_menu_append (GTK_MENU (file_menu), quit_item);
+	
+	gtk_menu_append (GTK_MENU (edit_menu), cut_item);
+	gtk_menu_append (GTK_MENU (edit_menu), copy_item);
+	gtk_menu_append (GTK_MENU (edit_menu), paste_item);
+	gtk_menu_append (GTK_MENU (edit_menu), delete_item);
+	gtk_menu_append (GTK_MENU (edit_menu), gtk_separator_menu_item_new ());
+	gtk_menu_append (GTK_MENU (edit_menu), find_item);
+	
+	gtk_menu_append (GTK_MENU (view_menu), zoom_in_item);
+	gtk_menu_append (GTK_MENU (view_menu), zoom_out_item);
+	gtk_menu_append (GTK_MENU (view_menu), zoom_reset_item);
+	gtk_menu_append (GTK_MENU (view_menu), fullscreen_item);
+	gtk_menu_append (GTK_MENU (view_menu), b->lite_item);
+	gtk_menu_append (GTK_MENU (view_menu), gtk_separator_menu_item_new ());
+	gtk_menu_append (GTK_MENU (view_menu), tabs_item);
+	gtk_menu_append (GTK_MENU (view_menu), history_item);
+	
+	gtk_menu_append (GTK_MENU (tools_menu), settings_item);
+	gtk_menu_append (GTK_MENU (tools_menu), storage_item);
+	gtk_menu_append (GTK_MENU (tools_menu), flight_item);
+	if (enableinspector)
+		gtk_menu_append (GTK_MENU (tools_menu), inspector_item);
+	
+	gtk_menu_append (GTK_MENU (help_menu), about_item);
+	
+	/* Attach the callback functions to the activate signal */
+	g_signal_connect (G_OBJECT (new_window_item), "activate", G_CALLBACK (new_window_cb), b);
+	g_signal_connect (G_OBJECT (open_item), "activate", G_CALLBACK (openfile_cb), b);
+	g_signal_connect (G_OBJECT (save_offline_item), "activate", G_CALLBACK (save_offline_cb), b);
+	g_signal_connect (G_OBJECT (print_item), "activate", G_CALLBACK (print_cb), b);
+	g_signal_connect (G_OBJECT (close_tab_item), "activate", G_CALLBACK (close_tab_cb), b);
+	g_signal_connect (G_OBJECT (quit_item), "activate", G_CALLBACK (destroy_cb), b);
+	g_signal_connect (G_OBJECT (cut_item), "activate", G_CALLBACK (cut_cb), b);
+	g_signal_connect (G_OBJECT (copy_item), "activate", G_CALLBACK (copy_cb), b);
+	g_signal_connect (G_OBJECT (paste_item), "activate", G_CALLBACK (paste_cb), b);
+	g_signal_connect (G_OBJECT (delete_item), "activate", G_CALLBACK (delete_cb), b);
+	g_signal_connect (G_OBJECT (find_item), "activate", G_CALLBACK (find_bar_show_cb), b);
+	g_signal_connect (G_OBJECT (zoom_in_item), "activate", G_CALLBACK (zoom_in_cb), b);
+	g_signal_connect (G_OBJECT (zoom_out_item), "activate", G_CALLBACK (zoom_out_cb), b);
+	g_signal_connect (G_OBJECT (zoom_reset_item), "activate", G_CALLBACK (zoom_reset_cb), b);
+	g_signal_connect (G_OBJECT (fullscreen_item), "activate", G_CALLBACK (fullscreen_cb), b);
+	g_signal_connect (G_OBJECT (b->lite_item), "toggled", G_CALLBACK (lite_cb), b);
+	g_signal_connect (G_OBJECT (tabs_item), "activate", G_CALLBACK (switcher_show_cb), b);
+	g_signal_connect (G_OBJECT (history_item), "activate", G_CALLBACK (history_cb), b);
+	g_signal_connect (G_OBJECT (settings_item), "activate", G_CALLBACK (settings_dialog_cb), b);
+	g_signal_connect (G_OBJECT (storage_item), "activate", G_CALLBACK (storage_cb), b);
+	g_signal_connect (G_OBJECT (flight_item), "activate", G_CALLBACK (flight_save_cb), b);
+	if (enableinspector)
+		g_signal_connect (G_OBJECT (inspector_item), "activate", G_CALLBACK (inspector), b);
+	g_signal_connect (G_OBJECT (about_item), "activate", G_CALLBACK (about_cb), b);
+	
+	/* Show menu items */
+	gtk_widget_show (new_window_item);
+	gtk_widget_show (open_item);
+	gtk_widget_show (save_offline_item);
+	gtk_widget_show (print_item);
+	gtk_widget_show (close_tab_item);
+	gtk_widget_show (quit_item);
+	gtk_widget_show (cut_item);
+	gtk_widget_show (copy_item);
+	gtk_widget_show (paste_item);
+	gtk_widget_show (delete_item);
+	gtk_widget_show (find_item);
+	gtk_widget_show (zoom_in_item);
+	gtk_widget_show (zoom_out_item);
+	gtk_widget_show (zoom_reset_item);
+	gtk_widget_show (fullscreen_item);
+	gtk_widget_show (b->lite_item);
+	gtk_widget_show (tabs_item);
+	gtk_widget_show (history_item);
+	gtk_widget_show (settings_item);
+	gtk_widget_show (storage_item);
+	gtk_widget_show (flight_item);
+	if (enableinspector)
+		gtk_widget_show (inspector_item);
+	gtk_widget_show (about_item);
+	
+	/* Create "File" and "Help" entries in menubar */
+	GtkWidget* file_item = gtk_menu_item_new_with_label ("File");
+	GtkWidget* edit_item = gtk_menu_item_new_with_label ("Edit");
+	GtkWidget* view_item = gtk_menu_item_new_with_label ("View");
+	GtkWidget* tools_item = gtk_menu_item_new_with_label ("Tools");
+	GtkWidget* help_item = gtk_menu_item_new_with_label ("Help");
+	gtk_widget_show (file_item);
+	gtk_widget_show (edit_item);
+	gtk_widget_show (view_item);
+	gtk_widget_show (tools_item);
+	gtk_widget_show (help_item);
+	
+	/* Associate file_menu with file_item in the menubar */
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (file_item), file_menu);
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (edit_item), edit_menu);
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (view_item), view_menu);
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (tools_item), tools_menu);
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (help_item), help_menu);
+	
+	/* Add file_menu to menu_bar */
+	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), file_item);
+	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), edit_item);
+	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), view_item);
+	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), tools_item);
+	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), help_item);
+	
+	return (GtkWidget*)menu_bar;
+}
+
+/*
+ * Create statusbar - when hovering over a link, show in statusbar
+ */
+static GtkWidget*
+create_statusbar (Browser* b)
+{
+	b->statusbar = GTK_STATUSBAR (gtk_statusbar_new ());
+	b->status_context_id = gtk_statusbar_get_context_id (b->statusbar, "Link Hover");
+
+	return (GtkWidget*)b->statusbar;
+}
+
+/*
+ * Create the find bar: entry, previous/next, match case, highlight all, match count.
+ * Hidden until edit.find is activated.
+ */
+static GtkWidget*
+create_find_bar (Browser* b)
+{
+	GtkWidget* hbox = gtk_hbox_new (FALSE, 2);
+	
+	/* The close button */
+	GtkWidget* close_button = gtk_button_new ();
+	gtk_button_set_relief (GTK_BUTTON (close_button), GTK_RELIEF_NONE);
+	gtk_button_set_focus_on_click (GTK_BUTTON (close_button), FALSE);
+	gtk_container_add (GTK_CONTAINER (close_button), gtk_image_new_from_stock (GTK_STOCK_CLOSE, GTK_ICON_SIZE_MENU));
+	gtk_widget_set_tooltip_text (close_button, "Close the find bar");
+	g_signal_connect (G_OBJECT (close_button), "clicked", G_CALLBACK (find_bar_close_cb), b);
+	gtk_box_pack_start (GTK_BOX (hbox), close_button, FALSE, FALSE, 0);
+	
+	gtk_box_pack_start (GTK_BOX (hbox), gtk_label_new ("Find:"), FALSE, FALSE, 5);
+	
+	/* The find entry - searches as the user types */
+	b->find_entry = gtk_entry_new ();
+	g_signal_connect (G_OBJECT (b->find_entry), "changed", G_CALLBACK (find_entry_changed_cb), b);
+	g_signal_connect (G_OBJECT (b->find_entry), "activate", G_CALLBACK (find_entry_activate_cb), b);
+	g_signal_connect (G_OBJECT (b->find_entry), "key-press-event", G_CALLBACK (find_entry_key_press_cb), b);
+	gtk_box_pack_start (GTK_BOX (hbox), b->find_entry, FALSE, FALSE, 0);
+	
+	/* The previous and next buttons */
+	GtkWidget* previous_button = gtk_button_new_from_stock (GTK_STOCK_GO_BACK);
+	gtk_button_set_relief (GTK_BUTTON (previous_button), GTK_RELIEF_NONE);
+	gtk_widget_set_tooltip_text (previous_button, "Find the previous match");
+	g_signal_connect (G_OBJECT (previous_button), "clicked", G_CALLBACK (find_previous_cb), b);
+	gtk_box_pack_start (GTK_BOX (hbox), previous_button, FALSE, FALSE, 0);
+	
+	GtkWidget* next_button = gtk_button_new_from_stock (GTK_STOCK_GO_FORWARD);
+	gtk_button_set_relief (GTK_BUTTON (next_button), GTK_RELIEF_NONE);
+	gtk_widget_set_tooltip_text (next_button, "Find the next match");
+	g_signal_connect (G_OBJECT (next_button), "clicked", G_CALLBACK (find_next_cb), b);
+	gtk_box_pack_start (GTK_BOX (hbox), next_button, FALSE, FALSE, 0);
+	
+	/* Toggles for matching case and highlighting all matches */
+	b->find_case_button = gtk_check_button_new_with_label ("Match case");
+	g_signal_connect (G_OBJECT (b->find_case_button), "toggled", G_CALLBACK (find_case_toggled_cb), b);
+	gtk_box_pack_start (GTK_BOX (hbox), b->find_case_button, FALSE, FALSE, 5);
+	
+	b->find_highlight_button = gtk_check_button_new_with_label ("Highlight all");
+	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (b->find_highlight_button), TRUE);
+	g_signal_connect (G_OBJECT (b->find_highlight_button), "toggled", G_CALLBACK (find_highlight_toggled_cb), b);
+	gtk_box_pack_start (GTK_BOX (hbox), b->find_highlight_button, FALSE, FALSE, 5);
+	
+	/* The match count - "n of m" */
+	b->find_status_label = gtk_label_new ("");
+	gtk_box_pack_start (GTK_BOX (hbox), b->find_status_label, FALSE, FALSE, 5);
+	
+	gtk_widget_show_all (hbox);
+	gtk_widget_set_no_show_all (hbox, TRUE);
+	gtk_widget_hide (hbox);
+	
+	return hbox;
+}
+
+/*
+ * Create the toolbar: back, forward, refresh, urlbar, home button
+ */
+static GtkWidget*
+create_toolbar (Browser* b)
+{
+	GtkWidget* toolbar = gtk_toolbar_new ();
+
+	gtk_toolbar_set_orientation (GTK_TOOLBAR (toolbar), GTK_ORIENTATION_HORIZONTAL);
+	gtk_toolbar_set_style (GTK_TOOLBAR (toolbar), GTK_TOOLBAR_BOTH_HORIZ);
+
+	/* the back button */
+	b->back_button = gtk_tool_button_new_from_stock (GTK_STOCK_GO_BACK);
+	gtk_widget_set_tooltip_text (GTK_WIDGET (b->back_button), "Go back to the previous page");
+	g_signal_connect (G_OBJECT (b->back_button), "clicked", G_CALLBACK (go_back_cb), b);
+	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), GTK_TOOL_ITEM (b->back_button), -1);
+
+	/* The forward button */
+	b->forward_button = gtk_tool_button_new_from_stock (GTK_STOCK_GO_FORWARD);
+	gtk_widget_set_tooltip_text (GTK_WIDGET (b->forward_button), "Go to the next page");
+	g_signal_connect (G_OBJECT (b->forward_button), "clicked", G_CALLBACK (go_forward_cb), b);
+	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), GTK_TOOL_ITEM (b->forward_button), -1);
+	
+	/* The refresh button */
+	b->refresh_button = gtk_tool_button_new_from_stock (GTK_STOCK_REFRESH);
+	gtk_widget_set_tooltip_text (GTK_WIDGET (b->refresh_button), "Reload the current page");
+	g_signal_connect (G_OBJECT (b->refresh_button), "clicked", G_CALLBACK (refresh_cb), b);
+	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), GTK_TOOL_ITEM (b->refresh_button), -1);
+	
+	GtkToolItem* item;
+
+	/* The URL entry */
+	b->uri_entry = gtk_entry_new ();
+	g_signal_connect (G_OBJECT (b->uri_entry), "activate", G_CALLBACK (activate_uri_entry_cb), b);
+	
+	/* The search-engine entry */
+	b->search_engine_entry = gtk_entry_new ();
+	gtk_entry_set_icon_from_stock (GTK_ENTRY (b->search_engine_entry), GTK_ENTRY_ICON_PRIMARY, GTK_STOCK_FILE);
+	gtk_entry_set_icon_from_stock (GTK_ENTRY (b->search_engine_entry), GTK_ENTRY_ICON_SECONDARY, GTK_STOCK_FIND);
+	gtk_entry_set_icon_tooltip_text (GTK_ENTRY (b->search_engine_entry), GTK_ENTRY_ICON_PRIMARY, "Choose Search Engine");
+	gtk_entry_set_icon_tooltip_text (GTK_ENTRY (b->search_engine_entry), GTK_ENTRY_ICON_SECONDARY, "Search");
+	g_signal_connect (G_OBJECT (b->search_engine_entry), "activate", G_CALLBACK (activate_search_engine_entry_cb), b);
+	g_signal_connect (G_OBJECT (b->search_engine_entry), "icon-press", G_CALLBACK (search_engine_entry_icon_cb), b);
+
+	/* Paned widget to hold uri entry and search-engine entry */
+	GtkWidget* h_paned = gtk_hpaned_new ();
+	gtk_paned_pack1 (GTK_PANED (h_paned), b->uri_entry, TRUE, TRUE);
+	gtk_paned_pack2 (GTK_PANED (h_paned), b->search_engine_entry, FALSE, TRUE);
+	
+	item = gtk_tool_item_new ();
+	gtk_tool_item_set_expand (item, TRUE);
+	gtk_container_add (GTK_CONTAINER (item), h_paned);
+	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+	
+	/* The home button */
+	item = gtk_tool_button_new_from_stock (GTK_STOCK_HOME);
+	gtk_widget_set_tooltip_text (GTK_WIDGET (item), "Go to home page");
+	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (home_cb), b);
+	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+
+	return toolbar;
+}
+
+static Client*
+create_new_client (Browser* b)
+{
+	Client* c;
+	
+	if (!(c = calloc(1, sizeof (Client))))
+		fprintf(stderr, "Cannot allocate memory for client\n");
+	
+	c->b = b;
+	c->flight_id = ++flight_tabs;
+	flight_record (FLIGHT_TAB_OPEN, 0, c->flight_id, 0);
+	metrics_add (METRIC_TABS, 1);
+	
+	/* Pane, vobx, scrolled-window */
+	c->pane = gtk_vpaned_new();
+	c->vbox = gtk_vbox_new (FALSE, 0);
+	c->scroll = gtk_scrolled_window_new (NULL, NULL);
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (c->scroll), GTK_POLICY_NEVER, GTK_POLICY_NEVER);
+	g_object_set_data (G_OBJECT (c->pane), "client", c);
+	
+	/* Setup web-view */
+	c->view = WEBKIT_WEB_VIEW (webkit_web_view_new ());
+	
+	g_signal_connect (G_OBJECT (c->view), "title-changed", G_CALLBACK (title_change_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "notify::progress", G_CALLBACK (progress_change_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "notify::load-status", G_CALLBACK (load_status_change_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "hovering-over-link", G_CALLBACK (link_hover_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "icon-loaded", G_CALLBACK (icon_loaded_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "mime-type-policy-decision-requested", G_CALLBACK (decide_download_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "download-requested", G_CALLBACK (init_download_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "create-web-view", G_CALLBACK (create_new_tab), c);
+	g_signal_connect (G_OBJECT (c->view), "navigation-policy-decision-requested", G_CALLBACK (navigation_policy_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "event", G_CALLBACK (jank_event_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "event-after", G_CALLBACK (jank_event_after_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "unrealize", G_CALLBACK (jank_unrealize_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "resource-request-starting", G_CALLBACK (resource_request_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "resource-content-length-received", G_CALLBACK (resource_length_cb), c);
+	g_signal_connect (G_OBJECT (c->view), "database-quota-exceeded", G_CALLBACK (database_quota_exceeded_cb), NULL);
+	
+	/* Settings */
+	set_settings (c->view);
+	
+	/* Arrangement of containers */
+	gtk_container_add (GTK_CONTAINER (c->scroll), GTK_WIDGET (c->view));
+	gtk_container_add (GTK_CONTAINER (c->vbox), c->scroll);
+	gtk_paned_pack1 (GTK_PANED (c->pane), c->vbox, TRUE, TRUE);
+	
+	/* The inspector is hooked up when it is first asked for - from the menu or the context menu */
+	if (enableinspector)
+		g_signal_connect_swapped (G_OBJECT (c->view), "populate-popup", G_CALLBACK (client_inspector), c);
+	
+	return c;
+}
+
+/*
+ * Renderer processes: sb --tab-processes N
+ *
+ * Tabs are spread over up to N renderer processes (sb --renderer FD), each
+ * hosting its views in GtkPlugs that the browser embeds in notebook pages
+ * through GtkSockets. Each renderer has a Unix socket to the browser, carrying
+ * one line per message - "<tab id> <command> <argument>". The browser numbers
+ * the tabs it opens with even ids, renderers the tabs their pages open with
+ * odd ids. A renderer that dies or stops answering pings only takes its own
+ * tabs with it; reloading such a tab starts it again in another process.
+ */
+static GPtrArray* renderers = NULL;
+
+/* In a renderer process, the socket to the browser */
+static GIOChannel* renderer_channel = NULL;
+static Outbox renderer_out;
+
+static void remote_attach (Client*, Renderer*, guint);
+static void renderer_release (Renderer*);
+
+static void
+outbox_init (Outbox* out, GIOChannel* channel)
+{
+	out->channel = channel;
+	out->queue = g_string_new (NULL);
+	out->watch_id = 0;
+}
+
+static void
+outbox_clear (Outbox* out)
+{
+	if (out->watch_id)
+		g_source_remove (out->watch_id);
+	out->watch_id = 0;
+	g_string_free (out->queue, TRUE);
+	out->queue = NULL;
+}
+
+/*
+ * Write as much of the queue as the socket takes. A peer that is gone takes
+ * nothing more - its messages are dropped, and its exit is handled elsewhere.
+ */
+static gboolean
+outbox_write_cb (GIOChannel* channel, GIOCondition condition, Outbox* out)
+{
+	gint fd = g_io_channel_unix_get_fd (out->channel);
+	gssize n;
+	
+	while (out->queue->len)
+	{
+		if ((n = send (fd, out->queue->str, out->queue->len, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0)
+			g_string_erase (out->queue, 0, n);
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		else
+			g_string_truncate (out->queue, 0);
+	}
+	if (out->queue->len)
+		return TRUE;
+	out->watch_id = 0;
+	return FALSE;
+}
+
+/*
+ * Send a message, as one line - newlines in the argument become spaces.
+ * What the socket does not take now is sent when it is writable again.
+ */
+static void
+channel_send (Outbox* out, guint id, const gchar* command, const gchar* arg)
+{
+	gsize start = out->queue->len;
+	gchar* p;
+	
+	g_string_append_printf (out->queue, "%u %s %s\n", id, command, arg ? arg : "");
+	for (p = out->queue->str + start; p[1]; p++)
+		if (*p == '\n' || *p == '\r')
+			*p = ' ';
+	if (!out->watch_id && outbox_write_cb (out->channel, G_IO_OUT, out))
+		out->watch_id = g_io_add_watch (out->channel, G_IO_OUT, (GIOFunc) outbox_write_cb, out);
+}
+
+/*
+ * Split a received line into its id, command and argument, in place
+ */
+static gboolean
+channel_parse (gchar* line, guint* id, gchar** command, gchar** arg)
+{
+	gchar* p;
+	
+	g_strchomp (line);
+	*id = strtoul (line, &p, 10);
+	if (*p != ' ')
+		return FALSE;
+	*command = p + 1;
+	if ((p = strchr (*command, ' ')))
+	{
+		*p = '\0';
+		*arg = p + 1;
+	}
+	else
+		*arg = *command + strlen (*command);
+	return TRUE;
+}
+
+/*
+ * Cookies with renderer processes: only the browser opens the cookie
+ * database. A renderer keeps its cookies in memory, starting with the
+ * browser's; each side sends the other its changes as "cookie-set" and
+ * "cookie-delete" messages, and the browser passes them on to the other
+ * renderers. A change is never sent back to the channel it came from.
+ */
+static GIOChannel* cookie_source = NULL;
+
+static gchar*
+cookie_to_line (SoupCookie* cookie)
+{
+	SoupDate* expires = soup_cookie_get_expires (cookie);
+	
+	return g_strdup_printf ("%s\t%s\t%s\t%s\t%ld\t%d\t%d", soup_cookie_get_name (cookie), soup_cookie_get_value (cookie),
+							soup_cookie_get_domain (cookie), soup_cookie_get_path (cookie),
+							expires ? (glong) soup_date_to_time_t (expires) : -1L,
+							soup_cookie_get_secure (cookie), soup_cookie_get_http_only (cookie));
+}
+
+static SoupCookie*
+cookie_from_line (const gchar* line)
+{
+	gchar** fields = g_strsplit (line, "\t", 7);
+	SoupCookie* cookie = NULL;
+	glong expiry;
+	
+	if (g_strv_length (fields) == 7)
+	{
+		cookie = soup_cookie_new (fields[0], fields[1], fields[2], fields[3], -1);
+		if ((expiry = atol (fields[4])) >= 0)
+		{
+			SoupDate* date = soup_date_new_from_time_t (expiry);
+			soup_cookie_set_expires (cookie, date);
+			soup_date_free (date);
+		}
+		soup_cookie_set_secure (cookie, fields[5][0] == '1');
+		soup_cookie_set_http_only (cookie, fields[6][0] == '1');
+	}
+	g_strfreev (fields);
+	return cookie;
+}
+
+/*
+ * Apply a cookie change received over channel
+ */
+static void
+cookie_apply (GIOChannel* channel, const gchar* command, const gchar* arg)
+{
+	SoupCookie* cookie;
+	
+	if (!cookie_jar || !(cookie = cookie_from_line (arg)))
+		return;
+	
+	cookie_source = channel;
+	if (!strcmp (command, "cookie-set"))
+		soup_cookie_jar_add_cookie (cookie_jar, cookie);
+	else
+	{
+		soup_cookie_jar_delete_cookie (cookie_jar, cookie);
+		soup_cookie_free (cookie);
+	}
+	cookie_source = NULL;
+}
+
+/*
+ * The jar changed - tell the browser, or the renderers
+ */
+static void
+cookie_share_cb (SoupCookieJar* jar, SoupCookie* old_cookie, SoupCookie* new_cookie, gpointer data)
+{
+	const gchar* command = new_cookie ? "cookie-set" : "cookie-delete";
+	gchar* line = cookie_to_line (new_cookie ? new_cookie : old_cookie);
+	guint i;
+	
+	if (renderer_channel && cookie_source != renderer_channel)
+		channel_send (&renderer_out, 0, command, line);
+	for (i = 0; renderers && i < renderers->len; i++)
+	{
+		Renderer* r = g_ptr_array_index (renderers, i);
+		if (r->channel != cookie_source)
+			channel_send (&r->out, 0, command, line);
+	}
+	g_free (line);
+}
+
+/*
+ * Give a new renderer the cookies so far, before any page it loads
+ */
+static void
+cookie_share_all (Renderer* r)
+{
+	GSList *cookies = cookie_jar ? soup_cookie_jar_all_cookies (cookie_jar) : NULL, *l;
+	
+	for (l = cookies; l; l = l->next)
+	{
+		gchar* line = cookie_to_line (l->data);
+		channel_send (&r->out, 0, "cookie-set", line);
+		g_free (line);
+		soup_cookie_free (l->data);
+	}
+	g_slist_free (cookies);
+}
+
+/*
+ * Send a command to the renderer of a tab. Returns FALSE for tabs shown in
+ * this process, so callers fall back to the view; commands for tabs whose
+ * renderer is gone are dropped.
+ */
+static gboolean
+remote_send (Client* c, const gchar* command, const gchar* arg)
+{
+	if (!c->remote)
+		return FALSE;
+	if (c->renderer)
+		channel_send (&c->renderer->out, c->remote_id, command, arg);
+	return TRUE;
+}
+
+static Client*
+remote_client (Renderer* r, guint id)
+{
+	guint i;
+	
+	for (i = 0; i < r->clients->len; i++)
+	{
+		Client* c = g_ptr_array_index (r->clients, i);
+		if (c->remote_id == id)
+			return c;
+	}
+	return NULL;
+}
+
+/*
+ * Show the title, or what went wrong with the renderer, in the tab label
+ */
+static void
+remote_update_label (Client* c)
+{
+	const gchar* title = c->title ? c->title : c->remote_uri;
+	gchar* text;
+	
+	if (!c->renderer)
+		text = g_strdup_printf ("Crashed: %s", title ? title : "");
+	else if (c->renderer->hung)
+		text = g_strdup_printf ("Not responding: %s", title ? title : "");
+	else
+		text = g_strdup (title ? title : "");
+	gtk_label_set_text (GTK_LABEL (c->label), text);
+	g_free (text);
+}
+
+/*
+ * The tab's socket is in a window now - tell the renderer where to plug in
+ */
+static void
+remote_socket_realize_cb (GtkWidget* socket, Client* c)
+{
+	gchar* id = g_strdup_printf ("%lu", (gulong) gtk_socket_get_id (GTK_SOCKET (socket)));
+	remote_send (c, "embed", id);
+	g_free (id);
+}
+
+/* Keep the socket when its plug goes away - the tab shows why instead */
+static gboolean
+remote_plug_removed_cb (GtkSocket* socket, Client* c)
+{
+	return TRUE;
+}
+
+/*
+ * A tab whose renderer went away - replace the page with a message
+ */
+static void
+remote_crashed (Client* c)
+{
+	c->renderer = NULL;
+	if (c->socket)
+	{
+		gtk_widget_destroy (c->socket);
+		c->socket = NULL;
+	}
+	c->message = gtk_label_new ("The process showing this page has stopped.\nReload to start it again.");
+	gtk_label_set_justify (GTK_LABEL (c->message), GTK_JUSTIFY_CENTER);
+	gtk_box_pack_start (GTK_BOX (c->vbox), c->message, TRUE, TRUE, 0);
+	gtk_widget_show (c->message);
+	
+	c->progress = 100;
+	remote_update_label (c);
+	if (c == c->b->current)
+		update_title (c->b);
+}
+
+static void
+renderer_free (Renderer* r)
+{
+	if (r->watch_id)
+		g_source_remove (r->watch_id);
+	if (r->ping_id)
+		g_source_remove (r->ping_id);
+	if (r->out.queue)
+		outbox_clear (&r->out);
+	g_io_channel_unref (r->channel);
+	g_ptr_array_free (r->clients, TRUE);
+	g_free (r);
+}
+
+/*
+ * A renderer exited - whatever tabs it still had crashed with it
+ */
+static void
+renderer_exited_cb (GPid pid, gint status, Renderer* r)
+{
+	g_spawn_close_pid (pid);
+	g_ptr_array_remove (renderers, r);
+	while (r->clients->len)
+		remote_crashed (g_ptr_array_remove_index (r->clients, r->clients->len - 1));
+	renderer_free (r);
+}
+
+/*
+ * A tab in a renderer opened another one - window.open or target=_blank
+ */
+static void
+renderer_open_tab (Renderer* r, guint id)
+{
+	Browser* b = browsers ? browsers->data : NULL;
+	Client* c = calloc (1, sizeof (Client));
+	guint i;
+	
+	/* A window showing the renderer's other tabs */
+	for (i = 0; i < r->clients->len; i++)
+		b = ((Client*) g_ptr_array_index (r->clients, i))->b;
+	if (!b)
+		return;
+	
+	c->b = b;
+	c->flight_id = ++flight_tabs;
+	flight_record (FLIGHT_TAB_OPEN, 0, c->flight_id, 0);
+	metrics_add (METRIC_TABS, 1);
+	c->remote = TRUE;
+	c->pane = gtk_vpaned_new ();
+	c->vbox = gtk_vbox_new (FALSE, 0);
+	g_object_set_data (G_OBJECT (c->pane), "client", c);
+	remote_attach (c, r, id);
+	gtk_paned_pack1 (GTK_PANED (c->pane), c->vbox, TRUE, TRUE);
+	
+	append_tab (b, c, NULL);
+	gtk_widget_show_all (c->pane);
+	if (!openinbackground)
+		gtk_notebook_set_current_page (GTK_NOTEBOOK (b->book), gtk_notebook_get_n_pages (GTK_NOTEBOOK (b->book)) - 1);
+}
+
+/*
+ * Handle a message from a renderer about one of its tabs
+ */
+static void
+renderer_message (Renderer* r, guint id, const gchar* command, const gchar* arg)
+{
+	Client* c;
+	
+	r->last_answer = g_get_monotonic_time ();
+	if (r->hung)
+	{
+		r->hung = FALSE;
+		g_ptr_array_foreach (r->clients, (GFunc) remote_update_label, NULL);
+	}
+	
+	if (!strcmp (command, "open"))
+	{
+		renderer_open_tab (r, id);
+		return;
+	}
+	if (id == 0 && g_str_has_prefix (command, "cookie-"))
+	{
+		cookie_apply (r->channel, command, arg);
+		return;
+	}
+	if (!(c = remote_client (r, id)))
+		return;
+	JANK_ENTER (c);
+	Browser* b = c->b;
+	
+	if (!strcmp (command, "committed"))
+	{
+		flight_record (FLIGHT_LOAD, WEBKIT_LOAD_COMMITTED, c->flight_id, 0);
+		metrics_add (METRIC_NAVIGATIONS, 1);
+		g_free (c->remote_uri);
+		c->remote_uri = g_strdup (arg);
+		if (c == b->current)
+			gtk_entry_set_text (GTK_ENTRY (b->uri_entry), arg);
+		gtk_label_set_text (GTK_LABEL (c->label), arg);
+	}
+	else if (!strcmp (command, "title"))
+	{
+		g_free (c->title);
+		c->title = g_strdup (arg);
+		remote_update_label (c);
+		if (c == b->current)
+			update_title (b);
+	}
+	else if (!strcmp (command, "progress"))
+	{
+		c->progress = atoi (arg);
+		if (c == b->current)
+			update_title (b);
+	}
+	else if (!strcmp (command, "history"))
+	{
+		c->can_go_back = arg[0] == '1';
+		c->can_go_forward = arg[0] && arg[1] == ' ' && arg[2] == '1';
+		if (c == b->current)
+			update_buttons (b);
+	}
+	else if (!strcmp (command, "link"))
+	{
+		gtk_statusbar_pop (b->statusbar, b->status_context_id);
+		if (arg[0])
+			gtk_statusbar_push (b->statusbar, b->status_context_id, arg);
+	}
+	else if (!strcmp (command, "found") && c == b->current)
+	{
+		b->find_match_count = atoi (arg);
+		b->find_found = b->find_match_count > 0;
+		find_bar_update_status (b);
+	}
+}
+
+static gboolean
+renderer_input_cb (GIOChannel* channel, GIOCondition condition, Renderer* r)
+{
+	gchar *line, *command, *arg;
+	guint id;
+	
+	while (g_io_channel_read_line (channel, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL)
+	{
+		if (channel_parse (line, &id, &command, &arg))
+			renderer_message (r, id, command, arg);
+		g_free (line);
+	}
+	
+	/* The process exiting is handled by its child watch */
+	if (condition & (G_IO_HUP | G_IO_ERR))
+	{
+		r->watch_id = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Ping a renderer, and mark its tabs when it stopped answering, or stopped
+ * reading what it is sent
+ */
+static gboolean
+renderer_ping_cb (gpointer data)
+{
+	Renderer* r = data;
+	
+	if (!r->hung && (g_get_monotonic_time () - r->last_answer > (gint64) renderer_hang_timeout * G_USEC_PER_SEC
+					 || r->out.queue->len > renderer_queue_limit))
+	{
+		r->hung = TRUE;
+		g_ptr_array_foreach (r->clients, (GFunc) remote_update_label, NULL);
+	}
+	channel_send (&r->out, 0, "ping", NULL);
+	return TRUE;
+}
+
+/*
+ * Command line of a renderer on socket fd - the session options of the
+ * browser, so its pages load, record and report the same way
+ */
+static GPtrArray*
+renderer_argv (gint fd)
+{
+	GPtrArray* argv = g_ptr_array_new_with_free_func (g_free);
+	static guint renderer_count = 0;
+	gchar** quota;
+	
+	g_ptr_array_add (argv, g_strdup ("/proc/self/exe"));
+	g_ptr_array_add (argv, g_strdup ("--renderer"));
+	g_ptr_array_add (argv, g_strdup_printf ("%d", fd));
+	if (profile)
+	{
+		g_ptr_array_add (argv, g_strdup ("--profile"));
+		g_ptr_array_add (argv, g_strdup (profile));
+	}
+	for (quota = storage_quota_options; quota && *quota; quota++)
+	{
+		g_ptr_array_add (argv, g_strdup ("--storage-quota"));
+		g_ptr_array_add (argv, g_strdup (*quota));
+	}
+	if (replay_file)
+	{
+		g_ptr_array_add (argv, g_strdup ("--replay"));
+		g_ptr_array_add (argv, g_strdup (replay_file));
+		if (replay_latency >= 0)
+			g_ptr_array_add (argv, g_strdup_printf ("--latency=%d", replay_latency));
+		if (replay_bandwidth > 0)
+			g_ptr_array_add (argv, g_strdup_printf ("--bandwidth=%d", replay_bandwidth));
+	}
+	/* Each renderer records its own tabs, next to the browser's recording */
+	if (record_file)
+	{
+		g_ptr_array_add (argv, g_strdup ("--record"));
+		g_ptr_array_add (argv, g_strdup_printf ("%s.%u", record_file, ++renderer_count));
+	}
+#ifdef CHECK_IO
+	if (check_io)
+		g_ptr_array_add (argv, g_strdup ("--check-io"));
+#endif
+	if (jank_monitor)
+	{
+		g_ptr_array_add (argv, g_strdup ("--jank"));
+		g_ptr_array_add (argv, g_strdup_printf ("--jank-threshold=%d", jank_threshold));
+	}
+	if (enablesmoothscrolling)
+		g_ptr_array_add (argv, g_strdup ("--smooth-scrolling"));
+	if (!fullcontentzoom)
+		g_ptr_array_add (argv, g_strdup ("--no-full-content-zoom"));
+	if (hidebackground)
+		g_ptr_array_add (argv, g_strdup ("--transparent"));
+	g_ptr_array_add (argv, NULL);
+	return argv;
+}
+
+static Renderer*
+renderer_spawn (void)
+{
+	gint fds[2];
+	GError* error = NULL;
+	
+	if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+		return NULL;
+	
+	/* Only the renderer's end is inherited */
+	GPtrArray* argv = renderer_argv (fds[1]);
+	Renderer* r = g_new0 (Renderer, 1);
+	fcntl (fds[1], F_SETFD, 0);
+	if (!g_spawn_async (NULL, (gchar**) argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_LEAVE_DESCRIPTORS_OPEN, NULL, NULL, &r->pid, &error))
+	{
+		fprintf (stderr, "sb: cannot start renderer: %s\n", error->message);
+		g_clear_error (&error);
+		close (fds[0]);
+		close (fds[1]);
+		g_ptr_array_free (argv, TRUE);
+		g_free (r);
+		return NULL;
+	}
+	close (fds[1]);
+	g_ptr_array_free (argv, TRUE);
+	
+	r->channel = g_io_channel_unix_new (fds[0]);
+	g_io_channel_set_close_on_unref (r->channel, TRUE);
+	g_io_channel_set_encoding (r->channel, NULL, NULL);
+	g_io_channel_set_flags (r->channel, G_IO_FLAG_NONBLOCK, NULL);
+	outbox_init (&r->out, r->channel);
+	r->watch_id = g_io_add_watch (r->channel, G_IO_IN | G_IO_HUP | G_IO_ERR, (GIOFunc) renderer_input_cb, r);
+	r->ping_id = g_timeout_add_seconds (renderer_ping_interval, renderer_ping_cb, r);
+	g_child_watch_add (r->pid, (GChildWatchFunc) renderer_exited_cb, r);
+	r->clients = g_ptr_array_new ();
+	r->next_id = 2;
+	r->last_answer = g_get_monotonic_time ();
+	g_ptr_array_add (renderers, r);
+	cookie_share_all (r);
+	return r;
+}
+
+/*
+ * The renderer for a new tab - a new process while there are fewer than
+ * --tab-processes, else the responsive one with the fewest tabs
+ */
+static Renderer*
+renderer_for_tab (void)
+{
+	Renderer* best = NULL;
+	guint i;
+	
+	if (!renderers)
+	{
+		renderers = g_ptr_array_new ();
+		if (cookie_jar)
+			g_signal_connect (G_OBJECT (cookie_jar), "changed", G_CALLBACK (cookie_share_cb), NULL);
+	}
+	if (renderers->len < (guint) tab_processes)
+		return renderer_spawn ();
+	
+	for (i = 0; i < renderers->len; i++)
+	{
+		Renderer* r = g_ptr_array_index (renderers, i);
+		if (!r->hung && (!best || r->clients->len < best->clients->len))
+			best = r;
+	}
+	return best ? best : renderer_spawn ();
+}
+
+/*
+ * A renderer with no tabs left is told to exit by closing its socket - or
+ * killed, if it is not listening
+ */
+static void
+renderer_release (Renderer* r)
+{
+	if (r->hung)
+		kill (r->pid, SIGKILL);
+	if (r->watch_id)
+		g_source_remove (r->watch_id);
+	if (r->ping_id)
+		g_source_remove (r->ping_id);
+	r->watch_id = r->ping_id = 0;
+	outbox_clear (&r->out);
+	shutdown (g_io_channel_unix_get_fd (r->channel), SHUT_RDWR);
+	g_ptr_array_remove (renderers, r);
+}
+
+/*
+ * Show a tab from renderer r, as tab id, in c's page
+ */
+static void
+remote_attach (Client* c, Renderer* r, guint id)
+{
+	c->renderer = r;
+	c->remote_id = id;
+	g_ptr_array_add (r->clients, c);
+	
+	if (c->message)
+	{
+		gtk_widget_destroy (c->message);
+		c->message = NULL;
+	}
+	c->socket = gtk_socket_new ();
+	g_signal_connect_after (G_OBJECT (c->socket), "realize", G_CALLBACK (remote_socket_realize_cb), c);
+	g_signal_connect (G_OBJECT (c->socket), "plug-removed", G_CALLBACK (remote_plug_removed_cb), c);
+	gtk_box_pack_start (GTK_BOX (c->vbox), c->socket, TRUE, TRUE, 0);
+	gtk_widget_show (c->socket);
+}
+
+/*
+ * Take a tab away from its renderer, which exits once it has none
+ */
+static void
+remote_detach (Client* c)
+{
+	Renderer* r = c->renderer;
+	
+	if (c->socket)
+		g_signal_handlers_disconnect_matched (G_OBJECT (c->socket), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, c);
+	if (!r)
+		return;
+	
+	remote_send (c, "close", NULL);
+	g_ptr_array_remove (r->clients, c);
+	c->renderer = NULL;
+	if (r->clients->len == 0)
+		renderer_release (r);
+}
+
+/*
+ * Start a crashed or hung tab again in a responsive renderer
+ */
+static void
+remote_restart (Client* c)
+{
+	Renderer* old = c->renderer;
+	Renderer* r;
+	
+	if (old)
+	{
+		/* Its other tabs go down with it */
+		kill (old->pid, SIGKILL);
+		remote_detach (c);
+		gtk_widget_destroy (c->socket);
+		c->socket = NULL;
+	}
+	if (!(r = renderer_for_tab ()))
+		return;
+	remote_attach (c, r, r->next_id);
+	r->next_id += 2;
+	remote_update_label (c);
+}
+
+static void
+client_load_uri (Client* c, const gchar* uri)
+{
+	if (!c->remote)
+	{
+		webkit_web_view_load_uri (c->view, uri);
+		return;
+	}
+	if (!c->renderer)
+		remote_restart (c);
+	g_free (c->remote_uri);
+	c->remote_uri = g_strdup (uri);
+	remote_send (c, "load", uri);
+}
+
+/*
+ * Reload a tab - a crashed or hung one in a new renderer
+ */
+static void
+remote_reload (Client* c)
+{
+	if (c->renderer && !c->renderer->hung)
+		remote_send (c, "reload", NULL);
+	else if (c->remote_uri)
+	{
+		gchar* uri = g_strdup (c->remote_uri);
+		remote_restart (c);
+		client_load_uri (c, uri);
+		g_free (uri);
+	}
+}
+
+static const gchar*
+client_get_uri (Client* c)
+{
+	return c->remote ? c->remote_uri : webkit_web_view_get_uri (c->view);
+}
+
+static void
+client_focus (Client* c)
+{
+	if (!c->remote)
+		gtk_widget_grab_focus (GTK_WIDGET (c->view));
+	else if (c->socket)
+		gtk_widget_grab_focus (c->socket);
+}
+
+/*
+ * A tab shown from a renderer process
+ */
+static Client*
+create_remote_client (Browser* b)
+{
+	Renderer* r = renderer_for_tab ();
+	Client* c;
+	
+	if (!r)
+		return create_new_client (b);
+	if (!(c = calloc (1, sizeof (Client))))
+		fprintf (stderr, "Cannot allocate memory for client\n");
+	
+	c->b = b;
+	c->remote = TRUE;
+	c->pane = gtk_vpaned_new ();
+	c->vbox = gtk_vbox_new (FALSE, 0);
+	g_object_set_data (G_OBJECT (c->pane), "client", c);
+	remote_attach (c, r, r->next_id);
+	r->next_id += 2;
+	gtk_paned_pack1 (GTK_PANED (c->pane), c->vbox, TRUE, TRUE);
+	
+	return c;
+}
+
+/*
+ * A new tab - in a renderer process with --tab-processes
+ */
+static Client*
+create_client (Browser* b)
+{
+	return tab_processes > 0 ? create_remote_client (b) : create_new_client (b);
+}
+
+/*
+ * Resident memory of this process in kB - read with open/read, as the metrics
+ * are, into a buffer on the stack, since the I/O thread calls it too
+ */
+static glong
+resident_memory (void)
+{
+	gchar statm[128];
+	gchar* resident;
+	gssize n;
+	int fd;
+	
+	if ((fd = open ("/proc/self/statm", O_RDONLY)) < 0)
+		return 0;
+	n = read (fd, statm, sizeof statm - 1);
+	close (fd);
+	statm[MAX (n, 0)] = '\0';
+	if (!(resident = strchr (statm, ' ')))
+		return 0;
+	return atol (resident + 1) * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * Metrics endpoint (--metrics-socket, --metrics-port) - the counters are
+ * added to where things happen; HTTP responses are counted here
+ */
+static void
+metrics_response_cb (SoupSession* session, SoupMessage* msg, gpointer data)
+{
+	metrics_add (METRIC_HTTP_RESPONSES, 1);
+	if (msg->status_code == SOUP_STATUS_NOT_MODIFIED)
+		metrics_add (METRIC_HTTP_NOT_MODIFIED, 1);
+}
+
+static gboolean
+metrics_start (void)
+{
+	GError* error = NULL;
+	
+	if (!metrics_socket && metrics_port <= 0)
+		return TRUE;
+	if (!metrics_serve (metrics_socket, metrics_port, &error))
+	{
+		fprintf (stderr, "sb: %s\n", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+	g_signal_connect (G_OBJECT (webkit_get_default_session ()), "request-unqueued", G_CALLBACK (metrics_response_cb), NULL);
+	return TRUE;
+}
+
+/*
+ * Flight recorder: always on, unlike --jank. A coarse heartbeat notes main
+ * loop stalls (--jank notes them itself, more precisely) and memory is
+ * sampled now and then. The ring is written to flight_file on SIGUSR1 and
+ * from the Tools menu, and to flight_crash_file on a crash - sb-flight turns
+ * either into a timeline.
+ */
+static gint64 flight_last_beat;
+
+static gboolean
+flight_beat_cb (gpointer data)
+{
+	gint64 now = g_get_monotonic_time ();
+	gint64 stall = (now - flight_last_beat) / 1000 - flight_beat_interval;
+	
+	flight_last_beat = now;
+	if (stall >= flight_stall_threshold)
+	{
+		flight_record (FLIGHT_STALL, 0, 0, stall);
+		metrics_add (METRIC_STALLS, 1);
+		metrics_add (METRIC_STALL_MS, stall);
+	}
+	return TRUE;
+}
+
+/* In the I/O thread - flight_record is safe from any thread */
+static gboolean
+flight_memory_job (gpointer data, GError** error)
+{
+	flight_record (FLIGHT_MEMORY, 0, 0, resident_memory ());
+	return TRUE;
+}
+
+static gboolean
+flight_memory_cb (gpointer data)
+{
+	io_call (flight_memory_job, NULL, NULL, NULL);
+	return TRUE;
+}
+
+static void
+flight_signal_cb (int signum)
+{
+	flight_dump (flight_path);
+}
+
+static const int flight_crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+static struct sigaction flight_crash_previous[G_N_ELEMENTS (flight_crash_signals)];
+
+static void
+flight_crash_cb (int signum, siginfo_t* info, void* context)
+{
+	guint i;
+	
+	flight_dump (flight_crash_path);
+	
+	/*
+	 * Let the crash go on as it would have, through whatever handled it
+	 * before (--jank, a sanitizer): a fault happens again on return, with
+	 * that handler back in place, and a sent signal is sent again
+	 */
+	for (i = 0; i < G_N_ELEMENTS (flight_crash_signals); i++)
+		if (flight_crash_signals[i] == signum)
+			sigaction (signum, &flight_crash_previous[i], NULL);
+	if (info->si_code <= 0)
+		raise (signum);
+}
+
+static void
+flight_start (void)
+{
+	struct sigaction action;
+	guint i;
+	
+	flight_path = data_path (flight_file);
+	flight_crash_path = data_path (flight_crash_file);
+	flight_init (flight_events);
+	flight_record (FLIGHT_START, 0, 0, getpid ());
+	
+	signal (SIGUSR1, flight_signal_cb);
+	memset (&action, 0, sizeof action);
+	action.sa_sigaction = flight_crash_cb;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset (&action.sa_mask);
+	for (i = 0; i < G_N_ELEMENTS (flight_crash_signals); i++)
+		sigaction (flight_crash_signals[i], &action, &flight_crash_previous[i]);
+	
+	if (!jank_monitor)
+	{
+		flight_last_beat = g_get_monotonic_time ();
+		g_timeout_add (flight_beat_interval, flight_beat_cb, NULL);
+	}
+	flight_memory_cb (NULL);
+	g_timeout_add_seconds (flight_memory_interval, flight_memory_cb, NULL);
+}
+
+/*
+ * Throw away the prerendered page of a window, if any
+ */
+static void
+prerender_discard (Browser* b)
+{
+	if (b->prerender_timeout_id)
+	{
+		g_source_remove (b->prerender_timeout_id);
+		b->prerender_timeout_id = 0;
+	}
+	if (b->prerender_swap_id)
+	{
+		g_source_remove (b->prerender_swap_id);
+		b->prerender_swap_id = 0;
+	}
+	if (!b->prerender)
+		return;
+	
+	client_free (b->prerender);
+	b->prerender = NULL;
+	gtk_widget_destroy (b->prerender_window);
+	gtk_widget_destroy (b->prerender_tab);
+	g_object_unref (b->prerender_tab);
+	b->prerender_window = b->prerender_tab = NULL;
+	g_free (b->prerender_uri);
+	b->prerender_uri = NULL;
+	prerender_active--;
+}
+
+/*
+ * Give up on a prerender that has not finished loading within its time budget
+ */
+static gboolean
+prerender_timeout_cb (gpointer data)
+{
+	Browser* b = data;
+	
+	b->prerender_timeout_id = 0;
+	if (b->prerender && webkit_web_view_get_load_status (b->prerender->view) != WEBKIT_LOAD_FINISHED)
+		prerender_discard (b);
+	return FALSE;
+}
+
+/*
+ * Hidden pages must not pop up dialogs - swallow them until the page is shown
+ */
+static gboolean
+prerender_script_dialog_cb (Client* c)
+{
+	return c->prerender;
+}
+
+/*
+ * Start loading a predicted next page in a hidden view, within the budgets:
+ * one page per window, prerender_limit pages in all, nothing while the visible
+ * page is still loading or memory is above prerender_memory_limit
+ */
+static void
+prerender_start (Browser* b, const gchar* uri)
+{
+	WebKitWebBackForwardList *history, *prerender_history;
+	GtkAllocation allocation;
+	gint i;
+	
+	if (!enableprerender || !uri || (b->prerender && !g_strcmp0 (uri, b->prerender_uri)))
+		return;
+	if (!g_str_has_prefix (uri, "http://") && !g_str_has_prefix (uri, "https://"))
+		return;
+	if (!g_strcmp0 (uri, webkit_web_view_get_uri (b->current->view)))
+		return;
+	
+	prerender_discard (b);
+	if (prerender_active >= prerender_limit
+		|| webkit_web_view_get_load_status (b->current->view) != WEBKIT_LOAD_FINISHED
+		|| resident_memory () > prerender_memory_limit)
+		return;
+	
+	/* A client like any other, kept in an offscreen window the size of the visible one */
+	Client* c = create_new_client (b);
+	c->prerender = TRUE;
+	g_signal_connect_swapped (G_OBJECT (c->view), "script-alert", G_CALLBACK (prerender_script_dialog_cb), c);
+	g_signal_connect_swapped (G_OBJECT (c->view), "script-confirm", G_CALLBACK (prerender_script_dialog_cb), c);
+	g_signal_connect_swapped (G_OBJECT (c->view), "script-prompt", G_CALLBACK (prerender_script_dialog_cb), c);
+	b->prerender_tab = g_object_ref_sink (create_tab_label (c, uri));
+	
+	gtk_widget_get_allocation (b->current->pane, &allocation);
+	b->prerender_window = gtk_offscreen_window_new ();
+	gtk_window_set_default_size (GTK_WINDOW (b->prerender_window), allocation.width, allocation.height);
+	gtk_container_add (GTK_CONTAINER (b->prerender_window), c->pane);
+	gtk_widget_show_all (b->prerender_window);
+	
+	/* Carry the history over, so Back still works once the page is shown */
+	history = webkit_web_view_get_back_forward_list (b->current->view);
+	prerender_history = webkit_web_view_get_back_forward_list (c->view);
+	for (i = webkit_web_back_forward_list_get_back_length (history); i > 0; i--)
+		webkit_web_back_forward_list_add_item (prerender_history, webkit_web_back_forward_list_get_nth_item (history, -i));
+	webkit_web_back_forward_list_add_item (prerender_history, webkit_web_back_forward_list_get_current_item (history));
+	
+	webkit_web_view_load_uri (c->view, uri);
+	b->prerender = c;
+	b->prerender_uri = g_strdup (uri);
+	b->prerender_timeout_id = g_timeout_add_seconds (prerender_timeout, prerender_timeout_cb, b);
+	prerender_active++;
+	prerender_started++;
+	metrics_add (METRIC_PRERENDERS, 1);
+}
+
+/*
+ * Show the prerendered page in place of the current tab
+ */
+static gboolean
+prerender_swap_cb (gpointer data)
+{
+	Browser* b = data;
+	JANK_ENTER (b->current);
+	Client *c = b->prerender, *old = b->current;
+	GtkNotebook* book = GTK_NOTEBOOK (b->book);
+	gchar* message;
+	guint i;
+	
+	b->prerender_swap_id = 0;
+	if (!c)
+		return FALSE;
+	if (b->prerender_timeout_id)
+	{
+		g_source_remove (b->prerender_timeout_id);
+		b->prerender_timeout_id = 0;
+	}
+	b->prerender = NULL;
+	c->prerender = FALSE;
+	g_free (b->prerender_uri);
+	b->prerender_uri = NULL;
+	prerender_active--;
+	prerender_hits++;
+	metrics_add (METRIC_PRERENDER_HITS, 1);
+	
+	/* Move the view into the notebook, right after the tab it replaces */
+	gint page = gtk_notebook_page_num (book, old->pane);
+	g_object_ref (c->pane);
+	gtk_container_remove (GTK_CONTAINER (b->prerender_window), c->pane);
+	gtk_widget_destroy (b->prerender_window);
+	b->prerender_window = NULL;
+	gtk_notebook_insert_page (book, c->pane, b->prerender_tab, page + 1);
+	gtk_notebook_set_tab_reorderable (book, c->pane, TRUE);
+	g_object_unref (c->pane);
+	g_object_unref (b->prerender_tab);
+	b->prerender_tab = NULL;
+	
+	for (i = 0; i < b->clients->len; i++)
+		if (g_ptr_array_index (b->clients, i) == old)
+			b->clients->pdata[i] = c;
+	
+	gtk_notebook_set_current_page (book, page + 1);
+	client_free (old);
+	gtk_notebook_remove_page (book, page);
+	
+	message = g_strdup_printf ("Prerendered page shown (%u of %u prerenders used)", prerender_hits, prerender_started);
+	gtk_statusbar_pop (b->statusbar, b->status_context_id);
+	gtk_statusbar_push (b->statusbar, b->status_context_id, message);
+	g_free (message);
+	
+	/* Paginated pages chain - predict the page after this one */
+	if (webkit_web_view_get_load_status (c->view) == WEBKIT_LOAD_FINISHED)
+		prerender_next_page (c);
+	
+	return FALSE;
+}
+
+/*
+ * Navigating the current tab to the prerendered page shows the hidden view
+ * instead of loading the page again
+ */
+static gboolean
+navigation_policy_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitNetworkRequest* request, WebKitWebNavigationAction* action, WebKitWebPolicyDecision* decision, Client* c)
+{
+	JANK_ENTER (c);
+	Browser* b = c->b;
+	
+	if (c->prerender || c != b->current || !b->prerender || b->prerender_swap_id)
+		return FALSE;
+	if (frame != webkit_web_view_get_main_frame (web_view)
+		|| webkit_web_navigation_action_get_reason (action) == WEBKIT_WEB_NAVIGATION_REASON_FORM_SUBMITTED
+		|| g_strcmp0 (webkit_network_request_get_uri (request), b->prerender_uri) != 0)
+		return FALSE;
+	
+	/* The current view is still in its signal handler - swap it out afterwards */
+	webkit_web_policy_decision_ignore (decision);
+	b->prerender_swap_id = g_idle_add (prerender_swap_cb, b);
+	return TRUE;
+}
+
+static gboolean
+prerender_hover_cb (gpointer data)
+{
+	Browser* b = data;
+	
+	b->prerender_hover_id = 0;
+	prerender_start (b, b->prerender_hover_uri);
+	return FALSE;
+}
+
+/*
+ * A link hovered for prerender_hover_delay ms is likely to be clicked
+ */
+static void
+prerender_hover (Browser* b, const gchar* link)
+{
+	if (b->prerender_hover_id)
+	{
+		g_source_remove (b->prerender_hover_id);
+		b->prerender_hover_id = 0;
+	}
+	g_free (b->prerender_hover_uri);
+	b->prerender_hover_uri = g_strdup (link);
+	
+	if (link && enableprerender)
+		b->prerender_hover_id = g_timeout_add (prerender_hover_delay, prerender_hover_cb, b);
+}
+
+/*
+ * A page announcing its next page (rel="next") is likely to be followed there
+ */
+static void
+prerender_next_page (Client* c)
+{
+	WebKitDOMDocument* document = webkit_web_view_get_dom_document (c->view);
+	WebKitDOMElement* next;
+	gchar* href = NULL;
+	
+	/* A lite tab would not want the whole of the next page */
+	if (!enableprerender || !document || c->lite)
+		return;
+	
+	next = webkit_dom_document_query_selector (document, "link[rel~=next], a[rel~=next]", NULL);
+	if (next && WEBKIT_DOM_IS_HTML_LINK_ELEMENT (next))
+		href = webkit_dom_html_link_element_get_href (WEBKIT_DOM_HTML_LINK_ELEMENT (next));
+	else if (next && WEBKIT_DOM_IS_HTML_ANCHOR_ELEMENT (next))
+		href = webkit_dom_html_anchor_element_get_href (WEBKIT_DOM_HTML_ANCHOR_ELEMENT (next));
+	
+	prerender_start (c->b, href);
+	g_free (href);
+}
+
+/*
+ * Release a client before its widgets are destroyed - nothing calls back into
+ * it afterwards
+ */
+static void
+client_free (Client* c)
+{
+	flight_record (FLIGHT_TAB_CLOSE, 0, c->flight_id, 0);
+	metrics_add (METRIC_TABS, -1);
+	if (c->remote)
+	{
+		remote_detach (c);
+		g_object_set_data (G_OBJECT (c->pane), "client", NULL);
+		g_free (c->remote_uri);
+		g_free (c->title);
+		free (c);
+		return;
+	}
+	
+	jank_event_abandon (c);
+	g_signal_handlers_disconnect_matched (G_OBJECT (c->view), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, c);
+	tab_index_drop (c);
+	if (c->inspector)
+		g_signal_handlers_disconnect_matched (G_OBJECT (c->inspector), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, c);
+	webkit_web_view_stop_loading (c->view);
+	g_object_set_data (G_OBJECT (c->pane), "client", NULL);
+	
+	g_free (c->normal_uri);
+	g_free (c->title);
+	free (c);
+}
+
+static GtkWidget*
+create_notebook (Browser* b)
+{
+	GtkWidget* notebook = gtk_notebook_new ();
+	gtk_notebook_popup_enable (GTK_NOTEBOOK (notebook));
+	g_signal_connect (G_OBJECT (notebook), "switch-page", G_CALLBACK (tab_switched_cb), b);
+	
+	/* One close button for the current tab, instead of one per tab */
+	GtkWidget* button = gtk_button_new ();
+	gtk_button_set_relief (GTK_BUTTON (button), GTK_RELIEF_NONE);
+	gtk_button_set_focus_on_click (GTK_BUTTON (button), FALSE);
+	gtk_widget_set_name (button, "sb-close-tab-button");
+	gtk_widget_set_tooltip_text (button, "Close the current tab");
+	gtk_container_add (GTK_CONTAINER (button), gtk_image_new_from_stock (GTK_STOCK_CLOSE, GTK_ICON_SIZE_MENU));
+	g_signal_connect (button, "clicked", G_CALLBACK (close_tab_cb), b);
+	g_signal_connect (button, "style-set", G_CALLBACK (notebook_tab_close_button_style_set), NULL);
+	gtk_widget_show_all (button);
+	gtk_notebook_set_action_widget (GTK_NOTEBOOK (notebook), button, GTK_PACK_END);
+	
+	return notebook;
+}
+
+/*
+ * Callback for a window being closed - quit when it was the last one
+ */
+static void
+window_destroy_cb (GtkWidget* widget, Browser* b)
+{
+	guint i;
+	
+	browsers = g_list_remove (browsers, b);
+	if (b->finish_id)
+		g_source_remove (b->finish_id);
+	
+	/* The tabs are destroyed after this - keep their signals away from b */
+	g_signal_handlers_disconnect_matched (G_OBJECT (b->book), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, b);
+	for (i = 0; i < b->clients->len; i++)
+		client_free (g_ptr_array_index (b->clients, i));
+	
+	if (b->switcher)
+		gtk_widget_destroy (b->switcher);
+	
+	prerender_discard (b);
+	prerender_hover (b, NULL);
+	
+	find_bar_cancel (b);
+	g_free (b->find_last_text);
+	g_ptr_array_free (b->clients, TRUE);
+	g_free (b);
+	
+	if (!browsers)
+		destroy_cb (widget, NULL);
+}
+
+/*
+ * Create the main window, set name and icon.
+ * Default geometry = 800x600
+ */
+static GtkWidget*
+create_window (Browser* b)
+{
+	GtkWidget* window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_default_size (GTK_WINDOW (window), 800, 600);
+	gtk_widget_set_name (window, "sb");
+	gtk_window_set_icon_name (GTK_WINDOW (window), "web-browser");
+	g_signal_connect (G_OBJECT (window), "destroy", G_CALLBACK (window_destroy_cb), b);
+
+	return window;
+}
+
+/*
+ * Build what the first page does not need - the menus with their shortcuts,
+ * and spell checking - once the window has been drawn
+ */
+static gboolean
+browser_finish_cb (gpointer data)
+{
+	Browser* b = data;
+	GtkAccelGroup* accel_group = gtk_accel_group_new ();
+	GtkWidget* vbox = gtk_widget_get_parent (b->book);
+	
+	b->finish_id = 0;
+	b->menubar = create_menubar (b, accel_group);
+	gtk_box_pack_start (GTK_BOX (vbox), b->menubar, FALSE, FALSE, 0);
+	gtk_box_reorder_child (GTK_BOX (vbox), b->menubar, 0);
+	/* Kiosk windows keep the shortcuts, without the menus */
+	if (!kiosk_file)
+		gtk_widget_show_all (b->menubar);
+	gtk_window_add_accel_group (GTK_WINDOW (b->window), accel_group);
+	g_object_unref (accel_group);
+	
+	spell_checking_start_cb (NULL);
+	
+	return FALSE;
+}
+
+static gboolean
+browser_first_expose_cb (GtkWidget* widget, GdkEventExpose* event, Browser* b)
+{
+	g_signal_handlers_disconnect_by_func (G_OBJECT (widget), G_CALLBACK (browser_first_expose_cb), b);
+	b->finish_id = g_idle_add_full (G_PRIORITY_LOW, browser_finish_cb, b, NULL);
+	return FALSE;
+}
+
+/*
+ * Create a browser window with one (blank) tab
+ */
+static Browser*
+create_browser ()
+{
+	Browser* b = g_new0 (Browser, 1);
+	GtkWidget* vbox = gtk_vbox_new (FALSE, 0);
+	
+	/* Create GtkNotebook to hold web page tabs - the menus and find bar come later */
+	b->book = create_notebook (b);
+	b->toolbar = create_toolbar (b);
+	gtk_box_pack_start (GTK_BOX (vbox), b->toolbar, FALSE, FALSE, 0);
+	b->clients = g_ptr_array_new ();
+	Client* c = create_client (b);
+	b->current = c;
+	append_tab (b, c, NULL);
+	gtk_box_pack_start (GTK_BOX (vbox), b->book, TRUE, TRUE, 0);
+	gtk_box_pack_start (GTK_BOX (vbox), create_statusbar (b), FALSE, FALSE, 0);
+	
+	b->window = create_window (b);
+	g_signal_connect_after (G_OBJECT (b->window), "expose-event", G_CALLBACK (browser_first_expose_cb), b);
+	gtk_container_add (GTK_CONTAINER (b->window), vbox);
+	client_focus (c);
+	
+	browsers = g_list_append (browsers, b);
+	
+	return b;
+}
+
+/*
+ * Main function of program
+ */
+/*
+ * Batch rendering: sb --render urls.txt --out dir/ --jobs N
+ *
+ * The parent hands urls to N worker processes (sb --render-worker) over their
+ * stdin, a few at a time, and reads one result line per page from their
+ * stdout - "ok|fail <index> <ms> <message>". Workers render with a small pool
+ * of offscreen views and exit when their stdin is closed. Handing out urls as
+ * workers free up keeps all of them busy however uneven the pages are.
+ */
+typedef struct RenderWorker {
+	GPid pid;
+	GIOChannel *in, *out;
+	guint pending;
+} RenderWorker;
+
+typedef struct RenderView {
+	GtkWidget* window;
+	WebKitWebView* view;
+	gint index;
+	guint timeout_id;
+	gint64 start;
+} RenderView;
+
+static GPtrArray* render_urls;
+static guint render_next = 0, render_done = 0, render_failures = 0, render_running = 0;
+static gint64 render_start;
+
+static RenderView* render_views;
+static GQueue render_queue = G_QUEUE_INIT;
+static gboolean render_input_done = FALSE;
+
+/*
+ * Worker: send the result for a page and free its view
+ */
+static void
+render_report (RenderView* rv, gboolean ok, const gchar* message)
+{
+	printf ("%s %d %.0f %s\n", ok ? "ok" : "fail", rv->index, (g_get_monotonic_time () - rv->start) / 1000.0, message);
+	fflush (stdout);
+	
+	rv->index = -1;
+	if (rv->timeout_id)
+	{
+		g_source_remove (rv->timeout_id);
+		rv->timeout_id = 0;
+	}
+	webkit_web_view_stop_loading (rv->view);
+}
+
+/*
+ * Worker: write the loaded page of a view as PNG and/or PDF
+ */
+static void
+render_capture (RenderView* rv)
+{
+	gchar* base = g_strdup_printf ("%s/%04d", render_out, rv->index);
+	GError* error = NULL;
+	gchar* path;
+	
+	if (g_strcmp0 (render_format, "pdf") != 0)
+	{
+		/* Flush pending paints into the offscreen pixmap first */
+		gdk_window_process_updates (gtk_widget_get_window (rv->window), TRUE);
+		GdkPixbuf* pixbuf = gtk_offscreen_window_get_pixbuf (GTK_OFFSCREEN_WINDOW (rv->window));
+		
+		path = g_strconcat (base, ".png", NULL);
+		if (!pixbuf)
+			g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED, "Nothing was painted");
+		else
+		{
+			gdk_pixbuf_save (pixbuf, path, "png", &error, NULL);
+			g_object_unref (pixbuf);
+		}
+		g_free (path);
+	}
+	
+	if (!error && g_strcmp0 (render_format, "png") != 0)
+	{
+		GtkPrintOperation* operation = gtk_print_operation_new ();
+		
+		path = g_strconcat (base, ".pdf", NULL);
+		gtk_print_operation_set_export_filename (operation, path);
+		webkit_web_frame_print_full (webkit_web_view_get_main_frame (rv->view), operation, GTK_PRINT_OPERATION_ACTION_EXPORT, &error);
+		g_object_unref (operation);
+		g_free (path);
+	}
+	
+	render_report (rv, !error, error ? error->message : base);
+	g_clear_error (&error);
+	g_free (base);
+}
+
+static void render_worker_next (void);
+
+static gboolean
+render_timeout_cb (gpointer data)
+{
+	RenderView* rv = data;
+	
+	rv->timeout_id = 0;
+	render_report (rv, FALSE, "timed out");
+	render_worker_next ();
+	return FALSE;
+}
+
+static void
+render_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, RenderView* rv)
+{
+	/* Ignore whatever a view does once its page is reported */
+	if (rv->index < 0)
+		return;
+	
+	switch (webkit_web_view_get_load_status (web_view))
+	{
+		case WEBKIT_LOAD_FINISHED:
+			render_capture (rv);
+			render_worker_next ();
+			break;
+		case WEBKIT_LOAD_FAILED:
+			render_report (rv, FALSE, "load failed");
+			render_worker_next ();
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Worker: give queued pages to idle views, and quit once everything is done
+ */
+static void
+render_worker_next (void)
+{
+	gboolean busy = FALSE;
+	guint i;
+	
+	for (i = 0; i < render_pool_size; i++)
+	{
+		RenderView* rv = &render_views[i];
+		gchar *line, *uri;
+		
+		if (rv->index < 0 && (line = g_queue_pop_head (&render_queue)))
+		{
+			rv->index = strtol (line, &uri, 10);
+			rv->start = g_get_monotonic_time ();
+			rv->timeout_id = g_timeout_add_seconds (render_timeout, render_timeout_cb, rv);
+			webkit_web_view_load_uri (rv->view, g_strstrip (uri));
+			g_free (line);
+		}
+		busy |= rv->index >= 0;
+	}
+	
+	if (render_input_done && !busy && g_queue_is_empty (&render_queue))
+		destroy_cb (NULL, NULL);
+}
+
+static gboolean
+render_worker_input_cb (GIOChannel* channel, GIOCondition condition, gpointer data)
+{
+	gchar* line;
+	
+	switch (g_io_channel_read_line (channel, &line, NULL, NULL, NULL))
+	{
+		case G_IO_STATUS_NORMAL:
+			g_queue_push_tail (&render_queue, line);
+			render_worker_next ();
+			return TRUE;
+		case G_IO_STATUS_AGAIN:
+			return TRUE;
+		default:
+			render_input_done = TRUE;
+			render_worker_next ();
+			return FALSE;
+	}
+}
+
+/*
+ * sb --render-worker: render "<index> <uri>" lines from stdin
+ */
+static int
+render_worker_main (void)
+{
+	guint i;
+	
+	g_mkdir_with_parents (render_out, 0755);
+	
+	/* Views set up like any other, each in an offscreen window of the render size */
+	render_views = g_new0 (RenderView, render_pool_size);
+	for (i = 0; i < render_pool_size; i++)
+	{
+		RenderView* rv = &render_views[i];
+		
+		rv->index = -1;
+		rv->view = WEBKIT_WEB_VIEW (webkit_web_view_new ());
+		set_settings (rv->view);
+		g_signal_connect (G_OBJECT (rv->view), "notify::load-status", G_CALLBACK (render_load_status_cb), rv);
+		
+		rv->window = gtk_offscreen_window_new ();
+		gtk_window_set_default_size (GTK_WINDOW (rv->window), render_width, render_height);
+		gtk_container_add (GTK_CONTAINER (rv->window), GTK_WIDGET (rv->view));
+		gtk_widget_show_all (rv->window);
+	}
+	
+	GIOChannel* input = g_io_channel_unix_new (STDIN_FILENO);
+	g_io_add_watch (input, G_IO_IN | G_IO_HUP | G_IO_ERR, render_worker_input_cb, NULL);
+	
+	gtk_main ();
+	
+	return 0;
+}
+
+/*
+ * Parent: keep a worker supplied with pages, and close its input when there are none left
+ */
+static void
+render_send (RenderWorker* w)
+{
+	while (w->in && w->pending < render_pool_size && render_next < render_urls->len)
+	{
+		gchar* line = g_strdup_printf ("%u %s\n", render_next, (gchar*) g_ptr_array_index (render_urls, render_next));
+		
+		g_io_channel_write_chars (w->in, line, -1, NULL, NULL);
+		g_io_channel_flush (w->in, NULL);
+		g_free (line);
+		render_next++;
+		w->pending++;
+	}
+	
+	if (w->in && render_next == render_urls->len && w->pending == 0)
+	{
+		g_io_channel_shutdown (w->in, TRUE, NULL);
+		g_io_channel_unref (w->in);
+		w->in = NULL;
+	}
+}
+
+static gboolean
+render_result_cb (GIOChannel* channel, GIOCondition condition, RenderWorker* w)
+{
+	gchar *line, *message;
+	
+	if (g_io_channel_read_line (channel, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL)
+	{
+		gboolean ok = g_str_has_prefix (line, "ok ");
+		guint index = strtoul (line + (ok ? 3 : 5), &message, 10);
+		gdouble msec = g_ascii_strtod (message, &message);
+		
+		render_done++;
+		if (!ok)
+			render_failures++;
+		w->pending--;
+		fprintf (stderr, "[%u/%u] %s %s (%.0f ms)%s%s\n", render_done, render_urls->len, ok ? "ok  " : "FAIL",
+				 index < render_urls->len ? (gchar*) g_ptr_array_index (render_urls, index) : "?", msec,
+				 ok ? "" : " - ", ok ? "" : g_strstrip (message));
+		g_free (line);
+		
+		render_send (w);
+		return TRUE;
+	}
+	
+	/* The worker is gone - whatever it still had is lost */
+	if (w->pending)
+		fprintf (stderr, "sb: render worker %d exited with %u page(s) unfinished\n", (int) w->pid, w->pending);
+	render_done += w->pending;
+	render_failures += w->pending;
+	if (w->in)
+	{
+		g_io_channel_shutdown (w->in, FALSE, NULL);
+		g_io_channel_unref (w->in);
+	}
+	g_io_channel_unref (w->out);
+	g_spawn_close_pid (w->pid);
+	g_free (w);
+	
+	if (--render_running == 0)
+	{
+		gdouble seconds = (g_get_monotonic_time () - render_start) / (gdouble) G_USEC_PER_SEC;
+		fprintf (stderr, "sb: rendered %u page(s) in %.1f s (%.2f pages/s), %u failed\n",
+				 render_done - render_failures, seconds, (render_done - render_failures) / seconds, render_failures);
+		gtk_main_quit ();
+	}
+	return FALSE;
+}
+
+/*
+ * sb --render FILE: render every url in FILE (one per line, # for comments)
+ * with --jobs worker processes
+ */
+static int
+render_main (void)
+{
+	gchar *contents, **lines, *timeout_arg;
+	GError* error = NULL;
+	gint i;
+	
+	if (!g_file_get_contents (render_file, &contents, NULL, &error))
+	{
+		fprintf (stderr, "sb: %s\n", error->message);
+		return 1;
+	}
+	render_urls = g_ptr_array_new_with_free_func (g_free);
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i]; i++)
+	{
+		g_strstrip (lines[i]);
+		if (lines[i][0] && lines[i][0] != '#')
+			g_ptr_array_add (render_urls, g_strdup (lines[i]));
+	}
+	g_strfreev (lines);
+	g_free (contents);
+	
+	if (render_urls->len == 0)
+		return 0;
+	if (render_jobs <= 0)
+		render_jobs = g_get_num_processors ();
+	render_jobs = MIN ((guint) render_jobs, (render_urls->len + render_pool_size - 1) / render_pool_size);
+	
+	timeout_arg = g_strdup_printf ("%d", render_timeout);
+	gchar* argv[] = {"/proc/self/exe", "--render-worker", "--out", render_out, "--format", render_format, "--timeout", timeout_arg, NULL};
+	
+	/* A worker dying must not take the parent with it */
+	signal (SIGPIPE, SIG_IGN);
+	
+	render_start = g_get_monotonic_time ();
+	for (i = 0; i < render_jobs; i++)
+	{
+		RenderWorker* w = g_new0 (RenderWorker, 1);
+		gint in_fd, out_fd;
+		
+		if (!g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, &w->pid, &in_fd, &out_fd, NULL, &error))
+		{
+			fprintf (stderr, "sb: cannot start render worker: %s\n", error->message);
+			g_clear_error (&error);
+			g_free (w);
+			continue;
+		}
+		w->in = g_io_channel_unix_new (in_fd);
+		w->out = g_io_channel_unix_new (out_fd);
+		g_io_channel_set_close_on_unref (w->out, TRUE);
+		g_io_add_watch (w->out, G_IO_IN | G_IO_HUP | G_IO_ERR, (GIOFunc) render_result_cb, w);
+		render_running++;
+		render_send (w);
+	}
+	g_free (timeout_arg);
+	
+	if (render_running)
+		gtk_main ();
+	
+	return render_failures || render_done < render_urls->len ? 1 : 0;
+}
+
+/*
+ * Scroll benchmark: sb --bench-scroll pages.txt
+ *
+ * Loads each page in turn in a normal window, scrolls it top to bottom by
+ * bench_scroll_step pixels every bench_scroll_interval ms through the
+ * scrolled window's adjustment, and times the gaps between expose events.
+ * Results go to stdout as JSON. Run with and without --smooth-scrolling,
+ * --no-full-content-zoom and --transparent to compare.
+ */
+static Browser* bench_browser;
+static GPtrArray* bench_uris;
+static guint bench_page = 0;
+static GArray* bench_frames;
+static gint64 bench_last_expose;
+static gboolean bench_scrolling = FALSE;
+static GString* bench_json;
+
+static void bench_scroll_load (void);
+
+static gint
+bench_compare (gconstpointer a, gconstpointer b)
+{
+	gdouble x = *(const gdouble*) a, y = *(const gdouble*) b;
+	return x < y ? -1 : x > y;
+}
+
+static gdouble
+bench_percentile (GArray* sorted, gdouble p)
+{
+	return sorted->len ? g_array_index (sorted, gdouble, MIN (sorted->len - 1, (guint) (p * sorted->len))) : 0;
+}
+
+/*
+ * Record the results of the current page and go on to the next
+ */
+static void
+bench_scroll_finish (const gchar* error)
+{
+	gchar* uri = g_strescape (g_ptr_array_index (bench_uris, bench_page), NULL);
+	guint i, dropped = 0;
+	
+	bench_scrolling = FALSE;
+	if (bench_json->len > 1)
+		g_string_append (bench_json, ",");
 	
-	/* Add them to the appropriate menu */
-	gtk_menu_append (GTK_MENU (file_menu), open_item);
-	gtk_menu_append (GTK_MENU (file_menu), print_item);
-	gtk_menu_append (GTK_MENU (file_menu), gtk_separator_menu_item_new ());
-	gtk_menu_append (GTK_MENU (file_menu), quit_item);
+	if (error)
+		g_string_append_printf (bench_json, "\n    {\"uri\": \"%s\", \"error\": \"%s\"}", uri, error);
+	else
+	{
+		/* A gap of n intervals means n - 1 frames were not drawn */
+		for (i = 0; i < bench_frames->len; i++)
+		{
+			gdouble gap = g_array_index (bench_frames, gdouble, i);
+			if (gap > 1.5 * bench_scroll_interval)
+				dropped += (guint) (gap / bench_scroll_interval + 0.5) - 1;
+		}
+		g_array_sort (bench_frames, bench_compare);
+		g_string_append_printf (bench_json, "\n    {\"uri\": \"%s\", \"frames\": %u, \"dropped\": %u, "
+								"\"p50_ms\": %.2f, \"p90_ms\": %.2f, \"p99_ms\": %.2f, \"max_ms\": %.2f}",
+								uri, bench_frames->len, dropped, bench_percentile (bench_frames, 0.5),
+								bench_percentile (bench_frames, 0.9), bench_percentile (bench_frames, 0.99),
+								bench_percentile (bench_frames, 1.0));
+	}
+	g_free (uri);
+	
+	bench_page++;
+	bench_scroll_load ();
+}
+
+static gboolean
+bench_scroll_step_cb (gpointer data)
+{
+	GtkAdjustment* adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (bench_browser->current->scroll));
+	gdouble bottom = gtk_adjustment_get_upper (adjustment) - gtk_adjustment_get_page_size (adjustment);
+	gdouble value = gtk_adjustment_get_value (adjustment);
+	
+	if (value >= bottom)
+	{
+		bench_scroll_finish (bottom <= 0 ? "page does not scroll" : NULL);
+		return FALSE;
+	}
+	gtk_adjustment_set_value (adjustment, MIN (value + bench_scroll_step, bottom));
+	return TRUE;
+}
+
+static gboolean
+bench_scroll_start_cb (gpointer data)
+{
+	GtkAdjustment* adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (bench_browser->current->scroll));
+	
+	gtk_adjustment_set_value (adjustment, 0);
+	g_array_set_size (bench_frames, 0);
+	bench_last_expose = 0;
+	bench_scrolling = TRUE;
+	g_timeout_add (bench_scroll_interval, bench_scroll_step_cb, NULL);
+	return FALSE;
+}
+
+static gboolean
+bench_expose_cb (GtkWidget* widget, GdkEventExpose* event, gpointer data)
+{
+	gint64 now = g_get_monotonic_time ();
+	
+	if (bench_scrolling)
+	{
+		if (bench_last_expose)
+		{
+			gdouble gap = (now - bench_last_expose) / 1000.0;
+			g_array_append_val (bench_frames, gap);
+		}
+		bench_last_expose = now;
+	}
+	return FALSE;
+}
+
+static void
+bench_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
+{
+	switch (webkit_web_view_get_load_status (web_view))
+	{
+		case WEBKIT_LOAD_FINISHED:
+			/* Let layout and the first paint settle before scrolling */
+			if (!bench_scrolling)
+				g_timeout_add (500, bench_scroll_start_cb, NULL);
+			break;
+		case WEBKIT_LOAD_FAILED:
+			bench_scroll_finish ("load failed");
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Load the next page, or print the results and quit after the last one
+ */
+static void
+bench_scroll_load (void)
+{
+	if (bench_page < bench_uris->len)
+	{
+		webkit_web_view_load_uri (bench_browser->current->view, g_ptr_array_index (bench_uris, bench_page));
+		return;
+	}
+	
+	gboolean smooth;
+	g_object_get (G_OBJECT (web_settings), "enable-smooth-scrolling", &smooth, NULL);
+	printf ("{\n  \"settings\": {\"smooth_scrolling\": %s, \"full_content_zoom\": %s, \"transparent\": %s, "
+			"\"interval_ms\": %u, \"step_px\": %u},\n  \"pages\": [%s\n  ]\n}\n",
+			smooth ? "true" : "false", fullcontentzoom ? "true" : "false", hidebackground ? "true" : "false",
+			bench_scroll_interval, bench_scroll_step, bench_json->str + 1);
+	gtk_widget_destroy (bench_browser->window);
+}
+
+static int
+bench_scroll_main (void)
+{
+	gchar *contents, **lines;
+	GError* error = NULL;
+	gint i;
+	
+	if (!g_file_get_contents (bench_scroll_file, &contents, NULL, &error))
+	{
+		fprintf (stderr, "sb: %s\n", error->message);
+		return 1;
+	}
+	bench_uris = g_ptr_array_new_with_free_func (g_free);
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i]; i++)
+	{
+		g_strstrip (lines[i]);
+		if (lines[i][0] == '/')
+			g_ptr_array_add (bench_uris, g_strconcat ("file://", lines[i], NULL));
+		else if (lines[i][0] && lines[i][0] != '#')
+			g_ptr_array_add (bench_uris, g_strdup (lines[i]));
+	}
+	g_strfreev (lines);
+	g_free (contents);
+	if (bench_uris->len == 0)
+		return 0;
+	
+	/* Only the page under test, in this process */
+	tab_processes = 0;
+	enableprerender = FALSE;
+	
+	bench_frames = g_array_new (FALSE, FALSE, sizeof (gdouble));
+	bench_json = g_string_new ("[");
+	
+	bench_browser = create_browser ();
+	gtk_window_resize (GTK_WINDOW (bench_browser->window), bench_scroll_width, bench_scroll_height);
+	g_signal_connect (G_OBJECT (bench_browser->current->view), "notify::load-status", G_CALLBACK (bench_load_status_cb), NULL);
+	g_signal_connect (G_OBJECT (bench_browser->current->view), "expose-event", G_CALLBACK (bench_expose_cb), NULL);
+	gtk_widget_show_all (bench_browser->window);
+	
+	bench_scroll_load ();
+	gtk_main ();
+	
+	return 0;
+}
+
+/*
+ * Tab churn soak: sb --soak N [URI]
+ *
+ * Opens a tab on URI (the built-in home page by default), waits for it to
+ * load and closes it through the same path as the close button, N times,
+ * printing resident memory every soak_sample_interval cycles. Fails if memory
+ * in the last quarter of the run is more than soak_growth_limit percent above
+ * the second quarter - the first quarter is warm-up for caches.
+ */
+static Browser* soak_browser;
+static Client* soak_client;
+static const gchar* soak_uri;
+static gint soak_cycle = 0;
+static guint soak_close_id = 0;
+static GArray* soak_samples;
+static gboolean soak_failed = FALSE;
+
+static void soak_open (void);
+
+static gdouble
+soak_mean (guint from, guint to)
+{
+	gdouble sum = 0;
+	guint i;
+	
+	for (i = from; i < to; i++)
+		sum += g_array_index (soak_samples, glong, i);
+	return to > from ? sum / (to - from) : 0;
+}
+
+static void
+soak_finish (void)
+{
+	guint quarter = soak_samples->len / 4;
+	
+	if (quarter == 0)
+		printf ("soak: too few samples to judge\n");
+	else
+	{
+		gdouble early = soak_mean (quarter, 2 * quarter);
+		gdouble late = soak_mean (soak_samples->len - quarter, soak_samples->len);
+		gdouble growth = 100.0 * (late - early) / early;
+		
+		soak_failed = growth > soak_growth_limit;
+		printf ("soak: %d cycles, resident memory %.0f kB -> %.0f kB (%+.1f%%): %s\n", soak_cycle,
+				early, late, growth, soak_failed ? "FAIL, no plateau" : "ok");
+	}
+	gtk_widget_destroy (soak_browser->window);
+}
+
+static gboolean
+soak_close_cb (gpointer data)
+{
+	soak_close_id = 0;
+	notebook_tab_close_clicked_cb (NULL, soak_client);
+	soak_client = NULL;
+	
+	if (++soak_cycle % soak_sample_interval == 0)
+	{
+		glong resident = resident_memory ();
+		g_array_append_val (soak_samples, resident);
+		printf ("%d %ld\n", soak_cycle, resident);
+		fflush (stdout);
+	}
+	
+	if (soak_cycle < soak_cycles)
+		soak_open ();
+	else
+		soak_finish ();
+	return FALSE;
+}
+
+static void
+soak_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, Client* c)
+{
+	WebKitLoadStatus status = webkit_web_view_get_load_status (web_view);
+	
+	/* Close from the main loop, not from inside the view's own signal */
+	if (c == soak_client && !soak_close_id && (status == WEBKIT_LOAD_FINISHED || status == WEBKIT_LOAD_FAILED))
+		soak_close_id = g_idle_add (soak_close_cb, NULL);
+}
+
+static void
+soak_open (void)
+{
+	Browser* b = soak_browser;
+	Client* c = create_new_client (b);
+	
+	append_tab (b, c, soak_uri);
+	gtk_widget_show_all (c->pane);
+	gtk_notebook_set_current_page (GTK_NOTEBOOK (b->book), gtk_notebook_get_n_pages (GTK_NOTEBOOK (b->book)) - 1);
+	g_signal_connect (G_OBJECT (c->view), "notify::load-status", G_CALLBACK (soak_load_status_cb), c);
+	soak_client = c;
+	webkit_web_view_load_uri (c->view, soak_uri);
+}
+
+static int
+soak_main (const gchar* uri)
+{
+	soak_uri = uri;
+	
+	/* The views churned are this process's */
+	tab_processes = 0;
+	enableprerender = FALSE;
+	soak_samples = g_array_new (FALSE, FALSE, sizeof (glong));
+	
+	/* The first tab stays, so closing the churned one never closes the window */
+	soak_browser = create_browser ();
+	webkit_web_view_load_uri (soak_browser->current->view, "about:blank");
+	gtk_widget_show_all (soak_browser->window);
+	
+	soak_open ();
+	gtk_main ();
+	
+	g_array_free (soak_samples, TRUE);
+	return soak_failed ? 1 : 0;
+}
+
+/*
+ * Kiosk: sb --kiosk playlist.txt
+ *
+ * Shows the pages of the playlist full screen, one after another, for wall
+ * displays. Each line is "URI [DWELL] [REFRESH]" - seconds the page is shown,
+ * and between checks for a new version (0 never checks); blank lines and
+ * lines starting with # are skipped. Every page stays loaded in its own tab,
+ * so rotating only switches the notebook page.
+ *
+ * A check is a conditional HEAD with the validators of the shown version
+ * (ETag, Last-Modified); the page is reloaded only if they changed. Pages
+ * without validators are checked with a GET, and a body that differs from the
+ * shown one is loaded into the view as it is, so it is not downloaded twice.
+ * An unchanged dashboard is neither downloaded nor drawn again. Views are
+ * never freed while the display runs, so a watchdog rebuilds the hidden tab
+ * loaded longest ago whenever resident memory grows past kiosk_memory_limit,
+ * at most once every kiosk_rebuild_cooldown seconds, to give memory time to
+ * come back.
+ */
+typedef struct KioskEntry {
+	gchar* uri;
+	guint dwell, refresh;
+	Client* c;
+	gint64 created;
+	gboolean loaded;
+	gchar *etag, *modified, *checksum;
+	SoupMessage* probe;
+	guint refresh_id;
+} KioskEntry;
+
+static Browser* kiosk_browser;
+static GPtrArray* kiosk_entries;
+static guint kiosk_current = 0;
+static guint kiosk_rotate_id = 0, kiosk_watchdog_id = 0;
+static gint64 kiosk_last_rebuild = 0;
+
+static void kiosk_open (KioskEntry* e, gint position);
+
+static void
+kiosk_entry_free (KioskEntry* e)
+{
+	if (e->probe)
+		soup_session_cancel_message (webkit_get_default_session (), e->probe, SOUP_STATUS_CANCELLED);
+	if (e->refresh_id)
+		g_source_remove (e->refresh_id);
+	g_free (e->uri);
+	g_free (e->etag);
+	g_free (e->modified);
+	g_free (e->checksum);
+	g_free (e);
+}
+
+static KioskEntry*
+kiosk_entry_for (Client* c)
+{
+	guint i;
+	
+	for (i = 0; i < kiosk_entries->len; i++)
+		if (((KioskEntry*) g_ptr_array_index (kiosk_entries, i))->c == c)
+			return g_ptr_array_index (kiosk_entries, i);
+	return NULL;
+}
+
+/*
+ * Remember what the shown version is - its validators and a checksum of the
+ * document - to compare the next check against
+ */
+static void
+kiosk_remember (KioskEntry* e)
+{
+	WebKitWebFrame* frame = webkit_web_view_get_main_frame (e->c->view);
+	WebKitNetworkResponse* response = webkit_web_frame_get_network_response (frame);
+	SoupMessage* msg = response ? webkit_network_response_get_message (response) : NULL;
+	GString* data = webkit_web_data_source_get_data (webkit_web_frame_get_data_source (frame));
+	
+	g_free (e->etag);
+	g_free (e->modified);
+	g_free (e->checksum);
+	e->etag = msg ? g_strdup (soup_message_headers_get_one (msg->response_headers, "ETag")) : NULL;
+	e->modified = msg ? g_strdup (soup_message_headers_get_one (msg->response_headers, "Last-Modified")) : NULL;
+	e->checksum = data ? g_compute_checksum_for_data (G_CHECKSUM_SHA1, (const guchar*) data->str, data->len) : NULL;
+	if (response)
+		g_object_unref (response);
+}
+
+static void
+kiosk_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, Client* c)
+{
+	JANK_ENTER (c);
+	KioskEntry* e = kiosk_entry_for (c);
+	
+	if (!e)
+		return;
+	switch (webkit_web_view_get_load_status (web_view))
+	{
+		case WEBKIT_LOAD_FINISHED:
+			e->loaded = TRUE;
+			kiosk_remember (e);
+			break;
+		case WEBKIT_LOAD_FAILED:
+			e->loaded = FALSE;
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+kiosk_probe_cb (SoupSession* session, SoupMessage* msg, KioskEntry* e)
+{
+	const gchar *etag, *modified, *type;
+	GHashTable* params = NULL;
+	gchar* checksum;
+	
+	if (msg->status_code == SOUP_STATUS_CANCELLED)
+		return;
+	e->probe = NULL;
+	
+	/* Unreachable for now - keep showing what there is */
+	if (msg->status_code == SOUP_STATUS_NOT_MODIFIED || !SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+		return;
+	
+	/* A server that ignores the conditions - compare the validators themselves */
+	etag = soup_message_headers_get_one (msg->response_headers, "ETag");
+	modified = soup_message_headers_get_one (msg->response_headers, "Last-Modified");
+	if (!strcmp (msg->method, SOUP_METHOD_HEAD))
+	{
+		if (g_strcmp0 (etag, e->etag) != 0 || g_strcmp0 (modified, e->modified) != 0)
+			webkit_web_view_reload (e->c->view);
+		return;
+	}
+	
+	/* Servers without validators send the whole page every time - show that copy */
+	checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1, (const guchar*) msg->response_body->data, msg->response_body->length);
+	if (g_strcmp0 (checksum, e->checksum) != 0)
+	{
+		type = soup_message_headers_get_content_type (msg->response_headers, &params);
+		webkit_web_view_load_string (e->c->view, msg->response_body->data, type ? type : "text/html",
+									 params ? g_hash_table_lookup (params, "charset") : NULL, e->uri);
+		if (params)
+			g_hash_table_destroy (params);
+	}
+	else if (etag || modified)
+	{
+		/* Same page, and validators from now on - check with HEAD next time */
+		g_free (e->etag);
+		g_free (e->modified);
+		e->etag = g_strdup (etag);
+		e->modified = g_strdup (modified);
+	}
+	g_free (checksum);
+}
+
+static gboolean
+kiosk_refresh_cb (gpointer data)
+{
+	KioskEntry* e = data;
+	const gchar* uri = webkit_web_view_get_uri (e->c->view);
+	WebKitLoadStatus status = webkit_web_view_get_load_status (e->c->view);
+	SoupMessage* msg;
+	
+	if (e->probe || (status != WEBKIT_LOAD_FINISHED && status != WEBKIT_LOAD_FAILED))
+		return TRUE;
+	
+	/* Nothing shown to compare with - try again from scratch */
+	if (!e->loaded || !uri || !(msg = soup_message_new (e->etag || e->modified ? SOUP_METHOD_HEAD : SOUP_METHOD_GET, uri)))
+	{
+		webkit_web_view_load_uri (e->c->view, e->uri);
+		return TRUE;
+	}
+	
+	if (e->etag)
+		soup_message_headers_append (msg->request_headers, "If-None-Match", e->etag);
+	if (e->modified)
+		soup_message_headers_append (msg->request_headers, "If-Modified-Since", e->modified);
+	e->probe = msg;
+	soup_session_queue_message (webkit_get_default_session (), msg, (SoupSessionCallback) kiosk_probe_cb, e);
+	return TRUE;
+}
+
+static gboolean
+kiosk_rotate_cb (gpointer data)
+{
+	KioskEntry* e;
+	
+	kiosk_current = (kiosk_current + 1) % kiosk_entries->len;
+	e = g_ptr_array_index (kiosk_entries, kiosk_current);
+	gtk_notebook_set_current_page (GTK_NOTEBOOK (kiosk_browser->book), kiosk_current);
+	kiosk_rotate_id = g_timeout_add_seconds (e->dwell, kiosk_rotate_cb, NULL);
+	return FALSE;
+}
+
+/*
+ * Replace the tab of an entry with a fresh one at the same position
+ */
+static void
+kiosk_rebuild (KioskEntry* e)
+{
+	Browser* b = kiosk_browser;
+	Client* old = e->c;
+	gint position = gtk_notebook_page_num (GTK_NOTEBOOK (b->book), old->pane);
+	
+	if (e->probe)
+		soup_session_cancel_message (webkit_get_default_session (), e->probe, SOUP_STATUS_CANCELLED);
+	e->probe = NULL;
+	kiosk_open (e, position);
+	
+	g_ptr_array_remove (b->clients, old);
+	client_free (old);
+	gtk_notebook_remove_page (GTK_NOTEBOOK (b->book), position + 1);
+	gtk_notebook_set_current_page (GTK_NOTEBOOK (b->book), kiosk_current);
+}
+
+/* In the I/O thread */
+static gboolean
+kiosk_memory_job (gpointer data, GError** error)
+{
+	*(glong*) data = resident_memory ();
+	return TRUE;
+}
+
+/*
+ * WebKit draws every view in this process, so memory can only be measured
+ * for all of them - rebuild the oldest view nobody is looking at, then wait
+ * kiosk_rebuild_cooldown for memory to come back before the next one. The
+ * shown view is never rebuilt, so a single page is left as it is.
+ */
+static void
+kiosk_memory_cb (const GError* error, gpointer data)
+{
+	gint64 now = g_get_monotonic_time ();
+	glong resident = *(glong*) data;
+	KioskEntry* oldest = NULL;
+	guint i;
+	
+	g_free (data);
+	if (!kiosk_entries || resident <= kiosk_memory_limit * 1024)
+		return;
+	
+	for (i = 0; i < kiosk_entries->len; i++)
+	{
+		KioskEntry* e = g_ptr_array_index (kiosk_entries, i);
+		if (i != kiosk_current && (!oldest || e->created < oldest->created))
+			oldest = e;
+	}
+	if (!oldest)
+		return;
+	fprintf (stderr, "sb: kiosk: resident memory %ld kB, rebuilding %s\n", resident, oldest->uri);
+	kiosk_rebuild (oldest);
+	kiosk_last_rebuild = now;
+}
+
+static gboolean
+kiosk_watchdog_cb (gpointer data)
+{
+	gint64 now = g_get_monotonic_time ();
+	glong* resident;
+	
+	if (kiosk_last_rebuild && now - kiosk_last_rebuild < (gint64) kiosk_rebuild_cooldown * G_USEC_PER_SEC)
+		return TRUE;
+	
+	resident = g_new0 (glong, 1);
+	io_call (kiosk_memory_job, resident, kiosk_memory_cb, resident);
+	return TRUE;
+}
+
+/*
+ * Load an entry into a new tab at position
+ */
+static void
+kiosk_open (KioskEntry* e, gint position)
+{
+	Browser* b = kiosk_browser;
+	Client* c = create_new_client (b);
 	
-	gtk_menu_append (GTK_MENU (edit_menu), cut_item);
-	gtk_menu_append (GTK_MENU (edit_menu), copy_item);
-	gtk_menu_append (GTK_MENU (edit_menu), paste_item);
-	gtk_menu_append (GTK_MENU (edit_menu), delete_item);
-	gtk_menu_append (GTK_MENU (edit_menu), gtk_separator_menu_item_new ());
-	gtk_menu_append (GTK_MENU (edit_menu), find_item);
+	gtk_notebook_insert_page (GTK_NOTEBOOK (b->book), c->pane, create_tab_label (c, e->uri), position);
+	g_ptr_array_add (b->clients, c);
+	gtk_widget_show_all (c->pane);
+	g_signal_connect (G_OBJECT (c->view), "notify::load-status", G_CALLBACK (kiosk_load_status_cb), c);
 	
-	gtk_menu_append (GTK_MENU (view_menu), zoom_in_item);
-	gtk_menu_append (GTK_MENU (view_menu), zoom_out_item);
-	gtk_menu_append (GTK_MENU (view_menu), zoom_reset_item);
-	gtk_menu_append (GTK_MENU (view_menu), fullscreen_item);
+	e->c = c;
+	e->created = g_get_monotonic_time ();
+	e->loaded = FALSE;
+	webkit_web_view_load_uri (c->view, e->uri);
+}
+
+static int
+kiosk_main (void)
+{
+	gchar *contents, **lines;
+	GError* error = NULL;
+	gint i;
 	
-	gtk_menu_append (GTK_MENU (tools_menu), settings_item);
-	if (enableinspector)
-		gtk_menu_append (GTK_MENU (tools_menu), inspector_item);
+	if (!g_file_get_contents (kiosk_file, &contents, NULL, &error))
+	{
+		fprintf (stderr, "sb: %s\n", error->message);
+		return 1;
+	}
+	kiosk_entries = g_ptr_array_new_with_free_func ((GDestroyNotify) kiosk_entry_free);
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i]; i++)
+	{
+		gchar** fields;
+		KioskEntry* e;
+		
+		g_strstrip (lines[i]);
+		if (!lines[i][0] || lines[i][0] == '#')
+			continue;
+		fields = g_strsplit_set (lines[i], " \t", -1);
+		e = g_new0 (KioskEntry, 1);
+		e->uri = g_strdup (fields[0]);
+		e->dwell = kiosk_dwell;
+		e->refresh = kiosk_refresh;
+		if (fields[1])
+		{
+			e->dwell = MAX (atoi (fields[1]), 1);
+			if (fields[2])
+				e->refresh = MAX (atoi (fields[2]), 0);
+		}
+		g_ptr_array_add (kiosk_entries, e);
+		g_strfreev (fields);
+	}
+	g_strfreev (lines);
+	g_free (contents);
 	
-	gtk_menu_append (GTK_MENU (help_menu), about_item);
+	if (kiosk_entries->len == 0)
+	{
+		fprintf (stderr, "sb: no pages in %s\n", kiosk_file);
+		return 1;
+	}
 	
-	/* Attach the callback functions to the activate signal */
-	gtk_signal_connect_object (GTK_OBJECT (open_item), "activate", GTK_SIGNAL_FUNC (openfile_cb), (gpointer) "file.open");
-	gtk_signal_connect_object (GTK_OBJECT (print_item), "activate", GTK_SIGNAL_FUNC (print_cb), (gpointer) "file.print");
-	gtk_signal_connect_object (GTK_OBJECT (quit_item), "activate", GTK_SIGNAL_FUNC (destroy_cb), (gpointer) "file.quit");
-	gtk_signal_connect_object (GTK_OBJECT (cut_item), "activate", GTK_SIGNAL_FUNC (cut_cb), (gpointer) "edit.cut");
-	gtk_signal_connect_object (GTK_OBJECT (copy_item), "activate", GTK_SIGNAL_FUNC (copy_cb), (gpointer) "edit.copy");
-	gtk_signal_connect_object (GTK_OBJECT (paste_item), "activate", GTK_SIGNAL_FUNC (paste_cb), (gpointer) "edit.paste");
-	gtk_signal_connect_object (GTK_OBJECT (delete_item), "activate", GTK_SIGNAL_FUNC (delete_cb), (gpointer) "edit.delete");
-	gtk_signal_connect_object (GTK_OBJECT (find_item), "activate", GTK_SIGNAL_FUNC (find_dialog_cb), (gpointer) "edit.find");
-	gtk_signal_connect_object (GTK_OBJECT (zoom_in_item), "activate", GTK_SIGNAL_FUNC (zoom_in_cb), (gpointer) "view.zoom-in");
-	gtk_signal_connect_object (GTK_OBJECT (zoom_out_item), "activate", GTK_SIGNAL_FUNC (zoom_out_cb), (gpointer) "view.zoom-out");
-	gtk_signal_connect_object (GTK_OBJECT (zoom_reset_item), "activate", GTK_SIGNAL_FUNC (zoom_reset_cb), (gpointer) "view.zoom-reset");
-	gtk_signal_connect_object (GTK_OBJECT (fullscreen_item), "activate", GTK_SIGNAL_FUNC (fullscreen_cb), (gpointer) "view.fullscreen");
-	gtk_signal_connect_object (GTK_OBJECT (settings_item), "activate", GTK_SIGNAL_FUNC (settings_dialog_cb), (gpointer) "tools.settings");
-	if (enableinspector)
-		gtk_signal_connect_object (GTK_OBJECT (inspector_item), "activate", GTK_SIGNAL_FUNC (inspector), (gpointer) "tools.inspector");
-	gtk_signal_connect_object (GTK_OBJECT (about_item), "activate", GTK_SIGNAL_FUNC (about_cb), (gpointer) "help.about");
+	/* Every tab is loaded here, and nothing is guessed ahead */
+	tab_processes = 0;
+	enableprerender = FALSE;
 	
-	/* Show menu items */
-	gtk_widget_show (open_item);
-	gtk_widget_show (print_item);
-	gtk_widget_show (quit_item);
-	gtk_widget_show (cut_item);
-	gtk_widget_show (copy_item);
-	gtk_widget_show (paste_item);
-	gtk_widget_show (delete_item);
-	gtk_widget_show (find_item);
-	gtk_widget_show (zoom_in_item);
-	gtk_widget_show (zoom_out_item);
-	gtk_widget_show (zoom_reset_item);
-	gtk_widget_show (fullscreen_item);
-	gtk_widget_show (settings_item);
-	if (enableinspector)
-		gtk_widget_show (inspector_item);
-	gtk_widget_show (about_item);
+	kiosk_browser = create_browser ();
+	for (i = 0; i < (gint) kiosk_entries->len; i++)
+	{
+		KioskEntry* e = g_ptr_array_index (kiosk_entries, i);
+		
+		kiosk_open (e, i);
+		if (e->refresh)
+			e->refresh_id = g_timeout_add_seconds (e->refresh, kiosk_refresh_cb, e);
+	}
 	
-	/* Create "File" and "Help" entries in menubar */
-	GtkWidget* file_item = gtk_menu_item_new_with_label ("File");
-	GtkWidget* edit_item = gtk_menu_item_new_with_label ("Edit");
-	GtkWidget* view_item = gtk_menu_item_new_with_label ("View");
-	GtkWidget* tools_item = gtk_menu_item_new_with_label ("Tools");
-	GtkWidget* help_item = gtk_menu_item_new_with_label ("Help");
-	gtk_widget_show (file_item);
-	gtk_widget_show (edit_item);
-	gtk_widget_show (view_item);
-	gtk_widget_show (tools_item);
-	gtk_widget_show (help_item);
+	/* Drop the blank tab the window came with, and everything around the pages */
+	notebook_tab_close_clicked_cb (NULL, kiosk_browser->current);
+	gtk_notebook_set_current_page (GTK_NOTEBOOK (kiosk_browser->book), 0);
+	gtk_notebook_set_show_border (GTK_NOTEBOOK (kiosk_browser->book), FALSE);
+	gtk_widget_show_all (kiosk_browser->window);
+	gtk_widget_hide (kiosk_browser->toolbar);
+	gtk_widget_hide (GTK_WIDGET (kiosk_browser->statusbar));
+	fullscreen_cb (NULL, kiosk_browser);
 	
-	/* Associate file_menu with file_item in the menubar */
-	gtk_menu_item_set_submenu (GTK_MENU_ITEM (file_item), file_menu);
-	gtk_menu_item_set_submenu (GTK_MENU_ITEM (edit_item), edit_menu);
-	gtk_menu_item_set_submenu (GTK_MENU_ITEM (view_item), view_menu);
-	gtk_menu_item_set_submenu (GTK_MENU_ITEM (tools_item), tools_menu);
-	gtk_menu_item_set_submenu (GTK_MENU_ITEM (help_item), help_menu);
+	if (kiosk_entries->len > 1)
+		kiosk_rotate_id = g_timeout_add_seconds (((KioskEntry*) g_ptr_array_index (kiosk_entries, 0))->dwell, kiosk_rotate_cb, NULL);
+	kiosk_watchdog_id = g_timeout_add_seconds (kiosk_watchdog_interval, kiosk_watchdog_cb, NULL);
 	
-	/* Add file_menu to menu_bar */
-	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), file_item);
-	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), edit_item);
-	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), view_item);
-	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), tools_item);
-	gtk_menu_bar_append (GTK_MENU_BAR (menu_bar), help_item);
+	gtk_main ();
 	
-	return (GtkWidget*)menu_bar;
+	if (kiosk_rotate_id)
+		g_source_remove (kiosk_rotate_id);
+	g_source_remove (kiosk_watchdog_id);
+	g_ptr_array_free (kiosk_entries, TRUE);
+	kiosk_entries = NULL;
+	return 0;
 }
 
 /*
- * Create statusbar - when hovering over a link, show in statusbar
+ * Renderer process: sb --renderer FD (started by --tab-processes)
+ *
+ * Hosts views for the browser at the other end of the Unix socket FD, and
+ * exits when the browser closes it. Tabs are created on their first command,
+ * and shown once the browser says which socket to plug into.
  */
-static GtkWidget*
-create_statusbar ()
+static GHashTable* remote_views;
+static guint remote_next_id = 1;
+
+static RemoteView* remote_view_new (guint);
+
+static void
+remote_title_cb (WebKitWebView* web_view, WebKitWebFrame* frame, const gchar* title, RemoteView* rv)
 {
-	main_statusbar = GTK_STATUSBAR (gtk_statusbar_new ());
-	status_context_id = gtk_statusbar_get_context_id (main_statusbar, "Link Hover");
+	channel_send (&renderer_out, rv->id, "title", title);
+}
 
-	return (GtkWidget*)main_statusbar;
+static void
+remote_progress_cb (WebKitWebView* web_view, GParamSpec* pspec, RemoteView* rv)
+{
+	gchar* progress = g_strdup_printf ("%d", (gint) (webkit_web_view_get_progress (web_view) * 100));
+	channel_send (&renderer_out, rv->id, "progress", progress);
+	g_free (progress);
 }
 
-/*
- * Create the toolbar: back, forward, refresh, urlbar, home button
- */
-static GtkWidget*
-create_toolbar ()
+static void
+remote_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, RemoteView* rv)
 {
-	GtkWidget* toolbar = gtk_toolbar_new ();
+	WebKitLoadStatus status = webkit_web_view_get_load_status (web_view);
+	
+	if (status == WEBKIT_LOAD_COMMITTED)
+		channel_send (&renderer_out, rv->id, "committed", webkit_web_view_get_uri (web_view));
+	if (status == WEBKIT_LOAD_COMMITTED || status == WEBKIT_LOAD_FINISHED || status == WEBKIT_LOAD_FAILED)
+	{
+		gchar* history = g_strdup_printf ("%d %d", webkit_web_view_can_go_back (web_view), webkit_web_view_can_go_forward (web_view));
+		channel_send (&renderer_out, rv->id, "history", history);
+		g_free (history);
+	}
+}
 
-	gtk_toolbar_set_orientation (GTK_TOOLBAR (toolbar), GTK_ORIENTATION_HORIZONTAL);
-	gtk_toolbar_set_style (GTK_TOOLBAR (toolbar), GTK_TOOLBAR_BOTH_HORIZ);
+static void
+remote_link_hover_cb (WebKitWebView* web_view, const gchar* title, const gchar* link, RemoteView* rv)
+{
+	channel_send (&renderer_out, rv->id, "link", link);
+}
 
-	/* the back button */
-	back_button = gtk_tool_button_new_from_stock (GTK_STOCK_GO_BACK);
-	gtk_widget_set_tooltip_text (GTK_WIDGET (back_button), "Go back to the previous page");
-	g_signal_connect (G_OBJECT (back_button), "clicked", G_CALLBACK (go_back_cb), NULL);
-	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), GTK_TOOL_ITEM (back_button), -1);
+static gboolean
+remote_mime_type_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitNetworkRequest* request, gchar* mimetype, WebKitWebPolicyDecision* decision, RemoteView* rv)
+{
+	if (webkit_web_view_can_show_mime_type (web_view, mimetype))
+		return FALSE;
+	webkit_web_policy_decision_download (decision);
+	return TRUE;
+}
 
-	/* The forward button */
-	forward_button = gtk_tool_button_new_from_stock (GTK_STOCK_GO_FORWARD);
-	gtk_widget_set_tooltip_text (GTK_WIDGET (forward_button), "Go to the next page");
-	g_signal_connect (G_OBJECT (forward_button), "clicked", G_CALLBACK (go_forward_cb), NULL);
-	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), GTK_TOOL_ITEM (forward_button), -1);
-	
-	/* The refresh button */
-	refresh_button = gtk_tool_button_new_from_stock (GTK_STOCK_REFRESH);
-	gtk_widget_set_tooltip_text (GTK_WIDGET (refresh_button), "Reload the current page");
-	g_signal_connect (G_OBJECT (refresh_button), "clicked", G_CALLBACK (refresh_cb), NULL);
-	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), GTK_TOOL_ITEM (refresh_button), -1);
-	
-	GtkToolItem* item;
+static void
+remote_resource_request_cb (WebKitWebView* web_view, WebKitWebFrame* frame, WebKitWebResource* resource, WebKitNetworkRequest* request, WebKitNetworkResponse* response, RemoteView* rv)
+{
+	archive_resource_request (web_view, request);
+}
 
-	/* The URL entry */
-	uri_entry = gtk_entry_new ();
-	g_signal_connect (G_OBJECT (uri_entry), "activate", G_CALLBACK (activate_uri_entry_cb), NULL);
+/*
+ * A page opened a window - it becomes a new tab in the browser, kept in this
+ * process with its opener
+ */
+static WebKitWebView*
+remote_create_web_view_cb (WebKitWebView* web_view, WebKitWebFrame* frame, RemoteView* rv)
+{
+	RemoteView* n = remote_view_new (remote_next_id);
 	
-	/* The search-engine entry */
-	search_engine_entry = gtk_entry_new ();
-	gtk_entry_set_icon_from_stock (GTK_ENTRY (search_engine_entry), GTK_ENTRY_ICON_PRIMARY, GTK_STOCK_FILE);
-	gtk_entry_set_icon_from_stock (GTK_ENTRY (search_engine_entry), GTK_ENTRY_ICON_SECONDARY, GTK_STOCK_FIND);
-	gtk_entry_set_icon_tooltip_text (GTK_ENTRY (search_engine_entry), GTK_ENTRY_ICON_PRIMARY, "Choose Search Engine");
-	gtk_entry_set_icon_tooltip_text (GTK_ENTRY (search_engine_entry), GTK_ENTRY_ICON_SECONDARY, "Search");
-	g_signal_connect (G_OBJECT (search_engine_entry), "activate", G_CALLBACK (activate_search_engine_entry_cb), NULL);
-	g_signal_connect (G_OBJECT (search_engine_entry), "icon-press", G_CALLBACK (search_engine_entry_icon_cb), NULL);
+	remote_next_id += 2;
+	channel_send (&renderer_out, n->id, "open", NULL);
+	return n->view;
+}
 
-	/* Paned widget to hold uri entry and search-engine entry */
-	GtkWidget* h_paned = gtk_hpaned_new ();
-	gtk_paned_pack1 (GTK_PANED (h_paned), uri_entry, TRUE, TRUE);
-	gtk_paned_pack2 (GTK_PANED (h_paned), search_engine_entry, FALSE, TRUE);
+static RemoteView*
+remote_view_new (guint id)
+{
+	RemoteView* rv = g_new0 (RemoteView, 1);
 	
-	item = gtk_tool_item_new ();
-	gtk_tool_item_set_expand (item, TRUE);
-	gtk_container_add (GTK_CONTAINER (item), h_paned);
-	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+	rv->id = id;
+	rv->view = WEBKIT_WEB_VIEW (webkit_web_view_new ());
+	set_settings (rv->view);
+	g_signal_connect (G_OBJECT (rv->view), "title-changed", G_CALLBACK (remote_title_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "notify::progress", G_CALLBACK (remote_progress_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "notify::load-status", G_CALLBACK (remote_load_status_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "hovering-over-link", G_CALLBACK (remote_link_hover_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "mime-type-policy-decision-requested", G_CALLBACK (remote_mime_type_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "download-requested", G_CALLBACK (init_download_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "create-web-view", G_CALLBACK (remote_create_web_view_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "resource-request-starting", G_CALLBACK (remote_resource_request_cb), rv);
+	g_signal_connect (G_OBJECT (rv->view), "database-quota-exceeded", G_CALLBACK (database_quota_exceeded_cb), NULL);
 	
-	/* The home button */
-	item = gtk_tool_button_new_from_stock (GTK_STOCK_HOME);
-	gtk_widget_set_tooltip_text (GTK_WIDGET (item), "Go to home page");
-	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (home_cb), NULL);
-	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+	/* Kept out of any window until the browser has a socket for it */
+	rv->scroll = gtk_scrolled_window_new (NULL, NULL);
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (rv->scroll), GTK_POLICY_NEVER, GTK_POLICY_NEVER);
+	gtk_container_add (GTK_CONTAINER (rv->scroll), GTK_WIDGET (rv->view));
+	g_object_ref_sink (rv->scroll);
+	
+	g_hash_table_insert (remote_views, GUINT_TO_POINTER (id), rv);
+	return rv;
+}
 
-	return toolbar;
+static void
+remote_view_free (RemoteView* rv)
+{
+	g_signal_handlers_disconnect_matched (G_OBJECT (rv->view), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, rv);
+	webkit_web_view_stop_loading (rv->view);
+	gtk_widget_destroy (rv->scroll);
+	g_object_unref (rv->scroll);
+	if (rv->plug)
+		gtk_widget_destroy (rv->plug);
+	g_free (rv);
 }
 
-static Client*
-create_new_client ()
+/*
+ * Find in the page - "<case> <forward|highlight> <text>"
+ */
+static void
+remote_find (RemoteView* rv, const gchar* arg, gboolean step)
 {
-	Client* c;
-	
-	if (!(c = calloc(1, sizeof (Client))))
-		fprintf(stderr, "Cannot allocate memory for client\n");
-	
-	/* Pane, vobx, scrolled-window */
-	c->pane = gtk_vpaned_new();
-	c->vbox = gtk_vbox_new (FALSE, 0);
-	c->scroll = gtk_scrolled_window_new (NULL, NULL);
-	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (c->scroll), GTK_POLICY_NEVER, GTK_POLICY_NEVER);
+	gboolean case_sensitive = arg[0] == '1';
+	gboolean flag = arg[0] && arg[1] == ' ' && arg[2] == '1';
+	const gchar* text = strlen (arg) > 4 ? arg + 4 : "";
+	gchar* count;
+	guint matches = 0;
 	
-	/* Setup web-view */
-	c->view = WEBKIT_WEB_VIEW (webkit_web_view_new ());
+	if (step)
+	{
+		webkit_web_view_search_text (rv->view, text, case_sensitive, flag, TRUE);
+		return;
+	}
 	
-	g_signal_connect (G_OBJECT (c->view), "title-changed", G_CALLBACK (title_change_cb), c);
-	g_signal_connect (G_OBJECT (c->view), "notify::progress", G_CALLBACK (progress_change_cb), c);
-	g_signal_connect (G_OBJECT (c->view), "notify::load-status", G_CALLBACK (load_status_change_cb), c);
-	g_signal_connect (G_OBJECT (c->view), "hovering-over-link", G_CALLBACK (link_hover_cb), c);
-	g_signal_connect (G_OBJECT (c->view), "mime-type-policy-decision-requested", G_CALLBACK (decide_download_cb), c);
-	g_signal_connect (G_OBJECT (c->view), "download-requested", G_CALLBACK (init_download_cb), c);
-	g_signal_connect (G_OBJECT (c->view), "create-web-view", G_CALLBACK (create_new_tab), c);
+	webkit_web_view_unmark_text_matches (rv->view);
+	if (webkit_web_view_search_text (rv->view, text, case_sensitive, TRUE, TRUE))
+		matches = webkit_web_view_mark_text_matches (rv->view, text, case_sensitive, find_highlight_limit);
+	webkit_web_view_set_highlight_text_matches (rv->view, flag);
 	
-	/* Settings */
-	set_settings (c->view);
+	count = g_strdup_printf ("%u", matches);
+	channel_send (&renderer_out, rv->id, "found", count);
+	g_free (count);
+}
+
+/*
+ * Handle a command from the browser
+ */
+static void
+renderer_command (guint id, const gchar* command, const gchar* arg)
+{
+	RemoteView* rv;
 	
-	/* Arrangement of containers */
-	gtk_container_add (GTK_CONTAINER (c->scroll), GTK_WIDGET (c->view));
-	gtk_container_add (GTK_CONTAINER (c->vbox), c->scroll);
-	gtk_paned_pack1 (GTK_PANED (c->pane), c->vbox, TRUE, TRUE);
-	/*gtk_notebook_append_page (GTK_NOTEBOOK (main_book), c->pane, NULL);*/
+	if (id == 0)
+	{
+		if (!strcmp (command, "ping"))
+			channel_send (&renderer_out, 0, "pong", NULL);
+		else if (g_str_has_prefix (command, "cookie-"))
+			cookie_apply (renderer_channel, command, arg);
+		return;
+	}
 	
-	if(enableinspector)
+	rv = g_hash_table_lookup (remote_views, GUINT_TO_POINTER (id));
+	if (!strcmp (command, "close"))
 	{
-		c->inspector = WEBKIT_WEB_INSPECTOR (webkit_web_view_get_inspector(c->view));
-		
-		g_signal_connect (G_OBJECT (c->inspector), "inspect-web-view", G_CALLBACK (inspector_new), c);
-		g_signal_connect (G_OBJECT (c->inspector), "show-window", G_CALLBACK (inspector_show), c);
-		g_signal_connect (G_OBJECT (c->inspector), "close-window", G_CALLBACK (inspector_close), c);
-		g_signal_connect (G_OBJECT (c->inspector), "finished", G_CALLBACK (inspector_finished), c);
-		
-		c->isinspecting = FALSE;
+		if (rv)
+		{
+			g_hash_table_remove (remote_views, GUINT_TO_POINTER (id));
+			remote_view_free (rv);
+		}
+		return;
 	}
+	if (!rv)
+		rv = remote_view_new (id);
 	
-	return c;
+	if (!strcmp (command, "embed"))
+	{
+		/* A new socket, after the browser moved the tab or restarted it */
+		if (rv->plug)
+		{
+			gtk_container_remove (GTK_CONTAINER (rv->plug), rv->scroll);
+			gtk_widget_destroy (rv->plug);
+		}
+		rv->plug = gtk_plug_new ((GdkNativeWindow) strtoul (arg, NULL, 10));
+		gtk_container_add (GTK_CONTAINER (rv->plug), rv->scroll);
+		gtk_widget_show_all (rv->plug);
+	}
+	else if (!strcmp (command, "load"))
+		webkit_web_view_load_uri (rv->view, arg);
+	else if (!strcmp (command, "back"))
+		webkit_web_view_go_back (rv->view);
+	else if (!strcmp (command, "forward"))
+		webkit_web_view_go_forward (rv->view);
+	else if (!strcmp (command, "reload"))
+		webkit_web_view_reload (rv->view);
+	else if (!strcmp (command, "zoom-in"))
+		webkit_web_view_zoom_in (rv->view);
+	else if (!strcmp (command, "zoom-out"))
+		webkit_web_view_zoom_out (rv->view);
+	else if (!strcmp (command, "zoom-reset"))
+		webkit_web_view_set_zoom_level (rv->view, 1.0);
+	else if (!strcmp (command, "cut"))
+		webkit_web_view_cut_clipboard (rv->view);
+	else if (!strcmp (command, "copy"))
+		webkit_web_view_copy_clipboard (rv->view);
+	else if (!strcmp (command, "paste"))
+		webkit_web_view_paste_clipboard (rv->view);
+	else if (!strcmp (command, "delete"))
+		webkit_web_view_delete_selection (rv->view);
+	else if (!strcmp (command, "print"))
+		webkit_web_frame_print (webkit_web_view_get_main_frame (rv->view));
+	else if (!strcmp (command, "find"))
+		remote_find (rv, arg, FALSE);
+	else if (!strcmp (command, "find-next"))
+		remote_find (rv, arg, TRUE);
+	else if (!strcmp (command, "find-clear"))
+	{
+		webkit_web_view_unmark_text_matches (rv->view);
+		webkit_web_view_set_highlight_text_matches (rv->view, FALSE);
+	}
+	else if (!strcmp (command, "highlight"))
+		webkit_web_view_set_highlight_text_matches (rv->view, arg[0] == '1');
 }
 
-static GtkWidget*
-create_notebook ()
+static gboolean
+renderer_command_cb (GIOChannel* channel, GIOCondition condition, gpointer data)
 {
-	GtkWidget* notebook = gtk_notebook_new ();
-	gtk_notebook_popup_enable (GTK_NOTEBOOK (notebook));
-	/*g_signal_connect (G_OBJECT (notebook), "switch-page", G_CALLBACK (tab_switched_cb), NULL);*/
+	gchar *line, *command, *arg;
+	GIOStatus status;
+	guint id;
 	
-	return notebook;
+	while ((status = g_io_channel_read_line (channel, &line, NULL, NULL, NULL)) == G_IO_STATUS_NORMAL)
+	{
+		if (channel_parse (line, &id, &command, &arg))
+			renderer_command (id, command, arg);
+		g_free (line);
+	}
+	
+	/* The browser closed the socket or went away */
+	if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR || (condition & (G_IO_HUP | G_IO_ERR)))
+	{
+		gtk_main_quit ();
+		return FALSE;
+	}
+	return TRUE;
 }
 
-/*
- * Create the main window, set name and icon.
- * Default geometry = 800x600
- */
-static GtkWidget*
-create_window ()
+static int
+renderer_main (void)
 {
-	GtkWidget* window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
-	gtk_window_set_default_size (GTK_WINDOW (window), 800, 600);
-	gtk_widget_set_name (window, "sb");
-	gtk_window_set_icon_name (GTK_WINDOW (window), "web-browser");
-	g_signal_connect (G_OBJECT (window), "destroy", G_CALLBACK (destroy_cb), NULL);
-
-	return window;
+	remote_views = g_hash_table_new (NULL, NULL);
+	renderer_channel = g_io_channel_unix_new (renderer_fd);
+	g_io_channel_set_encoding (renderer_channel, NULL, NULL);
+	g_io_channel_set_flags (renderer_channel, G_IO_FLAG_NONBLOCK, NULL);
+	outbox_init (&renderer_out, renderer_channel);
+	g_io_add_watch (renderer_channel, G_IO_IN | G_IO_HUP | G_IO_ERR, renderer_command_cb, NULL);
+	g_idle_add_full (G_PRIORITY_LOW, spell_checking_start_cb, NULL, NULL);
+	
+	/* Cookies in memory, kept in step with the browser's - none in replays, like the browser */
+	if (!replay_file)
+	{
+		cookie_jar = soup_cookie_jar_new ();
+		soup_session_add_feature (webkit_get_default_session (), SOUP_SESSION_FEATURE (cookie_jar));
+		g_signal_connect (G_OBJECT (cookie_jar), "changed", G_CALLBACK (cookie_share_cb), NULL);
+	}
+	
+	gtk_main ();
+	
+	record_write ();
+	io_flush ();
+	if (jank_monitor)
+		jank_report ();
+	if (check_io)
+		fprintf (stderr, "sb: file I/O on the main thread of a renderer from %u place(s)\n", io_check_reports ());
+	return 0;
 }
 
-/*
- * Main function of program
- */
 int
 main (int argc, char* argv[])
 {	
-	gtk_init (&argc, &argv);
+	GError* error = NULL;
+	gint i;
 	
-	if (argc > 1)
-		if (argv[1][1] == 'v')
-		{
-			printf ("surf-"VERSION", 2014 David Luco\n");
-			return 0;
-		}
+	startup_start = g_get_monotonic_time ();
+	
+	if (!gtk_init_with_args (&argc, &argv, "[URI]", option_entries, NULL, &error))
+	{
+		fprintf (stderr, "%s\n", error ? error->message : "Cannot open display");
+		return 1;
+	}
+	
+	if (show_version)
+	{
+		printf ("surf-"VERSION", 2014 David Luco\n");
+		return 0;
+	}
+	
+	if (profile && (!profile[0] || strchr (profile, '/') || profile[0] == '.'))
+	{
+		fprintf (stderr, "Not a profile name: %s\n", profile);
+		return 1;
+	}
+	
+	if (jank_monitor)
+		jank_init ();
+	if (check_io)
+		io_check_start ();
+	
+	/* Disk writes of the browser, off the main loop */
+	io_init (io_write_delay);
+	gchar* archive_dir = data_path ("archives");
+	data_mkdir (archive_dir);
+	g_free (archive_dir);
+	
+	/* Site storage of the profile */
+	storage_init ();
+	if (storage_clear_origin)
+		return storage_clear_main (storage_clear_origin);
+	
+	/* Persistent cookies for the shared session - replays start from none, and
+	 * render workers and renderers leave the database to the browser */
+	if (!replay_file && !render_worker && renderer_fd < 0)
+		cookie_jar_init ();
+	
+	/* Favicons stored on disk, decoded once into memory */
+	favicon_init ();
+	
+	/* Built-in pages and offline archives */
+	soup_session_add_feature_by_type (webkit_get_default_session (), SB_TYPE_REQUEST);
+	
+	/* Recorded network traffic */
+	if (replay_file && !replay_init ())
+		return 1;
+	if (record_file)
+		record_init ();
+	
+	if (render_worker)
+		return render_worker_main ();
+	if (renderer_fd >= 0)
+		return renderer_main ();
+	
+	/* The first page needs the stored cookies */
+	cookie_jar_wait ();
+	
+	if (render_file)
+		return render_main ();
+	if (bench_scroll_file)
+		return bench_scroll_main ();
+	
+	/* Always recording - tools and helper processes above are not */
+	flight_start ();
+	if (!metrics_start ())
+		return 1;
 	
-	/* Create GtkNotebook to hold web page tabs */
-	main_book = create_notebook ();
-	GtkWidget* vbox = gtk_vbox_new (FALSE, 0);
-	main_menu_bar = create_menubar ();
-	gtk_box_pack_start (GTK_BOX (vbox), main_menu_bar, FALSE, FALSE, 0);
-	main_toolbar = create_toolbar ();
-	gtk_box_pack_start (GTK_BOX (vbox), main_toolbar, FALSE, FALSE, 0);
-	Client* c = create_new_client ();
-	web_view = c->view;
-	gtk_notebook_append_page (GTK_NOTEBOOK (main_book), c->pane, NULL);
-	gtk_notebook_set_tab_reorderable (GTK_NOTEBOOK (main_book), c->pane, TRUE);
-	current_client = c;
-	gtk_box_pack_start (GTK_BOX (vbox), main_book, TRUE, TRUE, 0);
-	gtk_box_pack_start (GTK_BOX (vbox), create_statusbar (), FALSE, FALSE, 0);
-	
-	main_window = create_window ();
-	gtk_container_add (GTK_CONTAINER (main_window), vbox);
-	
-	search_buffer = gtk_entry_buffer_new (NULL, -1);
 	gchar* uri = (gchar*) (argc > 1 ? argv[1] : home_page);
 	
-	/* Get current web-view from notebook 
-	web_view = (WebKitWebView*)gtk_bin_get_child (GTK_BIN (gtk_notebook_get_nth_page (GTK_NOTEBOOK (main_book), gtk_notebook_get_current_page (GTK_NOTEBOOK (main_book)))));
-	*/
-	webkit_web_view_load_uri (web_view, uri);
-
-	gtk_widget_grab_focus (GTK_WIDGET (web_view));
-	gtk_widget_show_all (main_window);
+	if (soak_cycles > 0)
+		return soak_main (uri);
+	if (kiosk_file)
+		return kiosk_main ();
+	
+	/* Prerendered pages would be shown in this process */
+	if (tab_processes > 0)
+	{
+		enableprerender = FALSE;
+		/* Writing to a renderer that died must not take the browser with it */
+		signal (SIGPIPE, SIG_IGN);
+	}
+	
+	/* Visited pages, searchable by their text - replays are not history */
+	if (!replay_file)
+		history_init ();
+	
+	/* All windows share this process's session, caches and settings */
+	for (i = 0; i < MAX (window_count, 1); i++)
+	{
+		Browser* b = create_browser ();
+		client_load_uri (b->current, uri);
+		if (startup_time && !b->current->remote)
+			g_signal_connect_after (G_OBJECT (b->current->view), "expose-event", G_CALLBACK (startup_expose_cb), NULL);
+		gtk_widget_show_all (b->window);
+	}
+	if (quit_after > 0)
+		g_timeout_add_seconds (quit_after, quit_after_cb, NULL);
+	
 	gtk_main ();
+	
+	if (jank_monitor)
+		jank_report ();
+	if (check_io)
+		fprintf (stderr, "sb: file I/O on the main thread from %u place(s)\n", io_check_reports ());
+	
+	/* Compare with the sum over N single-window processes */
+	if (memory_report)
+	{
+		struct rusage usage;
+		getrusage (RUSAGE_SELF, &usage);
+		fprintf (stderr, "sb: %d window(s), peak resident memory %ld kB\n", MAX (window_count, 1), usage.ru_maxrss);
+		if (prerender_started)
+			fprintf (stderr, "sb: %u of %u prerendered pages shown (%.0f%% hit rate)\n",
+					 prerender_hits, prerender_started, 100.0 * prerender_hits / prerender_started);
+	}
 
 	return 0;
 }
@@ -0,0 +1,471 @@
+/*
+ * sb - simple browser
+ *
+ * Full-text index of open pages - see textindex.h. Each word maps to its
+ * postings: the pages containing it, in id order, as varint encoded
+ * (id - previous id, count) pairs. Pages only ever get new, higher ids, so
+ * postings are only appended to. Removed pages are skipped when postings
+ * are read, and the postings are rewritten once most of them is dead; each
+ * posting counts its live pages, which ranking uses, all along.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "textindex.h"
+
+/* BM25 ranking constants */
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+typedef struct Posting {
+	GByteArray* data;
+	guint last;
+	guint pages;			/* in data */
+	guint live;				/* of those, not removed */
+} Posting;
+
+typedef struct Page {
+	guint id;
+	gpointer owner;
+	guint words;
+	gsize bytes;
+	GHashTable* pending;	/* word -> count, until the page is ended */
+	GPtrArray* postings;	/* those it is in, once ended */
+} Page;
+
+struct TextIndex {
+	GHashTable* postings;	/* word -> Posting */
+	GHashTable* pages;		/* id -> Page */
+	GQueue order;			/* ended pages, oldest first */
+	guint next_id;
+	gsize limit;
+	gsize size;
+	gsize dead;
+	guint64 total_words;
+	guint ended;
+};
+
+typedef struct Score {
+	gdouble score;
+	guint terms;
+} Score;
+
+static void
+posting_free (Posting* posting)
+{
+	g_byte_array_free (posting->data, TRUE);
+	g_free (posting);
+}
+
+static void
+page_free (Page* page)
+{
+	if (page->pending)
+		g_hash_table_destroy (page->pending);
+	if (page->postings)
+		g_ptr_array_free (page->postings, TRUE);
+	g_free (page);
+}
+
+/* Memory taken by a word and its postings, besides the encoded pairs */
+static gsize
+word_overhead (const gchar* word)
+{
+	return strlen (word) + 1 + sizeof (Posting) + 4 * sizeof (gpointer);
+}
+
+static void
+put_varint (GByteArray* data, guint value)
+{
+	guint8 byte;
+	
+	while (value >= 0x80)
+	{
+		byte = (value & 0x7f) | 0x80;
+		g_byte_array_append (data, &byte, 1);
+		value >>= 7;
+	}
+	byte = value;
+	g_byte_array_append (data, &byte, 1);
+}
+
+static guint
+get_varint (const guint8** p, const guint8* end)
+{
+	guint value = 0, shift = 0;
+	
+	while (*p < end)
+	{
+		guint8 byte = *(*p)++;
+		value |= (guint) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
+		shift += 7;
+	}
+	return value;
+}
+
+/*
+ * Whether the character at p is part of a word - a letter, digit or mark in
+ * any script - and its size. Punctuation and spaces outside ASCII, like
+ * no-break spaces, quotes and dashes, separate words; bytes that are not
+ * UTF-8 are kept in words, one at a time.
+ */
+static inline gboolean
+is_word_char (const gchar* p, const gchar* end, gsize* size)
+{
+	gunichar ch;
+	
+	*size = 1;
+	if ((guchar) *p < 0x80)
+		return g_ascii_isalnum (*p);
+	ch = g_utf8_get_char_validated (p, end - p);
+	if (ch == (gunichar) -1 || ch == (gunichar) -2)
+		return TRUE;
+	*size = g_utf8_next_char (p) - p;
+	return g_unichar_isalnum (ch) || g_unichar_ismark (ch);
+}
+
+gboolean
+text_index_word (const gchar** text, const gchar* end, gchar* word, gsize* length)
+{
+	const gchar *p = *text, *start;
+	gboolean ascii = TRUE;
+	gsize n, size;
+	
+	for (;;)
+	{
+		while (p < end && !is_word_char (p, end, &size))
+			p += size;
+		if (p == end)
+		{
+			*text = p;
+			return FALSE;
+		}
+		
+		for (start = p; p < end && is_word_char (p, end, &size); p += size)
+			ascii &= (guchar) *p < 0x80;
+		n = p - start;
+		
+		/* Single characters and very long runs say little about a page */
+		if (n < 2 || n > TEXT_INDEX_WORD_MAX)
+		{
+			ascii = TRUE;
+			continue;
+		}
+		break;
+	}
+	*text = p;
+	
+	if (ascii)
+	{
+		for (*length = 0; *length < n; (*length)++)
+			word[*length] = g_ascii_tolower (start[*length]);
+		word[n] = '\0';
+		return TRUE;
+	}
+	
+	gchar* folded = g_utf8_validate (start, n, NULL) ? g_utf8_casefold (start, n) : g_strndup (start, n);
+	*length = strlen (folded);
+	if (*length > TEXT_INDEX_WORD_MAX)
+	{
+		/* Folding can make it longer - cut it at a character */
+		*length = TEXT_INDEX_WORD_MAX;
+		while (*length > 0 && (folded[*length] & 0xc0) == 0x80)
+			(*length)--;
+	}
+	memcpy (word, folded, *length);
+	word[*length] = '\0';
+	g_free (folded);
+	return TRUE;
+}
+
+TextIndex*
+text_index_new (gsize limit)
+{
+	TextIndex* index = g_new0 (TextIndex, 1);
+	
+	index->postings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) posting_free);
+	index->pages = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) page_free);
+	g_queue_init (&index->order);
+	index->next_id = 1;
+	index->limit = limit;
+	return index;
+}
+
+void
+text_index_free (TextIndex* index)
+{
+	g_hash_table_destroy (index->postings);
+	g_hash_table_destroy (index->pages);
+	g_queue_clear (&index->order);
+	g_free (index);
+}
+
+guint
+text_index_begin (TextIndex* index, gpointer owner)
+{
+	Page* page = g_new0 (Page, 1);
+	
+	page->id = index->next_id++;
+	page->owner = owner;
+	page->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (index->pages, GUINT_TO_POINTER (page->id), page);
+	return page->id;
+}
+
+void
+text_index_feed (TextIndex* index, guint id, const gchar* text, gsize length)
+{
+	Page* page = g_hash_table_lookup (index->pages, GUINT_TO_POINTER (id));
+	const gchar* end = text + length;
+	gchar word[TEXT_INDEX_WORD_MAX + 1];
+	gsize n;
+	
+	if (!page || !page->pending)
+		return;
+	
+	while (text_index_word (&text, end, word, &n))
+	{
+		guint* count = g_hash_table_lookup (page->pending, word);
+		
+		if (!count)
+		{
+			count = g_new0 (guint, 1);
+			g_hash_table_insert (page->pending, g_strndup (word, n), count);
+		}
+		(*count)++;
+		page->words++;
+	}
+}
+
+/*
+ * Rewrite all postings without the pages that were removed
+ */
+static void
+text_index_compact (TextIndex* index)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	
+	index->size = 0;
+	g_hash_table_iter_init (&iter, index->postings);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+	{
+		Posting* posting = value;
+		GByteArray* data = g_byte_array_new ();
+		const guint8 *p = posting->data->data, *end = p + posting->data->len;
+		guint id = 0, last = 0;
+		
+		posting->pages = 0;
+		while (p < end)
+		{
+			id += get_varint (&p, end);
+			guint count = get_varint (&p, end);
+			Page* page = g_hash_table_lookup (index->pages, GUINT_TO_POINTER (id));
+			
+			if (!page || page->pending)
+				continue;
+			put_varint (data, id - last);
+			put_varint (data, count);
+			last = id;
+			posting->pages++;
+		}
+		posting->live = posting->pages;
+		g_byte_array_free (posting->data, TRUE);
+		posting->data = data;
+		posting->last = last;
+		
+		if (posting->pages == 0)
+			g_hash_table_iter_remove (&iter);
+		else
+			index->size += data->len + word_overhead (key);
+	}
+	index->dead = 0;
+}
+
+void
+text_index_remove (TextIndex* index, guint id)
+{
+	Page* page = g_hash_table_lookup (index->pages, GUINT_TO_POINTER (id));
+	
+	if (!page)
+		return;
+	
+	if (!page->pending)
+	{
+		guint i;
+		
+		for (i = 0; i < page->postings->len; i++)
+			((Posting*) g_ptr_array_index (page->postings, i))->live--;
+		g_queue_remove (&index->order, page);
+		index->dead += page->bytes;
+		index->total_words -= page->words;
+		index->ended--;
+	}
+	g_hash_table_remove (index->pages, GUINT_TO_POINTER (id));
+	
+	if (index->dead > index->size / 2)
+		text_index_compact (index);
+}
+
+void
+text_index_end (TextIndex* index, guint id)
+{
+	Page* page = g_hash_table_lookup (index->pages, GUINT_TO_POINTER (id));
+	GHashTableIter iter;
+	gpointer key, value;
+	
+	if (!page || !page->pending)
+		return;
+	
+	page->postings = g_ptr_array_sized_new (g_hash_table_size (page->pending));
+	page->bytes += g_hash_table_size (page->pending) * sizeof (gpointer);
+	g_hash_table_iter_init (&iter, page->pending);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+	{
+		Posting* posting = g_hash_table_lookup (index->postings, key);
+		
+		if (!posting)
+		{
+			posting = g_new0 (Posting, 1);
+			posting->data = g_byte_array_new ();
+			g_hash_table_insert (index->postings, g_strdup (key), posting);
+			page->bytes += word_overhead (key);
+		}
+		
+		gsize before = posting->data->len;
+		put_varint (posting->data, id - posting->last);
+		put_varint (posting->data, *(guint*) value);
+		posting->last = id;
+		posting->pages++;
+		posting->live++;
+		page->bytes += posting->data->len - before;
+		g_ptr_array_add (page->postings, posting);
+	}
+	g_hash_table_destroy (page->pending);
+	page->pending = NULL;
+	
+	index->size += page->bytes;
+	index->total_words += page->words;
+	index->ended++;
+	g_queue_push_tail (&index->order, page);
+	
+	/* Over the limit - forget the pages indexed longest ago */
+	while (index->size - index->dead > index->limit && index->order.length > 1)
+		text_index_remove (index, ((Page*) g_queue_peek_head (&index->order))->id);
+}
+
+static gint
+hit_compare (gconstpointer a, gconstpointer b)
+{
+	gdouble d = ((const TextIndexHit*) b)->score - ((const TextIndexHit*) a)->score;
+	return d > 0 ? 1 : d < 0 ? -1 : 0;
+}
+
+/*
+ * Add the BM25 weight of one posting to the scores of its pages
+ */
+static void
+score_posting (TextIndex* index, Posting* posting, guint term, GHashTable* scores)
+{
+	const guint8 *p = posting->data->data, *end = p + posting->data->len;
+	gdouble average = index->ended ? (gdouble) index->total_words / index->ended : 1;
+	gdouble live = MIN (posting->live, index->ended);
+	gdouble idf = log (1 + (index->ended - live + 0.5) / (live + 0.5));
+	guint id = 0;
+	
+	while (p < end)
+	{
+		id += get_varint (&p, end);
+		guint count = get_varint (&p, end);
+		Page* page = g_hash_table_lookup (index->pages, GUINT_TO_POINTER (id));
+		Score* score;
+		
+		if (!page || page->pending)
+			continue;
+		if (!(score = g_hash_table_lookup (scores, page)))
+		{
+			/* Only pages matching every earlier word can still match */
+			if (term > 0)
+				continue;
+			score = g_new0 (Score, 1);
+			g_hash_table_insert (scores, page, score);
+		}
+		else if (score->terms < term)
+			continue;
+		
+		score->score += idf * count * (BM25_K1 + 1) / (count + BM25_K1 * (1 - BM25_B + BM25_B * page->words / MAX (average, 1)));
+		if (score->terms == term)
+			score->terms = term + 1;
+	}
+}
+
+guint
+text_index_search (TextIndex* index, const gchar* query, TextIndexHit* hits, guint size)
+{
+	GHashTable* scores = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+	GPtrArray* words = g_ptr_array_new_with_free_func (g_free);
+	const gchar* end = query + strlen (query);
+	gchar word[TEXT_INDEX_WORD_MAX + 1];
+	GHashTableIter iter;
+	gpointer key, value;
+	guint term, found = 0;
+	gsize n;
+	
+	while (text_index_word (&query, end, word, &n))
+		g_ptr_array_add (words, g_strndup (word, n));
+	
+	for (term = 0; term < words->len; term++)
+	{
+		const gchar* w = g_ptr_array_index (words, term);
+		Posting* posting;
+		
+		/* The last word may still be being typed */
+		if (term == words->len - 1)
+		{
+			gsize length = strlen (w);
+			g_hash_table_iter_init (&iter, index->postings);
+			while (g_hash_table_iter_next (&iter, &key, &value))
+				if (strncmp (key, w, length) == 0)
+					score_posting (index, value, term, scores);
+		}
+		else if ((posting = g_hash_table_lookup (index->postings, w)))
+			score_posting (index, posting, term, scores);
+		else
+			break;
+	}
+	
+	if (words->len > 0)
+	{
+		GArray* matches = g_array_new (FALSE, FALSE, sizeof (TextIndexHit));
+		
+		g_hash_table_iter_init (&iter, scores);
+		while (g_hash_table_iter_next (&iter, &key, &value))
+		{
+			Score* score = value;
+			if (score->terms == words->len)
+			{
+				TextIndexHit hit = {((Page*) key)->owner, score->score};
+				g_array_append_val (matches, hit);
+			}
+		}
+		g_array_sort (matches, hit_compare);
+		found = MIN (matches->len, size);
+		memcpy (hits, matches->data, found * sizeof (TextIndexHit));
+		g_array_free (matches, TRUE);
+	}
+	
+	g_ptr_array_free (words, TRUE);
+	g_hash_table_destroy (scores);
+	return found;
+}
+
+gsize
+text_index_size (TextIndex* index)
+{
+	return index->size - index->dead;
+}
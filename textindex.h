@@ -0,0 +1,61 @@
+/*
+ * sb - simple browser
+ *
+ * Full-text index of open pages - an in-memory inverted index from words to
+ * the pages containing them.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef TEXTINDEX_H
+#define TEXTINDEX_H
+
+#include <glib.h>
+
+/* Words longer than this are not indexed */
+#define TEXT_INDEX_WORD_MAX 64
+
+typedef struct TextIndex TextIndex;
+
+typedef struct TextIndexHit {
+	gpointer owner;
+	gdouble score;
+} TextIndexHit;
+
+/*
+ * An index using at most about limit bytes - beyond that, the pages indexed
+ * longest ago are dropped
+ */
+TextIndex* text_index_new (gsize limit);
+void text_index_free (TextIndex* index);
+
+/*
+ * Index a page: begin returns its id, feed adds text to it (a word must not
+ * be split across calls), and end makes it searchable. Pages are never
+ * updated - remove the old one and index the new text under a new id.
+ */
+guint text_index_begin (TextIndex* index, gpointer owner);
+void text_index_feed (TextIndex* index, guint page, const gchar* text, gsize length);
+void text_index_end (TextIndex* index, guint page);
+
+/* Drop a page, whether or not it was ended - page 0 is ignored */
+void text_index_remove (TextIndex* index, guint page);
+
+/*
+ * Pages containing every word of the query (the last one may be a prefix),
+ * best first. Up to size hits are stored; the return value is the number
+ * stored.
+ */
+guint text_index_search (TextIndex* index, const gchar* query, TextIndexHit* hits, guint size);
+
+/*
+ * The next word of text, as it is indexed - lowercased, or casefolded if it
+ * is not ASCII - stored into word, which must hold TEXT_INDEX_WORD_MAX + 1
+ * bytes. Returns FALSE at the end of the text.
+ */
+gboolean text_index_word (const gchar** text, const gchar* end, gchar* word, gsize* length);
+
+/* Approximate memory used, in bytes */
+gsize text_index_size (TextIndex* index);
+
+#endif
@@ -0,0 +1,451 @@
+/*
+ * sb - simple browser
+ *
+ * URL normalization - see url.h. This runs on every keystroke and request, so
+ * it makes one pass over the text and writes straight into the caller's
+ * buffer.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <string.h>
+
+#include "url.h"
+
+/* Output with snprintf semantics - count everything, store what fits */
+typedef struct Writer {
+	gchar* out;
+	gsize size;
+	gsize length;
+} Writer;
+
+static const gchar* opaque_schemes[] = {"about", "data", "javascript", "mailto", NULL};
+
+static inline void
+put (Writer* w, gchar ch)
+{
+	if (w->length + 1 < w->size)
+		w->out[w->length] = ch;
+	w->length++;
+}
+
+static void
+put_string (Writer* w, const gchar* p, gsize n)
+{
+	while (n--)
+		put (w, *p++);
+}
+
+static void
+put_escaped (Writer* w, guchar ch)
+{
+	static const gchar hex[] = "0123456789ABCDEF";
+	
+	put (w, '%');
+	put (w, hex[ch >> 4]);
+	put (w, hex[ch & 15]);
+}
+
+static gsize
+finish (Writer* w)
+{
+	if (w->size)
+		w->out[MIN (w->length, w->size - 1)] = '\0';
+	return w->length;
+}
+
+static inline gboolean
+is_space (gchar ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v';
+}
+
+static void
+trim (const gchar** text, gsize* length)
+{
+	while (*length && is_space (**text))
+	{
+		(*text)++;
+		(*length)--;
+	}
+	while (*length && is_space ((*text)[*length - 1]))
+		(*length)--;
+}
+
+/*
+ * Length of the scheme that text starts with, or 0. "host:8080" is not a
+ * scheme - a scheme is followed by // unless it is one of opaque_schemes.
+ */
+static gsize
+scheme_length (const gchar* p, gsize n)
+{
+	gsize i, j;
+	
+	if (n == 0 || !g_ascii_isalpha (p[0]))
+		return 0;
+	for (i = 1; i < n && (g_ascii_isalnum (p[i]) || p[i] == '+' || p[i] == '-' || p[i] == '.'); i++)
+		;
+	if (i == n || p[i] != ':')
+		return 0;
+	if (i + 2 < n && p[i + 1] == '/' && p[i + 2] == '/')
+		return i;
+	
+	for (j = 0; opaque_schemes[j]; j++)
+		if (strlen (opaque_schemes[j]) == i && g_ascii_strncasecmp (p, opaque_schemes[j], i) == 0)
+			return i;
+	return 0;
+}
+
+/* Length of the authority (user@host:port) at the start of p */
+static gsize
+authority_length (const gchar* p, gsize n)
+{
+	gsize i;
+	
+	for (i = 0; i < n && p[i] != '/' && p[i] != '?' && p[i] != '#'; i++)
+		;
+	return i;
+}
+
+/*
+ * Could p be a host, optionally with a port? Needs a dot inside the name,
+ * brackets (IPv6), a port, or to be localhost. A user@ in front is allowed
+ * when a port or a path follows (more), so a mail address stays a search.
+ */
+static gboolean
+looks_like_host (const gchar* p, gsize n, gboolean more)
+{
+	gsize i, port = n;
+	gboolean dot = FALSE;
+	
+	/* A trailing :digits is a port */
+	for (i = n; i > 0 && g_ascii_isdigit (p[i - 1]); i--)
+		;
+	if (i > 0 && i < n && p[i - 1] == ':')
+		port = i - 1;
+	
+	/* Skip the user info, up to the last @ before the port */
+	for (i = port; i > 0 && p[i - 1] != '@'; i--)
+		;
+	if (i > 0)
+	{
+		if (port == n && !more)
+			return FALSE;
+		p += i;
+		n -= i;
+		port -= i;
+	}
+	
+	if (port == 0)
+		return FALSE;
+	if (p[0] == '[')
+		return p[port - 1] == ']';
+	
+	for (i = 0; i < port; i++)
+	{
+		guchar ch = p[i];
+		if (ch == '.')
+			dot |= i > 0 && i < port - 1;
+		else if (!g_ascii_isalnum (ch) && ch != '-' && ch != '_' && ch < 0x80)
+			return FALSE;
+	}
+	
+	return dot || port < n || (port == 9 && g_ascii_strncasecmp (p, "localhost", 9) == 0);
+}
+
+UrlKind
+url_classify (const gchar* text, gsize length)
+{
+	trim (&text, &length);
+	if (length == 0)
+		return URL_KIND_EMPTY;
+	if (text[0] == '/' || (text[0] == '~' && (length == 1 || text[1] == '/')))
+		return URL_KIND_PATH;
+	if (scheme_length (text, length))
+		return URL_KIND_URL;
+	
+	/* Whitespace before the first / makes it a search */
+	gsize authority = authority_length (text, length);
+	return looks_like_host (text, authority, authority < length) ? URL_KIND_URL : URL_KIND_SEARCH;
+}
+
+/*
+ * Next code point of a label, lowercased, or (gunichar) -1 at the end or on
+ * invalid UTF-8
+ */
+static gunichar
+next_char (const gchar** p, const gchar* end)
+{
+	gunichar ch;
+	
+	if (*p >= end)
+		return (gunichar) -1;
+	ch = g_utf8_get_char_validated (*p, end - *p);
+	if (ch == (gunichar) -1 || ch == (gunichar) -2)
+		return (gunichar) -1;
+	*p = g_utf8_next_char (*p);
+	return g_unichar_tolower (ch);
+}
+
+static guint
+punycode_adapt (guint64 delta, guint points, gboolean first)
+{
+	guint k = 0;
+	
+	delta = first ? delta / 700 : delta / 2;
+	delta += delta / points;
+	while (delta > ((36 - 1) * 26) / 2)
+	{
+		delta /= 36 - 1;
+		k += 36;
+	}
+	return k + (36 * delta) / (delta + 38);
+}
+
+static inline gchar
+punycode_digit (guint d)
+{
+	return d < 26 ? 'a' + d : '0' + d - 26;
+}
+
+/*
+ * Write one host label - lowercased if it is ASCII, else as xn--<punycode>
+ * (RFC 3492). The code points are decoded again on each pass instead of
+ * being copied out.
+ */
+static void
+put_label (Writer* w, const gchar* label, gsize n)
+{
+	const gchar *p, *end = label + n;
+	guint total = 0, basic = 0, handled;
+	gunichar ch, next, code = 0x80;
+	guint64 delta = 0;
+	guint bias = 72;
+	gsize i;
+	
+	for (i = 0; i < n && (guchar) label[i] < 0x80; i++)
+		;
+	if (i == n)
+	{
+		for (i = 0; i < n; i++)
+			put (w, g_ascii_tolower (label[i]));
+		return;
+	}
+	
+	for (p = label; (ch = next_char (&p, end)) != (gunichar) -1; total++)
+		basic += ch < 0x80;
+	if (p != end)
+	{
+		/* Not UTF-8 - leave it for the network layer to reject */
+		put_string (w, label, n);
+		return;
+	}
+	
+	put_string (w, "xn--", 4);
+	for (p = label; (ch = next_char (&p, end)) != (gunichar) -1;)
+		if (ch < 0x80)
+			put (w, ch);
+	if (basic)
+		put (w, '-');
+	
+	for (handled = basic; handled < total; delta++, code++)
+	{
+		/* Smallest code point not yet handled */
+		next = G_MAXUINT32;
+		for (p = label; (ch = next_char (&p, end)) != (gunichar) -1;)
+			if (ch >= code && ch < next)
+				next = ch;
+		delta += (guint64) (next - code) * (handled + 1);
+		code = next;
+	
+		for (p = label; (ch = next_char (&p, end)) != (gunichar) -1;)
+		{
+			if (ch < code)
+				delta++;
+			if (ch != code)
+				continue;
+	
+			guint64 q = delta;
+			guint k, t;
+			for (k = 36;; k += 36)
+			{
+				t = k <= bias ? 1 : k >= bias + 26 ? 26 : k - bias;
+				if (q < t)
+					break;
+				put (w, punycode_digit (t + (q - t) % (36 - t)));
+				q = (q - t) / (36 - t);
+			}
+			put (w, punycode_digit (q));
+			bias = punycode_adapt (delta, handled + 1, handled == basic);
+			delta = 0;
+			handled++;
+		}
+	}
+}
+
+/* Write a host, label by label */
+static void
+put_host (Writer* w, const gchar* p, gsize n)
+{
+	gsize start = 0, i;
+	
+	if (n && p[0] == '[')
+	{
+		for (i = 0; i < n; i++)
+			put (w, g_ascii_tolower (p[i]));
+		return;
+	}
+	for (i = 0; i <= n; i++)
+	{
+		if (i == n || p[i] == '.')
+		{
+			put_label (w, p + start, i - start);
+			if (i < n)
+				put (w, '.');
+			start = i + 1;
+		}
+	}
+}
+
+/* Write user@host:port with the host normalized */
+static void
+put_authority (Writer* w, const gchar* p, gsize n)
+{
+	gsize host = 0, port = n, i;
+	
+	for (i = 0; i < n; i++)
+		if (p[i] == '@')
+			host = i + 1;
+	put_string (w, p, host);
+	
+	for (i = n; i > host && g_ascii_isdigit (p[i - 1]); i--)
+		;
+	if (i > host && i < n && p[i - 1] == ':')
+		port = i - 1;
+	
+	put_host (w, p + host, port - host);
+	put_string (w, p + port, n - port);
+}
+
+/* Write the rest of a uri, escaping what cannot appear in one */
+static void
+put_rest (Writer* w, const gchar* p, gsize n)
+{
+	gsize i;
+	
+	for (i = 0; i < n; i++)
+	{
+		guchar ch = p[i];
+		if (ch <= 0x20 || ch == 0x7f || ch == '"' || ch == '<' || ch == '>')
+			put_escaped (w, ch);
+		else
+			put (w, ch);
+	}
+}
+
+/* Write a path, escaping what cannot appear in one - escapes already there are kept */
+static void
+put_path (Writer* w, const gchar* p, gsize n)
+{
+	gsize i;
+	
+	for (i = 0; i < n; i++)
+	{
+		guchar ch = p[i];
+		if (g_ascii_isalnum (ch) || (ch && strchr ("/-._~!$&'()*+,;=:@", ch)))
+			put (w, ch);
+		else if (ch == '%' && i + 2 < n && g_ascii_isxdigit (p[i + 1]) && g_ascii_isxdigit (p[i + 2]))
+			put (w, ch);
+		else
+			put_escaped (w, ch);
+	}
+}
+
+static void
+put_query (Writer* w, const gchar* p, gsize n)
+{
+	gsize i;
+	
+	for (i = 0; i < n; i++)
+	{
+		guchar ch = p[i];
+		if (g_ascii_isalnum (ch) || ch == '-' || ch == '.' || ch == '_' || ch == '~')
+			put (w, ch);
+		else if (ch == ' ')
+			put (w, '+');
+		else
+			put_escaped (w, ch);
+	}
+}
+
+gsize
+url_search (const gchar* search_prefix, const gchar* text, gsize length, gchar* out, gsize size)
+{
+	Writer w = {out, size, 0};
+	
+	trim (&text, &length);
+	if (search_prefix)
+		put_string (&w, search_prefix, strlen (search_prefix));
+	put_query (&w, text, length);
+	return finish (&w);
+}
+
+gsize
+url_normalize (const gchar* text, gsize length, const gchar* search_prefix, gchar* out, gsize size, UrlKind* kind)
+{
+	Writer w = {out, size, 0};
+	UrlKind k = url_classify (text, length);
+	gsize scheme, authority;
+	
+	if (kind)
+		*kind = k;
+	trim (&text, &length);
+	
+	switch (k)
+	{
+		case URL_KIND_EMPTY:
+			break;
+		case URL_KIND_PATH:
+			put_string (&w, "file://", 7);
+			if (text[0] == '~')
+			{
+				const gchar* home = g_get_home_dir ();
+				put_path (&w, home, strlen (home));
+				text++;
+				length--;
+			}
+			put_path (&w, text, length);
+			break;
+		case URL_KIND_SEARCH:
+			return url_search (search_prefix, text, length, out, size);
+		case URL_KIND_URL:
+			if ((scheme = scheme_length (text, length)))
+			{
+				gsize i;
+				for (i = 0; i < scheme; i++)
+					put (&w, g_ascii_tolower (text[i]));
+				put (&w, ':');
+				text += scheme + 1;
+				length -= scheme + 1;
+	
+				/* Opaque uris (about:, mailto:...) are left as they are */
+				if (length < 2 || text[0] != '/' || text[1] != '/')
+				{
+					put_rest (&w, text, length);
+					break;
+				}
+				put_string (&w, "//", 2);
+				text += 2;
+				length -= 2;
+			}
+			else
+				put_string (&w, URL_DEFAULT_SCHEME, strlen (URL_DEFAULT_SCHEME));
+	
+			authority = authority_length (text, length);
+			put_authority (&w, text, authority);
+			put_rest (&w, text + authority, length - authority);
+			break;
+	}
+	
+	return finish (&w);
+}
@@ -0,0 +1,46 @@
+/*
+ * sb - simple browser
+ *
+ * URL normalization - what was typed into the address bar, as a uri.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef URL_H
+#define URL_H
+
+#include <glib.h>
+
+/* Scheme for addresses typed without one */
+#define URL_DEFAULT_SCHEME "http://"
+
+typedef enum {
+	URL_KIND_EMPTY,		/* nothing but whitespace */
+	URL_KIND_URL,		/* has a scheme, or starts with something that looks like a host */
+	URL_KIND_PATH,		/* an absolute or ~ path */
+	URL_KIND_SEARCH		/* anything else */
+} UrlKind;
+
+/*
+ * All functions work on text of the given length (it need not be terminated)
+ * and write into out like snprintf: the result is always terminated, and the
+ * return value is the length of the full result, so a return value >= size
+ * means out was too small. None of them allocate.
+ */
+
+/* Classify text, ignoring leading and trailing whitespace */
+UrlKind url_classify (const gchar* text, gsize length);
+
+/*
+ * Turn text into a uri: trim it, add URL_DEFAULT_SCHEME if there is no
+ * scheme, lowercase the scheme and host, encode international host names
+ * with punycode, and turn paths into file:// uris. Searches become
+ * search_prefix followed by the encoded query. The kind is stored in *kind
+ * if kind is not NULL.
+ */
+gsize url_normalize (const gchar* text, gsize length, const gchar* search_prefix, gchar* out, gsize size, UrlKind* kind);
+
+/* search_prefix followed by text, trimmed and form-encoded */
+gsize url_search (const gchar* search_prefix, const gchar* text, gsize length, gchar* out, gsize size);
+
+#endif
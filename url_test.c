@@ -0,0 +1,113 @@
+/*
+ * sb - simple browser
+ *
+ * url_test [N] - check url_normalize() on known input, time it over typical
+ * address bar input, then feed it N random inputs into buffers of random
+ * size, checking that it never writes past the end, always terminates, and
+ * returns the same length whatever the buffer size. Needs only url.c.
+ *
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "url.h"
+
+#define SEARCH_PREFIX "https://duckduckgo.com/?q="
+
+static const struct {
+	const gchar *text, *uri;
+} expected[] = {
+	{"example.com", "http://example.com"},
+	{"  https://www.Example.com/path?query=1#top  ", "https://www.example.com/path?query=1#top"},
+	{"localhost:8080/app", "http://localhost:8080/app"},
+	{"bücher.de/katalog", "http://xn--bcher-kva.de/katalog"},
+	{"how do i exit vim", SEARCH_PREFIX "how+do+i+exit+vim"},
+	{"user@intranet:8443/wiki/Main_Page", "http://user@intranet:8443/wiki/Main_Page"},
+	{"me@example.com", SEARCH_PREFIX "me%40example.com"},
+	{"/tmp/a%20b c", "file:///tmp/a%20b%20c"},
+	{"/tmp/100%", "file:///tmp/100%25"},
+};
+
+static int
+check_expected (void)
+{
+	gchar out[2048];
+	guint i;
+	int failed = 0;
+	
+	for (i = 0; i < G_N_ELEMENTS (expected); i++)
+	{
+		url_normalize (expected[i].text, strlen (expected[i].text), SEARCH_PREFIX, out, sizeof out, NULL);
+		if (strcmp (out, expected[i].uri) != 0)
+		{
+			fprintf (stderr, "url_normalize: \"%s\" gave %s, expected %s\n", expected[i].text, out, expected[i].uri);
+			failed = 1;
+		}
+	}
+	if (!failed)
+		printf ("url_normalize: %u known inputs ok\n", (guint) G_N_ELEMENTS (expected));
+	return failed;
+}
+
+int
+main (int argc, char* argv[])
+{
+	static const gchar* corpus[] = {
+		"example.com", "  https://www.Example.com/path?query=1#top  ", "localhost:8080/app",
+		"bücher.de/katalog", "how do i exit vim", "/var/log/syslog", "~/notes.txt",
+		"about:blank", "192.168.0.1", "[::1]:631/printers", "what is 2+2?",
+		"http://user@intranet:8443/wiki/Main_Page", "日本語.jp",
+	};
+	gint count = argc > 1 ? atoi (argv[1]) : 100000;
+	gchar out[2048], fuzz[64], guarded[96];
+	guint i, j, round, rounds = MAX (count / G_N_ELEMENTS (corpus), 1);
+	gsize sink = 0;
+	
+	if (check_expected ())
+		return 1;
+	
+	gint64 start = g_get_monotonic_time ();
+	for (round = 0; round < rounds; round++)
+		for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+			sink += url_normalize (corpus[i], strlen (corpus[i]), SEARCH_PREFIX, out, sizeof out, NULL);
+	gint64 elapsed = g_get_monotonic_time () - start;
+	printf ("url_normalize: %u calls, %.1f ns/call (%" G_GSIZE_FORMAT " bytes)\n", rounds * (guint) G_N_ELEMENTS (corpus),
+			elapsed * 1000.0 / (rounds * G_N_ELEMENTS (corpus)), sink);
+	
+	/* Random input biased towards the characters the classifier cares about */
+	GRand* rand = g_rand_new_with_seed (1);
+	for (i = 0; i < (guint) count; i++)
+	{
+		gsize length = g_rand_int_range (rand, 0, sizeof fuzz), size = g_rand_int_range (rand, 0, 64), n;
+		
+		for (j = 0; j < length; j++)
+		{
+			gint kind = g_rand_int_range (rand, 0, 10);
+			fuzz[j] = kind < 3 ? "./:@[]~ %?#\t"[g_rand_int_range (rand, 0, 12)]
+					: kind < 5 ? (gchar) g_rand_int_range (rand, 0x80, 0x100)
+					: "abcXYZ019-"[g_rand_int_range (rand, 0, 10)];
+		}
+		memset (guarded, 0x5a, sizeof guarded);
+		n = url_normalize (fuzz, length, SEARCH_PREFIX, guarded, size, NULL);
+		
+		for (j = size; j < sizeof guarded; j++)
+			if ((guchar) guarded[j] != 0x5a)
+				break;
+		if (j < sizeof guarded
+			|| (size && strnlen (guarded, size) != MIN (n, size - 1))
+			|| url_normalize (fuzz, length, SEARCH_PREFIX, out, sizeof out, NULL) != n
+			|| (size && strncmp (out, guarded, size - 1) != 0))
+		{
+			fprintf (stderr, "url_normalize: failed on input %u (%" G_GSIZE_FORMAT " bytes into %" G_GSIZE_FORMAT ")\n", i, length, size);
+			g_rand_free (rand);
+			return 1;
+		}
+	}
+	g_rand_free (rand);
+	printf ("url_normalize: %d random inputs ok\n", count);
+	
+	return 0;
+}